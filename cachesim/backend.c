@@ -9,6 +9,63 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+
+// Tag comparison with SSE/AVX is selected at runtime (unless disabled with CACHESIM_NO_SIMD)
+#if defined(__GNUC__) && defined(__x86_64__) && LONG_MAX == 0x7fffffffffffffffL && \
+    !defined(CACHESIM_NO_SIMD)
+#define CACHESIM_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Cache__replay_parallel uses POSIX threads (unless disabled with CACHESIM_NO_THREADS)
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(CACHESIM_NO_THREADS)
+#define CACHESIM_THREADS
+#include <pthread.h>
+#endif
+
+// Trace files are mapped into memory on POSIX systems (and read with stdio otherwise)
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(USE_PIN)
+#define CACHESIM_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Allocator for per-cache state (Python objects use the Python allocator)
+#ifndef NO_PYTHON
+#define CACHE_MALLOC PyMem_Malloc
+#define CACHE_REALLOC PyMem_Realloc
+#define CACHE_FREE PyMem_Free
+#else
+#define CACHE_MALLOC malloc
+#define CACHE_REALLOC realloc
+#define CACHE_FREE free
+#endif
+
+// Allocator for PSEL samples, which grow while caches are simulated without the GIL
+#ifndef NO_PYTHON
+#define SAMPLES_REALLOC PyMem_RawRealloc
+#define SAMPLES_FREE PyMem_RawFree
+#else
+#define SAMPLES_REALLOC realloc
+#define SAMPLES_FREE free
+#endif
+
+// Set indices of non power of two sets are computed with 128 bit multiplications, if available
+#if defined(__SIZEOF_INT128__)
+#define CACHESIM_FASTMOD
+#endif
+
+// Forces inlining of kernel bodies, so constant configuration arguments are propagated
+#if defined(__GNUC__)
+#define CACHE_ALWAYS_INLINE inline static __attribute__((always_inline))
+#else
+#define CACHE_ALWAYS_INLINE inline static
+#endif
 
 #ifndef NO_PYTHON
 struct module_state {
@@ -19,12 +76,6 @@ struct module_state {
 #define GETSTATE(m) ((struct module_state*)PyModule_GetState(m))
 #endif
 
-#if PY_MAJOR_VERSION < 3
-static PyMethodDef cachesim_methods[] = {
-    {NULL, NULL}
-};
-#endif
-
 #endif
 
 
@@ -32,8 +83,10 @@ static PyMethodDef cachesim_methods[] = {
 static void Cache_dealloc(Cache* self) {
     Py_XDECREF(self->store_to);
     Py_XDECREF(self->load_from);
-    //Py_XDECREF(self->victims_to);
-    PyMem_Del(self->placement);
+    Py_XDECREF(self->tlb);
+    Py_XDECREF(self->victims_to);
+    Cache__free_state(self);
+    PyMem_Free((char*)self->name);
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 #endif
@@ -54,7 +107,7 @@ int isPowerOfTwo(long x) {
 static PyMemberDef Cache_members[] = {
     {"name", T_STRING, offsetof(Cache, name), 0,
      "name of cache level"},
-    {"sets", T_LONG, offsetof(Cache, sets), 0,
+    {"sets", T_LONG, offsetof(Cache, sets), READONLY,
      "number of sets available"},
     {"ways", T_LONG, offsetof(Cache, ways), 0,
      "number of ways available"},
@@ -66,20 +119,14 @@ static PyMemberDef Cache_members[] = {
      "number of bytes per subblock (must be a devisor of cl_size)"},
     {"subblock_bits", T_LONG, offsetof(Cache, subblock_bits), 0,
      "number of bits needed to identify subblocks (= number of subblocks per cacheline)"},
-    {"replacement_policy_id", T_INT, offsetof(Cache, replacement_policy_id), 0,
+    {"replacement_policy_id", T_INT, offsetof(Cache, replacement_policy_id), READONLY,
      "replacement strategy of cachlevel"},
-    {"write_back", T_INT, offsetof(Cache, write_back), 0,
+    {"write_back", T_INT, offsetof(Cache, write_back), READONLY,
      "write back of cachlevel (0 is write-through, 1 is write-back)"},
-    {"write_allocate", T_INT, offsetof(Cache, write_allocate), 0,
+    {"write_allocate", T_INT, offsetof(Cache, write_allocate), READONLY,
      "write allocate of cachlevel (0 is non-write-allocate, 1 is write-allocate)"},
-    {"write_combining", T_INT, offsetof(Cache, write_combining), 0,
+    {"write_combining", T_INT, offsetof(Cache, write_combining), READONLY,
      "combine writes on this level, before passing them on"},
-    {"load_from", T_OBJECT, offsetof(Cache, load_from), 0,
-     "load parent Cache object (cache level which is closer to main memory)"},
-    {"store_to", T_OBJECT, offsetof(Cache, store_to), 0,
-     "store parent Cache object (cache level which is closer to main memory)"},
-    {"victims_to", T_OBJECT, offsetof(Cache, victims_to), 0,
-     "Cache object where victims will be send to (closer to main memory, None if victims vanish)"},
     {"LOAD_count", T_LONGLONG, offsetof(Cache, LOAD.count), 0,
      "number of loads performed"},
     {"LOAD_byte", T_LONGLONG, offsetof(Cache, LOAD.byte), 0,
@@ -100,8 +147,76 @@ static PyMemberDef Cache_members[] = {
      "number of evicts"},
     {"EVICT_byte", T_LONGLONG, offsetof(Cache, EVICT.byte), 0,
      "number of bytes evicted"},
-    {"verbosity", T_INT, offsetof(Cache, verbosity), 0,
-     "verbosity level of output"},
+    {"INVALIDATE_count", T_LONGLONG, offsetof(Cache, INVALIDATE.count), 0,
+     "number of lines invalidated by stores of other cores"},
+    {"INVALIDATE_byte", T_LONGLONG, offsetof(Cache, INVALIDATE.byte), 0,
+     "number of bytes invalidated by stores of other cores"},
+    {"INTERVENTION_count", T_LONGLONG, offsetof(Cache, INTERVENTION.count), 0,
+     "number of modified lines supplied to other cores"},
+    {"INTERVENTION_byte", T_LONGLONG, offsetof(Cache, INTERVENTION.byte), 0,
+     "number of modified bytes supplied to other cores"},
+    {"UPGRADE_count", T_LONGLONG, offsetof(Cache, UPGRADE.count), 0,
+     "number of stores to lines shared with other cores"},
+    {"UPGRADE_byte", T_LONGLONG, offsetof(Cache, UPGRADE.byte), 0,
+     "number of bytes upgraded from shared to modified"},
+    {"BACK_INVALIDATE_count", T_LONGLONG, offsetof(Cache, BACK_INVALIDATE.count), 0,
+     "number of lines invalidated because the directory replaced their entry"},
+    {"BACK_INVALIDATE_byte", T_LONGLONG, offsetof(Cache, BACK_INVALIDATE.byte), 0,
+     "number of bytes invalidated because the directory replaced their entry"},
+    {"PREFETCH_ISSUED_count", T_LONGLONG, offsetof(Cache, PREFETCH_ISSUED.count), 0,
+     "number of lines filled by the prefetcher"},
+    {"PREFETCH_ISSUED_byte", T_LONGLONG, offsetof(Cache, PREFETCH_ISSUED.byte), 0,
+     "number of bytes filled by the prefetcher"},
+    {"PREFETCH_USEFUL_count", T_LONGLONG, offsetof(Cache, PREFETCH_USEFUL.count), 0,
+     "number of prefetched lines hit by a demand access in time"},
+    {"PREFETCH_USEFUL_byte", T_LONGLONG, offsetof(Cache, PREFETCH_USEFUL.byte), 0,
+     "number of prefetched bytes hit by a demand access in time"},
+    {"PREFETCH_LATE_count", T_LONGLONG, offsetof(Cache, PREFETCH_LATE.count), 0,
+     "number of prefetched lines hit within prefetch_latency demand accesses"},
+    {"PREFETCH_LATE_byte", T_LONGLONG, offsetof(Cache, PREFETCH_LATE.byte), 0,
+     "number of prefetched bytes hit within prefetch_latency demand accesses"},
+    {"prefetcher", T_INT, offsetof(Cache, prefetcher), READONLY,
+     "prefetcher (0 = none, 1 = next-line, 2 = adjacent-line, 3 = stride, 4 = streamer)"},
+    {"prefetch_distance", T_INT, offsetof(Cache, prefetch_distance), READONLY,
+     "lines between the triggering access and the first prefetched line"},
+    {"prefetch_degree", T_INT, offsetof(Cache, prefetch_degree), READONLY,
+     "lines prefetched per trigger"},
+    {"prefetch_latency", T_LONGLONG, offsetof(Cache, prefetch_latency), READONLY,
+     "demand accesses until a prefetched line arrives"},
+    {"core", T_INT, offsetof(Cache, core), READONLY,
+     "core this private cache belongs to in a CoherenceDomain (-1 if none)"},
+    {"rrip_bits", T_INT, offsetof(Cache, rrip_bits), READONLY,
+     "bits per way used for ages with SRRIP"},
+    {"rrip_insert", T_INT, offsetof(Cache, rrip_insert), READONLY,
+     "age of inserted lines with SRRIP (0 is youngest, 2**rrip_bits-1 is replaced first)"},
+    {"rrip_hit_promotion", T_INT, offsetof(Cache, rrip_hit_promotion), READONLY,
+     "age update on hits with SRRIP (0 = reset to 0, 1 = decrement by one)"},
+    {"drrip_leader_sets", T_INT, offsetof(Cache, dueling.leader_sets), READONLY,
+     "leader sets per insertion policy with DRRIP"},
+    {"drrip_psel_bits", T_INT, offsetof(Cache, dueling.psel_bits), READONLY,
+     "width of the DRRIP policy selection counter"},
+    {"drrip_follower", T_INT, offsetof(Cache, dueling.follower), READONLY,
+     "insertion of DRRIP follower sets (0 = follow PSEL, 1 = SRRIP, 2 = BRRIP)"},
+    {"drrip_sample_interval", T_LONGLONG, offsetof(Cache, dueling.sample_interval), READONLY,
+     "policy updates between two recorded PSEL values (0 = none are recorded)"},
+    {"drrip_psel", T_INT, offsetof(Cache, dueling.psel), READONLY,
+     "current DRRIP policy selection counter (followers use BRRIP if the top bit is set)"},
+    {"drrip_srrip_leader_misses", T_LONGLONG, offsetof(Cache, dueling.leader_misses[0]), READONLY,
+     "misses in DRRIP leader sets inserting with SRRIP"},
+    {"drrip_brrip_leader_misses", T_LONGLONG, offsetof(Cache, dueling.leader_misses[1]), READONLY,
+     "misses in DRRIP leader sets inserting with BRRIP"},
+    {"set_index_function", T_INT, offsetof(Cache, set_index_function), READONLY,
+     "mapping of cachelines to sets (0 = modulo sets, 1 = XOR-folded, 2 = Intel LLC slice hash)"},
+    {"slices", T_INT, offsetof(Cache, slices), READONLY,
+     "number of slices the sets are split into with the Intel LLC slice hash"},
+    {"tag_index_threshold", T_INT, offsetof(Cache, tag_index_threshold), READONLY,
+     "associativity from which on a hashed tag index is used for lookups (0 = never)"},
+    {"sampling", T_LONG, offsetof(Cache, sampling), READONLY,
+     "one in sampling sets is simulated (1 = all sets)"},
+    {"sampling_function", T_INT, offsetof(Cache, sampling_function), READONLY,
+     "selection of the simulated sets (0 = every sampling-th set, 1 = pseudo-random)"},
+    {"sampled_sets", T_LONG, offsetof(Cache, sampled_sets), READONLY,
+     "number of simulated sets"},
     {NULL}  /* Sentinel */
 };
 #endif
@@ -110,8 +225,150 @@ inline static long Cache__get_cacheline_id(Cache* self, long long addr) {
     return addr >> self->cl_bits;
 }
 
+inline static long Cache__mod_reciprocal(Cache* self, unsigned long long x) {
+    // Returns x modulo set_modulus without division, by multiplying with the fixed-point
+    // reciprocal (see D. Lemire, O. Kaser, N. Kurz: Faster Remainder by Direct Computation,
+    // 2019). The remainder is the integer part of set_modulus times the fractional part of
+    // x/set_modulus.
+#ifdef CACHESIM_FASTMOD
+    unsigned __int128 reciprocal =
+        ((unsigned __int128)self->set_reciprocal[1] << 64) | self->set_reciprocal[0];
+    unsigned __int128 fraction = reciprocal * x;
+    unsigned long long modulus = (unsigned long long)self->set_modulus;
+    unsigned __int128 low = ((unsigned __int128)(unsigned long long)fraction * modulus) >> 64;
+    return (long)((low + (fraction >> 64) * modulus) >> 64);
+#else
+    return (long)(x % (unsigned long long)self->set_modulus);
+#endif
+}
+
+inline static long Cache__reduce_cl_id(Cache* self, unsigned long long x) {
+    // Returns x modulo set_modulus
+    if(self->set_mask != 0) {
+        return (long)(x & self->set_mask);
+    }
+    return Cache__mod_reciprocal(self, x);
+}
+
+inline static unsigned long long Cache__xor_fold(unsigned long long x, int bits) {
+    // XOR of all bits wide chunks of x
+    unsigned long long folded = 0;
+    while(x != 0) {
+        folded ^= x & ((1ULL << bits) - 1);
+        x >>= bits;
+    }
+    return folded;
+}
+
+// Intel LLC complex addressing: bit i of the slice is the parity of the physical address bits
+// selected by intel_slice_masks[i], as reverse engineered for CPUs with 2, 4 and 8 slices
+// (C. Maurice et al.: Reverse Engineering Intel Last-Level Cache Complex Addressing Using
+// Performance Counters, RAID 2015)
+static const unsigned long long intel_slice_masks[] = {
+    0x1B5F575440ULL, 0x2EB5FAA880ULL, 0x3CCCC93100ULL};
+
+#define INTEL_SLICE_MAX_SLICES 8
+
+inline static long Cache__get_slice(Cache* self, long cl_id) {
+    unsigned long long addr = (unsigned long long)cl_id << self->cl_bits;
+    long slice = 0;
+    for(int bit=0; (1 << bit) < self->slices; bit++) {
+        slice |= (long)__builtin_parityll(addr & intel_slice_masks[bit]) << bit;
+    }
+    return slice;
+}
+
 inline static long Cache__get_set_id(Cache* self, long cl_id) {
-    return cl_id % self->sets;
+    // Returns the set of cl_id, with set sampling its index among the sampled sets or -1 if
+    // the set is not simulated
+    long set_id;
+    if(self->set_index_function == SET_INDEX_XOR) {
+        set_id = Cache__reduce_cl_id(
+            self, Cache__xor_fold((unsigned long long)cl_id, self->set_fold_bits));
+    } else if(self->set_index_function == SET_INDEX_INTEL_SLICE) {
+        set_id = Cache__get_slice(self, cl_id)*self->set_modulus +
+                 Cache__reduce_cl_id(self, (unsigned long long)cl_id);
+    } else {
+        set_id = Cache__reduce_cl_id(self, (unsigned long long)cl_id);
+    }
+    if(self->sample_map != NULL) {
+        return self->sample_map[set_id];
+    }
+    return set_id;
+}
+
+inline static int Cache__samples_range(Cache* self, addr_range range) {
+    // Returns 1 if any cacheline of range belongs to a simulated set (see Cache__init_sampling)
+    long last_cl_id = (range.addr+range.length-1) >> self->cl_bits;
+    for(long cl_id=range.addr >> self->cl_bits; cl_id<=last_cl_id; cl_id++) {
+        if(Cache__get_set_id(self, cl_id) != -1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void Cache__init_set_index(Cache* self) {
+    // Precomputes mask or reciprocal of the number of sets (per slice) for Cache__get_set_id
+    self->set_modulus = self->sets / (self->set_index_function == SET_INDEX_INTEL_SLICE ?
+                                      self->slices : 1);
+    self->set_mask = isPowerOfTwo(self->set_modulus) ? (unsigned long long)self->set_modulus-1 : 0;
+#ifdef CACHESIM_FASTMOD
+    // ceil(2^128/set_modulus), which is 0 (mod 2^128) for set_modulus == 1
+    unsigned __int128 reciprocal =
+        ~(unsigned __int128)0 / (unsigned long long)self->set_modulus + 1;
+    self->set_reciprocal[0] = (unsigned long long)reciprocal;
+    self->set_reciprocal[1] = (unsigned long long)(reciprocal >> 64);
+#endif
+    self->set_fold_bits = 1;
+    while(self->set_fold_bits < 63 && 1L << self->set_fold_bits < self->sets) {
+        self->set_fold_bits++;
+    }
+}
+
+static int Cache__init_sampling(Cache* self) {
+    // Selects the simulated sets according to sampling and sampling_function, and numbers them
+    // in sample_map. Returns -1 if memory allocation failed, 0 otherwise.
+    self->sample_map = NULL;
+    self->sample_loads = NULL;
+    self->sample_misses = NULL;
+    if(self->sampling <= 1) {
+        self->sampled_sets = self->sets;
+        return 0;
+    }
+    self->sampled_sets = (self->sets + self->sampling - 1) / self->sampling;
+    self->sample_map = CACHE_MALLOC(self->sets*sizeof(long));
+    self->sample_loads = CACHE_MALLOC(self->sampled_sets*sizeof(long long));
+    self->sample_misses = CACHE_MALLOC(self->sampled_sets*sizeof(long long));
+    if(self->sample_map == NULL || self->sample_loads == NULL || self->sample_misses == NULL) {
+        return -1;
+    }
+    memset(self->sample_loads, 0, self->sampled_sets*sizeof(long long));
+    memset(self->sample_misses, 0, self->sampled_sets*sizeof(long long));
+    if(self->sampling_function == SAMPLE_HASH) {
+        // Selection sampling (D. Knuth, TAOCP Vol. 2, Algorithm 3.4.2 S): each set is taken
+        // with probability (sets still needed)/(sets left), which gives exactly sampled_sets
+        // uniformly chosen sets. The xorshift generator has a fixed seed, so the same sets
+        // are chosen in every run.
+        unsigned long long x = 0x9E3779B97F4A7C15ULL;
+        long needed = self->sampled_sets;
+        for(long set_id=0; set_id<self->sets; set_id++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            if(x % (unsigned long long)(self->sets-set_id) < (unsigned long long)needed) {
+                self->sample_map[set_id] = self->sampled_sets - needed--;
+            } else {
+                self->sample_map[set_id] = -1;
+            }
+        }
+    } else {
+        for(long set_id=0; set_id<self->sets; set_id++) {
+            self->sample_map[set_id] = set_id % self->sampling == 0 ?
+                                       set_id / self->sampling : -1;
+        }
+    }
+    return 0;
 }
 
 inline static addr_range __range_from_addrs(long long addr, long long last_addr) {
@@ -144,778 +401,5981 @@ inline static addr_range Cache__get_range_from_cl_id_and_range(
     return new_range;
 }
 
-inline static int Cache__get_location(Cache* self, long cl_id, long set_id) {
-    // Returns the location a cacheline has in a cache
-    // if cacheline is not present, returns -1
-    // TODO use sorted data structure for faster searches in case of large number of
-    // ways or full-associativity?
+inline static unsigned long long tag_index__bucket(tag_index* index, long cl_id) {
+    // Fibonacci hashing: the upper bits of the product are well distributed, even for strided
+    // cl_ids
+    return ((unsigned long long)cl_id * 0x9E3779B97F4A7C15ULL) >> index->shift;
+}
 
-    for(long i=0; i<self->ways; i++) {
-        if(self->placement[set_id*self->ways+i].invalid == 0 &&
-           self->placement[set_id*self->ways+i].cl_id == cl_id) {
-            return i;
-        }
+void tag_index__clear(tag_index* index) {
+    for(unsigned long long b=0; b<=index->mask; b++) {
+        index->locations[b] = -1;
     }
-
-    return -1; // Not found
 }
 
-void Cache__store(Cache* self, addr_range range, int non_temporal);
+int tag_index__init(tag_index* index, long entries) {
+    // Allocates an empty index with room for entries valid cachelines (at most half of the
+    // buckets will be used). Returns 0 on success, -1 if memory allocation failed.
+    int bits = 1;
+    while((1ULL << bits) < 2ULL*(unsigned long long)entries) {
+        bits++;
+    }
+    index->mask = (1ULL << bits) - 1;
+    index->shift = 64 - bits;
+    index->cl_ids = (long*)malloc((index->mask+1)*sizeof(long));
+    index->locations = (long*)malloc((index->mask+1)*sizeof(long));
+    if(index->cl_ids == NULL || index->locations == NULL) {
+        free(index->cl_ids);
+        free(index->locations);
+        index->cl_ids = NULL;
+        index->locations = NULL;
+        return -1;
+    }
+    tag_index__clear(index);
+    return 0;
+}
 
-static int Cache__inject(Cache* self, cache_entry* entry) {
-    /*
-    Injects a cache entry into a cache and handles all side effects that might occur:
-     - choose replacement according to policy
-     - reorder queues
-     - inform victim caches
-     - handle write-back on replacement
-    */
-    long set_id = Cache__get_set_id(self, entry->cl_id);
+void tag_index__free(tag_index* index) {
+    free(index->cl_ids);
+    free(index->locations);
+    index->cl_ids = NULL;
+    index->locations = NULL;
+}
 
-    // Get cacheline id to be replaced according to replacement strategy
-    int replace_idx;
-    cache_entry replace_entry;
-
-    if(self->replacement_policy_id == 0 || self->replacement_policy_id == 1) {
-        // FIFO: replace end of queue
-        // LRU: replace end of queue
-        replace_idx = 0;
-        replace_entry = self->placement[set_id*self->ways+self->ways-1];
-
-        // Reorder queue
-        for(long i=self->ways-1; i>0; i--) {
-            self->placement[set_id*self->ways+i] = self->placement[set_id*self->ways+i-1];
-
-            // Reorder bitfild in accordance to queue
-            if(self->write_combining == 1) {
-                for(long j=0; j<self->subblock_bits; j++) {
-                    if(BITTEST(self->subblock_bitfield, set_id*self->ways*self->subblock_bits +
-                               (i-1)*self->subblock_bits + j)) {
-                        BITSET(self->subblock_bitfield, set_id*self->ways*self->subblock_bits +
-                               i*self->subblock_bits + j);
-                    } else {
-                        BITCLEAR(self->subblock_bitfield, set_id*self->ways*self->subblock_bits +
-                                 i*self->subblock_bits + j);
-                    }
-                }
-            }
+inline static long tag_index__find(tag_index* index, long cl_id) {
+    // Returns location (index into tags) of cl_id or -1 if it is not indexed
+    for(unsigned long long b=tag_index__bucket(index, cl_id); ; b=(b+1) & index->mask) {
+        if(index->locations[b] == -1 || index->cl_ids[b] == cl_id) {
+            return index->locations[b];
         }
-    } else if(self->replacement_policy_id == 2) {
-        // MRU: replace first of queue
-        replace_idx = self->ways-1;
-        replace_entry = self->placement[set_id*self->ways];
+    }
+}
 
-        // Reorder queue
-        for(long i=0; i>self->ways-1; i++) {
-            self->placement[set_id*self->ways+i] = self->placement[set_id*self->ways+i+1];
+inline static void tag_index__set(tag_index* index, long cl_id, long location) {
+    // Inserts cl_id or updates its location, if already present
+    unsigned long long b = tag_index__bucket(index, cl_id);
+    while(index->locations[b] != -1 && index->cl_ids[b] != cl_id) {
+        b = (b+1) & index->mask;
+    }
+    index->cl_ids[b] = cl_id;
+    index->locations[b] = location;
+}
 
-            // Reorder bitfild in accordance to queue
-            if(self->write_combining == 1) {
-                for(long j=0; j<self->subblock_bits; j++) {
-                    if(BITTEST(self->subblock_bitfield, set_id*self->ways*self->subblock_bits +
-                               (i+1)*self->subblock_bits + j)) {
-                        BITSET(self->subblock_bitfield, set_id*self->ways*self->subblock_bits +
-                               i*self->subblock_bits + j);
-                    } else {
-                        BITCLEAR(self->subblock_bitfield, set_id*self->ways*self->subblock_bits +
-                                 i*self->subblock_bits + j);
-                    }
-                }
-            }
+inline static void tag_index__remove(tag_index* index, long cl_id) {
+    // Removes cl_id from index (if present)
+    unsigned long long b = tag_index__bucket(index, cl_id);
+    while(index->locations[b] != -1 && index->cl_ids[b] != cl_id) {
+        b = (b+1) & index->mask;
+    }
+    if(index->locations[b] == -1) {
+        return;
+    }
+    // Backward shift deletion: move following entries of the probe sequence into the gap, so
+    // no tombstones are needed
+    unsigned long long gap = b;
+    for(b=(b+1) & index->mask; index->locations[b] != -1; b=(b+1) & index->mask) {
+        unsigned long long home = tag_index__bucket(index, index->cl_ids[b]);
+        // Entry may only move to gap if gap lies cyclically between its home bucket and b
+        if(((b - home) & index->mask) >= ((b - gap) & index->mask)) {
+            index->cl_ids[gap] = index->cl_ids[b];
+            index->locations[gap] = index->locations[b];
+            gap = b;
         }
-    } else { // if(self->replacement_policy_id == 3) {
-        // RR: replace random element
-        replace_idx = rand() & (self->ways - 1);
-        replace_entry = self->placement[set_id*self->ways+replace_idx];
     }
+    index->locations[gap] = -1;
+}
 
-    // Replace other cacheline according to replacement strategy (using placement order as state)
-    self->placement[set_id*self->ways+replace_idx] = *entry;
-#ifndef NO_PYTHON
-    if(self->verbosity >= 3) {
-        PySys_WriteStdout(
-            "%s REPLACED cl_id=%li invalid=%u dirty=%u\n",
-            self->name, replace_entry.cl_id, replace_entry.invalid, replace_entry.dirty);
+static long tags__find_scalar(const long* tags, long ways, long cl_id) {
+    for(long i=0; i<ways; i++) {
+        if(tags[i] == cl_id) {
+            return i;
+        }
     }
-#endif
-
-    // ignore invalid cache lines for write-back or victim cache
-    if(replace_entry.invalid == 0) {
-        // write-back: check for dirty bit of replaced and inform next lower level of store
-        if(self->write_back == 1 && replace_entry.dirty == 1) {
-            self->EVICT.count++;
-            self->EVICT.byte += self->cl_size;
-#ifndef NO_PYTHON
-            if(self->verbosity >= 3) {
-                PySys_WriteStdout(
-                    "%s EVICT cl_id=%li invalid=%u dirty=%u\n",
-                    self->name, replace_entry.cl_id, replace_entry.invalid, replace_entry.dirty);
-            }
-#endif
-            if(self->store_to != NULL) {
-                int non_temporal = 0; // default for non write-combining caches
+    return -1;
+}
 
-                if(self->write_combining == 1) {
-                    // Check if non-temporal store may be used or write-allocate is necessary
-                    non_temporal = 1;
-                    for(long i=0; i<self->subblock_bits; i++) {
-                        if(BITTEST(self->subblock_bitfield,
-                                set_id*self->ways*self->subblock_bits +
-                                replace_idx*self->subblock_bits + i)) {
-                            // incomplete cacheline, thus write-allocate is necessary
-                            non_temporal = 0;
-                        }
-                        // Clear bits for future use
-                        BITCLEAR(self->subblock_bitfield,
-                                set_id*self->ways*self->subblock_bits +
-                                replace_idx*self->subblock_bits + i);
-                    }
-                }
-#ifndef NO_PYTHON
-                Py_INCREF(self->store_to);
-#endif
-                // TODO addrs vs cl_id is not nicely solved here
-                Cache__store(
-                    (Cache*)self->store_to,
-                    Cache__get_range_from_cl_id(self, replace_entry.cl_id),
-                    non_temporal);
-#ifndef NO_PYTHON
-                Py_DECREF(self->store_to);
-#endif
-            } // else last-level-cache
-        } else if(self->victims_to != NULL) {
-            // Deliver replaced cacheline to victim cache, if neither dirty or already write_back
-            // (if it were dirty, it would have been written to store_to if write_back is enabled)
-#ifndef NO_PYTHON
-            Py_INCREF(self->victims_to);
-#endif
-            // Inject into victims_to
-            Cache* victims_to = (Cache*)self->victims_to;
-            Cache__inject(victims_to, &replace_entry);
-            // Take care to include into evict stats
-            self->EVICT.count++;
-            self->EVICT.byte += self->cl_size;
-            victims_to->STORE.count++;
-            victims_to->STORE.byte += self->cl_size;
-#ifndef NO_PYTHON
-            Py_DECREF(self->victims_to);
-#endif
+#ifdef CACHESIM_X86_SIMD
+__attribute__((target("avx2")))
+static long tags__find_avx2(const long* tags, long ways, long cl_id) {
+    // Compares eight tags per iteration, movemask yields one bit per tag
+    __m256i needle = _mm256_set1_epi64x(cl_id);
+    long i = 0;
+    for(; i+8<=ways; i+=8) {
+        __m256i lo = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(tags+i)), needle);
+        __m256i hi = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(tags+i+4)), needle);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(lo)) |
+                   _mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4;
+        if(mask != 0) {
+            return i + __builtin_ctz(mask);
         }
     }
-
-    return replace_idx;
+    if(i+4 <= ways) {
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(tags+i)), needle);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        if(mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 4;
+    }
+    long rest = tags__find_scalar(tags+i, ways-i, cl_id);
+    return rest == -1 ? -1 : i + rest;
 }
 
-int Cache__load(Cache* self, addr_range range) {
-    /*
-    Signals request of addr range by higher level. This handles hits and misses.
-    */
-    self->LOAD.count++;
-    self->LOAD.byte += range.length;
-    int placement_idx = -1;
-
-    // Handle range:
-    long last_cl_id = Cache__get_cacheline_id(self, range.addr+range.length-1);
-    for(long cl_id=Cache__get_cacheline_id(self, range.addr); cl_id<=last_cl_id; cl_id++) {
-        long set_id = Cache__get_set_id(self, cl_id);
-#ifndef NO_PYTHON
-        if(self->verbosity >= 4) {
-            PySys_WriteStdout(
-                "%s LOAD=%lli addr=%lli length=%lli cl_id=%li set_id=%li\n",
-                self->name, self->LOAD.count, range.addr, range.length, cl_id, set_id);
+__attribute__((target("avx512f")))
+static long tags__find_avx512(const long* tags, long ways, long cl_id) {
+    // Compares eight tags per instruction, the remainder is handled with a masked load
+    __m512i needle = _mm512_set1_epi64(cl_id);
+    long i = 0;
+    for(; i+8<=ways; i+=8) {
+        __mmask8 mask = _mm512_cmpeq_epi64_mask(_mm512_loadu_si512((const void*)(tags+i)), needle);
+        if(mask != 0) {
+            return i + __builtin_ctz(mask);
         }
-#endif
+    }
+    if(i < ways) {
+        __mmask8 valid = (__mmask8)((1u << (ways-i)) - 1);
+        __mmask8 mask = _mm512_mask_cmpeq_epi64_mask(
+            valid, _mm512_maskz_loadu_epi64(valid, (const void*)(tags+i)), needle);
+        if(mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return -1;
+}
 
-        // Check if cl_id is already cached
-        int location = Cache__get_location(self, cl_id, set_id);
-        if(location != -1) {
-            // HIT: Found it!
-            self->HIT.count++;
-            // We only add actual bytes that were requested to hit.byte
-            self->HIT.byte += self->cl_size < range.length ? self->cl_size : range.length;
-#ifndef NO_PYTHON
-            if(self->verbosity >= 3) {
-                PySys_WriteStdout("%s HIT self->LOAD=%lli addr=%lli cl_id=%li set_id=%li\n",
-                                  self->name, self->LOAD.count, range.addr, cl_id, set_id);
-            }
+// 0 = scalar, 1 = AVX2, 2 = AVX-512, -1 = not yet detected
+static int tags__isa = -1;
 #endif
 
-            cache_entry entry = self->placement[set_id*self->ways+location];
-
-            if(self->replacement_policy_id == 0 || self->replacement_policy_id == 3) {
-                // FIFO: nothing to do
-                // RR: nothing to do
-                placement_idx = self->ways-1;
-                continue;
-            } else { // if(self->replacement_policy_id == 1 || self->replacement_policy_id == 2) {
-                // LRU: Reorder elements to account for access to element
-                // MRU: Reorder elements to account for access to element
-                if(location != 0) {
-                    for(int j=location; j>0; j--) {
-                        self->placement[set_id*self->ways+j] =
-                            self->placement[set_id*self->ways+j-1];
-
-                        // Reorder bitfild in accordance to queue
-                        if(self->write_combining == 1) {
-                            for(long i=0; i<self->subblock_bits; i++) {
-                                if(BITTEST(self->subblock_bitfield,
-                                           set_id*self->ways*self->subblock_bits +
-                                           (j-1)*self->subblock_bits + i)) {
-                                    BITSET(self->subblock_bitfield,
-                                           set_id*self->ways*self->subblock_bits +
-                                           j*self->subblock_bits + i);
-                                } else {
-                                    BITCLEAR(self->subblock_bitfield,
-                                             set_id*self->ways*self->subblock_bits +
-                                             j*self->subblock_bits + i);
-                                }
-                            }
-                        }
-                    }
-                    self->placement[set_id*self->ways] = entry;
-                }
-                placement_idx = 0;
-                continue;
-            }
-            // TODO if this is an exclusive cache, swap delivered cacheline with swap_cl_id (here and at end -> DO NOT RETURN)
-        }
-
-        // MISS!
-        self->MISS.count++;
-        // We only add actual bytes that were requested to miss.byte
-        self->MISS.byte += self->cl_size < range.length ? self->cl_size : range.length;
-#ifndef NO_PYTHON
-        if(self->verbosity >= 2) {
-            PySys_WriteStdout("%s CACHED [%li",
-                              self->name, self->placement[set_id*self->ways].cl_id);
-            for(long i=1; i<self->ways; i++) {
-                PySys_WriteStdout(", %li", self->placement[set_id*self->ways+i].cl_id);
-            }
-            PySys_WriteStdout("]\n");
-        }
-        if(self->verbosity >= 1) {
-            PySys_WriteStdout(
-                "%s MISS self->LOAD=%lli addr=%lli length=%lli cl_id=%li set_id=%li\n",
-                self->name, self->LOAD.count, range.addr, range.length, cl_id, set_id);
+static void tags__detect_isa(void) {
+    // Selects tag comparison for this CPU, needs to be called before any lookup
+#ifdef CACHESIM_X86_SIMD
+    if(tags__isa == -1) {
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512f")) {
+            tags__isa = 2;
+        } else if(__builtin_cpu_supports("avx2")) {
+            tags__isa = 1;
+        } else {
+            tags__isa = 0;
         }
+    }
 #endif
+}
 
-        // Load from lower cachelevel
-        // Check victim cache, if available
-        int victim_hit = 0;
-        if(self->victims_to != NULL) {
-#ifndef NO_PYTHON
-            Py_INCREF(self->victims_to);
-#endif
-            // check for hit in victim cache
-            long victim_set_id = Cache__get_set_id((Cache*)self->victims_to, cl_id);
-            int victim_location_victim = Cache__get_location((Cache*)self->victims_to, cl_id, victim_set_id);
-            if(victim_location_victim != -1) {
-                // hit in victim cache
-#ifndef NO_PYTHON
-                if(self->verbosity >= 1) {
-                    PySys_WriteStdout("%s VICTIM HIT cl_id=%li\n", ((Cache*)self->victims_to)->name, cl_id);
-                }
-#endif
-                // load data from victim cache
-                Cache__load((Cache*)self->victims_to, Cache__get_range_from_cl_id(self, cl_id));
-                // do NOT go onto load_from cache
-                victim_hit = 1;
-            } 
-#ifndef NO_PYTHON
-            else if(self->verbosity >= 1) {
-                PySys_WriteStdout("%s VICTIM MISS cl_id=%li\n", ((Cache*)self->victims_to)->name, cl_id);
-            }
-            Py_DECREF(self->victims_to);
-#endif
+inline static long tags__find(const long* tags, long ways, long cl_id) {
+    // Returns way in which cl_id is found among the ways tags of a set, -1 if not found. Invalid
+    // entries never match, since they hold CACHE_TAG_INVALID.
+#ifdef CACHESIM_X86_SIMD
+    if(ways >= 4) {
+        if(tags__isa == 2) {
+            return tags__find_avx512(tags, ways, cl_id);
+        } else if(tags__isa == 1) {
+            return tags__find_avx2(tags, ways, cl_id);
         }
-        // If no hit in victim cache, or no victim cache available, go to next cache level
-        if(!victim_hit && self->load_from != NULL) {
-#ifndef NO_PYTHON
-            Py_INCREF(self->load_from);
-#endif
-            // TODO use replace_entry to inform other cache of swap (in case of exclusive caches)
-            Cache__load((Cache*)self->load_from, Cache__get_range_from_cl_id(self, cl_id));
-            // TODO, replace_cl_id);
-#ifndef NO_PYTHON
-            Py_DECREF(self->load_from);
+    }
 #endif
-        } // else last-level-cache
+    return tags__find_scalar(tags, ways, cl_id);
+}
 
-        cache_entry entry;
-        entry.cl_id = cl_id;
-        entry.dirty = 0;
-        entry.invalid = 0;
+inline static unsigned long long* Cache__dirty_word(Cache* self, long set_id, long way) {
+    return self->dirty_mask + set_id*self->dirty_words + way/64;
+}
 
-        // Inject new entry into own cache. This also handles replacement.
-        placement_idx = Cache__inject(self, &entry);
+inline static int Cache__is_dirty(Cache* self, long set_id, long way) {
+    return (*Cache__dirty_word(self, set_id, way) >> (way % 64)) & 1;
+}
+
+inline static void Cache__set_dirty(Cache* self, long set_id, long way, int dirty) {
+    unsigned long long* word = Cache__dirty_word(self, set_id, way);
+    *word = (*word & ~(1ULL << (way % 64))) | ((unsigned long long)(dirty != 0) << (way % 64));
+}
+
+inline static cache_entry Cache__get_entry(Cache* self, long set_id, long way) {
+    // Gathers entry from tags and dirty_mask
+    cache_entry entry;
+    entry.cl_id = self->tags[set_id*self->ways+way];
+    entry.invalid = entry.cl_id == CACHE_TAG_INVALID;
+    entry.dirty = Cache__is_dirty(self, set_id, way);
+    return entry;
+}
+
+inline static void Cache__put_entry(Cache* self, long set_id, long way, cache_entry entry) {
+    // Scatters entry into tags and dirty_mask
+    self->tags[set_id*self->ways+way] = entry.invalid ? CACHE_TAG_INVALID : entry.cl_id;
+    Cache__set_dirty(self, set_id, way, entry.dirty);
+}
 
-        // TODO if this is an exclusive cache (swap_on_load = True), swap delivered cacheline with swap_cl_id (here and at hit)
+inline static void Cache__recency_touch(Cache* self, long set_id, int way) {
+    // Moves way to the front of the recency list of its set
+    int* prev = self->recency_prev + set_id*self->ways;
+    int* next = self->recency_next + set_id*self->ways;
+    if(self->recency_head[set_id] == way) {
+        return;
     }
-    // TODO Does this make sens or multiple cachelines? It is atm only used by write-allocate,
-    // which should be fine, because requests are already split into individual cachelines
-    return placement_idx;
+    // Unlink (way is not head, thus prev[way] != -1)
+    next[prev[way]] = next[way];
+    if(next[way] != -1) {
+        prev[next[way]] = prev[way];
+    } else {
+        self->recency_tail[set_id] = prev[way];
+    }
+    // Push to front
+    prev[way] = -1;
+    next[way] = self->recency_head[set_id];
+    prev[self->recency_head[set_id]] = way;
+    self->recency_head[set_id] = way;
 }
 
-void Cache__store(Cache* self, addr_range range, int non_temporal) {
-    self->STORE.count++;
-    self->STORE.byte += range.length;
-    // Handle range:
-    long last_cl_id = Cache__get_cacheline_id(self, range.addr+range.length-1);
-    for(long cl_id=Cache__get_cacheline_id(self, range.addr); cl_id<=last_cl_id; cl_id++) {
-        long set_id = Cache__get_set_id(self, cl_id);
-        int location = Cache__get_location(self, cl_id, set_id);
-#ifndef NO_PYTHON
-        if(self->verbosity >= 2) {
-            PySys_WriteStdout(
-                "%s STORE=%lli NT=%i addr=%lli length=%lli cl_id=%li sets=%li location=%i\n",
-                self->name, self->LOAD.count, non_temporal, range.addr, range.length,
-                cl_id, self->sets, location);
-        }
-#endif
+inline static int Cache__rrip_age(Cache* self, const unsigned long long* state, long way) {
+    // Ages are packed into words, without crossing word boundaries
+    long per_word = 64/self->rrip_bits;
+    return (int)(state[way/per_word] >> (way%per_word*self->rrip_bits)) &
+           ((1 << self->rrip_bits) - 1);
+}
 
-        if(self->write_allocate == 1 && non_temporal == 0) {
-            // Write-allocate policy
+inline static void Cache__rrip_set_age(Cache* self, unsigned long long* state, long way, int age) {
+    long per_word = 64/self->rrip_bits;
+    int shift = (int)(way%per_word*self->rrip_bits);
+    state[way/per_word] = (state[way/per_word] & ~(((1ULL << self->rrip_bits) - 1) << shift)) |
+                          (unsigned long long)age << shift;
+}
 
-            // Make sure line is loaded into cache (this will produce HITs and MISSes, iff it is 
-            // not present in this cache):
-            if(location == -1) {
-                // TODO does this also make sens if store with write-allocate and MISS happens on L2?
-                // or would this inject byte loads instead of CL loads into the statistic
-                // TODO makes no sens if first level is write-through (all byte requests hit L2)
-                location = Cache__load(self, Cache__get_range_from_cl_id(self, cl_id));
-            }
-        } else if(location == -1 && self->write_back == 1) {
-            // In non-temporal store case, write-combining or write-through:
-            // If the cacheline is not yet present, we inject a cachelien without loading it
-            cache_entry entry;
-            entry.cl_id = cl_id;
-            entry.dirty = 1;
-            entry.invalid = 0;
-            location = Cache__inject(self, &entry);
+inline static int Cache__find_invalid(Cache* self, long set_id) {
+    // Returns first invalid way of a set, -1 if all ways are valid
+    return (int)tags__find(self->tags+set_id*self->ways, self->ways, CACHE_TAG_INVALID);
+}
+
+static int Cache__victim_tail(Cache* self, long set_id) {
+    // FIFO, LRU: replace end of queue
+    return self->recency_tail[set_id];
+}
+
+static int Cache__victim_mru(Cache* self, long set_id) {
+    // MRU: replace first of queue, unless there are still invalid entries (those are always at
+    // the end of the queue)
+    int way = self->recency_tail[set_id];
+    if(self->tags[set_id*self->ways+way] != CACHE_TAG_INVALID) {
+        way = self->recency_head[set_id];
+    }
+    return way;
+}
+
+static int Cache__victim_random(Cache* self, long set_id) {
+    // RR: replace random element
+    return rand() & (self->ways - 1);
+}
+
+static void Cache__touch_recency(Cache* self, long set_id, int way, int counting) {
+    // FIFO (on insertion), LRU, MRU: move to front of queue
+    Cache__recency_touch(self, set_id, way);
+}
+
+static int Cache__victim_plru(Cache* self, long set_id) {
+    // PLRU: follow tree bits from the root (node 1), children of node n are 2n and 2n+1 and
+    // leaves ways to 2*ways-1 are the ways
+    int way = Cache__find_invalid(self, set_id);
+    if(way != -1) {
+        return way;
+    }
+    unsigned long long* state = self->policy_state + set_id*self->policy_state_words;
+    long node = 1;
+    while(node < self->ways) {
+        node = 2*node + ((state[node/64] >> (node%64)) & 1);
+    }
+    return (int)(node - self->ways);
+}
+
+static void Cache__touch_plru(Cache* self, long set_id, int way, int counting) {
+    // PLRU: let all nodes on the path from the root point away from way
+    unsigned long long* state = self->policy_state + set_id*self->policy_state_words;
+    for(long node=way+self->ways; node>1; node/=2) {
+        long parent = node/2;
+        if(node%2 == 0) {
+            state[parent/64] |= 1ULL << (parent%64);
+        } else {
+            state[parent/64] &= ~(1ULL << (parent%64));
         }
+    }
+}
 
-        // Mark address range as cached in the bitfield
-        if(self->write_combining == 1) {
-            // If write_combining is active, set the touched bits:
-            // Extract local range
-            long long cl_start = Cache__get_addr_from_cl_id(self, cl_id);
-            long long start = range.addr > cl_start ? range.addr : cl_start;
-            long long end = range.addr+range.length < cl_start+self->cl_size ?
-                                range.addr+range.length : cl_start+self->cl_size;
-            // PySys_WriteStdout("cl_start=%lli start=%lli end=%lli\n", cl_start, start, end);
-            for(long long i=start-cl_start; i<end-cl_start; i++) {
-                BITSET(self->subblock_bitfield,
-                       set_id*self->ways*self->subblock_bits + location*self->subblock_bits + i);
+static int Cache__victim_nru(Cache* self, long set_id) {
+    // NRU: first way, which was not recently used (there is always one, see Cache__touch_nru)
+    int way = Cache__find_invalid(self, set_id);
+    if(way != -1) {
+        return way;
+    }
+    unsigned long long* state = self->policy_state + set_id*self->policy_state_words;
+    for(long w=0; w<self->policy_state_words; w++) {
+        unsigned long long unused = ~state[w];
+        if(w == self->policy_state_words-1 && self->ways%64 != 0) {
+            unused &= (1ULL << (self->ways%64)) - 1;
+        }
+        if(unused != 0) {
+            return (int)(w*64 + __builtin_ctzll(unused));
+        }
+    }
+    return 0;
+}
+
+static void Cache__touch_nru(Cache* self, long set_id, int way, int counting) {
+    // NRU: mark as recently used, if this was the last unmarked way, start over
+    unsigned long long* state = self->policy_state + set_id*self->policy_state_words;
+    state[way/64] |= 1ULL << (way%64);
+    for(long w=0; w<self->policy_state_words; w++) {
+        unsigned long long full = ~0ULL;
+        if(w == self->policy_state_words-1 && self->ways%64 != 0) {
+            full = (1ULL << (self->ways%64)) - 1;
+        }
+        if(state[w] != full) {
+            return;
+        }
+    }
+    memset(state, 0, self->policy_state_words*sizeof(unsigned long long));
+    state[way/64] |= 1ULL << (way%64);
+}
+
+static int Cache__victim_rrip(Cache* self, long set_id) {
+    // SRRIP, DRRIP: first way with the maximum age, if there is none, all ways are aged until
+    // one reaches it
+    int victim = Cache__find_invalid(self, set_id);
+    if(victim != -1) {
+        return victim;
+    }
+    unsigned long long* state = self->policy_state + set_id*self->policy_state_words;
+    int max_age = (1 << self->rrip_bits) - 1;
+    int victim_age = -1;
+    for(long way=0; way<self->ways; way++) {
+        int age = Cache__rrip_age(self, state, way);
+        if(age > victim_age) {
+            victim = (int)way;
+            victim_age = age;
+            if(age == max_age) {
+                return victim;
             }
         }
+    }
+    for(long way=0; way<self->ways; way++) {
+        Cache__rrip_set_age(
+            self, state, way, Cache__rrip_age(self, state, way) + max_age - victim_age);
+    }
+    return victim;
+}
 
-        if(self->write_back == 1 && location != -1) {
-            // Write-back policy and cache-line in cache
+static void Cache__insert_srrip(Cache* self, long set_id, int way, int counting) {
+    // SRRIP: inserted lines get rrip_insert
+    Cache__rrip_set_age(self, self->policy_state + set_id*self->policy_state_words, way,
+                        self->rrip_insert);
+}
 
-            // Mark cacheline as dirty for later write-back during eviction
-            self->placement[set_id*self->ways+location].dirty = 1;
-            // PySys_WriteStdout("DIRTY\n");
-        } else {
-            // Write-through policy or cache-line not in cache
+static void Cache__hit_srrip(Cache* self, long set_id, int way, int counting) {
+    // SRRIP, DRRIP: hits reset (hit priority) or decrement (frequency priority) the age
+    unsigned long long* state = self->policy_state + set_id*self->policy_state_words;
+    int age = Cache__rrip_age(self, state, way);
+    Cache__rrip_set_age(self, state, way,
+                        self->rrip_hit_promotion == 1 && age > 0 ? age-1 : 0);
+}
 
-            // Store to lower cachelevel
-            // TODO use Cache__inject
-            if(self->store_to != NULL) {
-                addr_range store_range = Cache__get_range_from_cl_id_and_range(self, cl_id, range);
-                self->EVICT.count++;
-                self->EVICT.byte += store_range.length;
-#ifndef NO_PYTHON
-                Py_INCREF(self->store_to);
+static void Cache__sample_psel(Cache* self) {
+    // Appends PSEL to samples on every sample_interval-th DRRIP update
+    set_dueling* dueling = &self->dueling;
+    if(dueling->sample_interval == 0 || ++dueling->events % dueling->sample_interval != 0) {
+        return;
+    }
+    if(dueling->samples_length == dueling->samples_capacity) {
+        long long capacity = dueling->samples_capacity > 0 ? 2*dueling->samples_capacity : 1024;
+        int* samples = SAMPLES_REALLOC(dueling->samples, capacity*sizeof(int));
+        if(samples == NULL) {
+            return; // sample is lost, simulation continues
+        }
+        dueling->samples = samples;
+        dueling->samples_capacity = capacity;
+    }
+    dueling->samples[dueling->samples_length++] = dueling->psel;
+}
+
+static void Cache__insert_drrip(Cache* self, long set_id, int way, int counting) {
+    // DRRIP: leader sets insert with SRRIP or BRRIP and count their misses in PSEL, followers
+    // use the insertion of the leaders with fewer misses (or a fixed one)
+    set_dueling* dueling = &self->dueling;
+    int brrip;
+    long offset = dueling->leader_stride > 0 ? set_id % dueling->leader_stride : -1;
+    if(offset == 0) {
+        // SRRIP leader
+        dueling->leader_misses[0] += counting;
+        if(dueling->psel < (1 << dueling->psel_bits) - 1) {
+            dueling->psel++;
+        }
+        brrip = 0;
+    } else if(offset == 1) {
+        // BRRIP leader
+        dueling->leader_misses[1] += counting;
+        if(dueling->psel > 0) {
+            dueling->psel--;
+        }
+        brrip = 1;
+    } else if(dueling->follower == 0) {
+        // Most significant bit of PSEL selects BRRIP
+        brrip = dueling->psel >> (dueling->psel_bits-1);
+    } else {
+        brrip = dueling->follower == 2;
+    }
+
+    // BRRIP inserts with the maximum age, except for every DRRIP_BIMODAL_INTERVAL-th line
+    int age = self->rrip_insert;
+    if(brrip && dueling->bimodal_count++ % DRRIP_BIMODAL_INTERVAL != 0) {
+        age = (1 << self->rrip_bits) - 1;
+    }
+    Cache__rrip_set_age(self, self->policy_state + set_id*self->policy_state_words, way, age);
+    if(counting) {
+        Cache__sample_psel(self);
+    }
+}
+
+static void Cache__hit_drrip(Cache* self, long set_id, int way, int counting) {
+    Cache__hit_srrip(self, set_id, way, counting);
+    if(counting) {
+        Cache__sample_psel(self);
+    }
+}
+
+typedef struct replacement_policy {
+    // Replacement policy implementation, replacement_policy_id is the index in
+    // replacement_policies
+    int (*victim)(Cache* self, long set_id); // way to be replaced by the next insertion
+    // called after a line was inserted, counting as passed to the kernel (stats of the policy)
+    void (*insert)(Cache* self, long set_id, int way, int counting);
+    void (*hit)(Cache* self, long set_id, int way, int counting); // called after a hit (or NULL)
+    int recency_list; // 1 if the queue order is kept in the recency lists
+} replacement_policy;
+
+static const replacement_policy replacement_policies[] = {
+    {Cache__victim_tail, Cache__touch_recency, NULL, 1}, // 0 = FIFO
+    {Cache__victim_tail, Cache__touch_recency, Cache__touch_recency, 1}, // 1 = LRU
+    {Cache__victim_mru, Cache__touch_recency, Cache__touch_recency, 1}, // 2 = MRU
+    {Cache__victim_random, NULL, NULL, 0}, // 3 = RR
+    {Cache__victim_plru, Cache__touch_plru, Cache__touch_plru, 0}, // 4 = PLRU
+    {Cache__victim_nru, Cache__touch_nru, Cache__touch_nru, 0}, // 5 = NRU
+    {Cache__victim_rrip, Cache__insert_srrip, Cache__hit_srrip, 0}, // 6 = SRRIP
+    {Cache__victim_rrip, Cache__insert_drrip, Cache__hit_drrip, 0}, // 7 = DRRIP
+};
+
+#define REPLACEMENT_POLICY_COUNT \
+    ((int)(sizeof(replacement_policies)/sizeof(replacement_policies[0])))
+
+static void Cache__clear_entries(Cache* self) {
+    // Marks all entries as invalid and clean, resets queue order and replacement state
+    for(long i=0; i<self->sampled_sets*self->ways; i++) {
+        self->tags[i] = CACHE_TAG_INVALID;
+    }
+    memset(self->dirty_mask, 0, self->sampled_sets*self->dirty_words*sizeof(unsigned long long));
+    // Queue order of each set is the way order
+    for(long set_id=0; self->recency_prev != NULL && set_id<self->sampled_sets; set_id++) {
+        for(int way=0; way<self->ways; way++) {
+            self->recency_prev[set_id*self->ways+way] = way-1;
+            self->recency_next[set_id*self->ways+way] = way+1 < self->ways ? way+1 : -1;
+        }
+        self->recency_head[set_id] = 0;
+        self->recency_tail[set_id] = (int)self->ways-1;
+    }
+    memset(self->policy_state, 0,
+           self->sampled_sets*self->policy_state_words*sizeof(unsigned long long));
+    // PSEL starts in the middle (followers use BRRIP until SRRIP leaders miss less)
+    self->dueling.psel = 1 << (self->dueling.psel_bits-1);
+    self->dueling.bimodal_count = 0;
+    if(self->index.locations != NULL) {
+        tag_index__clear(&self->index);
+    }
+    if(self->prefetched != NULL) {
+        for(long i=0; i<self->sampled_sets*self->ways; i++) {
+            self->prefetched[i] = -1;
+        }
+    }
+    for(int i=0; i<PREFETCH_STREAMS; i++) {
+        self->prefetch_streams[i].page = CACHE_TAG_INVALID;
+        self->prefetch_streams[i].last_use = -1;
+    }
+    self->prefetch_trigger = CACHE_TAG_INVALID;
+}
+
+inline static void Cache__index_entry(Cache* self, long location) {
+    // Adds entry at location to the tag index (if used and entry is valid)
+    if(self->index.locations != NULL && self->tags[location] != CACHE_TAG_INVALID) {
+        tag_index__set(&self->index, self->tags[location], location);
+    }
+}
+
+inline static void Cache__unindex_entry(Cache* self, long location) {
+    // Removes entry at location from the tag index (if used and entry is valid)
+    if(self->index.locations != NULL && self->tags[location] != CACHE_TAG_INVALID) {
+        tag_index__remove(&self->index, self->tags[location]);
+    }
+}
+
+int Cache__init_tag_index(Cache* self) {
+    // Allocates tag index if associativity reaches tag_index_threshold, all entries need to be
+    // invalid. Returns -1 if memory allocation failed, 0 otherwise.
+    self->index.cl_ids = NULL;
+    self->index.locations = NULL;
+    if(self->tag_index_threshold <= 0 || self->ways < self->tag_index_threshold) {
+        return 0;
+    }
+    return tag_index__init(&self->index, self->sampled_sets*self->ways);
+}
+
+#ifdef CACHESIM_MMAP
+static void state_snapshot__release(state_snapshot* snapshot) {
+    // Drops a reference to snapshot, which is freed with the last one
+    if(--snapshot->references == 0) {
+        close(snapshot->fd);
+        free(snapshot);
+    }
+}
 #endif
-                Cache__store((Cache*)(self->store_to),
-                             store_range,
-                             non_temporal);
-#ifndef NO_PYTHON
-                Py_DECREF(self->store_to);
+
+static void Cache__free_arrays(Cache* self) {
+    // Frees the arrays of the state of self (see Cache__state_arrays) but the PSEL samples, or
+    // unmaps them if they point into a snapshot
+#ifdef CACHESIM_MMAP
+    if(self->snapshot != NULL) {
+        munmap(self->state_mapping, self->snapshot->size);
+        state_snapshot__release(self->snapshot);
+        self->snapshot = NULL;
+        self->state_mapping = NULL;
+        self->tags = NULL;
+        self->dirty_mask = NULL;
+        self->recency_prev = NULL;
+        self->recency_next = NULL;
+        self->recency_head = NULL;
+        self->recency_tail = NULL;
+        self->policy_state = NULL;
+        self->prefetched = NULL;
+        self->sample_loads = NULL;
+        self->sample_misses = NULL;
+        self->subblock_bitfield = NULL;
+        self->index.cl_ids = NULL;
+        self->index.locations = NULL;
+    }
 #endif
-            } // else last-level-cache
+    CACHE_FREE(self->tags);
+    CACHE_FREE(self->dirty_mask);
+    CACHE_FREE(self->recency_prev);
+    CACHE_FREE(self->recency_next);
+    CACHE_FREE(self->recency_head);
+    CACHE_FREE(self->recency_tail);
+    CACHE_FREE(self->policy_state);
+    CACHE_FREE(self->prefetched);
+    CACHE_FREE(self->sample_loads);
+    CACHE_FREE(self->sample_misses);
+    CACHE_FREE(self->subblock_bitfield);
+    self->tags = NULL;
+    self->dirty_mask = NULL;
+    self->recency_prev = NULL;
+    self->recency_next = NULL;
+    self->recency_head = NULL;
+    self->recency_tail = NULL;
+    self->policy_state = NULL;
+    self->prefetched = NULL;
+    self->sample_loads = NULL;
+    self->sample_misses = NULL;
+    self->subblock_bitfield = NULL;
+    tag_index__free(&self->index);
+}
+
+void Cache__free_state(Cache* self) {
+    // Frees everything allocated by Cache__alloc_state (and subblock_bitfield)
+    Cache__free_arrays(self);
+    SAMPLES_FREE(self->dueling.samples);
+    CACHE_FREE(self->sample_map);
+    self->dueling.samples = NULL;
+    self->sample_map = NULL;
+    self->dueling.samples_length = 0;
+    self->dueling.samples_capacity = 0;
+}
+
+int Cache__alloc_state(Cache* self) {
+    // Allocates tags, dirty bits, replacement state, tag index, prefetch state and sampled sets
+    // according to sets, ways, replacement_policy_id, rrip_bits, tag_index_threshold,
+    // prefetcher and sampling. All entries will be invalid.
+    // Returns -1 if memory allocation failed, 0 otherwise.
+    self->policy = &replacement_policies[self->replacement_policy_id];
+    Cache__init_set_index(self);
+    int sampling_error = Cache__init_sampling(self);
+    self->dirty_words = (self->ways+63)/64;
+    if(self->replacement_policy_id == 4 || self->replacement_policy_id == 5) {
+        // PLRU: ways-1 tree nodes (numbered from 1), NRU: one bit per way
+        self->policy_state_words = (self->ways+63)/64;
+    } else if(self->replacement_policy_id >= 6) {
+        self->policy_state_words = (self->ways + 64/self->rrip_bits - 1) / (64/self->rrip_bits);
+    } else {
+        self->policy_state_words = 0;
+    }
+    // DRRIP: leader sets are spread evenly, with too few sets for leader_sets pairs, all sets
+    // are leaders
+    self->dueling.leader_stride = self->sampled_sets/self->dueling.leader_sets;
+    if(self->dueling.leader_stride < 2) {
+        self->dueling.leader_stride = self->sampled_sets >= 2 ? 2 : 0;
+    }
+    self->tags = CACHE_MALLOC(self->sampled_sets*self->ways*sizeof(long));
+    self->dirty_mask = CACHE_MALLOC(self->sampled_sets*self->dirty_words*sizeof(unsigned long long));
+    if(self->policy->recency_list) {
+        // Queue order, only kept by FIFO, LRU and MRU
+        self->recency_prev = CACHE_MALLOC(self->sampled_sets*self->ways*sizeof(int));
+        self->recency_next = CACHE_MALLOC(self->sampled_sets*self->ways*sizeof(int));
+        self->recency_head = CACHE_MALLOC(self->sampled_sets*sizeof(int));
+        self->recency_tail = CACHE_MALLOC(self->sampled_sets*sizeof(int));
+    } else {
+        self->recency_prev = NULL;
+        self->recency_next = NULL;
+        self->recency_head = NULL;
+        self->recency_tail = NULL;
+    }
+    self->policy_state = CACHE_MALLOC(
+        (self->sampled_sets*self->policy_state_words+1)*sizeof(unsigned long long));
+    self->prefetched = self->prefetcher != PREFETCH_NONE ?
+        CACHE_MALLOC(self->sampled_sets*self->ways*sizeof(long long)) : NULL;
+    if(sampling_error != 0 || self->tags == NULL || self->dirty_mask == NULL ||
+       (self->policy->recency_list &&
+        (self->recency_prev == NULL || self->recency_next == NULL ||
+         self->recency_head == NULL || self->recency_tail == NULL)) ||
+       self->policy_state == NULL ||
+       (self->prefetcher != PREFETCH_NONE && self->prefetched == NULL) ||
+       Cache__init_tag_index(self) != 0) {
+        Cache__free_state(self);
+        return -1;
+    }
+    Cache__clear_entries(self);
+    tags__detect_isa();
+    Cache__bind_kernel(self);
+    return 0;
+}
+
+CACHE_ALWAYS_INLINE int Cache__find_location(
+        Cache* self, long cl_id, long set_id, const replacement_policy* policy) {
+    // Returns the location a cacheline has in a cache
+    // if cacheline is not present, returns -1
+
+    if(self->index.locations != NULL) {
+        // Large number of ways or full-associativity: use hashed tag index
+        long location = tag_index__find(&self->index, cl_id);
+        return location == -1 ? -1 : (int)(location - set_id*self->ways);
+    }
+
+    if(policy->recency_list) {
+        // Check most recently inserted or used entry first, as it is the most likely hit
+        int head = self->recency_head[set_id];
+        if(self->tags[set_id*self->ways+head] == cl_id) {
+            return head;
         }
     }
+    return (int)tags__find(self->tags+set_id*self->ways, self->ways, cl_id);
+}
+
+inline static int Cache__get_location(Cache* self, long cl_id, long set_id) {
+    if(set_id == -1) {
+        return -1; // set is not simulated (set sampling)
+    }
+    return Cache__find_location(self, cl_id, set_id, self->policy);
+}
 
-    // Print bitfield
+inline static void Cache__recency_demote(Cache* self, long set_id, int way) {
+    // Moves way to the end of the recency list of its set
+    int* prev = self->recency_prev + set_id*self->ways;
+    int* next = self->recency_next + set_id*self->ways;
+    if(self->recency_tail[set_id] == way) {
+        return;
+    }
+    // Unlink (way is not tail, thus next[way] != -1)
+    prev[next[way]] = prev[way];
+    if(prev[way] != -1) {
+        next[prev[way]] = next[way];
+    } else {
+        self->recency_head[set_id] = next[way];
+    }
+    // Append to end
+    next[way] = -1;
+    prev[way] = self->recency_tail[set_id];
+    next[self->recency_tail[set_id]] = way;
+    self->recency_tail[set_id] = way;
+}
+
+static int Cache__invalidate(Cache* self, long cl_id) {
+    // Removes cacheline from self without writing it back. The entry becomes the next victim
+    // of its set. Returns -1 if the cacheline was not cached, its dirty bit otherwise.
+    long set_id = Cache__get_set_id(self, cl_id);
+    int location = Cache__get_location(self, cl_id, set_id);
+    if(location == -1) {
+        return -1;
+    }
+    int dirty = Cache__is_dirty(self, set_id, location);
+    Cache__unindex_entry(self, set_id*self->ways+location);
+    self->tags[set_id*self->ways+location] = CACHE_TAG_INVALID;
+    Cache__set_dirty(self, set_id, location, 0);
+    if(self->subblock_bitfield != NULL) {
+        for(long i=0; i<self->subblock_bits; i++) {
+            BITCLEAR(self->subblock_bitfield,
+                     set_id*self->ways*self->subblock_bits + location*self->subblock_bits + i);
+        }
+    }
+    if(self->policy->recency_list) {
+        // Invalid entries are kept at the end of the queue (see Cache__victim_mru)
+        Cache__recency_demote(self, set_id, location);
+    }
+    return dirty;
+}
+
+static void CoherenceDomain__evicted(CoherenceDomain* self, int core, long cl_id);
+
+static int Cache__swap_out(Cache* self, long cl_id, int verbose, int counting);
+
+static int Cache__fetch(Cache* self, long cl_id, int verbose, int counting) {
+    // Loads a cacheline missing in self from the levels below: from victims_to if it holds the
+    // line, otherwise from load_from. Levels with swap_on_load hand the line over instead of
+    // keeping a copy. Returns the dirty bit of the handed over line (0 if a copy is kept below).
+    // verbose and counting as passed to the kernel of self (see Cache__load_kernel).
+    addr_range range = Cache__get_range_from_cl_id(self, cl_id);
+    if(self->victims_to != NULL) {
+        Cache* victims_to = (Cache*)self->victims_to;
+        int dirty = -1;
+        if(victims_to->swap_on_load) {
+            dirty = Cache__invalidate(victims_to, cl_id);
+            if(counting && dirty != -1) {
+                victims_to->LOAD.count++;
+                victims_to->LOAD.byte += range.length;
+                victims_to->HIT.count++;
+                victims_to->HIT.byte += range.length;
+            }
+        } else if(Cache__get_location(
+                victims_to, cl_id, Cache__get_set_id(victims_to, cl_id)) != -1) {
+            Cache__load(victims_to, range);
+            dirty = 0;
+        }
 #ifndef NO_PYTHON
-    if(self->verbosity >= 3 && self->subblock_bitfield != NULL) {
-        for(long k=0; k<self->sets; k++) {
-           for(long j=0; j<self->ways; j++) {
-                for(long i=0; i<self->subblock_bits; i++) {
-                    if(BITTEST(self->subblock_bitfield,
-                               k*self->subblock_bits*self->ways+self->subblock_bits*j+i)) {
-                        PySys_WriteStdout("I");
-                    } else {
-                        PySys_WriteStdout("O");
-                    }
-                }
-                PySys_WriteStdout("\n");
+        if(verbose && self->verbosity >= 1) {
+            PySys_WriteStdout("%s VICTIM %s cl_id=%li\n",
+                              victims_to->name, dirty != -1 ? "HIT" : "MISS", cl_id);
+        }
+#endif
+        if(dirty != -1) {
+            // do NOT go onto load_from cache
+            return dirty;
+        }
+    }
+    if(self->load_from != NULL) {
+        Cache* load_from = (Cache*)self->load_from;
+        if(load_from->swap_on_load) {
+            return Cache__swap_out(load_from, cl_id, verbose, counting);
+        }
+        Cache__load(load_from, range);
+    } // else last-level-cache
+    return 0;
+}
+
+static int Cache__fetch_into(Cache* self, long cl_id, int verbose, int counting) {
+    // Cache__fetch for a cacheline which will be injected into self. Returns the dirty bit the
+    // entry needs to have: a line handed over dirty is written through, if self is not
+    // write-back.
+    int dirty = Cache__fetch(self, cl_id, verbose, counting);
+    if(dirty && self->write_back == 0) {
+        if(self->store_to != NULL) {
+            if(counting) {
+                self->EVICT.count++;
+                self->EVICT.byte += self->cl_size;
             }
-            PySys_WriteStdout("\n\n");
+            Cache__store((Cache*)self->store_to, Cache__get_range_from_cl_id(self, cl_id), 0);
         }
+        dirty = 0;
     }
-#endif
+    return dirty;
 }
 
+typedef struct cache_kernel {
+    // Simulation of one cache level, bound to each cache by Cache__bind_kernel
+    int (*load)(Cache* self, addr_range range);
+    void (*store)(Cache* self, addr_range range, int non_temporal);
+    int (*inject)(Cache* self, cache_entry* entry);
+    void (*prefetch)(Cache* self); // issues the prefetches deferred by load (see Cache__load)
+} cache_kernel;
+
+static void Cache__prefetch_line(Cache* self, long cl_id, int verbose, int counting) {
+    // Fills cacheline as requested by the prefetcher of self, unless it is cached already
+    long set_id = Cache__get_set_id(self, cl_id);
+    if(cl_id < 0 || set_id == -1 || Cache__get_location(self, cl_id, set_id) != -1) {
+        return;
+    }
+    if(counting) {
+        self->PREFETCH_ISSUED.count++;
+        self->PREFETCH_ISSUED.byte += self->cl_size;
+    }
 #ifndef NO_PYTHON
+    if(verbose && self->verbosity >= 3) {
+        PySys_WriteStdout("%s PREFETCH cl_id=%li\n", self->name, cl_id);
+    }
+#endif
+    cache_entry entry;
+    entry.cl_id = cl_id;
+    entry.dirty = Cache__fetch_into(self, cl_id, verbose, counting);
+    entry.invalid = 0;
+    int location = self->kernel->inject(self, &entry);
+    self->prefetched[set_id*self->ways+location] = self->prefetch_clock;
+}
 
-static PyObject* Cache_load(Cache* self, PyObject *args, PyObject *kwds)
-{
-    addr_range range;
-    range.length = 1; // default to 1
+static void Cache__prefetch(Cache* self, int verbose, int counting) {
+    // Trains the prefetcher with the access to prefetch_trigger and issues its prefetches. This
+    // is deferred until the demand access is complete (the prefetches may replace its line).
+    long cl_id = self->prefetch_trigger;
+    self->prefetch_trigger = CACHE_TAG_INVALID;
+    if(self->prefetcher == PREFETCH_NEXT_LINE) {
+        for(int i=0; i<self->prefetch_degree; i++) {
+            Cache__prefetch_line(self, cl_id+self->prefetch_distance+i, verbose, counting);
+        }
+        return;
+    } else if(self->prefetcher == PREFETCH_ADJACENT) {
+        Cache__prefetch_line(self, cl_id ^ 1, verbose, counting);
+        return;
+    }
 
-    static char *kwlist[] = {"addr", "length", NULL};
-    PyArg_ParseTupleAndKeywords(args, kwds, "L|I", kwlist, &range.addr, &range.length);
+    // PREFETCH_STRIDE and PREFETCH_STREAMER follow the accesses per page
+    long lines_per_page = self->cl_size < PREFETCH_PAGE_SIZE ?
+                          PREFETCH_PAGE_SIZE/self->cl_size : 1;
+    long long page = cl_id / lines_per_page;
+    prefetch_stream* stream = NULL;
+    prefetch_stream* lru = &self->prefetch_streams[0];
+    for(int i=0; i<PREFETCH_STREAMS && stream == NULL; i++) {
+        if(self->prefetch_streams[i].page == page) {
+            stream = &self->prefetch_streams[i];
+        } else if(self->prefetch_streams[i].last_use < lru->last_use) {
+            lru = &self->prefetch_streams[i];
+        }
+    }
+    for(int i=0; i<PREFETCH_STREAMS && stream == NULL && self->prefetcher == PREFETCH_STRIDE;
+            i++) {
+        // Strides continue into the next page, if the access was predicted
+        prefetch_stream* other = &self->prefetch_streams[i];
+        if(other->confidence > 0 && other->last_cl_id+other->stride == cl_id) {
+            stream = other;
+            stream->page = page;
+        }
+    }
+    if(stream == NULL) {
+        // First access to page
+        lru->page = page;
+        lru->last_cl_id = cl_id;
+        lru->stride = 0;
+        lru->confidence = 0;
+        lru->last_use = self->prefetch_clock;
+        return;
+    }
+    stream->last_use = self->prefetch_clock;
+    long stride = cl_id - stream->last_cl_id;
+    if(stride == 0) {
+        return;
+    }
+    if(self->prefetcher == PREFETCH_STREAMER) {
+        stride = stride > 0 ? 1 : -1;
+    }
+    if(stride == stream->stride) {
+        stream->confidence++;
+    } else {
+        stream->stride = stride;
+        stream->confidence = 0;
+    }
+    stream->last_cl_id = cl_id;
+    if(stream->confidence == 0) {
+        return; // stride needs to be seen twice in a row
+    }
+    for(int i=0; i<self->prefetch_degree; i++) {
+        long target = cl_id + stride*(self->prefetch_distance+i);
+        if(self->prefetcher == PREFETCH_STREAMER && (target < 0 || target/lines_per_page != page)) {
+            break;
+        }
+        Cache__prefetch_line(self, target, verbose, counting);
+    }
+}
 
-    Cache__load(self, range); // TODO , 0);
-    // Swap cl_id is irrelevant here, since this is only called on first level cache
+inline static void Cache__prefetch_hit(Cache* self, long cl_id, long location, int counting) {
+    // Demand access hit entry at location, which might have been prefetched
+    long long filled = self->prefetched[location];
+    if(filled == -1) {
+        return;
+    }
+    self->prefetched[location] = -1;
+    if(counting && self->prefetch_clock - filled < self->prefetch_latency) {
+        self->PREFETCH_LATE.count++;
+        self->PREFETCH_LATE.byte += self->cl_size;
+    } else if(counting) {
+        self->PREFETCH_USEFUL.count++;
+        self->PREFETCH_USEFUL.byte += self->cl_size;
+    }
+    self->prefetch_trigger = cl_id;
+}
 
-    Py_RETURN_NONE;
+static int Cache__swap_out(Cache* self, long cl_id, int verbose, int counting) {
+    // Load of a cacheline by the level above an exclusive level (swap_on_load). A hit moves the
+    // line up (it is removed from self), a miss is forwarded without allocating the line in
+    // self. Lines come back through Cache__inject when they are replaced above. Returns the
+    // dirty bit of the line.
+    if(counting) {
+        self->LOAD.count++;
+        self->LOAD.byte += self->cl_size;
+    }
+    int dirty = Cache__invalidate(self, cl_id);
+    if(dirty != -1) {
+        if(counting) {
+            self->HIT.count++;
+            self->HIT.byte += self->cl_size;
+        }
+#ifndef NO_PYTHON
+        if(verbose && self->verbosity >= 3) {
+            PySys_WriteStdout("%s SWAP cl_id=%li dirty=%i\n", self->name, cl_id, dirty);
+        }
+#endif
+        return dirty;
+    }
+    if(counting) {
+        self->MISS.count++;
+        self->MISS.byte += self->cl_size;
+    }
+    return Cache__fetch(self, cl_id, verbose, counting);
 }
 
-static PyObject* Cache_iterload(Cache* self, PyObject *args, PyObject *kwds)
-{
-    PyObject *addrs;
-    addr_range range;
-    range.length = 1; // default to 1
+/*
+Cache__inject_kernel, Cache__load_kernel and Cache__store_kernel implement the simulation of a
+single cache level. All arguments after self (entry or range) describe the configuration of
+self. Generic kernels pass the configuration as found in self, specialized kernels (see
+CACHESIM_SPECIALIZED_KERNELS) pass constants, so the compiler can remove all checks for other
+configurations. Other cache levels are always accessed through their bound kernel.
+
+policy: replacement_policies entry of replacement_policy_id
+write_back, write_allocate, write_combining: write mode
+set_indexing: 0 = Cache__get_set_id, 1 = set_mask (SET_INDEX_MODULO with power of two sets),
+              2 = set_reciprocal (SET_INDEX_MODULO with other sets)
+verbose: 0 if no output may be generated (verbosity is ignored)
+counting: 0 if no stats may be counted (functional warming, see Cache__warm)
+*/
+#define CACHE_KERNEL_PARAMS const replacement_policy* policy, int write_back, \
+    int write_allocate, int write_combining, int set_indexing, int verbose, int counting
+#define CACHE_KERNEL_ARGS policy, write_back, write_allocate, write_combining, set_indexing, \
+    verbose, counting
+
+CACHE_ALWAYS_INLINE long Cache__kernel_set_id(Cache* self, long cl_id, int set_indexing) {
+    if(set_indexing == 1) {
+        return (long)((unsigned long long)cl_id & self->set_mask);
+    } else if(set_indexing == 2) {
+        return Cache__mod_reciprocal(self, (unsigned long long)cl_id);
+    }
+    return Cache__get_set_id(self, cl_id);
+}
 
-    static char *kwlist[] = {"addrs", "length", NULL};
-    PyArg_ParseTupleAndKeywords(args, kwds, "O|L", kwlist, &addrs, &range.length);
-    Py_INCREF(addrs);
+CACHE_ALWAYS_INLINE int Cache__inject_kernel(
+        Cache* self, cache_entry* entry, CACHE_KERNEL_PARAMS) {
+    /*
+    Injects a cache entry into a cache and handles all side effects that might occur:
+     - choose replacement according to policy
+     - reorder queues
+     - inform victim caches
+     - handle write-back on replacement
+    */
+    long set_id = Cache__kernel_set_id(self, entry->cl_id, set_indexing);
+    if(set_indexing == 0 && set_id == -1) {
+        return -1; // set is not simulated (set sampling)
+    }
 
-    // Get and check iterator
-    PyObject *addrs_iter = PyObject_GetIter(addrs);
-    Py_DECREF(addrs);
-    if(addrs_iter == NULL) {
-        PyErr_SetString(PyExc_ValueError, "addrs is not iteratable");
-        return NULL;
+    // Get cacheline id to be replaced according to replacement strategy
+    int replace_idx = policy->victim(self, set_id);
+    cache_entry replace_entry = Cache__get_entry(self, set_id, replace_idx);
+
+    // New entry takes over the way of the replaced one (entries never move, queue order and
+    // other replacement state is kept separately)
+    if(policy->insert != NULL) {
+        policy->insert(self, set_id, replace_idx, counting);
+    }
+    Cache__unindex_entry(self, set_id*self->ways+replace_idx);
+    Cache__put_entry(self, set_id, replace_idx, *entry);
+    Cache__index_entry(self, set_id*self->ways+replace_idx);
+    if(self->prefetched != NULL) {
+        self->prefetched[set_id*self->ways+replace_idx] = -1;
+    }
+#ifndef NO_PYTHON
+    if(verbose && self->verbosity >= 3) {
+        PySys_WriteStdout(
+            "%s REPLACED cl_id=%li invalid=%u dirty=%u\n",
+            self->name, replace_entry.cl_id, replace_entry.invalid, replace_entry.dirty);
     }
+#endif
 
-    // Iterate of elements in addrs
-    PyObject *addr;
-    while((addr = PyIter_Next(addrs_iter))) {
-        // For each address, build range:
-#if PY_MAJOR_VERSION >= 3
-        range.addr = PyLong_AsLong(addr);
-#else
-        range.addr = PyInt_AsLong(addr);
+    // ignore invalid cache lines for write-back or victim cache
+    if(replace_entry.invalid == 0) {
+        if(self->load_from != NULL && ((Cache*)self->load_from)->swap_on_load) {
+            // Exclusive lower level: the replaced line moves down, dirty or not, and is written
+            // back from there once it is replaced again
+            Cache* load_from = (Cache*)self->load_from;
+            if(write_combining == 1) {
+                for(long i=0; i<self->subblock_bits; i++) {
+                    BITCLEAR(self->subblock_bitfield,
+                             set_id*self->ways*self->subblock_bits +
+                             replace_idx*self->subblock_bits + i);
+                }
+            }
+            load_from->kernel->inject(load_from, &replace_entry);
+            if(counting) {
+                self->EVICT.count++;
+                self->EVICT.byte += self->cl_size;
+                load_from->STORE.count++;
+                load_from->STORE.byte += self->cl_size;
+            }
+        } else if(write_back == 1 && replace_entry.dirty == 1) {
+            // write-back: check for dirty bit of replaced and inform next lower level of store
+            if(counting) {
+                self->EVICT.count++;
+                self->EVICT.byte += self->cl_size;
+            }
+#ifndef NO_PYTHON
+            if(verbose && self->verbosity >= 3) {
+                PySys_WriteStdout(
+                    "%s EVICT cl_id=%li invalid=%u dirty=%u\n",
+                    self->name, replace_entry.cl_id, replace_entry.invalid, replace_entry.dirty);
+            }
 #endif
-        Cache__load(self, range); // TODO , 0);
-        // Swap cl_id is irrelevant here, since this is only called on first level cache
+            if(self->store_to != NULL) {
+                int non_temporal = 0; // default for non write-combining caches
+
+                if(write_combining == 1) {
+                    // Check if non-temporal store may be used or write-allocate is necessary
+                    non_temporal = 1;
+                    for(long i=0; i<self->subblock_bits; i++) {
+                        if(!BITTEST(self->subblock_bitfield,
+                                set_id*self->ways*self->subblock_bits +
+                                replace_idx*self->subblock_bits + i)) {
+                            // incomplete cacheline, thus write-allocate is necessary
+                            non_temporal = 0;
+                        }
+                        // Clear bits for future use
+                        BITCLEAR(self->subblock_bitfield,
+                                set_id*self->ways*self->subblock_bits +
+                                replace_idx*self->subblock_bits + i);
+                    }
+                }
+                // TODO addrs vs cl_id is not nicely solved here
+                Cache__store(
+                    (Cache*)self->store_to,
+                    Cache__get_range_from_cl_id(self, replace_entry.cl_id),
+                    non_temporal);
+            } // else last-level-cache
+        } else if(self->victims_to != NULL) {
+            // Deliver replaced cacheline to victim cache, if neither dirty or already write_back
+            // (if it were dirty, it would have been written to store_to if write_back is enabled)
+            // Inject into victims_to
+            Cache* victims_to = (Cache*)self->victims_to;
+            int injected = victims_to->kernel->inject(victims_to, &replace_entry) != -1;
+            // Take care to include into evict stats
+            if(counting) {
+                self->EVICT.count++;
+                self->EVICT.byte += self->cl_size;
+            }
+            if(counting && injected) {
+                victims_to->STORE.count++;
+                victims_to->STORE.byte += self->cl_size;
+            }
+        }
+        if(self->coherence != NULL) {
+            // Private level of a core: the core might not hold the line anymore
+            CoherenceDomain__evicted(self->coherence, self->core, replace_entry.cl_id);
+        }
+    }
+
+    return replace_idx;
+}
+
+CACHE_ALWAYS_INLINE int Cache__load_kernel(Cache* self, addr_range range, CACHE_KERNEL_PARAMS) {
+    /*
+    Signals request of addr range by higher level. This handles hits and misses.
+    */
+    if(set_indexing == 0 && self->sample_map != NULL && !Cache__samples_range(self, range)) {
+        return -1; // only other sets are simulated (set sampling)
+    }
+    if(counting) {
+        self->LOAD.count++;
+        self->LOAD.byte += range.length;
+    }
+    int placement_idx = -1;
+
+    // Handle range:
+    long last_cl_id = Cache__get_cacheline_id(self, range.addr+range.length-1);
+    for(long cl_id=Cache__get_cacheline_id(self, range.addr); cl_id<=last_cl_id; cl_id++) {
+        long set_id = Cache__kernel_set_id(self, cl_id, set_indexing);
+        if(set_indexing == 0 && set_id == -1) {
+            continue;
+        }
+        if(counting && set_indexing == 0 && self->sample_loads != NULL) {
+            self->sample_loads[set_id]++;
+        }
+        if(self->prefetcher != PREFETCH_NONE) {
+            if(self->prefetch_trigger != CACHE_TAG_INVALID) {
+                // triggered by the previous cacheline
+                Cache__prefetch(self, verbose, counting);
+            }
+            self->prefetch_clock++;
+        }
+#ifndef NO_PYTHON
+        if(verbose && self->verbosity >= 4) {
+            PySys_WriteStdout(
+                "%s LOAD=%lli addr=%lli length=%lli cl_id=%li set_id=%li\n",
+                self->name, self->LOAD.count, range.addr, range.length, cl_id, set_id);
+        }
+#endif
+
+        // Check if cl_id is already cached
+        int location = Cache__find_location(self, cl_id, set_id, policy);
+        if(location != -1) {
+            // HIT: Found it!
+            if(counting) {
+                self->HIT.count++;
+                // We only add actual bytes that were requested to hit.byte
+                self->HIT.byte += self->cl_size < range.length ? self->cl_size : range.length;
+            }
+#ifndef NO_PYTHON
+            if(verbose && self->verbosity >= 3) {
+                PySys_WriteStdout("%s HIT self->LOAD=%lli addr=%lli cl_id=%li set_id=%li\n",
+                                  self->name, self->LOAD.count, range.addr, cl_id, set_id);
+            }
+#endif
+
+            // Update replacement state (e.g., move to front of queue with LRU)
+            if(policy->hit != NULL) {
+                policy->hit(self, set_id, location, counting);
+            }
+            if(self->prefetched != NULL) {
+                Cache__prefetch_hit(self, cl_id, set_id*self->ways+location, counting);
+            }
+            placement_idx = location;
+            continue;
+        }
+
+        // MISS!
+        if(counting) {
+            self->MISS.count++;
+            if(set_indexing == 0 && self->sample_misses != NULL) {
+                self->sample_misses[set_id]++;
+            }
+            // We only add actual bytes that were requested to miss.byte
+            self->MISS.byte += self->cl_size < range.length ? self->cl_size : range.length;
+        }
+#ifndef NO_PYTHON
+        if(verbose && self->verbosity >= 2) {
+            // In queue order (in way order, if the policy keeps no queue)
+            int way = policy->recency_list ? self->recency_head[set_id] : 0;
+            PySys_WriteStdout("%s CACHED [%li",
+                              self->name, self->tags[set_id*self->ways+way]);
+            for(int i=1; i<self->ways; i++) {
+                way = policy->recency_list ? self->recency_next[set_id*self->ways+way] : i;
+                PySys_WriteStdout(", %li", self->tags[set_id*self->ways+way]);
+            }
+            PySys_WriteStdout("]\n");
+        }
+        if(verbose && self->verbosity >= 1) {
+            PySys_WriteStdout(
+                "%s MISS self->LOAD=%lli addr=%lli length=%lli cl_id=%li set_id=%li\n",
+                self->name, self->LOAD.count, range.addr, range.length, cl_id, set_id);
+        }
+#endif
+
+        // Load from lower cachelevel (victim cache, if available, or load_from)
+        cache_entry entry;
+        entry.cl_id = cl_id;
+        entry.dirty = Cache__fetch_into(self, cl_id, verbose, counting);
+        entry.invalid = 0;
+
+        // Inject new entry into own cache. This also handles replacement.
+        placement_idx = Cache__inject_kernel(self, &entry, CACHE_KERNEL_ARGS);
+        if(self->prefetcher != PREFETCH_NONE) {
+            self->prefetch_trigger = cl_id;
+        }
+    }
+    // TODO Does this make sens or multiple cachelines? It is atm only used by write-allocate,
+    // which should be fine, because requests are already split into individual cachelines
+    return placement_idx;
+}
+
+CACHE_ALWAYS_INLINE void Cache__store_kernel(
+        Cache* self, addr_range range, int non_temporal, CACHE_KERNEL_PARAMS) {
+    if(set_indexing == 0 && self->sample_map != NULL && !Cache__samples_range(self, range)) {
+        return; // only other sets are simulated (set sampling)
+    }
+    if(counting) {
+        self->STORE.count++;
+        self->STORE.byte += range.length;
+    }
+    // Handle range:
+    long last_cl_id = Cache__get_cacheline_id(self, range.addr+range.length-1);
+    for(long cl_id=Cache__get_cacheline_id(self, range.addr); cl_id<=last_cl_id; cl_id++) {
+        long set_id = Cache__kernel_set_id(self, cl_id, set_indexing);
+        if(set_indexing == 0 && set_id == -1) {
+            continue;
+        }
+        int location = Cache__find_location(self, cl_id, set_id, policy);
+#ifndef NO_PYTHON
+        if(verbose && self->verbosity >= 2) {
+            PySys_WriteStdout(
+                "%s STORE=%lli NT=%i addr=%lli length=%lli cl_id=%li sets=%li location=%i\n",
+                self->name, self->LOAD.count, non_temporal, range.addr, range.length,
+                cl_id, self->sets, location);
+        }
+#endif
+
+        if(location != -1 && self->prefetched != NULL) {
+            self->prefetch_clock++;
+            Cache__prefetch_hit(self, cl_id, set_id*self->ways+location, counting);
+        }
+
+        if(write_allocate == 1 && non_temporal == 0) {
+            // Write-allocate policy
+
+            // Make sure line is loaded into cache (this will produce HITs and MISSes, iff it is 
+            // not present in this cache):
+            if(location == -1) {
+                // TODO does this also make sens if store with write-allocate and MISS happens on L2?
+                // or would this inject byte loads instead of CL loads into the statistic
+                // TODO makes no sens if first level is write-through (all byte requests hit L2)
+                location = self->kernel->load(self, Cache__get_range_from_cl_id(self, cl_id));
+            }
+        } else if(location == -1 && write_back == 1) {
+            // In non-temporal store case, write-combining or write-through:
+            // If the cacheline is not yet present, we inject a cachelien without loading it
+            if(self->load_from != NULL && ((Cache*)self->load_from)->swap_on_load) {
+                // A copy in an exclusive level below is merged into the injected line
+                Cache__invalidate((Cache*)self->load_from, cl_id);
+            }
+            cache_entry entry;
+            entry.cl_id = cl_id;
+            entry.dirty = 1;
+            entry.invalid = 0;
+            location = Cache__inject_kernel(self, &entry, CACHE_KERNEL_ARGS);
+        }
+
+        // Mark address range as cached in the bitfield
+        if(write_combining == 1) {
+            // If write_combining is active, set the touched bits:
+            // Extract local range
+            long long cl_start = Cache__get_addr_from_cl_id(self, cl_id);
+            long long start = range.addr > cl_start ? range.addr : cl_start;
+            long long end = range.addr+range.length < cl_start+self->cl_size ?
+                                range.addr+range.length : cl_start+self->cl_size;
+            // PySys_WriteStdout("cl_start=%lli start=%lli end=%lli\n", cl_start, start, end);
+            // One bit per subblock touched
+            for(long long i=(start-cl_start)/self->subblock_size;
+                i*self->subblock_size < end-cl_start; i++) {
+                BITSET(self->subblock_bitfield,
+                       set_id*self->ways*self->subblock_bits + location*self->subblock_bits + i);
+            }
+        }
+
+        if(write_back == 1 && location != -1) {
+            // Write-back policy and cache-line in cache
+
+            // Mark cacheline as dirty for later write-back during eviction
+            Cache__set_dirty(self, set_id, location, 1);
+            // PySys_WriteStdout("DIRTY\n");
+        } else {
+            // Write-through policy or cache-line not in cache
+
+            // Store to lower cachelevel
+            // TODO use Cache__inject
+            if(self->store_to != NULL) {
+                addr_range store_range = Cache__get_range_from_cl_id_and_range(self, cl_id, range);
+                if(counting) {
+                    self->EVICT.count++;
+                    self->EVICT.byte += store_range.length;
+                }
+                Cache__store((Cache*)(self->store_to),
+                             store_range,
+                             non_temporal);
+            } // else last-level-cache
+        }
+
+        if(self->prefetch_trigger != CACHE_TAG_INVALID) {
+            // by a hit on a prefetched line or the write-allocate miss
+            Cache__prefetch(self, verbose, counting);
+        }
+    }
+
+    // Print bitfield
+#ifndef NO_PYTHON
+    if(verbose && self->verbosity >= 3 && self->subblock_bitfield != NULL) {
+        for(long k=0; k<self->sets; k++) {
+           for(long j=0; j<self->ways; j++) {
+                for(long i=0; i<self->subblock_bits; i++) {
+                    if(BITTEST(self->subblock_bitfield,
+                               k*self->subblock_bits*self->ways+self->subblock_bits*j+i)) {
+                        PySys_WriteStdout("I");
+                    } else {
+                        PySys_WriteStdout("O");
+                    }
+                }
+                PySys_WriteStdout("\n");
+            }
+            PySys_WriteStdout("\n\n");
+        }
+    }
+#endif
+}
+
+static int Cache__load_generic(Cache* self, addr_range range) {
+    return Cache__load_kernel(self, range, self->policy, self->write_back, self->write_allocate,
+                              self->write_combining, 0, 1, 1);
+}
+
+static void Cache__store_generic(Cache* self, addr_range range, int non_temporal) {
+    Cache__store_kernel(self, range, non_temporal, self->policy, self->write_back,
+                        self->write_allocate, self->write_combining, 0, 1, 1);
+}
+
+static int Cache__inject_generic(Cache* self, cache_entry* entry) {
+    return Cache__inject_kernel(self, entry, self->policy, self->write_back,
+                                self->write_allocate, self->write_combining, 0, 1, 1);
+}
+
+static void Cache__prefetch_generic(Cache* self) {
+    Cache__prefetch(self, 1, 1);
+}
+
+static const cache_kernel generic_kernel = {
+    Cache__load_generic, Cache__store_generic, Cache__inject_generic, Cache__prefetch_generic};
+
+// Stats-free variants of the generic kernel, bound to all caches of a hierarchy during
+// functional warming (see Cache__warm)
+static int Cache__load_warming(Cache* self, addr_range range) {
+    return Cache__load_kernel(self, range, self->policy, self->write_back, self->write_allocate,
+                              self->write_combining, 0, 0, 0);
+}
+
+static void Cache__store_warming(Cache* self, addr_range range, int non_temporal) {
+    Cache__store_kernel(self, range, non_temporal, self->policy, self->write_back,
+                        self->write_allocate, self->write_combining, 0, 0, 0);
+}
+
+static int Cache__inject_warming(Cache* self, cache_entry* entry) {
+    return Cache__inject_kernel(self, entry, self->policy, self->write_back,
+                                self->write_allocate, self->write_combining, 0, 0, 0);
+}
+
+static void Cache__prefetch_warming(Cache* self) {
+    Cache__prefetch(self, 0, 0);
+}
+
+static const cache_kernel warming_kernel = {
+    Cache__load_warming, Cache__store_warming, Cache__inject_warming, Cache__prefetch_warming};
+
+#ifdef CACHESIM_SPECIALIZED_KERNELS
+// One kernel per replacement policy, set indexing and write mode. Write modes are numbered
+// 0 = write-through, 1 = write-back with write-allocate, 2 = write-back without
+// write-allocate, 3 = write-combining (write-back without write-allocate). All other
+// configurations use generic_kernel.
+#define CACHE_KERNEL_NAME(f, p, idx, mode) Cache__##f##_##p##_##idx##_##mode
+#define CACHE_KERNEL_FUNCTIONS(p, idx, mode, wb, wa, wc) \
+    static int CACHE_KERNEL_NAME(load, p, idx, mode)(Cache* self, addr_range range) { \
+        return Cache__load_kernel(self, range, &replacement_policies[p], wb, wa, wc, idx, 0, 1); \
+    } \
+    static void CACHE_KERNEL_NAME(store, p, idx, mode)( \
+            Cache* self, addr_range range, int non_temporal) { \
+        Cache__store_kernel( \
+            self, range, non_temporal, &replacement_policies[p], wb, wa, wc, idx, 0, 1); \
+    } \
+    static int CACHE_KERNEL_NAME(inject, p, idx, mode)(Cache* self, cache_entry* entry) { \
+        return Cache__inject_kernel( \
+            self, entry, &replacement_policies[p], wb, wa, wc, idx, 0, 1); \
+    }
+#define CACHE_KERNEL_ENTRY(p, idx, mode, wb, wa, wc) \
+    {CACHE_KERNEL_NAME(load, p, idx, mode), CACHE_KERNEL_NAME(store, p, idx, mode), \
+     CACHE_KERNEL_NAME(inject, p, idx, mode), Cache__prefetch_generic},
+#define CACHE_KERNELS_OF_INDEXING(X, p, idx) \
+    X(p, idx, 0, 0, 0, 0) X(p, idx, 1, 1, 1, 0) X(p, idx, 2, 1, 0, 0) X(p, idx, 3, 1, 0, 1)
+#define CACHE_KERNELS_OF_POLICY(X, p) \
+    CACHE_KERNELS_OF_INDEXING(X, p, 0) CACHE_KERNELS_OF_INDEXING(X, p, 1) \
+    CACHE_KERNELS_OF_INDEXING(X, p, 2)
+#define CACHE_KERNELS(X) \
+    CACHE_KERNELS_OF_POLICY(X, 0) CACHE_KERNELS_OF_POLICY(X, 1) \
+    CACHE_KERNELS_OF_POLICY(X, 2) CACHE_KERNELS_OF_POLICY(X, 3) \
+    CACHE_KERNELS_OF_POLICY(X, 4) CACHE_KERNELS_OF_POLICY(X, 5) \
+    CACHE_KERNELS_OF_POLICY(X, 6) CACHE_KERNELS_OF_POLICY(X, 7)
+
+CACHE_KERNELS(CACHE_KERNEL_FUNCTIONS)
+
+// Indexed by replacement_policy_id*12 + set_indexing*4 + write mode
+static const cache_kernel specialized_kernels[] = {CACHE_KERNELS(CACHE_KERNEL_ENTRY)};
+#endif
+
+void Cache__bind_kernel(Cache* self) {
+    // Selects the kernel used to simulate self, needs to be called again after
+    // replacement_policy_id, sets, set_index_function, the write mode or verbosity have changed
+    self->kernel = &generic_kernel;
+#ifdef CACHESIM_SPECIALIZED_KERNELS
+    int mode;
+    if(self->write_back == 0 && self->write_allocate == 0 && self->write_combining == 0) {
+        mode = 0;
+    } else if(self->write_back == 1 && self->write_allocate == 1 && self->write_combining == 0) {
+        mode = 1;
+    } else if(self->write_back == 1 && self->write_allocate == 0) {
+        mode = self->write_combining == 1 ? 3 : 2;
+    } else {
+        return;
+    }
+#ifndef NO_PYTHON
+    if(self->verbosity > 0) {
+        return;
+    }
+#endif
+    int set_indexing = 0;
+    if(self->set_index_function == SET_INDEX_MODULO && self->sample_map == NULL) {
+        set_indexing = self->set_mask != 0 ? 1 : 2;
+    }
+    self->kernel = &specialized_kernels[
+        self->replacement_policy_id*12 + set_indexing*4 + mode];
+#endif
+}
+
+int Cache__load(Cache* self, addr_range range) {
+    if(self->tlb != NULL) {
+        Cache__load((Cache*)self->tlb, range);
+    }
+    int location = self->kernel->load(self, range);
+    if(self->prefetch_trigger != CACHE_TAG_INVALID) {
+        self->kernel->prefetch(self);
+    }
+    return location;
+}
+
+void Cache__store(Cache* self, addr_range range, int non_temporal) {
+    if(self->tlb != NULL) {
+        // Stores are translated just like loads
+        Cache__load((Cache*)self->tlb, range);
+    }
+    self->kernel->store(self, range, non_temporal);
+}
+
+int Cache__get_hierarchy(Cache* self, Cache** caches, int max_caches) {
+    // Collects self and all caches reachable through load_from, store_to, victims_to and tlb,
+    // each only once. Returns number of caches written to caches (at most max_caches).
+    int n = 0;
+    if(max_caches < 1) {
+        return 0;
+    }
+    caches[n++] = self;
+    for(int i=0; i<n; i++) {
+        Cache* links[4] = {(Cache*)caches[i]->load_from,
+                           (Cache*)caches[i]->store_to,
+                           (Cache*)caches[i]->victims_to,
+                           (Cache*)caches[i]->tlb};
+        for(int l=0; l<4; l++) {
+            if(links[l] == NULL) {
+                continue;
+            }
+            int known = 0;
+            for(int j=0; j<n; j++) {
+                known |= caches[j] == links[l];
+            }
+            if(!known && n < max_caches) {
+                caches[n++] = links[l];
+            }
+        }
+    }
+    return n;
+}
+
+void Cache__force_write_back(Cache* self) {
+    for(long i=0; i<self->ways*self->sampled_sets; i++) {
+        // TODO merge with Cache__inject (last section)?
+        if(self->tags[i] != CACHE_TAG_INVALID &&
+           Cache__is_dirty(self, i / self->ways, i % self->ways)) {
+            self->EVICT.count++;
+            self->EVICT.byte += self->cl_size;
+#ifndef NO_PYTHON
+            if(self->verbosity >= 3) {
+                PySys_WriteStdout(
+                    "%s EVICT cl_id=%li invalid=%u dirty=%u\n",
+                    self->name, self->tags[i], 0, 1);
+            }
+#endif
+            if(self->store_to != NULL && ((Cache*)self->store_to)->swap_on_load) {
+                // Exclusive lower level: the line moves down as a whole (see Cache__inject)
+                Cache* store_to = (Cache*)self->store_to;
+                cache_entry entry;
+                entry.cl_id = self->tags[i];
+                entry.dirty = 1;
+                entry.invalid = 0;
+                Cache__invalidate(self, entry.cl_id);
+                store_to->STORE.count++;
+                store_to->STORE.byte += self->cl_size;
+                store_to->kernel->inject(store_to, &entry);
+                if(self->coherence != NULL) {
+                    CoherenceDomain__evicted(self->coherence, self->core, entry.cl_id);
+                }
+                continue;
+            }
+            if(self->store_to != NULL) {
+                // Found dirty line, initiate write-back:
+                int non_temporal = 0; // default for non write-combining caches
+
+                if(self->write_combining == 1) {
+                    // Check if non-temporal store may be used or write-allocate is necessary
+                    non_temporal = 1;
+                    for(long j=0; j<self->subblock_bits; j++) {
+                        if(!BITTEST(self->subblock_bitfield, i*self->subblock_bits + j)) {
+                            // incomplete cacheline, thus write-allocate is necessary
+                            non_temporal = 0;
+                        }
+                        // Clear bits for future use
+                        BITCLEAR(self->subblock_bitfield, i*self->subblock_bits + j);
+                    }
+                }
+
+                Cache__store(
+                    (Cache*)self->store_to,
+                    Cache__get_range_from_cl_id(self, self->tags[i]),
+                    non_temporal);
+            }
+            Cache__set_dirty(self, i / self->ways, i % self->ways, 0);
+        }
+    }
+}
+
+void Cache__reset_stats(Cache* self) {
+    self->LOAD.count = 0;
+    self->STORE.count = 0;
+    self->HIT.count = 0;
+    self->MISS.count = 0;
+    self->EVICT.count = 0;
+
+    self->LOAD.byte = 0;
+    self->STORE.byte = 0;
+    self->HIT.byte = 0;
+    self->MISS.byte = 0;
+    self->EVICT.byte = 0;
+
+    self->INVALIDATE.count = 0;
+    self->INVALIDATE.byte = 0;
+    self->INTERVENTION.count = 0;
+    self->INTERVENTION.byte = 0;
+    self->UPGRADE.count = 0;
+    self->UPGRADE.byte = 0;
+    self->BACK_INVALIDATE.count = 0;
+    self->BACK_INVALIDATE.byte = 0;
+    self->PREFETCH_ISSUED.count = 0;
+    self->PREFETCH_ISSUED.byte = 0;
+    self->PREFETCH_USEFUL.count = 0;
+    self->PREFETCH_USEFUL.byte = 0;
+    self->PREFETCH_LATE.count = 0;
+    self->PREFETCH_LATE.byte = 0;
+
+    self->dueling.leader_misses[0] = 0;
+    self->dueling.leader_misses[1] = 0;
+    self->dueling.events = 0;
+    self->dueling.samples_length = 0;
+
+    if(self->sample_map != NULL) {
+        memset(self->sample_loads, 0, self->sampled_sets*sizeof(long long));
+        memset(self->sample_misses, 0, self->sampled_sets*sizeof(long long));
+    }
+
+    // self->LOAD.cl = 0;
+    // self->STORE.cl = 0;
+    // self->HIT.cl = 0;
+    // self->MISS.cl = 0;
+}
+
+void Cache__estimate(const Cache* self, sampling_estimate* estimate) {
+    // Estimates misses and miss ratio of all sets from the sampled sets (simple random sampling
+    // of sets without replacement, see R. E. Kessler, M. D. Hill, D. A. Wood: A Comparison of
+    // Trace-Sampling Techniques for Multi-Megabyte Caches, 1994). The miss ratio is a ratio
+    // estimator, its variance is approximated by linearization. Without sampling, the
+    // estimates are exact.
+    long long loads = self->HIT.count + self->MISS.count;
+    estimate->scale = (double)self->sets / self->sampled_sets;
+    estimate->misses = estimate->scale*self->MISS.count;
+    estimate->miss_ratio = loads > 0 ? (double)self->MISS.count / loads : 0.0;
+    estimate->misses_error = 0.0;
+    estimate->miss_ratio_error = 0.0;
+    long n = self->sampled_sets;
+    if(self->sample_map == NULL || n == self->sets) {
+        return;
+    }
+    if(n < 2) {
+        estimate->misses_error = NAN;
+        estimate->miss_ratio_error = NAN;
+        return;
+    }
+    double mean_misses = (double)self->MISS.count / n;
+    double misses_variance = 0.0, ratio_variance = 0.0;
+    for(long i=0; i<n; i++) {
+        double deviation = self->sample_misses[i] - mean_misses;
+        double residual = self->sample_misses[i] - estimate->miss_ratio*self->sample_loads[i];
+        misses_variance += deviation*deviation;
+        ratio_variance += residual*residual;
+    }
+    // Variance of the sample means, with finite population correction
+    double correction = (1.0 - (double)n / self->sets) / n;
+    misses_variance *= correction / (n-1);
+    ratio_variance *= correction / (n-1);
+    estimate->misses_error = 1.96*self->sets*sqrt(misses_variance);
+    if(loads > 0) {
+        double mean_loads = (double)loads / n;
+        estimate->miss_ratio_error = 1.96*sqrt(ratio_variance) / mean_loads;
+    }
+}
+
+void Cache__replay(Cache* self, const access_record* records, long long n) {
+    // Replays packed load and store records in the order given
+    addr_range range;
+    for(long long i=0; i<n; i++) {
+        range.addr = records[i].addr;
+        range.length = records[i].length;
+        if(records[i].op == ACCESS_STORE) {
+            Cache__store(self, range, records[i].non_temporal);
+        } else {
+            Cache__load(self, range);
+        }
+    }
+}
+
+static void Cache__warm_hierarchy(Cache** hierarchy, int n, const access_record* records,
+                                  long long count) {
+    // Replays records through hierarchy[0] with the n caches of its hierarchy bound to
+    // warming_kernel
+    for(int i=0; i<n; i++) {
+        hierarchy[i]->kernel = &warming_kernel;
+    }
+    Cache__replay(hierarchy[0], records, count);
+    for(int i=0; i<n; i++) {
+        Cache__bind_kernel(hierarchy[i]);
+    }
+}
+
+void Cache__warm(Cache* self, const access_record* records, long long n) {
+    // Functional warming: replays records like Cache__replay, which updates tags and
+    // replacement state of the whole hierarchy, but neither counts stats nor generates output
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    int caches = Cache__get_hierarchy(self, hierarchy, HIERARCHY_MAX_CACHES);
+    Cache__warm_hierarchy(hierarchy, caches, records, n);
+}
+
+#ifdef CACHESIM_THREADS
+static long Cache__max_partitions(
+        Cache** hierarchy, int n, const access_record* records, long long records_n) {
+    // Returns the largest number of partitions (by cl_id modulo partitions) records can be split
+    // into, so that no two partitions share any state on any level of the hierarchy. Returns 1,
+    // if records need to be replayed serially to get the same results.
+    if(n >= HIERARCHY_MAX_CACHES) {
+        return 1; // hierarchy might be incomplete
+    }
+    long sets_gcd = 0;
+    for(int i=0; i<n; i++) {
+        Cache* cache = hierarchy[i];
+        if(cache->cl_bits != hierarchy[0]->cl_bits || // cl_ids differ between levels
+           cache->set_index_function != SET_INDEX_MODULO || // sets do not nest
+           cache->replacement_policy_id == 3 || // RR: shared random number generator
+           cache->replacement_policy_id == 7 || // DRRIP: shared PSEL
+           cache->index.locations != NULL || // tag index is shared by all sets
+           cache->coherence != NULL || // directory is shared by all sets
+           cache->prefetcher != PREFETCH_NONE || // prefetches cross partitions
+           cache->sample_map != NULL || // sampled sets are not spread evenly over partitions
+           cache->tlb != NULL || // pages span all partitions
+           (cache->subblock_bitfield != NULL && // sets share bytes of the bitfield
+            cache->ways*cache->subblock_bits % CHAR_BIT != 0) ||
+           cache->verbosity > 0) { // output would be interleaved
+            return 1;
+        }
+        // gcd of all sets, partitions need to divide it
+        long a = sets_gcd, b = cache->sets;
+        while(b != 0) {
+            long t = a % b;
+            a = b;
+            b = t;
+        }
+        sets_gcd = a;
+    }
+    // Accesses spanning cachelines could only be split, which changes load and store counts
+    for(long long i=0; i<records_n; i++) {
+        if(records[i].length > 1 &&
+           Cache__get_cacheline_id(hierarchy[0], records[i].addr) !=
+           Cache__get_cacheline_id(hierarchy[0], records[i].addr+records[i].length-1)) {
+            return 1;
+        }
+    }
+    return sets_gcd;
+}
+
+typedef struct replay_partition {
+    Cache* caches; // copies of the hierarchy (first level first) with private stats
+    const access_record* records;
+    long long n;
+    unsigned long partition; // only records with cl_id % partitions == partition are replayed
+    unsigned long partitions;
+} replay_partition;
+
+static void* Cache__replay_partition(void* arg) {
+    replay_partition* part = (replay_partition*)arg;
+    Cache* first_level = &part->caches[0];
+    addr_range range;
+    for(long long i=0; i<part->n; i++) {
+        unsigned long cl_id = (unsigned long)Cache__get_cacheline_id(
+            first_level, part->records[i].addr);
+        if(cl_id % part->partitions != part->partition) {
+            continue;
+        }
+        range.addr = part->records[i].addr;
+        range.length = part->records[i].length;
+        if(part->records[i].op == ACCESS_STORE) {
+            Cache__store(first_level, range, part->records[i].non_temporal);
+        } else {
+            Cache__load(first_level, range);
+        }
+    }
+    return NULL;
+}
+
+static void* Cache__partition_link(Cache** hierarchy, Cache* copies, int n, void* link) {
+    // Returns the copy of link in copies
+    for(int i=0; i<n; i++) {
+        if((void*)hierarchy[i] == link) {
+            return &copies[i];
+        }
+    }
+    return NULL;
+}
+
+static void Cache__add_stats(struct stats* to, const struct stats* from) {
+    to->count += from->count;
+    to->byte += from->byte;
+}
+#endif
+
+int Cache__replay_parallel(Cache* self, const access_record* records, long long n, int threads) {
+    // Replays records with the same results as Cache__replay, but distributed over up to threads
+    // threads. Accesses to different sets never interact, so if every level's sets are a
+    // multiple of the number of partitions, each partition of cachelines only uses its own
+    // sets and can be simulated independently. Each thread works on copies of the caches,
+    // which share all placement and replacement state, but count their own stats. Stats are
+    // added to the caches afterwards. Returns the number of partitions used (1 if records were
+    // replayed serially, e.g., because of RR replacement or non-nesting sets).
+#ifdef CACHESIM_THREADS
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    int hierarchy_size = Cache__get_hierarchy(self, hierarchy, HIERARCHY_MAX_CACHES);
+    long max_partitions = threads > 1 ?
+        Cache__max_partitions(hierarchy, hierarchy_size, records, n) : 1;
+    long partitions = threads < max_partitions ? threads : max_partitions;
+    if(partitions < 1) {
+        partitions = 1; // serial replay for threads < 1
+    }
+    while(max_partitions % partitions != 0) {
+        partitions--;
+    }
+
+    replay_partition* parts = NULL;
+    Cache* caches = NULL;
+    pthread_t* thread_ids = NULL;
+    if(partitions > 1) {
+        // Called without the GIL, thus the Python allocator may not be used
+        parts = malloc(partitions*sizeof(replay_partition));
+        caches = malloc(partitions*hierarchy_size*sizeof(Cache));
+        thread_ids = malloc(partitions*sizeof(pthread_t));
+    }
+    if(parts == NULL || caches == NULL || thread_ids == NULL) {
+        free(parts);
+        free(caches);
+        free(thread_ids);
+        Cache__replay(self, records, n);
+        return 1;
+    }
+
+    for(long p=0; p<partitions; p++) {
+        Cache* copies = &caches[p*hierarchy_size];
+        for(int i=0; i<hierarchy_size; i++) {
+            copies[i] = *hierarchy[i];
+            memset(&copies[i].LOAD, 0, sizeof(struct stats));
+            memset(&copies[i].STORE, 0, sizeof(struct stats));
+            memset(&copies[i].HIT, 0, sizeof(struct stats));
+            memset(&copies[i].MISS, 0, sizeof(struct stats));
+            memset(&copies[i].EVICT, 0, sizeof(struct stats));
+            copies[i].load_from = Cache__partition_link(
+                hierarchy, copies, hierarchy_size, hierarchy[i]->load_from);
+            copies[i].store_to = Cache__partition_link(
+                hierarchy, copies, hierarchy_size, hierarchy[i]->store_to);
+            copies[i].victims_to = Cache__partition_link(
+                hierarchy, copies, hierarchy_size, hierarchy[i]->victims_to);
+        }
+        parts[p].caches = copies;
+        parts[p].records = records;
+        parts[p].n = n;
+        parts[p].partition = (unsigned long)p;
+        parts[p].partitions = (unsigned long)partitions;
+    }
+
+    // Partition 0 is replayed by the calling thread, partitions without a thread as well
+    int* started = calloc(partitions, sizeof(int));
+    for(long p=1; started != NULL && p<partitions; p++) {
+        started[p] = pthread_create(
+            &thread_ids[p], NULL, Cache__replay_partition, &parts[p]) == 0;
+    }
+    Cache__replay_partition(&parts[0]);
+    for(long p=1; p<partitions; p++) {
+        if(started != NULL && started[p]) {
+            pthread_join(thread_ids[p], NULL);
+        } else {
+            Cache__replay_partition(&parts[p]);
+        }
+    }
+
+    for(long p=0; p<partitions; p++) {
+        for(int i=0; i<hierarchy_size; i++) {
+            Cache__add_stats(&hierarchy[i]->LOAD, &parts[p].caches[i].LOAD);
+            Cache__add_stats(&hierarchy[i]->STORE, &parts[p].caches[i].STORE);
+            Cache__add_stats(&hierarchy[i]->HIT, &parts[p].caches[i].HIT);
+            Cache__add_stats(&hierarchy[i]->MISS, &parts[p].caches[i].MISS);
+            Cache__add_stats(&hierarchy[i]->EVICT, &parts[p].caches[i].EVICT);
+        }
+    }
+    free(started);
+    free(parts);
+    free(caches);
+    free(thread_ids);
+    return (int)partitions;
+#else
+    Cache__replay(self, records, n);
+    return 1;
+#endif
+}
+
+/*
+Binary trace files: a 16 byte header (TRACE_MAGIC, the version and the number of records as 64
+bit little endian integer) followed by blocks of up to TRACE_BLOCK_RECORDS records. Address
+and length start from 0 in every block, so blocks can be decoded independently.
+
+With TRACE_VERSION_DELTA, each block starts with its number of records and payload bytes (32
+bit little endian integers) and TRACE_FLAG_* of all records (4 bits per record, the first
+record in the low bits). The payload holds per record the difference to the previous address
+(zigzag encoded) as varint (7 bits per byte, least significant first) and, if
+TRACE_FLAG_LENGTH is set, the length as varint.
+
+With TRACE_VERSION_RLE, the block header holds the number of records and payload bytes and a
+lag (1 to TRACE_RLE_MAX_LAG byte), records are predicted from the record lag positions before
+(which is also the base of the address difference): a record with the same op, non_temporal
+flag and length as that record, and an address difference equal to the one of that record, is
+predicted. Runs of predicted records are stored as varint (run << 1 | 1), all other records as
+varint (TRACE_FLAG_* << 1), followed by the zigzag encoded address difference and, with
+TRACE_FLAG_LENGTH, the length. Interleaved streams thus take a few bytes per block. The blocks
+are followed by an index with the file offset of each block (64 bit little endian) and a
+footer with the offset of the index, the number of blocks and TRACE_INDEX_MAGIC.
+*/
+
+static void trace__put_u32(unsigned char* p, unsigned long value) {
+    for(int i=0; i<4; i++) {
+        p[i] = (unsigned char)(value >> 8*i);
+    }
+}
+
+static unsigned long trace__get_u32(const unsigned char* p) {
+    return (unsigned long)p[0] | (unsigned long)p[1] << 8 | (unsigned long)p[2] << 16 |
+           (unsigned long)p[3] << 24;
+}
+
+static void trace__put_u64(unsigned char* p, unsigned long long value) {
+    trace__put_u32(p, (unsigned long)(value & 0xffffffffUL));
+    trace__put_u32(p+4, (unsigned long)(value >> 32));
+}
+
+static unsigned long long trace__get_u64(const unsigned char* p) {
+    return (unsigned long long)trace__get_u32(p) | (unsigned long long)trace__get_u32(p+4) << 32;
+}
+
+static unsigned char* trace__put_varint(unsigned char* p, unsigned long long value) {
+    while(value >= 0x80) {
+        *p++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (unsigned char)value;
+    return p;
+}
+
+static inline const unsigned char* trace__get_varint(
+        const unsigned char* p, const unsigned char* end, unsigned long long* value) {
+    // Returns the position after the varint at p, NULL if it is truncated or too long
+    if(p < end && *p < 0x80) {
+        *value = *p;
+        return p+1;
+    }
+    unsigned long long v = 0;
+    for(int shift=0; p < end && shift < 64; shift += 7) {
+        unsigned char byte = *p++;
+        v |= (unsigned long long)(byte & 0x7f) << shift;
+        if(byte < 0x80) {
+            *value = v;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static inline unsigned long long trace__zigzag(unsigned long long delta) {
+    return delta << 1 ^ (0 - (delta >> 63));
+}
+
+static inline unsigned long long trace__unzigzag(unsigned long long value) {
+    return value >> 1 ^ (0 - (value & 1));
+}
+
+static inline int trace__op_flags(const access_record* record) {
+    if(record->op != ACCESS_STORE) {
+        return 0;
+    }
+    return TRACE_FLAG_STORE | (record->non_temporal ? TRACE_FLAG_NON_TEMPORAL : 0);
+}
+
+static inline void trace__set_op(access_record* record, int flags) {
+    record->op = flags & TRACE_FLAG_STORE ? ACCESS_STORE : ACCESS_LOAD;
+    record->non_temporal = (flags & TRACE_FLAG_NON_TEMPORAL) != 0;
+    record->reserved[0] = record->reserved[1] = 0;
+}
+
+static long trace__encode_delta_block(const access_record* records, int n, unsigned char* block) {
+    // Encodes n records into block (at least TRACE_BLOCK_MAX_SIZE bytes), returns its size
+    unsigned char* flags = block + 8;
+    unsigned char* p = flags + (n+1)/2;
+    memset(flags, 0, (n+1)/2);
+    unsigned long long prev_addr = 0;
+    unsigned long prev_length = 0;
+    for(int i=0; i<n; i++) {
+        int flag = trace__op_flags(&records[i]);
+        if(records[i].length != prev_length) {
+            flag |= TRACE_FLAG_LENGTH;
+        }
+        flags[i/2] |= flag << 4*(i%2);
+        p = trace__put_varint(p, trace__zigzag((unsigned long long)records[i].addr - prev_addr));
+        if(flag & TRACE_FLAG_LENGTH) {
+            p = trace__put_varint(p, records[i].length);
+        }
+        prev_addr = (unsigned long long)records[i].addr;
+        prev_length = records[i].length;
+    }
+    trace__put_u32(block, (unsigned long)n);
+    trace__put_u32(block+4, (unsigned long)(p - (flags + (n+1)/2)));
+    return (long)(p - block);
+}
+
+static long trace__encode_rle_block(
+        const access_record* records, int n, int lag, unsigned char* block) {
+    // Encodes n records predicted from the record lag positions before into block (at least
+    // TRACE_BLOCK_MAX_SIZE bytes), returns its size
+    unsigned char* p = block + TRACE_BLOCK_HEADER_SIZE(TRACE_VERSION_RLE, n);
+    unsigned long long run = 0;
+    for(int i=0; i<n; i++) {
+        const access_record* record = &records[i];
+        const access_record* base = i >= lag ? &records[i-lag] : NULL;
+        unsigned long long delta = (unsigned long long)record->addr -
+                                   (base != NULL ? (unsigned long long)base->addr : 0);
+        int flags = trace__op_flags(record);
+        if(base != NULL && flags == trace__op_flags(base) && record->length == base->length &&
+           delta == (unsigned long long)base->addr -
+                    (i >= 2*lag ? (unsigned long long)records[i-2*lag].addr : 0)) {
+            run++;
+            continue;
+        }
+        if(run > 0) {
+            p = trace__put_varint(p, run << 1 | 1);
+            run = 0;
+        }
+        if(record->length != (base != NULL ? base->length : 0)) {
+            flags |= TRACE_FLAG_LENGTH;
+        }
+        p = trace__put_varint(p, (unsigned long long)flags << 1);
+        p = trace__put_varint(p, trace__zigzag(delta));
+        if(flags & TRACE_FLAG_LENGTH) {
+            p = trace__put_varint(p, record->length);
+        }
+    }
+    if(run > 0) {
+        p = trace__put_varint(p, run << 1 | 1);
+    }
+    trace__put_u32(block, (unsigned long)n);
+    trace__put_u32(block+4, (unsigned long)(
+        p - block - TRACE_BLOCK_HEADER_SIZE(TRACE_VERSION_RLE, n)));
+    block[8] = (unsigned char)lag;
+    return (long)(p - block);
+}
+
+static int trace__best_lag(const access_record* records, int n) {
+    // Returns the lag which predicts most of the n records (see trace__encode_rle_block)
+    int best_lag = 1;
+    int best_predicted = -1;
+    for(int lag=1; lag<=TRACE_RLE_MAX_LAG; lag++) {
+        int predicted = 0;
+        for(int i=lag; i<n; i++) {
+            const access_record* base = &records[i-lag];
+            unsigned long long base_delta = (unsigned long long)base->addr -
+                (i >= 2*lag ? (unsigned long long)records[i-2*lag].addr : 0);
+            // Without branches, they are mispredicted on irregular traces
+            predicted += (records[i].length == base->length) &
+                         (records[i].op == base->op) &
+                         (records[i].non_temporal == base->non_temporal) &
+                         ((unsigned long long)records[i].addr - base_delta ==
+                          (unsigned long long)base->addr);
+        }
+        if(predicted > best_predicted) {
+            best_lag = lag;
+            best_predicted = predicted;
+        }
+    }
+    return best_lag;
+}
+
+static int trace__block_size(const unsigned char* block, int version, size_t* size) {
+    // Sets size of the block (header and payload) from its first 8 bytes, returns its number of
+    // records or TRACE_ERROR_FORMAT if they are invalid
+    unsigned long n = trace__get_u32(block);
+    unsigned long payload = trace__get_u32(block+4);
+    if(n < 1 || n > TRACE_BLOCK_RECORDS ||
+       payload > TRACE_BLOCK_MAX_SIZE - TRACE_BLOCK_HEADER_SIZE(version, n)) {
+        return TRACE_ERROR_FORMAT;
+    }
+    *size = TRACE_BLOCK_HEADER_SIZE(version, n) + payload;
+    return (int)n;
+}
+
+static int trace__decode_delta_block(
+        const unsigned char* block, size_t size, access_record* records) {
+    // Decodes the block of size bytes (as checked by trace__block_size) into records, returns
+    // the number of records or TRACE_ERROR_FORMAT
+    int n = (int)trace__get_u32(block);
+    const unsigned char* flags = block + 8;
+    const unsigned char* p = flags + (n+1)/2;
+    const unsigned char* end = block + size;
+    unsigned long long addr = 0, length = 0, value;
+    for(int i=0; i<n; i++) {
+        int flag = flags[i/2] >> 4*(i%2) & 0xf;
+        p = trace__get_varint(p, end, &value);
+        if(p == NULL) {
+            return TRACE_ERROR_FORMAT;
+        }
+        addr += trace__unzigzag(value);
+        if(flag & TRACE_FLAG_LENGTH) {
+            p = trace__get_varint(p, end, &length);
+            if(p == NULL || length > UINT_MAX) {
+                return TRACE_ERROR_FORMAT;
+            }
+        }
+        records[i].addr = (long long)addr;
+        records[i].length = (unsigned int)length;
+        trace__set_op(&records[i], flag);
+    }
+    return p == end ? n : TRACE_ERROR_FORMAT;
+}
+
+static int trace__decode_rle_block(
+        const unsigned char* block, size_t size, access_record* records) {
+    // Decodes the block of size bytes (as checked by trace__block_size) into records, returns
+    // the number of records or TRACE_ERROR_FORMAT
+    int n = (int)trace__get_u32(block);
+    int lag = block[8];
+    const unsigned char* p = block + TRACE_BLOCK_HEADER_SIZE(TRACE_VERSION_RLE, n);
+    const unsigned char* end = block + size;
+    unsigned long long value;
+    if(lag < 1 || lag > TRACE_RLE_MAX_LAG) {
+        return TRACE_ERROR_FORMAT;
+    }
+    for(int i=0; i<n;) {
+        p = trace__get_varint(p, end, &value);
+        if(p == NULL) {
+            return TRACE_ERROR_FORMAT;
+        }
+        if(value & 1) {
+            // Run of predicted records
+            unsigned long long run = value >> 1;
+            if(i < lag || run < 1 || run > (unsigned long long)(n-i)) {
+                return TRACE_ERROR_FORMAT;
+            }
+            for(int last=i+(int)run; i<last; i++) {
+                unsigned long long base = (unsigned long long)records[i-lag].addr;
+                records[i] = records[i-lag];
+                records[i].addr = (long long)(
+                    2*base - (i >= 2*lag ? (unsigned long long)records[i-2*lag].addr : 0));
+            }
+            continue;
+        }
+        int flags = (int)(value >> 1);
+        unsigned long long delta, length = i >= lag ? records[i-lag].length : 0;
+        p = flags <= 7 ? trace__get_varint(p, end, &delta) : NULL;
+        if(p != NULL && flags & TRACE_FLAG_LENGTH) {
+            p = trace__get_varint(p, end, &length);
+        }
+        if(p == NULL || length > UINT_MAX) {
+            return TRACE_ERROR_FORMAT;
+        }
+        records[i].addr = (long long)(
+            (i >= lag ? (unsigned long long)records[i-lag].addr : 0) + trace__unzigzag(delta));
+        records[i].length = (unsigned int)length;
+        trace__set_op(&records[i], flags);
+        i++;
+    }
+    return p == end ? n : TRACE_ERROR_FORMAT;
+}
+
+static int trace__decode_block(
+        const unsigned char* block, size_t size, int version, access_record* records) {
+    if(version == TRACE_VERSION_RLE) {
+        return trace__decode_rle_block(block, size, records);
+    }
+    return trace__decode_delta_block(block, size, records);
+}
+
+static int trace__write_header(FILE* file, int version, long long records) {
+    unsigned char header[TRACE_HEADER_SIZE];
+    memcpy(header, TRACE_MAGIC, 7);
+    header[7] = (unsigned char)version;
+    trace__put_u64(header+8, (unsigned long long)records);
+    return fwrite(header, TRACE_HEADER_SIZE, 1, file) == 1 ? 0 : TRACE_ERROR_IO;
+}
+
+int trace_writer__open(trace_writer* self, const char* path, int version) {
+    // Creates (or truncates) the trace file at path, with blocks encoded as given by version
+    // (TRACE_VERSION_DELTA or TRACE_VERSION_RLE). Returns 0, TRACE_ERROR_IO or
+    // TRACE_ERROR_FORMAT if version is neither.
+    memset(self, 0, sizeof(trace_writer));
+    if(version != TRACE_VERSION_DELTA && version != TRACE_VERSION_RLE) {
+        return TRACE_ERROR_FORMAT;
+    }
+    self->version = version;
+    self->pending = malloc(TRACE_BLOCK_RECORDS*sizeof(access_record));
+    self->block = malloc(TRACE_BLOCK_MAX_SIZE);
+    if(self->pending != NULL && self->block != NULL) {
+        self->file = fopen(path, "wb");
+    }
+    if(self->file == NULL || trace__write_header(self->file, self->version, 0) != 0) {
+        if(self->file != NULL) {
+            fclose(self->file);
+        }
+        free(self->pending);
+        free(self->block);
+        memset(self, 0, sizeof(trace_writer));
+        return TRACE_ERROR_IO;
+    }
+    self->offset = TRACE_HEADER_SIZE;
+    return 0;
+}
+
+static int trace_writer__flush(trace_writer* self) {
+    if(self->pending_count == 0) {
+        return 0;
+    }
+    long size;
+    if(self->version == TRACE_VERSION_RLE) {
+        size = trace__encode_rle_block(
+            self->pending, self->pending_count,
+            trace__best_lag(self->pending, self->pending_count), self->block);
+        if(self->blocks == self->blocks_capacity) {
+            long long capacity = self->blocks_capacity > 0 ? 2*self->blocks_capacity : 1024;
+            long long* offsets = realloc(self->offsets, capacity*sizeof(long long));
+            if(offsets == NULL) {
+                return TRACE_ERROR_IO;
+            }
+            self->offsets = offsets;
+            self->blocks_capacity = capacity;
+        }
+        self->offsets[self->blocks++] = self->offset;
+    } else {
+        size = trace__encode_delta_block(self->pending, self->pending_count, self->block);
+    }
+    self->pending_count = 0;
+    self->offset += size;
+    return fwrite(self->block, size, 1, self->file) == 1 ? 0 : TRACE_ERROR_IO;
+}
+
+int trace_writer__write(trace_writer* self, const access_record* record) {
+    // Appends record to the trace, returns 0 or TRACE_ERROR_IO
+    self->pending[self->pending_count++] = *record;
+    self->records++;
+    if(self->pending_count == TRACE_BLOCK_RECORDS) {
+        return trace_writer__flush(self);
+    }
+    return 0;
+}
+
+static int trace_writer__write_index(trace_writer* self) {
+    unsigned char entry[TRACE_FOOTER_SIZE];
+    for(long long i=0; i<self->blocks; i++) {
+        trace__put_u64(entry, (unsigned long long)self->offsets[i]);
+        if(fwrite(entry, 8, 1, self->file) != 1) {
+            return TRACE_ERROR_IO;
+        }
+    }
+    trace__put_u64(entry, (unsigned long long)self->offset);
+    trace__put_u64(entry+8, (unsigned long long)self->blocks);
+    memcpy(entry+16, TRACE_INDEX_MAGIC, 7);
+    entry[23] = (unsigned char)self->version;
+    return fwrite(entry, TRACE_FOOTER_SIZE, 1, self->file) == 1 ? 0 : TRACE_ERROR_IO;
+}
+
+int trace_writer__close(trace_writer* self) {
+    // Writes pending records, the index and the number of records to the header, closes the
+    // file. Returns 0 or TRACE_ERROR_IO.
+    if(self->file == NULL) {
+        return TRACE_ERROR_IO;
+    }
+    int error = trace_writer__flush(self);
+    if(error == 0 && self->version == TRACE_VERSION_RLE) {
+        error = trace_writer__write_index(self);
+    }
+    if(error == 0 && (fseek(self->file, 0, SEEK_SET) != 0 ||
+                      trace__write_header(self->file, self->version, self->records) != 0)) {
+        error = TRACE_ERROR_IO;
+    }
+    if(fclose(self->file) != 0) {
+        error = TRACE_ERROR_IO;
+    }
+    free(self->pending);
+    free(self->block);
+    free(self->offsets);
+    memset(self, 0, sizeof(trace_writer));
+    return error;
+}
+
+static int trace_reader__read_footer(trace_reader* self, const unsigned char* footer) {
+    // Sets end (and index, if the file is mapped) from the footer of a file of self->size
+    // bytes. Returns 0 or TRACE_ERROR_FORMAT if the footer is missing (e.g., the file has been
+    // truncated or its writer was interrupted) or invalid.
+    self->end = self->size;
+    if(self->size < TRACE_HEADER_SIZE + TRACE_FOOTER_SIZE ||
+       memcmp(footer+16, TRACE_INDEX_MAGIC, 7) != 0 || footer[23] != self->version) {
+        return TRACE_ERROR_FORMAT;
+    }
+    unsigned long long index = trace__get_u64(footer);
+    unsigned long long blocks = trace__get_u64(footer+8);
+    if(index < TRACE_HEADER_SIZE || blocks > (self->size - TRACE_FOOTER_SIZE) / 8 ||
+       index != self->size - TRACE_FOOTER_SIZE - 8*blocks) {
+        return TRACE_ERROR_FORMAT;
+    }
+    self->end = (size_t)index;
+    if(self->data != NULL) {
+        self->index = self->data + index;
+        self->blocks = (long long)blocks;
+    }
+    return 0;
+}
+
+int trace_reader__open(trace_reader* self, const char* path) {
+    // Opens the trace file at path, which is mapped into memory if possible (and read
+    // block-wise otherwise). Returns 0, TRACE_ERROR_IO or TRACE_ERROR_FORMAT.
+    memset(self, 0, sizeof(trace_reader));
+    unsigned char header[TRACE_HEADER_SIZE];
+    unsigned char footer[TRACE_FOOTER_SIZE];
+#ifdef CACHESIM_MMAP
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd == -1) {
+        return TRACE_ERROR_IO;
+    }
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        return TRACE_ERROR_IO;
+    }
+    if(st.st_size >= TRACE_HEADER_SIZE) {
+        void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED) {
+            madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+            self->data = (const unsigned char*)data;
+            self->size = (size_t)st.st_size;
+            memcpy(header, self->data, TRACE_HEADER_SIZE);
+            if(self->size >= TRACE_HEADER_SIZE + TRACE_FOOTER_SIZE) {
+                memcpy(footer, self->data + self->size - TRACE_FOOTER_SIZE, TRACE_FOOTER_SIZE);
+            }
+        }
+    }
+    close(fd);
+#endif
+    if(self->data == NULL) {
+        self->file = fopen(path, "rb");
+        if(self->file == NULL) {
+            return TRACE_ERROR_IO;
+        }
+        self->block = malloc(TRACE_BLOCK_MAX_SIZE);
+        long size = -1;
+        if(self->block == NULL || fread(header, TRACE_HEADER_SIZE, 1, self->file) != 1) {
+            trace_reader__close(self);
+            return self->block == NULL ? TRACE_ERROR_IO : TRACE_ERROR_FORMAT;
+        }
+        // Footer can only be read from seekable files, others are read until their end
+        if(fseek(self->file, 0, SEEK_END) == 0 && (size = ftell(self->file)) >= 0) {
+            self->size = (size_t)size;
+            if(self->size < TRACE_HEADER_SIZE + TRACE_FOOTER_SIZE ||
+               fseek(self->file, -TRACE_FOOTER_SIZE, SEEK_END) != 0 ||
+               fread(footer, TRACE_FOOTER_SIZE, 1, self->file) != 1) {
+                memset(footer, 0, TRACE_FOOTER_SIZE);
+            }
+            if(fseek(self->file, TRACE_HEADER_SIZE, SEEK_SET) != 0) {
+                trace_reader__close(self);
+                return TRACE_ERROR_IO;
+            }
+        } else {
+            self->size = (size_t)-1;
+            memset(footer, 0, TRACE_FOOTER_SIZE);
+        }
+    }
+    self->version = header[7];
+    if(memcmp(header, TRACE_MAGIC, 7) != 0 ||
+       (self->version != TRACE_VERSION_DELTA && self->version != TRACE_VERSION_RLE)) {
+        trace_reader__close(self);
+        return TRACE_ERROR_FORMAT;
+    }
+    self->records = (long long)trace__get_u64(header+8);
+    self->offset = TRACE_HEADER_SIZE;
+    self->end = self->size;
+    // TRACE_VERSION_RLE files end with the index, which can only be found in seekable files
+    if(self->version == TRACE_VERSION_RLE && self->size != (size_t)-1 &&
+       trace_reader__read_footer(self, footer) != 0) {
+        trace_reader__close(self);
+        return TRACE_ERROR_FORMAT;
+    }
+    // Each block holds at most TRACE_BLOCK_RECORDS records in at least one payload byte, so a
+    // larger number of records in the header cannot be right (and must not be allocated)
+    if(self->records < 0 || (self->size != (size_t)-1 && (unsigned long long)self->records >
+       (unsigned long long)(self->end - TRACE_HEADER_SIZE) /
+       (TRACE_BLOCK_HEADER_SIZE(self->version, 1) + 1) * TRACE_BLOCK_RECORDS)) {
+        trace_reader__close(self);
+        return TRACE_ERROR_FORMAT;
+    }
+    return 0;
+}
+
+static int trace_reader__finish(const trace_reader* self) {
+    // Returns 0 at the end of a trace, if all records of its header have been read, and
+    // TRACE_ERROR_FORMAT if the file has been truncated (e.g., at a block boundary)
+    return self->decoded == self->records ? 0 : TRACE_ERROR_FORMAT;
+}
+
+int trace_reader__next(trace_reader* self, access_record* records) {
+    // Decodes the next block into records (room for TRACE_BLOCK_RECORDS), returns the number
+    // of records, 0 at the end of the trace or TRACE_ERROR_IO/TRACE_ERROR_FORMAT
+    const unsigned char* block;
+    size_t size;
+    int n;
+    if(self->offset == self->end ||
+       (self->end == (size_t)-1 && self->decoded == self->records)) {
+        // The index of a file which cannot be seeked is not read
+        return trace_reader__finish(self);
+    }
+    if(self->data != NULL) {
+        block = self->data + self->offset;
+        if(self->end - self->offset < 8) {
+            return TRACE_ERROR_FORMAT;
+        }
+        n = trace__block_size(block, self->version, &size);
+        if(n < 0 || self->end - self->offset < size) {
+            return TRACE_ERROR_FORMAT;
+        }
+    } else {
+        size_t read = fread(self->block, 1, 8, self->file);
+        if(read == 0 && feof(self->file) && self->end == (size_t)-1) {
+            return trace_reader__finish(self);
+        }
+        if(read < 8) {
+            return ferror(self->file) ? TRACE_ERROR_IO : TRACE_ERROR_FORMAT;
+        }
+        n = trace__block_size(self->block, self->version, &size);
+        if(n < 0 || self->end - self->offset < size) {
+            return TRACE_ERROR_FORMAT;
+        }
+        if(fread(self->block+8, 1, size-8, self->file) != size-8) {
+            return ferror(self->file) ? TRACE_ERROR_IO : TRACE_ERROR_FORMAT;
+        }
+        block = self->block;
+    }
+    if(n > self->records - self->decoded) {
+        return TRACE_ERROR_FORMAT;
+    }
+    self->offset += size;
+    self->decoded += n;
+    return trace__decode_block(block, size, self->version, records);
+}
+
+static int trace_reader__skip(trace_reader* self, long long max_records) {
+    // Skips the next block without decoding it, if it has at most max_records records. Returns
+    // the number of records skipped, 0 if the block is read with stdio or needs to be decoded.
+    size_t size;
+    if(self->data == NULL || self->end - self->offset < 8) {
+        return 0;
+    }
+    int n = trace__block_size(self->data + self->offset, self->version, &size);
+    if(n <= 0 || n > max_records || n > self->records - self->decoded ||
+       self->end - self->offset < size) {
+        return 0;
+    }
+    self->offset += size;
+    self->decoded += n;
+    return n;
+}
+
+int trace_reader__decode(const trace_reader* self, long long block, access_record* records) {
+    // Decodes block (0 to self->blocks-1) of a mapped file with index into records (room for
+    // TRACE_BLOCK_RECORDS). Does not change self, so blocks can be decoded concurrently.
+    // Returns the number of records or TRACE_ERROR_FORMAT.
+    if(self->index == NULL || block < 0 || block >= self->blocks) {
+        return TRACE_ERROR_FORMAT;
+    }
+    unsigned long long offset = trace__get_u64(self->index + 8*block);
+    size_t size;
+    if(offset < TRACE_HEADER_SIZE || offset > self->end || self->end - offset < 8) {
+        return TRACE_ERROR_FORMAT;
+    }
+    int n = trace__block_size(self->data + offset, self->version, &size);
+    if(n < 0 || self->end - offset < size) {
+        return TRACE_ERROR_FORMAT;
+    }
+    return trace__decode_block(self->data + offset, size, self->version, records);
+}
+
+void trace_reader__close(trace_reader* self) {
+#ifdef CACHESIM_MMAP
+    if(self->data != NULL) {
+        munmap((void*)self->data, self->size);
+    }
+#endif
+    if(self->file != NULL) {
+        fclose(self->file);
+    }
+    free(self->block);
+    memset(self, 0, sizeof(trace_reader));
+}
+
+#ifdef CACHESIM_THREADS
+typedef struct trace_pipeline {
+    // Decoder threads decode the blocks of an indexed trace in order into a ring of slots,
+    // ahead of the thread replaying them. Block b uses slot b % slots, so at most slots blocks
+    // are decoded but not yet replayed.
+    const trace_reader* reader;
+    access_record* records; // TRACE_BLOCK_RECORDS per slot
+    int* counts; // records decoded into each slot (or TRACE_ERROR_FORMAT)
+    long long* slot_blocks; // block decoded into each slot, -1 if none yet
+    int slots;
+    long long next; // next block to be decoded
+    long long replayed; // number of blocks replayed, their slots may be reused
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t decoded;
+    pthread_cond_t released;
+} trace_pipeline;
+
+static void* trace_pipeline__decode(void* arg) {
+    trace_pipeline* self = (trace_pipeline*)arg;
+    pthread_mutex_lock(&self->lock);
+    while(!self->stop && self->next < self->reader->blocks) {
+        long long block = self->next++;
+        int slot = (int)(block % self->slots);
+        while(!self->stop && block >= self->replayed + self->slots) {
+            pthread_cond_wait(&self->released, &self->lock);
+        }
+        if(self->stop) {
+            break;
+        }
+        pthread_mutex_unlock(&self->lock);
+        int n = trace_reader__decode(
+            self->reader, block, &self->records[(long long)slot*TRACE_BLOCK_RECORDS]);
+        pthread_mutex_lock(&self->lock);
+        self->counts[slot] = n;
+        self->slot_blocks[slot] = block;
+        pthread_cond_broadcast(&self->decoded);
+    }
+    pthread_mutex_unlock(&self->lock);
+    return NULL;
+}
+
+static long long Cache__replay_pipelined(Cache* self, const trace_reader* reader, int threads) {
+    // Replays all blocks of reader, decoded by up to threads threads. Returns the number of
+    // records replayed, TRACE_ERROR_FORMAT or TRACE_ERROR_IO if no thread could be started.
+    trace_pipeline pipeline;
+    memset(&pipeline, 0, sizeof(trace_pipeline));
+    pipeline.reader = reader;
+    pipeline.slots = threads*TRACE_PIPELINE_SLOTS_PER_THREAD;
+    pipeline.records = malloc(
+        (size_t)pipeline.slots*TRACE_BLOCK_RECORDS*sizeof(access_record));
+    pipeline.counts = malloc(pipeline.slots*sizeof(int));
+    pipeline.slot_blocks = malloc(pipeline.slots*sizeof(long long));
+    pthread_t* thread_ids = malloc(threads*sizeof(pthread_t));
+    int started = 0;
+    if(pipeline.records != NULL && pipeline.counts != NULL && pipeline.slot_blocks != NULL &&
+       thread_ids != NULL) {
+        for(int i=0; i<pipeline.slots; i++) {
+            pipeline.slot_blocks[i] = -1;
+        }
+        pthread_mutex_init(&pipeline.lock, NULL);
+        pthread_cond_init(&pipeline.decoded, NULL);
+        pthread_cond_init(&pipeline.released, NULL);
+        while(started < threads && pthread_create(
+                &thread_ids[started], NULL, trace_pipeline__decode, &pipeline) == 0) {
+            started++;
+        }
+    }
+
+    long long replayed = started > 0 ? 0 : TRACE_ERROR_IO;
+    for(long long block=0; started > 0 && block<reader->blocks; block++) {
+        int slot = (int)(block % pipeline.slots);
+        pthread_mutex_lock(&pipeline.lock);
+        while(pipeline.slot_blocks[slot] != block) {
+            pthread_cond_wait(&pipeline.decoded, &pipeline.lock);
+        }
+        int n = pipeline.counts[slot];
+        pthread_mutex_unlock(&pipeline.lock);
+        if(n < 0 || n > reader->records - replayed) {
+            replayed = TRACE_ERROR_FORMAT;
+            break;
+        }
+        Cache__replay(self, &pipeline.records[(long long)slot*TRACE_BLOCK_RECORDS], n);
+        replayed += n;
+        pthread_mutex_lock(&pipeline.lock);
+        pipeline.replayed = block+1;
+        pthread_cond_broadcast(&pipeline.released);
+        pthread_mutex_unlock(&pipeline.lock);
+    }
+    if(replayed >= 0 && replayed != reader->records) {
+        // The header announces more records than the indexed blocks hold
+        replayed = TRACE_ERROR_FORMAT;
+    }
+
+    if(started > 0) {
+        pthread_mutex_lock(&pipeline.lock);
+        pipeline.stop = 1;
+        pthread_cond_broadcast(&pipeline.released);
+        pthread_mutex_unlock(&pipeline.lock);
+        for(int i=0; i<started; i++) {
+            pthread_join(thread_ids[i], NULL);
+        }
+    }
+    if(pipeline.records != NULL && pipeline.counts != NULL && pipeline.slot_blocks != NULL &&
+       thread_ids != NULL) {
+        pthread_mutex_destroy(&pipeline.lock);
+        pthread_cond_destroy(&pipeline.decoded);
+        pthread_cond_destroy(&pipeline.released);
+    }
+    free(pipeline.records);
+    free(pipeline.counts);
+    free(pipeline.slot_blocks);
+    free(thread_ids);
+    return replayed;
+}
+#endif
+
+long long Cache__replay_file(Cache* self, const char* path, int decode_threads) {
+    // Replays a trace file block by block, as written by trace_writer. With decode_threads > 0,
+    // blocks of indexed files (TRACE_VERSION_RLE) are decoded by as many background threads,
+    // ahead of the simulation. Otherwise they are decoded by the calling thread. Returns the
+    // number of records replayed or TRACE_ERROR_IO/TRACE_ERROR_FORMAT (records before a
+    // malformed block have been replayed).
+    trace_reader reader;
+    int n = trace_reader__open(&reader, path);
+    if(n != 0) {
+        return n;
+    }
+#ifdef CACHESIM_THREADS
+    if(decode_threads > 0 && reader.index != NULL) {
+        long long replayed = Cache__replay_pipelined(self, &reader, decode_threads);
+        if(replayed != TRACE_ERROR_IO) {
+            trace_reader__close(&reader);
+            return replayed;
+        }
+    }
+#endif
+    access_record* records = malloc(TRACE_BLOCK_RECORDS*sizeof(access_record));
+    if(records == NULL) {
+        trace_reader__close(&reader);
+        return TRACE_ERROR_IO;
+    }
+    long long replayed = 0;
+    while((n = trace_reader__next(&reader, records)) > 0) {
+        Cache__replay(self, records, n);
+        replayed += n;
+    }
+    free(records);
+    trace_reader__close(&reader);
+    return n < 0 ? n : replayed;
+}
+
+static void time_sampling__counts(const Cache* cache, long long* counts) {
+    // Current values of the extrapolated counts of cache
+    counts[0] = cache->HIT.count;
+    counts[1] = cache->MISS.count;
+    counts[2] = cache->EVICT.count;
+}
+
+static long long time_sampling__warming_start(const time_sampling* self) {
+    // Position within a period of the first warmed record (records before are fast-forwarded)
+    long long detailed_start = self->period - self->detailed;
+    if(self->warming < 0 || self->warming > detailed_start) {
+        return 0;
+    }
+    return detailed_start - self->warming;
+}
+
+int time_sampling__init(time_sampling* self, Cache* first_level, long long period,
+                        long long detailed, long long warming) {
+    // Prepares time sampling of the hierarchy of first_level and resets all its stats, so they
+    // are the sums of all detailed windows replayed. Returns -1 if 1 <= detailed <= period or
+    // warming >= -1 does not hold.
+    if(period < 1 || detailed < 1 || detailed > period || warming < -1) {
+        return -1;
+    }
+    memset(self, 0, sizeof(time_sampling));
+    self->period = period;
+    self->detailed = detailed;
+    self->warming = warming;
+    self->caches = Cache__get_hierarchy(first_level, self->hierarchy, HIERARCHY_MAX_CACHES);
+    for(int i=0; i<self->caches; i++) {
+        Cache__reset_stats(self->hierarchy[i]);
+    }
+    return 0;
+}
+
+static void time_sampling__close_window(time_sampling* self) {
+    double records = (double)self->window_records;
+    for(int i=0; i<self->caches; i++) {
+        long long counts[TIME_SAMPLING_STATS];
+        time_sampling__counts(self->hierarchy[i], counts);
+        for(int k=0; k<TIME_SAMPLING_STATS; k++) {
+            double count = (double)(counts[k] - self->window_start[i][k]);
+            self->count_squares[i][k] += count*count;
+            self->count_records[i][k] += count*records;
+        }
+    }
+    self->window_sum += records;
+    self->window_squares += records*records;
+    self->windows++;
+    self->window_records = 0;
+}
+
+void time_sampling__replay(time_sampling* self, const access_record* records, long long n) {
+    // Replays records with time sampling, continuing at the position within the period the
+    // last call stopped at. Detailed windows are replayed with Cache__replay, warming records
+    // with the stats-free kernels of Cache__warm, fast-forwarded records are not touched.
+    long long detailed_start = self->period - self->detailed;
+    long long warming_start = time_sampling__warming_start(self);
+    long long done = 0;
+    while(done < n) {
+        long long phase = self->records % self->period;
+        long long count;
+        if(phase >= detailed_start) {
+            if(self->window_records == 0) {
+                for(int i=0; i<self->caches; i++) {
+                    time_sampling__counts(self->hierarchy[i], self->window_start[i]);
+                }
+            }
+            count = self->period - phase < n - done ? self->period - phase : n - done;
+            Cache__replay(self->hierarchy[0], records+done, count);
+            self->window_records += count;
+            if(phase + count == self->period) {
+                time_sampling__close_window(self);
+            }
+        } else if(phase >= warming_start) {
+            count = detailed_start - phase < n - done ? detailed_start - phase : n - done;
+            Cache__warm_hierarchy(self->hierarchy, self->caches, records+done, count);
+        } else {
+            count = warming_start - phase < n - done ? warming_start - phase : n - done;
+        }
+        done += count;
+        self->records += count;
+    }
+}
+
+long long time_sampling__replay_file(time_sampling* self, const char* path) {
+    // Replays a trace file (see Cache__replay_file) with time sampling. Blocks of mapped files
+    // which are fast-forwarded as a whole are skipped without decoding them. Returns the number
+    // of records seen or TRACE_ERROR_IO/TRACE_ERROR_FORMAT.
+    trace_reader reader;
+    int n = trace_reader__open(&reader, path);
+    if(n != 0) {
+        return n;
+    }
+    access_record* records = malloc(TRACE_BLOCK_RECORDS*sizeof(access_record));
+    if(records == NULL) {
+        trace_reader__close(&reader);
+        return TRACE_ERROR_IO;
+    }
+    long long warming_start = time_sampling__warming_start(self);
+    long long replayed = 0;
+    for(;;) {
+        long long phase = self->records % self->period;
+        n = 0;
+        if(phase < warming_start) {
+            n = trace_reader__skip(&reader, warming_start - phase);
+            self->records += n;
+        }
+        if(n == 0) {
+            n = trace_reader__next(&reader, records);
+            if(n <= 0) {
+                break;
+            }
+            time_sampling__replay(self, records, n);
+        }
+        replayed += n;
+    }
+    free(records);
+    trace_reader__close(&reader);
+    return n < 0 ? n : replayed;
+}
+
+int time_sampling__estimate(const time_sampling* self, const Cache* cache,
+                            time_sampling_estimate* estimate) {
+    // Extrapolates the counts of cache to all records seen, from the sums of its counts and of
+    // the records of all detailed windows, including an incomplete last one (ratio estimator,
+    // see Cache__estimate). Windows are a simple random sample without replacement of all
+    // periods, which holds approximately for systematic sampling of periods (R. E. Wunderlich,
+    // T. F. Wenisch, B. Falsafi, J. C. Hoe: SMARTS: Accelerating Microarchitecture Simulation
+    // via Rigorous Statistical Sampling, 2003). Returns -1 if cache is not part of the sampled
+    // hierarchy.
+    int c = 0;
+    while(c < self->caches && self->hierarchy[c] != cache) {
+        c++;
+    }
+    if(c == self->caches) {
+        return -1;
+    }
+    long long counts[TIME_SAMPLING_STATS];
+    time_sampling__counts(cache, counts);
+    double windows = (double)self->windows;
+    double window_sum = self->window_sum;
+    double window_squares = self->window_squares;
+    double records = (double)self->window_records;
+    if(self->window_records > 0) {
+        windows += 1;
+        window_sum += records;
+        window_squares += records*records;
+    }
+    for(int k=0; k<TIME_SAMPLING_STATS; k++) {
+        double count_squares = self->count_squares[c][k];
+        double count_records = self->count_records[c][k];
+        if(self->window_records > 0) {
+            double count = (double)(counts[k] - self->window_start[c][k]);
+            count_squares += count*count;
+            count_records += count*records;
+        }
+        if(window_sum == 0) {
+            estimate->counts[k] = 0.0;
+            estimate->errors[k] = self->records > 0 ? NAN : 0.0;
+            continue;
+        }
+        double ratio = counts[k] / window_sum;
+        estimate->counts[k] = counts[k]*(double)self->records / window_sum;
+        estimate->errors[k] = 0.0;
+        if(window_sum == self->records) {
+            continue;
+        }
+        if(windows < 2) {
+            estimate->errors[k] = NAN;
+            continue;
+        }
+        double residuals = count_squares - 2*ratio*count_records + ratio*ratio*window_squares;
+        double mean_records = window_sum / windows;
+        // Variance of ratio, with finite population correction
+        double variance = (1.0 - window_sum / self->records) / windows *
+            (residuals > 0 ? residuals : 0.0) / (windows-1) / (mean_records*mean_records);
+        estimate->errors[k] = 1.96*self->records*sqrt(variance);
+    }
+    return 0;
+}
+
+/*
+State of a cache (Cache__get_state): a cache_state with the configuration, stats and all scalar
+state, followed by all arrays (tags, dirty bits, replacement, prefetch and set sampling state,
+write-combining bits, tag index and PSEL samples). Every array starts at a multiple of
+STATE_ALIGNMENT, so states of all caches can be copied straight out of a mapped state file.
+*/
+#define CACHE_STATE_CONFIG 25
+#define CACHE_STATE_ARRAYS 14
+#define STATE_ALIGN(size) (((size) + STATE_ALIGNMENT-1) / STATE_ALIGNMENT * STATE_ALIGNMENT)
+
+typedef struct cache_state {
+    long long config[CACHE_STATE_CONFIG]; // see Cache__state_config, needs to match on restore
+    struct stats stats[CACHE_STATS];
+    long long psel;
+    long long bimodal_count;
+    long long leader_misses[2];
+    long long events;
+    long long samples_length;
+    long long prefetch_clock;
+    long long prefetch_trigger;
+    prefetch_stream prefetch_streams[PREFETCH_STREAMS];
+} cache_state;
+
+typedef struct state_array {
+    void* data;
+    size_t size; // in bytes
+} state_array;
+
+static void Cache__state_config(const Cache* self, long long* config) {
+    // Configuration which determines the layout and meaning of the state of self
+    long long values[CACHE_STATE_CONFIG] = {
+        self->sets, self->ways, self->cl_size, self->subblock_size, self->set_index_function,
+        self->slices, self->sampling, self->sampling_function, self->replacement_policy_id,
+        self->rrip_bits, self->write_back, self->write_allocate, self->write_combining,
+        self->prefetcher, self->index.locations != NULL ? (long long)self->index.mask+1 : 0,
+        self->dueling.leader_sets, self->dueling.psel_bits, self->dueling.follower,
+        self->dueling.sample_interval, self->rrip_insert, self->rrip_hit_promotion,
+        self->prefetch_distance, self->prefetch_degree, self->prefetch_latency,
+        self->swap_on_load};
+    memcpy(config, values, sizeof(values));
+}
+
+static int Cache__state_arrays(const Cache* self, long long samples_length,
+                               state_array* arrays) {
+    // Collects the arrays of the state of self (with samples_length PSEL samples) in
+    // arrays (room for CACHE_STATE_ARRAYS), returns their number
+    long entries = self->sampled_sets*self->ways;
+    state_array all[CACHE_STATE_ARRAYS] = {
+        {self->tags, entries*sizeof(long)},
+        {self->dirty_mask, self->sampled_sets*self->dirty_words*sizeof(unsigned long long)},
+        {self->recency_prev, self->recency_prev != NULL ? entries*sizeof(int) : 0},
+        {self->recency_next, self->recency_prev != NULL ? entries*sizeof(int) : 0},
+        {self->recency_head, self->recency_prev != NULL ? self->sampled_sets*sizeof(int) : 0},
+        {self->recency_tail, self->recency_prev != NULL ? self->sampled_sets*sizeof(int) : 0},
+        {self->policy_state,
+         (self->sampled_sets*self->policy_state_words+1)*sizeof(unsigned long long)},
+        {self->prefetched, self->prefetched != NULL ? entries*sizeof(long long) : 0},
+        {self->sample_loads, self->sample_map != NULL ? self->sampled_sets*sizeof(long long) : 0},
+        {self->sample_misses,
+         self->sample_map != NULL ? self->sampled_sets*sizeof(long long) : 0},
+        {self->subblock_bitfield, self->subblock_bitfield != NULL ?
+         BITNSLOTS(self->sets*self->ways*self->subblock_bits) : 0},
+        {self->index.cl_ids, self->index.locations != NULL ? (self->index.mask+1)*sizeof(long) : 0},
+        {self->index.locations,
+         self->index.locations != NULL ? (self->index.mask+1)*sizeof(long) : 0},
+        {self->dueling.samples, (size_t)samples_length*sizeof(int)}};
+    int n = 0;
+    for(int i=0; i<CACHE_STATE_ARRAYS; i++) {
+        if(all[i].size > 0) {
+            arrays[n++] = all[i];
+        }
+    }
+    return n;
+}
+
+size_t Cache__state_size(const Cache* self) {
+    // Returns the size of the state of self in bytes
+    state_array arrays[CACHE_STATE_ARRAYS];
+    int n = Cache__state_arrays(self, self->dueling.samples_length, arrays);
+    size_t size = STATE_ALIGN(sizeof(cache_state));
+    for(int i=0; i<n; i++) {
+        size += STATE_ALIGN(arrays[i].size);
+    }
+    return size;
+}
+
+void Cache__get_state(const Cache* self, void* state) {
+    // Writes the complete state of self (Cache__state_size bytes) to state, which can be
+    // restored into any cache with the same configuration with Cache__set_state
+    cache_state fixed;
+    memset(&fixed, 0, sizeof(cache_state));
+    Cache__state_config(self, fixed.config);
+    memcpy(fixed.stats, &self->LOAD, CACHE_STATS*sizeof(struct stats));
+    fixed.psel = self->dueling.psel;
+    fixed.bimodal_count = self->dueling.bimodal_count;
+    fixed.leader_misses[0] = self->dueling.leader_misses[0];
+    fixed.leader_misses[1] = self->dueling.leader_misses[1];
+    fixed.events = self->dueling.events;
+    fixed.samples_length = self->dueling.samples_length;
+    fixed.prefetch_clock = self->prefetch_clock;
+    fixed.prefetch_trigger = self->prefetch_trigger;
+    memcpy(fixed.prefetch_streams, self->prefetch_streams, sizeof(fixed.prefetch_streams));
+
+    unsigned char* p = (unsigned char*)state;
+    memset(p, 0, STATE_ALIGN(sizeof(cache_state)));
+    memcpy(p, &fixed, sizeof(cache_state));
+    p += STATE_ALIGN(sizeof(cache_state));
+    state_array arrays[CACHE_STATE_ARRAYS];
+    int n = Cache__state_arrays(self, self->dueling.samples_length, arrays);
+    for(int i=0; i<n; i++) {
+        memcpy(p, arrays[i].data, arrays[i].size);
+        memset(p + arrays[i].size, 0, STATE_ALIGN(arrays[i].size) - arrays[i].size);
+        p += STATE_ALIGN(arrays[i].size);
+    }
+}
+
+static int Cache__check_state(const Cache* self, const void* state, size_t size) {
+    // Returns 0 if state (size bytes) can be restored into self, STATE_ERROR_FORMAT or
+    // STATE_ERROR_MISMATCH otherwise
+    cache_state fixed;
+    long long config[CACHE_STATE_CONFIG];
+    if(size < STATE_ALIGN(sizeof(cache_state))) {
+        return STATE_ERROR_FORMAT;
+    }
+    memcpy(&fixed, state, sizeof(cache_state));
+    Cache__state_config(self, config);
+    if(memcmp(config, fixed.config, sizeof(config)) != 0 ||
+       self->coherence != NULL) { // the directory would not know the restored lines
+        return STATE_ERROR_MISMATCH;
+    }
+    if(fixed.samples_length < 0 || (size_t)fixed.samples_length > size/sizeof(int)) {
+        return STATE_ERROR_FORMAT;
+    }
+    state_array arrays[CACHE_STATE_ARRAYS];
+    int n = Cache__state_arrays(self, fixed.samples_length, arrays);
+    size_t expected = STATE_ALIGN(sizeof(cache_state));
+    for(int i=0; i<n; i++) {
+        expected += STATE_ALIGN(arrays[i].size);
+    }
+    return size == expected ? 0 : STATE_ERROR_FORMAT;
+}
+
+int Cache__set_state(Cache* self, const void* state, size_t size) {
+    // Restores a state written by Cache__get_state. Returns 0, STATE_ERROR_FORMAT,
+    // STATE_ERROR_MISMATCH (different configuration or part of a CoherenceDomain) or
+    // STATE_ERROR_IO (out of memory).
+    int error = Cache__check_state(self, state, size);
+    if(error != 0) {
+        return error;
+    }
+    cache_state fixed;
+    memcpy(&fixed, state, sizeof(cache_state));
+    if(fixed.samples_length > self->dueling.samples_capacity) {
+        int* samples = SAMPLES_REALLOC(self->dueling.samples, fixed.samples_length*sizeof(int));
+        if(samples == NULL) {
+            errno = ENOMEM;
+            return STATE_ERROR_IO;
+        }
+        self->dueling.samples = samples;
+        self->dueling.samples_capacity = fixed.samples_length;
+    }
+    memcpy(&self->LOAD, fixed.stats, CACHE_STATS*sizeof(struct stats));
+    self->dueling.psel = (int)fixed.psel;
+    self->dueling.bimodal_count = fixed.bimodal_count;
+    self->dueling.leader_misses[0] = fixed.leader_misses[0];
+    self->dueling.leader_misses[1] = fixed.leader_misses[1];
+    self->dueling.events = fixed.events;
+    self->dueling.samples_length = fixed.samples_length;
+    self->prefetch_clock = fixed.prefetch_clock;
+    self->prefetch_trigger = (long)fixed.prefetch_trigger;
+    memcpy(self->prefetch_streams, fixed.prefetch_streams, sizeof(fixed.prefetch_streams));
+
+    const unsigned char* p = (const unsigned char*)state + STATE_ALIGN(sizeof(cache_state));
+    state_array arrays[CACHE_STATE_ARRAYS];
+    int n = Cache__state_arrays(self, fixed.samples_length, arrays);
+    for(int i=0; i<n; i++) {
+        memcpy(arrays[i].data, p, arrays[i].size);
+        p += STATE_ALIGN(arrays[i].size);
+    }
+    return 0;
+}
+
+int Cache__save_state(Cache* self, const char* path) {
+    // Writes the state of all caches of the hierarchy of self to a state file: a header, the
+    // offset and size of the section of every cache (in Cache__get_hierarchy order) and the
+    // sections at multiples of STATE_ALIGNMENT. Returns 0 or STATE_ERROR_IO.
+    static const unsigned char zeros[STATE_ALIGNMENT];
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    long long table[2*HIERARCHY_MAX_CACHES];
+    int n = Cache__get_hierarchy(self, hierarchy, HIERARCHY_MAX_CACHES);
+    unsigned char header[STATE_HEADER_SIZE];
+    long long fields[3] = {STATE_BYTE_ORDER, n, (long long)sizeof(cache_state)};
+    memcpy(header, STATE_MAGIC, 7);
+    header[7] = STATE_VERSION;
+    memcpy(header+8, fields, sizeof(fields));
+
+    size_t offset = STATE_ALIGN(STATE_HEADER_SIZE + 2*n*sizeof(long long));
+    size_t max_size = 0;
+    for(int i=0; i<n; i++) {
+        size_t size = Cache__state_size(hierarchy[i]);
+        table[2*i] = (long long)offset;
+        table[2*i+1] = (long long)size;
+        offset += STATE_ALIGN(size);
+        max_size = size > max_size ? size : max_size;
+    }
+
+    FILE* file = fopen(path, "wb");
+    unsigned char* buffer = malloc(max_size);
+    int error = file == NULL || buffer == NULL ||
+        fwrite(header, STATE_HEADER_SIZE, 1, file) != 1 ||
+        fwrite(table, sizeof(long long), 2*n, file) != (size_t)2*n;
+    size_t written = STATE_HEADER_SIZE + 2*n*sizeof(long long);
+    for(int i=0; i<n && !error; i++) {
+        size_t padding = (size_t)table[2*i] - written;
+        Cache__get_state(hierarchy[i], buffer);
+        error = fwrite(zeros, 1, padding, file) != padding ||
+            fwrite(buffer, 1, (size_t)table[2*i+1], file) != (size_t)table[2*i+1];
+        written = (size_t)(table[2*i] + table[2*i+1]);
+    }
+    int saved_errno = errno;
+    free(buffer);
+    if(file != NULL && fclose(file) != 0) {
+        error = 1;
+        saved_errno = errno;
+    }
+    errno = buffer == NULL && file != NULL ? ENOMEM : saved_errno;
+    return error ? STATE_ERROR_IO : 0;
+}
+
+static unsigned char* state__read_file(const char* path, size_t* size, int* mapped) {
+    // Maps (or reads) the file at path into memory, returns NULL (with errno set) on error
+    unsigned char* data = NULL;
+    *mapped = 0;
+#ifdef CACHESIM_MMAP
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd == -1) {
+        return NULL;
+    }
+    if(fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping != MAP_FAILED) {
+            madvise(mapping, (size_t)st.st_size, MADV_SEQUENTIAL);
+            data = (unsigned char*)mapping;
+            *size = (size_t)st.st_size;
+            *mapped = 1;
+        }
+    }
+    close(fd);
+    if(data != NULL) {
+        return data;
+    }
+#endif
+    FILE* file = fopen(path, "rb");
+    long length = -1;
+    if(file == NULL) {
+        return NULL;
+    }
+    if(fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) >= 0 &&
+       fseek(file, 0, SEEK_SET) == 0) {
+        data = malloc(length > 0 ? (size_t)length : 1);
+        if(data != NULL && fread(data, 1, (size_t)length, file) != (size_t)length) {
+            free(data);
+            data = NULL;
+        }
+    }
+    int saved_errno = errno;
+    fclose(file);
+    errno = saved_errno;
+    *size = (size_t)length;
+    return data;
+}
+
+int Cache__restore_state(Cache* self, const char* path) {
+    // Restores all caches of the hierarchy of self from a file written by Cache__save_state
+    // for a hierarchy with the same structure and configurations. Nothing is restored if any
+    // cache does not match. Returns 0, STATE_ERROR_IO, STATE_ERROR_FORMAT or
+    // STATE_ERROR_MISMATCH.
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    long long table[2*HIERARCHY_MAX_CACHES];
+    long long fields[3];
+    int n = Cache__get_hierarchy(self, hierarchy, HIERARCHY_MAX_CACHES);
+    size_t size;
+    int mapped;
+    unsigned char* data = state__read_file(path, &size, &mapped);
+    if(data == NULL) {
+        return STATE_ERROR_IO;
+    }
+    int error = 0;
+    if(size < STATE_HEADER_SIZE || memcmp(data, STATE_MAGIC, 7) != 0 ||
+       data[7] != STATE_VERSION) {
+        error = STATE_ERROR_FORMAT;
+    } else {
+        memcpy(fields, data+8, sizeof(fields));
+        if(fields[0] != STATE_BYTE_ORDER || fields[2] != (long long)sizeof(cache_state)) {
+            error = STATE_ERROR_FORMAT; // other byte order or build
+        } else if(fields[1] != n) {
+            error = STATE_ERROR_MISMATCH;
+        } else if(size < STATE_HEADER_SIZE + 2*n*sizeof(long long)) {
+            error = STATE_ERROR_FORMAT;
+        }
+    }
+    if(error == 0) {
+        memcpy(table, data+STATE_HEADER_SIZE, 2*n*sizeof(long long));
+    }
+    for(int i=0; i<n && error == 0; i++) {
+        if(table[2*i] < 0 || table[2*i] % STATE_ALIGNMENT != 0 || table[2*i+1] < 0 ||
+           (size_t)table[2*i] > size || (size_t)table[2*i+1] > size - (size_t)table[2*i]) {
+            error = STATE_ERROR_FORMAT;
+        } else {
+            error = Cache__check_state(hierarchy[i], data+table[2*i], (size_t)table[2*i+1]);
+        }
+    }
+    for(int i=0; i<n && error == 0; i++) {
+        error = Cache__set_state(hierarchy[i], data+table[2*i], (size_t)table[2*i+1]);
+    }
+    int saved_errno = errno;
+#ifdef CACHESIM_MMAP
+    if(mapped) {
+        munmap(data, size);
+    }
+#endif
+    if(!mapped) {
+        free(data);
+    }
+    errno = saved_errno;
+    return error;
+}
+
+/*
+Forks (Cache__fork) share the state of a cache copy-on-write: the arrays of the cache and of
+all its forks point into private mappings of the same snapshot (a file holding the state as
+written by Cache__get_state), so pages are only copied once they are written to. Arrays hold
+consecutive sets, thus a fork takes memory for the groups of sets (pages) it touches only. A
+cache which is forked again keeps its snapshot as long as its arrays still match it.
+*/
+#ifdef CACHESIM_MMAP
+static state_snapshot* state_snapshot__create(const Cache* cache) {
+    // Writes the state of cache to a new anonymous file, returns NULL (with errno set) on error
+    state_snapshot* snapshot = malloc(sizeof(state_snapshot));
+    if(snapshot == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    snapshot->size = Cache__state_size(cache);
+    snapshot->references = 0;
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    snapshot->fd = memfd_create("cachesim-state", MFD_CLOEXEC);
+#else
+    FILE* file = tmpfile();
+    snapshot->fd = file != NULL ? dup(fileno(file)) : -1;
+    if(file != NULL) {
+        fclose(file);
+    }
+#endif
+    void* data = MAP_FAILED;
+    if(snapshot->fd != -1 && ftruncate(snapshot->fd, (off_t)snapshot->size) == 0) {
+        data = mmap(NULL, snapshot->size, PROT_READ|PROT_WRITE, MAP_SHARED, snapshot->fd, 0);
+    }
+    if(data == MAP_FAILED) {
+        int saved_errno = errno;
+        if(snapshot->fd != -1) {
+            close(snapshot->fd);
+        }
+        free(snapshot);
+        errno = saved_errno;
+        return NULL;
+    }
+    Cache__get_state(cache, data);
+    munmap(data, snapshot->size);
+    return snapshot;
+}
+
+static unsigned char* state_snapshot__map(state_snapshot* snapshot) {
+    // Maps snapshot copy-on-write, returns NULL (with errno set) on error
+    void* mapping = mmap(NULL, snapshot->size, PROT_READ|PROT_WRITE, MAP_PRIVATE,
+                         snapshot->fd, 0);
+    if(mapping == MAP_FAILED) {
+        return NULL;
+    }
+    snapshot->references++;
+    return (unsigned char*)mapping;
+}
+
+static void Cache__point_arrays(Cache* self, unsigned char* state) {
+    // Points the arrays of self (but the PSEL samples) into state, a state of a cache with the
+    // configuration of self. Arrays self does not have (NULL) are skipped, as in
+    // Cache__state_arrays.
+    state_array arrays[CACHE_STATE_ARRAYS];
+    unsigned char* data[CACHE_STATE_ARRAYS];
+    int n = Cache__state_arrays(self, 0, arrays);
+    unsigned char* p = state + STATE_ALIGN(sizeof(cache_state));
+    for(int i=0; i<n; i++) {
+        data[i] = p;
+        p += STATE_ALIGN(arrays[i].size);
+    }
+    int i = 0;
+    self->tags = (long*)data[i++];
+    self->dirty_mask = (unsigned long long*)data[i++];
+    if(self->recency_prev != NULL) {
+        self->recency_prev = (int*)data[i++];
+        self->recency_next = (int*)data[i++];
+        self->recency_head = (int*)data[i++];
+        self->recency_tail = (int*)data[i++];
+    }
+    self->policy_state = (unsigned long long*)data[i++];
+    if(self->prefetched != NULL) {
+        self->prefetched = (long long*)data[i++];
+    }
+    if(self->sample_map != NULL) {
+        self->sample_loads = (long long*)data[i++];
+        self->sample_misses = (long long*)data[i++];
+    }
+    if(self->subblock_bitfield != NULL) {
+        self->subblock_bitfield = (char*)data[i++];
+    }
+    if(self->index.locations != NULL) {
+        self->index.cl_ids = (long*)data[i++];
+        self->index.locations = (long*)data[i++];
+    }
+}
+
+static int Cache__matches_snapshot(const Cache* self) {
+    // Returns 1 if the arrays of self still hold the state of its snapshot, 0 otherwise
+    state_array arrays[CACHE_STATE_ARRAYS];
+    int n = Cache__state_arrays(self, 0, arrays);
+    size_t size = 0;
+    for(int i=0; i<n; i++) {
+        size += STATE_ALIGN(arrays[i].size);
+    }
+    void* view = mmap(NULL, self->snapshot->size, PROT_READ, MAP_SHARED, self->snapshot->fd, 0);
+    if(view == MAP_FAILED) {
+        return 0;
+    }
+    size_t offset = STATE_ALIGN(sizeof(cache_state));
+    int matches = memcmp(self->state_mapping + offset, (unsigned char*)view + offset, size) == 0;
+    munmap(view, self->snapshot->size);
+    return matches;
+}
+
+static int Cache__share_state(Cache* self) {
+    // Points the arrays of self into a snapshot of their current contents, which forks can map
+    // as well. Returns 0 or STATE_ERROR_IO (with errno set).
+    if(self->snapshot != NULL && Cache__matches_snapshot(self)) {
+        return 0;
+    }
+    state_snapshot* snapshot = state_snapshot__create(self);
+    unsigned char* mapping = snapshot != NULL ? state_snapshot__map(snapshot) : NULL;
+    if(mapping == NULL) {
+        int saved_errno = errno;
+        if(snapshot != NULL) {
+            close(snapshot->fd);
+            free(snapshot);
+        }
+        errno = saved_errno;
+        return STATE_ERROR_IO;
+    }
+    Cache previous = *self;
+    Cache__point_arrays(self, mapping);
+    self->snapshot = snapshot;
+    self->state_mapping = mapping;
+    Cache__free_arrays(&previous); // or unmaps the previous snapshot
+    return 0;
+}
+#endif
+
+int Cache__fork(Cache* self, Cache* fork) {
+    // Makes fork (memory for a Cache) a copy of self with the same configuration, contents,
+    // replacement and prefetcher state and stats, which shares the arrays of self copy-on-write.
+    // Links of fork point to the caches self links to (see Cache__fork_hierarchy). Returns 0,
+    // STATE_ERROR_MISMATCH (self is part of a CoherenceDomain) or STATE_ERROR_IO (with errno
+    // set, ENOSYS without mmap).
+    if(self->coherence != NULL) {
+        return STATE_ERROR_MISMATCH;
+    }
+#ifdef CACHESIM_MMAP
+    if(Cache__share_state(self) != 0) {
+        return STATE_ERROR_IO;
+    }
+    long long samples_length = self->dueling.samples_length;
+    long* sample_map = self->sample_map != NULL ?
+        CACHE_MALLOC(self->sets*sizeof(long)) : NULL;
+    int* samples = samples_length > 0 ?
+        SAMPLES_REALLOC(NULL, samples_length*sizeof(int)) : NULL;
+    unsigned char* mapping = state_snapshot__map(self->snapshot);
+    if(mapping == NULL || (self->sample_map != NULL && sample_map == NULL) ||
+       (samples_length > 0 && samples == NULL)) {
+        int saved_errno = mapping == NULL ? errno : ENOMEM;
+        if(mapping != NULL) {
+            munmap(mapping, self->snapshot->size);
+            state_snapshot__release(self->snapshot);
+        }
+        CACHE_FREE(sample_map);
+        SAMPLES_FREE(samples);
+        errno = saved_errno;
+        return STATE_ERROR_IO;
+    }
+    // Everything but the object header (with Python)
+    memcpy((char*)fork + offsetof(Cache, name), (char*)self + offsetof(Cache, name),
+           sizeof(Cache) - offsetof(Cache, name));
+    fork->state_mapping = mapping;
+    Cache__point_arrays(fork, mapping);
+    if(sample_map != NULL) {
+        memcpy(sample_map, self->sample_map, self->sets*sizeof(long));
+    }
+    fork->sample_map = sample_map;
+    if(samples != NULL) {
+        memcpy(samples, self->dueling.samples, samples_length*sizeof(int));
+    }
+    fork->dueling.samples = samples;
+    fork->dueling.samples_capacity = samples_length;
+    fork->busy = 0;
+    return 0;
+#else
+    (void)fork;
+    errno = ENOSYS;
+    return STATE_ERROR_IO;
+#endif
+}
+
+static void* Cache__fork_link(Cache** hierarchy, Cache** forks, int n, void* link) {
+    // Returns the fork of link in forks
+    for(int i=0; i<n; i++) {
+        if((void*)hierarchy[i] == link) {
+            return forks[i];
+        }
+    }
+    return NULL;
+}
+
+int Cache__fork_hierarchy(Cache* self, Cache** forks) {
+    // Forks all caches of the hierarchy of self (see Cache__fork) into forks (memory for one
+    // Cache each, in Cache__get_hierarchy order), which are linked like the originals. The
+    // memory of the forks is zeroed again on error. Returns 0, STATE_ERROR_MISMATCH or
+    // STATE_ERROR_IO.
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    int n = Cache__get_hierarchy(self, hierarchy, HIERARCHY_MAX_CACHES);
+    for(int i=0; i<n; i++) {
+        if(hierarchy[i]->coherence != NULL) {
+            return STATE_ERROR_MISMATCH;
+        }
+    }
+    for(int i=0; i<n; i++) {
+        int error = Cache__fork(hierarchy[i], forks[i]);
+        if(error != 0) {
+            int saved_errno = errno;
+            for(int j=0; j<i; j++) {
+                Cache__free_state(forks[j]);
+                memset((char*)forks[j] + offsetof(Cache, name), 0,
+                       sizeof(Cache) - offsetof(Cache, name));
+            }
+            errno = saved_errno;
+            return error;
+        }
+    }
+    for(int i=0; i<n; i++) {
+        forks[i]->load_from = Cache__fork_link(hierarchy, forks, n, hierarchy[i]->load_from);
+        forks[i]->store_to = Cache__fork_link(hierarchy, forks, n, hierarchy[i]->store_to);
+        forks[i]->victims_to = Cache__fork_link(hierarchy, forks, n, hierarchy[i]->victims_to);
+        forks[i]->tlb = Cache__fork_link(hierarchy, forks, n, hierarchy[i]->tlb);
+    }
+    return 0;
+}
+
+/*
+CoherenceDomain: every core has a chain of private levels (from its first level along
+load_from), which ends at the first level all cores load from (the shared level). A directory
+holds one entry per cacheline found in any private level, with the cores holding it (sharers)
+and its MESI/MOESI state. Private hits need no coherence action, all other accesses consult the
+directory before they are passed to the core's first level:
+ - a load miss downgrades a line held EXCLUSIVE or MODIFIED by another core to SHARED. A
+   modified copy is supplied by its owner (intervention), with MESI it is also written back to
+   the shared level, with MOESI the owner keeps it dirty (OWNED).
+ - a store to a line shared with other cores invalidates all other copies (upgrade miss if the
+   core already held the line, read for ownership with intervention of a modified copy
+   otherwise). The core becomes the owner of the MODIFIED line.
+Private levels notify the directory on replacement (see Cache__inject_kernel), so sharers are
+exact and there is never more than one entry per private cache entry. A bounded directory
+(snoop filter) may need to replace the entry of a line which is still held by some cores. Those
+copies are back-invalidated (modified data is written back to the shared level), even if they
+are still used in a private level, since the directory only sees private misses.
+*/
+
+static Cache* CoherenceDomain__shared_level(Cache** first_levels, int cores) {
+    // Returns the first level (of core 0) all cores load from, NULL if there is none
+    if(cores < 2) {
+        return NULL;
+    }
+    for(Cache* c=first_levels[0]; c != NULL; c=(Cache*)c->load_from) {
+        int common = 1;
+        for(int core=1; core<cores && common; core++) {
+            common = 0;
+            for(Cache* d=first_levels[core]; d != NULL && !common; d=(Cache*)d->load_from) {
+                common = d == c;
+            }
+        }
+        if(common) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static int CoherenceDomain__check(Cache** first_levels, int cores, Cache** culprit) {
+    // Returns 0 if first_levels can form a domain, otherwise the reason (1 = too many or no
+    // cores, 2 = first level shared by all cores, 3 = level shared by some cores, 4 = level in
+    // another domain, 5 = different cl_size, 6 = private level with a prefetcher, 7 = private
+    // level with set sampling). culprit is set to the offending cache.
+    *culprit = NULL;
+    if(cores < 1 || cores > COHERENCE_MAX_CORES) {
+        return 1;
+    }
+    Cache* shared = CoherenceDomain__shared_level(first_levels, cores);
+    for(int core=0; core<cores; core++) {
+        *culprit = first_levels[core];
+        if(first_levels[core] == shared) {
+            return 2;
+        }
+        for(Cache* c=first_levels[core]; c != shared; c=(Cache*)c->load_from) {
+            *culprit = c;
+            if(c->coherence != NULL) {
+                return 4;
+            }
+            if(c->cl_bits != first_levels[0]->cl_bits) {
+                return 5;
+            }
+            if(c->prefetcher != PREFETCH_NONE) {
+                return 6; // prefetched lines would bypass the directory
+            }
+            if(c->sample_map != NULL) {
+                return 7; // lines of other sets would be missing in the directory
+            }
+            for(int other=0; other<cores; other++) {
+                for(Cache* d=first_levels[other]; other != core && d != shared;
+                        d=(Cache*)d->load_from) {
+                    if(d == c) {
+                        return 3;
+                    }
+                }
+            }
+        }
+    }
+    *culprit = shared;
+    if(shared != NULL && shared->cl_bits != first_levels[0]->cl_bits) {
+        return 5;
+    }
+    return 0;
+}
+
+static void CoherenceDomain__clear_directory(CoherenceDomain* self) {
+    // Removes all entries from the directory
+    for(long e=0; e<self->capacity; e++) {
+        self->entries[e].cl_id = CACHE_TAG_INVALID;
+        if(self->free_entries != NULL) {
+            self->free_entries[e] = self->capacity-1-e;
+        }
+    }
+    self->free_count = self->capacity;
+    tag_index__clear(&self->index);
+}
+
+int CoherenceDomain__init(CoherenceDomain* self, Cache** first_levels, int cores, int protocol,
+                          long directory_sets, long directory_ways) {
+    // Forms a domain of cores with the given first levels and attaches it to their private
+    // levels. The directory is bounded to directory_sets*directory_ways entries, if
+    // directory_sets > 0. Returns 0 on success, -1 if memory allocation failed and the reason
+    // (see CoherenceDomain__check) if the caches can not form a domain.
+    Cache* culprit;
+    int error = CoherenceDomain__check(first_levels, cores, &culprit);
+    if(error != 0) {
+        return error;
+    }
+    self->protocol = protocol;
+    self->cores = cores;
+    self->shared = CoherenceDomain__shared_level(first_levels, cores);
+    self->directory_sets = directory_sets > 0 ? directory_sets : 0;
+    self->directory_ways = directory_sets > 0 ? directory_ways : 0;
+    int n = 0;
+    self->capacity = 0;
+    for(int core=0; core<cores; core++) {
+        for(Cache* c=first_levels[core]; c != self->shared; c=(Cache*)c->load_from) {
+            n++;
+            self->capacity += c->sampled_sets*c->ways;
+        }
+    }
+    if(self->directory_sets > 0) {
+        self->capacity = self->directory_sets*self->directory_ways;
+    }
+    self->private_caches = malloc(n*sizeof(Cache*));
+    self->private_start = malloc((cores+1)*sizeof(int));
+    self->entries = malloc(self->capacity*sizeof(coherence_entry));
+    self->free_entries = self->directory_sets == 0 ? malloc(self->capacity*sizeof(long)) : NULL;
+    self->index.cl_ids = NULL;
+    self->index.locations = NULL;
+    if(self->private_caches == NULL || self->private_start == NULL || self->entries == NULL ||
+       (self->directory_sets == 0 && self->free_entries == NULL) ||
+       tag_index__init(&self->index, self->capacity) != 0) {
+        free(self->private_start);
+        self->private_start = NULL;
+        CoherenceDomain__free(self);
+        return -1;
+    }
+    n = 0;
+    for(int core=0; core<cores; core++) {
+        self->private_start[core] = n;
+        for(Cache* c=first_levels[core]; c != self->shared; c=(Cache*)c->load_from) {
+            c->coherence = self;
+            c->core = core;
+            self->private_caches[n++] = c;
+        }
+    }
+    self->private_start[cores] = n;
+    CoherenceDomain__clear_directory(self);
+    self->clock = 0;
+    self->lookups = 0;
+    self->misses = 0;
+    self->evictions = 0;
+    return 0;
+}
+
+void CoherenceDomain__free(CoherenceDomain* self) {
+    // Detaches the domain from all private levels and frees the directory
+    for(int i=0; self->private_start != NULL && i<self->private_start[self->cores]; i++) {
+        self->private_caches[i]->coherence = NULL;
+        self->private_caches[i]->core = -1;
+    }
+    free(self->private_caches);
+    free(self->private_start);
+    free(self->entries);
+    free(self->free_entries);
+    tag_index__free(&self->index);
+    self->private_caches = NULL;
+    self->private_start = NULL;
+    self->entries = NULL;
+    self->free_entries = NULL;
+    self->cores = 0;
+    self->capacity = 0;
+    self->free_count = 0;
+}
+
+#define COHERENCE_BIT(core) (1ULL << (core))
+
+inline static Cache* CoherenceDomain__first_level(CoherenceDomain* self, int core) {
+    return self->private_caches[self->private_start[core]];
+}
+
+static int CoherenceDomain__holds(CoherenceDomain* self, int core, long cl_id) {
+    // Returns 1 if any private level of core holds the cacheline
+    for(int i=self->private_start[core]; i<self->private_start[core+1]; i++) {
+        Cache* cache = self->private_caches[i];
+        if(Cache__get_location(cache, cl_id, Cache__get_set_id(cache, cl_id)) != -1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void CoherenceDomain__release(CoherenceDomain* self, long e) {
+    tag_index__remove(&self->index, self->entries[e].cl_id);
+    self->entries[e].cl_id = CACHE_TAG_INVALID;
+    if(self->free_entries != NULL) {
+        self->free_entries[self->free_count++] = e;
+    }
+}
+
+static void CoherenceDomain__drop_sharer(CoherenceDomain* self, long e, int core) {
+    // Removes core from the sharers of entry e, which is released if no sharers remain
+    coherence_entry* entry = &self->entries[e];
+    entry->sharers &= ~COHERENCE_BIT(core);
+    if(entry->sharers == 0) {
+        CoherenceDomain__release(self, e);
+    } else if(entry->owner == core) {
+        // An OWNED line was written back by its owner, the others keep clean copies
+        entry->owner = -1;
+        entry->state = COHERENCE_SHARED;
+    }
+}
+
+static void CoherenceDomain__collect(CoherenceDomain* self) {
+    // Removes sharers which do not hold their lines anymore (e.g., after mark_all_invalid)
+    for(long e=0; e<self->capacity; e++) {
+        for(int core=0; core<self->cores && self->entries[e].cl_id != CACHE_TAG_INVALID;
+                core++) {
+            if((self->entries[e].sharers & COHERENCE_BIT(core)) &&
+               !CoherenceDomain__holds(self, core, self->entries[e].cl_id)) {
+                CoherenceDomain__drop_sharer(self, e, core);
+            }
+        }
+    }
+}
+
+static void CoherenceDomain__back_invalidate(CoherenceDomain* self, long e) {
+    // Replaces entry e of a bounded directory: the line is removed from all private levels, a
+    // core which modified it writes it back to the shared level
+    coherence_entry* entry = &self->entries[e];
+    for(int core=0; core<self->cores; core++) {
+        if(!(entry->sharers & COHERENCE_BIT(core))) {
+            continue;
+        }
+        int dirty = 0;
+        for(int i=self->private_start[core]; i<self->private_start[core+1]; i++) {
+            Cache* cache = self->private_caches[i];
+            int invalidated = Cache__invalidate(cache, entry->cl_id);
+            if(invalidated != -1) {
+                cache->BACK_INVALIDATE.count++;
+                cache->BACK_INVALIDATE.byte += cache->cl_size;
+                dirty |= invalidated;
+            }
+        }
+        Cache* last_private = self->private_caches[self->private_start[core+1]-1];
+        if(dirty && last_private->store_to != NULL) {
+            Cache__store((Cache*)last_private->store_to,
+                         Cache__get_range_from_cl_id(last_private, entry->cl_id), 0);
+        }
+    }
+    self->evictions++;
+    CoherenceDomain__release(self, e);
+}
+
+static long CoherenceDomain__allocate(CoherenceDomain* self, long cl_id, int core, int state) {
+    // Adds an entry for a cacheline only held by core. Returns its index, -1 if the directory
+    // is full (only possible if private levels were modified outside of the domain).
+    long e;
+    if(self->directory_sets > 0) {
+        // First free way of the set, otherwise the least recently used one is replaced
+        long first = (long)((unsigned long)cl_id % (unsigned long)self->directory_sets) *
+                     self->directory_ways;
+        e = first;
+        for(long way=first; way<first+self->directory_ways; way++) {
+            if(self->entries[way].cl_id == CACHE_TAG_INVALID) {
+                e = way;
+                break;
+            }
+            if(self->entries[way].last_use < self->entries[e].last_use) {
+                e = way;
+            }
+        }
+        if(self->entries[e].cl_id != CACHE_TAG_INVALID) {
+            CoherenceDomain__back_invalidate(self, e);
+        }
+    } else {
+        if(self->free_count == 0) {
+            CoherenceDomain__collect(self);
+            if(self->free_count == 0) {
+                return -1;
+            }
+        }
+        e = self->free_entries[--self->free_count];
+    }
+    self->entries[e].cl_id = cl_id;
+    self->entries[e].sharers = COHERENCE_BIT(core);
+    self->entries[e].owner = core;
+    self->entries[e].state = state;
+    self->entries[e].last_use = self->clock;
+    tag_index__set(&self->index, cl_id, e);
+    return e;
+}
+
+inline static void CoherenceDomain__lookup(CoherenceDomain* self, long e) {
+    // Counts a directory access which found entry e (-1 if the line is not held by any core)
+    self->lookups++;
+    self->clock++;
+    if(e == -1) {
+        self->misses++;
+    } else {
+        self->entries[e].last_use = self->clock;
+    }
+}
+
+static void CoherenceDomain__evicted(CoherenceDomain* self, int core, long cl_id) {
+    // A private level of core replaced cacheline, core stops sharing it if no other private
+    // level holds it
+    long e = tag_index__find(&self->index, cl_id);
+    if(e != -1 && (self->entries[e].sharers & COHERENCE_BIT(core)) &&
+       !CoherenceDomain__holds(self, core, cl_id)) {
+        CoherenceDomain__drop_sharer(self, e, core);
+    }
+}
+
+static void CoherenceDomain__invalidate(CoherenceDomain* self, int core, long cl_id) {
+    // Removes cacheline from all private levels of core. Modified data is not written back, it
+    // is taken over by the core which caused the invalidation.
+    for(int i=self->private_start[core]; i<self->private_start[core+1]; i++) {
+        Cache* cache = self->private_caches[i];
+        if(Cache__invalidate(cache, cl_id) != -1) {
+            cache->INVALIDATE.count++;
+            cache->INVALIDATE.byte += cache->cl_size;
+        }
+    }
+}
+
+static int CoherenceDomain__intervene(
+        CoherenceDomain* self, int core, long cl_id, int write_back) {
+    // Supplies the modified copy core holds of cacheline to another core (counted in the level
+    // closest to core which holds it dirty). With write_back, the line is also written to the
+    // shared level and all copies of core become clean. Returns 0 if core holds no dirty copy.
+    int found = 0;
+    for(int i=self->private_start[core]; i<self->private_start[core+1]; i++) {
+        Cache* cache = self->private_caches[i];
+        long set_id = Cache__get_set_id(cache, cl_id);
+        int location = Cache__get_location(cache, cl_id, set_id);
+        if(location == -1 || !Cache__is_dirty(cache, set_id, location)) {
+            continue;
+        }
+        if(!found) {
+            cache->INTERVENTION.count++;
+            cache->INTERVENTION.byte += cache->cl_size;
+            found = 1;
+        }
+        if(write_back) {
+            Cache__set_dirty(cache, set_id, location, 0);
+        }
+    }
+    Cache* last_private = self->private_caches[self->private_start[core+1]-1];
+    if(found && write_back && last_private->store_to != NULL) {
+        Cache__store((Cache*)last_private->store_to,
+                     Cache__get_range_from_cl_id(last_private, cl_id), 0);
+    }
+    return found;
+}
+
+void CoherenceDomain__load(CoherenceDomain* self, int core, addr_range range) {
+    // Loads range on core
+    Cache* first_level = CoherenceDomain__first_level(self, core);
+    long first_cl_id = Cache__get_cacheline_id(first_level, range.addr);
+    long last_cl_id = Cache__get_cacheline_id(first_level, range.addr+range.length-1);
+    for(long cl_id=first_cl_id; cl_id<=last_cl_id; cl_id++) {
+        long e = tag_index__find(&self->index, cl_id);
+        if(e != -1 && (self->entries[e].sharers & COHERENCE_BIT(core))) {
+            continue; // private hit
+        }
+        CoherenceDomain__lookup(self, e);
+        if(e == -1) {
+            continue; // not cached by any core
+        }
+        // Miss in all private levels, other cores get a shared copy
+        coherence_entry* entry = &self->entries[e];
+        if(entry->state == COHERENCE_MODIFIED || entry->state == COHERENCE_OWNED) {
+            int write_back = self->protocol == COHERENCE_MESI;
+            if(CoherenceDomain__intervene(self, entry->owner, cl_id, write_back) &&
+               !write_back) {
+                entry->state = COHERENCE_OWNED;
+                continue;
+            }
+        }
+        entry->owner = -1;
+        entry->state = COHERENCE_SHARED;
+    }
+
+    Cache__load(first_level, range);
+
+    for(long cl_id=first_cl_id; cl_id<=last_cl_id; cl_id++) {
+        long e = tag_index__find(&self->index, cl_id);
+        if((e != -1 && (self->entries[e].sharers & COHERENCE_BIT(core))) ||
+           !CoherenceDomain__holds(self, core, cl_id)) {
+            continue;
+        }
+        if(e == -1) {
+            CoherenceDomain__allocate(self, cl_id, core, COHERENCE_EXCLUSIVE);
+        } else {
+            self->entries[e].sharers |= COHERENCE_BIT(core);
+        }
+    }
+}
+
+void CoherenceDomain__store(CoherenceDomain* self, int core, addr_range range, int non_temporal) {
+    // Stores range on core
+    Cache* first_level = CoherenceDomain__first_level(self, core);
+    long first_cl_id = Cache__get_cacheline_id(first_level, range.addr);
+    long last_cl_id = Cache__get_cacheline_id(first_level, range.addr+range.length-1);
+    for(long cl_id=first_cl_id; cl_id<=last_cl_id; cl_id++) {
+        long e = tag_index__find(&self->index, cl_id);
+        coherence_entry* entry = e != -1 ? &self->entries[e] : NULL;
+        if(entry != NULL && (entry->sharers & COHERENCE_BIT(core)) && entry->owner == core &&
+           (entry->state == COHERENCE_EXCLUSIVE || entry->state == COHERENCE_MODIFIED)) {
+            entry->state = COHERENCE_MODIFIED;
+            continue; // private hit
+        }
+        CoherenceDomain__lookup(self, e);
+        if(entry == NULL) {
+            continue; // not cached by any core
+        }
+        if(entry->sharers & COHERENCE_BIT(core)) {
+            // Upgrade miss: core holds a shared copy
+            first_level->UPGRADE.count++;
+            first_level->UPGRADE.byte += first_level->cl_size;
+        } else if(entry->state == COHERENCE_MODIFIED || entry->state == COHERENCE_OWNED) {
+            // Read for ownership: modified copy is handed over
+            CoherenceDomain__intervene(self, entry->owner, cl_id, 0);
+        }
+        for(int other=0; other<self->cores; other++) {
+            if(other != core && (entry->sharers & COHERENCE_BIT(other))) {
+                CoherenceDomain__invalidate(self, other, cl_id);
+            }
+        }
+        entry->sharers &= COHERENCE_BIT(core);
+        if(entry->sharers == 0) {
+            CoherenceDomain__release(self, e);
+        } else {
+            entry->owner = core;
+            entry->state = COHERENCE_MODIFIED;
+        }
+    }
+
+    Cache__store(first_level, range, non_temporal);
+
+    for(long cl_id=first_cl_id; cl_id<=last_cl_id; cl_id++) {
+        long e = tag_index__find(&self->index, cl_id);
+        if((e != -1 && (self->entries[e].sharers & COHERENCE_BIT(core))) ||
+           !CoherenceDomain__holds(self, core, cl_id)) {
+            continue; // already owned or not allocated (e.g., write-through)
+        }
+        CoherenceDomain__allocate(self, cl_id, core, COHERENCE_MODIFIED);
+    }
+}
+
+inline static void CoherenceDomain__access(
+        CoherenceDomain* self, int core, const access_record* record) {
+    addr_range range;
+    range.addr = record->addr;
+    range.length = record->length;
+    if(record->op == ACCESS_STORE) {
+        CoherenceDomain__store(self, core, range, record->non_temporal);
+    } else {
+        CoherenceDomain__load(self, core, range);
+    }
+}
+
+void CoherenceDomain__replay(CoherenceDomain* self, const access_record** traces,
+                             const long long* lengths, const long long** timestamps,
+                             long long quantum) {
+    // Replays one trace per core. With timestamps (one non-decreasing array per trace), accesses
+    // of all cores are replayed in timestamp order (equal timestamps in core order). Otherwise
+    // cores take turns, each replaying the next quantum accesses of its trace.
+    long long pos[COHERENCE_MAX_CORES] = {0};
+    if(timestamps != NULL) {
+        for(;;) {
+            int core = -1;
+            for(int c=0; c<self->cores; c++) {
+                if(pos[c] < lengths[c] &&
+                   (core == -1 || timestamps[c][pos[c]] < timestamps[core][pos[core]])) {
+                    core = c;
+                }
+            }
+            if(core == -1) {
+                break;
+            }
+            CoherenceDomain__access(self, core, &traces[core][pos[core]++]);
+        }
+        return;
+    }
+    if(quantum < 1) {
+        quantum = 1;
+    }
+    for(int active=1; active;) {
+        active = 0;
+        for(int c=0; c<self->cores; c++) {
+            for(long long q=0; q<quantum && pos[c] < lengths[c]; q++) {
+                CoherenceDomain__access(self, c, &traces[c][pos[c]++]);
+            }
+            active |= pos[c] < lengths[c];
+        }
+    }
+}
+
+/*
+StackDistance: one pass over a trace gives the hits of LRU caches of all associativities and all
+power-of-two set counts (modulo indexing). An access hits in a cache with s sets and w ways iff
+fewer than w other lines of its set (in the s-set configuration) were used since the last access
+to the same line (LRU inclusion property), so a histogram of these stack distances per set count
+is enough. Distances are computed with one Fenwick tree per set, over the local access times of
+the set: each line that is among the max_ways most recently used lines of its set is marked at
+the time of its last access. Only max_ways lines are marked, so window = 2*max_ways times suffice
+if the marks are renumbered (compacted) whenever a set runs out of times. Writes are treated as
+accesses (write-allocate), every cacheline of an access is counted.
+*/
+
+inline static void fenwick__add(int* tree, long window, long position, int value) {
+    for(position++; position<=window; position+=position & -position) {
+        tree[position-1] += value;
+    }
+}
+
+inline static int fenwick__prefix(const int* tree, long position) {
+    // Returns the sum of all values before position
+    int sum = 0;
+    for(; position>0; position-=position & -position) {
+        sum += tree[position-1];
+    }
+    return sum;
+}
+
+inline static long fenwick__first(const int* tree, long window_step, long window) {
+    // Returns the first position with a positive value (the tree may not be empty)
+    long position = 0;
+    for(long step=window_step; step>0; step>>=1) {
+        if(position+step <= window && tree[position+step-1] < 1) {
+            position += step;
+        }
+    }
+    return position;
+}
+
+void StackDistance__free(StackDistance* self) {
+    free(self->set_states);
+    free(self->last);
+    free(self->histograms);
+    tag_index__free(&self->index);
+    self->set_states = NULL;
+    self->last = NULL;
+    self->histograms = NULL;
+}
+
+int StackDistance__init(StackDistance* self, unsigned int cl_size, long max_sets, long max_ways) {
+    // cl_size and max_sets need to be powers of two. Returns 0 on success, -1 if memory
+    // allocation failed.
+    self->cl_size = cl_size;
+    self->cl_bits = log2_uint(cl_size);
+    self->levels = (int)log2_uint((unsigned long)max_sets) + 1;
+    self->max_ways = max_ways;
+    self->window = 2*max_ways;
+    for(self->window_step=1; self->window_step*2 <= self->window; self->window_step*=2) {}
+    long sets = (1L << self->levels) - 1;
+    self->set_states = calloc(sets*STACK_DISTANCE_SET_SIZE(self->window, max_ways), sizeof(int));
+    self->histograms = calloc(self->levels*(max_ways+1), sizeof(long long));
+    self->lines = 0;
+    self->lines_capacity = 1024;
+    self->last = malloc(self->lines_capacity*self->levels*sizeof(int));
+    self->accesses = 0;
+    self->busy = 0;
+    self->index.cl_ids = NULL;
+    self->index.locations = NULL;
+    if(self->set_states == NULL || self->histograms == NULL || self->last == NULL ||
+       tag_index__init(&self->index, self->lines_capacity) != 0) {
+        StackDistance__free(self);
+        return -1;
+    }
+    return 0;
+}
+
+static int StackDistance__add_line(StackDistance* self, long cl_id) {
+    // Returns the new line of cl_id, -1 if memory allocation failed
+    if(self->lines == self->lines_capacity) {
+        long capacity = self->lines_capacity*2;
+        int *last = realloc(self->last, capacity*self->levels*sizeof(int));
+        if(last == NULL) {
+            return -1;
+        }
+        self->last = last;
+        // Rehash all lines into a larger index
+        tag_index index;
+        if(tag_index__init(&index, capacity) != 0) {
+            return -1;
+        }
+        for(unsigned long long b=0; b<=self->index.mask; b++) {
+            if(self->index.locations[b] != -1) {
+                tag_index__set(&index, self->index.cl_ids[b], self->index.locations[b]);
+            }
+        }
+        tag_index__free(&self->index);
+        self->index = index;
+        self->lines_capacity = capacity;
+    }
+    long line = self->lines++;
+    for(int level=0; level<self->levels; level++) {
+        self->last[line*self->levels+level] = -1;
+    }
+    tag_index__set(&self->index, cl_id, line);
+    return line;
+}
+
+static void StackDistance__compact(StackDistance* self, int* state) {
+    // Renumbers the marks of a set to the first local times, in order
+    int *tree = &state[2];
+    int *time_slots = &state[2+self->window];
+    int *slot_times = &state[2+2*self->window];
+    int time = 0;
+    for(int t=0; t<state[0]; t++) {
+        int slot = time_slots[t];
+        if(slot_times[slot] == t) {
+            slot_times[slot] = time;
+            time_slots[time++] = slot;
+        }
+    }
+    // Fenwick tree with ones at the first time positions
+    for(long p=1; p<=self->window; p++) {
+        long lowest = p & -p;
+        long first = p - lowest; // first position covered by p (exclusive)
+        tree[p-1] = (int)(p <= time ? lowest : (first < time ? time - first : 0));
+    }
+    state[0] = time;
+}
+
+int StackDistance__access(StackDistance* self, long cl_id) {
+    // Counts the stack distances of an access to cl_id for all set counts. Returns 0 on success,
+    // -1 if memory allocation failed.
+    long line = tag_index__find(&self->index, cl_id);
+    if(line == -1) {
+        line = StackDistance__add_line(self, cl_id);
+        if(line == -1) {
+            return -1;
+        }
+    }
+    int *last = &self->last[line*self->levels];
+    for(int level=0; level<self->levels; level++) {
+        long set = (1L << level) - 1 + (cl_id & ((1L << level) - 1));
+        int *state = &self->set_states[set*STACK_DISTANCE_SET_SIZE(self->window, self->max_ways)];
+        int *tree = &state[2];
+        int *time_slots = &state[2+self->window];
+        int *slot_times = &state[2+2*self->window];
+        int *slot_lines = &state[2+2*self->window+self->max_ways];
+        int slot = last[level];
+        long distance = self->max_ways;
+        if(slot != -1 && slot_lines[slot] == line) {
+            distance = state[1] - fenwick__prefix(tree, slot_times[slot]+1);
+            fenwick__add(tree, self->window, slot_times[slot], -1);
+            slot_times[slot] = -1;
+            state[1]--;
+        } else {
+            slot = -1;
+        }
+        self->histograms[level*(self->max_ways+1)+distance]++;
+
+        if(state[0] == self->window) {
+            StackDistance__compact(self, state);
+        }
+        if(slot == -1) {
+            // Marked lines use slots 0 to marks-1, if all are used, the least recently used line
+            // becomes deeper than max_ways and hands its slot over
+            if(state[1] == self->max_ways) {
+                long oldest = fenwick__first(tree, self->window_step, self->window);
+                fenwick__add(tree, self->window, oldest, -1);
+                state[1]--;
+                slot = time_slots[oldest];
+            } else {
+                slot = state[1];
+            }
+            slot_lines[slot] = (int)line;
+            last[level] = slot;
+        }
+        int time = state[0]++;
+        fenwick__add(tree, self->window, time, 1);
+        time_slots[time] = slot;
+        slot_times[slot] = time;
+        state[1]++;
+    }
+    self->accesses++;
+    return 0;
+}
+
+int StackDistance__replay(StackDistance* self, const access_record* records, long long n) {
+    // Counts all cachelines of all records (loads and stores alike). Returns 0 on success, -1 if
+    // memory allocation failed.
+    for(long long i=0; i<n; i++) {
+        long first = records[i].addr >> self->cl_bits;
+        long last = (records[i].addr + (records[i].length > 0 ? records[i].length : 1) - 1) >>
+            self->cl_bits;
+        for(long cl_id=first; cl_id<=last; cl_id++) {
+            if(StackDistance__access(self, cl_id) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+long long StackDistance__replay_file(StackDistance* self, const char* path) {
+    // Counts all records of a trace file (see Cache__replay_file). Returns the number of records,
+    // TRACE_ERROR_IO (also if memory allocation failed) or TRACE_ERROR_FORMAT.
+    trace_reader reader;
+    int n = trace_reader__open(&reader, path);
+    if(n != 0) {
+        return n;
+    }
+    access_record* records = malloc(TRACE_BLOCK_RECORDS*sizeof(access_record));
+    if(records == NULL) {
+        trace_reader__close(&reader);
+        return TRACE_ERROR_IO;
+    }
+    long long replayed = 0;
+    while((n = trace_reader__next(&reader, records)) > 0) {
+        if(StackDistance__replay(self, records, n) != 0) {
+            n = TRACE_ERROR_IO;
+            break;
+        }
+        replayed += n;
+    }
+    free(records);
+    trace_reader__close(&reader);
+    return n < 0 ? n : replayed;
+}
+
+long long StackDistance__hits(const StackDistance* self, long sets, long ways) {
+    // Returns the hits of an LRU cache with sets (a power of two <= max_sets) and at most
+    // max_ways ways
+    int level = (int)log2_uint((unsigned long)sets);
+    long long hits = 0;
+    for(long distance=0; distance<ways; distance++) {
+        hits += self->histograms[level*(self->max_ways+1)+distance];
+    }
+    return hits;
+}
+
+#ifndef NO_PYTHON
+
+static int Cache__lock_hierarchy(Cache* self, Cache** hierarchy, int *n) {
+    // Marks all caches reachable from self as busy, so the hierarchy can be simulated without
+    // holding the GIL. Must be called with the GIL held. Returns 1 if the GIL may be released,
+    // 0 if it needs to be kept (verbose output is written through Python) and -1 (with
+    // RuntimeError set) if any of the caches is already being simulated by another thread.
+    *n = Cache__get_hierarchy(self, hierarchy, HIERARCHY_MAX_CACHES);
+    int nogil = 1;
+    for(int i=0; i<*n; i++) {
+        if(hierarchy[i]->busy) {
+            PyErr_Format(PyExc_RuntimeError,
+                         "cache %s is already being simulated by another thread",
+                         hierarchy[i]->name);
+            return -1;
+        }
+        if(hierarchy[i]->verbosity > 0) {
+            nogil = 0;
+        }
+    }
+    for(int i=0; i<*n; i++) {
+        hierarchy[i]->busy = 1;
+    }
+    return nogil;
+}
+
+static void Cache__unlock_hierarchy(Cache** hierarchy, int n) {
+    for(int i=0; i<n; i++) {
+        hierarchy[i]->busy = 0;
+    }
+}
+
+static int Cache__check_idle(Cache* self) {
+    // Returns -1 (with RuntimeError set) if the hierarchy of self is currently being simulated by
+    // another thread, 0 otherwise.
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    int n = Cache__get_hierarchy(self, hierarchy, HIERARCHY_MAX_CACHES);
+    for(int i=0; i<n; i++) {
+        if(hierarchy[i]->busy) {
+            PyErr_Format(PyExc_RuntimeError,
+                         "cache %s is already being simulated by another thread",
+                         hierarchy[i]->name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static PyObject* Cache_load(Cache* self, PyObject *args, PyObject *kwds)
+{
+    addr_range range;
+    range.length = 1; // default to 1
+
+    static char *kwlist[] = {"addr", "length", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "L|L", kwlist, &range.addr, &range.length) ||
+       Cache__check_idle(self) != 0) {
+        return NULL;
+    }
+
+    Cache__load(self, range); // TODO , 0);
+    // Swap cl_id is irrelevant here, since this is only called on first level cache
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* Cache_iterload(Cache* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *addrs;
+    addr_range range;
+    range.length = 1; // default to 1
+
+    static char *kwlist[] = {"addrs", "length", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|L", kwlist, &addrs, &range.length) ||
+       Cache__check_idle(self) != 0) {
+        return NULL;
+    }
+    Py_INCREF(addrs);
+
+    // Get and check iterator
+    PyObject *addrs_iter = PyObject_GetIter(addrs);
+    Py_DECREF(addrs);
+    if(addrs_iter == NULL) {
+        PyErr_SetString(PyExc_ValueError, "addrs is not iteratable");
+        return NULL;
+    }
+
+    // Iterate of elements in addrs
+    PyObject *addr;
+    while((addr = PyIter_Next(addrs_iter))) {
+        // For each address, build range:
+#if PY_MAJOR_VERSION >= 3
+        range.addr = PyLong_AsLong(addr);
+#else
+        range.addr = PyInt_AsLong(addr);
+#endif
+        Py_DECREF(addr);
+        if(range.addr == -1 && PyErr_Occurred()) {
+            break;
+        }
+        Cache__load(self, range); // TODO , 0);
+        // Swap cl_id is irrelevant here, since this is only called on first level cache
+    }
+    Py_DECREF(addrs_iter);
+    if(PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* Cache_store(Cache* self, PyObject *args, PyObject *kwds)
+{
+    addr_range range;
+    range.length = 1; // default to 1
+    int non_temporal = 0;
+
+    static char *kwlist[] = {"addr", "length", "non_temporal", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "L|Lp", kwlist,
+                                    &range.addr, &range.length, &non_temporal) ||
+       Cache__check_idle(self) != 0) {
+        return NULL;
+    }
+
+    // Handling ranges in c tremendously increases the speed for multiple elements
+    Cache__store(self, range, non_temporal);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* Cache_iterstore(Cache* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *addrs;
+    addr_range range;
+    range.length = 1; // default to 1
+    int non_temporal = 0;
+
+    static char *kwlist[] = {"addrs", "length", "non_temporal", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|Lp", kwlist,
+                                    &addrs, &range.length, &non_temporal) ||
+       Cache__check_idle(self) != 0) {
+        return NULL;
+    }
+    Py_INCREF(addrs);
+
+    // Get and check iterator
+    PyObject *addrs_iter = PyObject_GetIter(addrs);
+    Py_DECREF(addrs);
+    if(addrs_iter == NULL) {
+        PyErr_SetString(PyExc_ValueError, "addrs is not iteratable");
+        return NULL;
+    }
+
+    // Iterate of elements in addrs
+    PyObject *addr;
+    while((addr = PyIter_Next(addrs_iter))) {
+        // For each address, build range:
+#if PY_MAJOR_VERSION >= 3
+        range.addr = PyLong_AsLong(addr);
+#else
+        range.addr = PyInt_AsLong(addr);
+#endif
+        Py_DECREF(addr);
+        if(range.addr == -1 && PyErr_Occurred()) {
+            break;
+        }
+        Cache__store(self, range, non_temporal);
+    }
+    Py_DECREF(addrs_iter);
+    if(PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static int __get_int_buffer(PyObject *obj, Py_buffer *view, int *is_signed, const char *name)
+{
+    // Acquires a one-dimensional buffer of native integers from obj (e.g., a numpy array or
+    // array.array). On error, an exception is set and -1 is returned.
+    if(PyObject_GetBuffer(obj, view, PyBUF_STRIDES|PyBUF_FORMAT) != 0) {
+        PyErr_Format(PyExc_ValueError, "%s does not support the buffer protocol", name);
+        return -1;
+    }
+    if(view->ndim != 1) {
+        PyErr_Format(PyExc_ValueError, "%s needs to be one-dimensional", name);
+        PyBuffer_Release(view);
+        return -1;
+    }
+
+    // Only accept native byte order, which is what numpy and array.array produce by default
+    const char *format = view->format;
+    if(format[0] == '@' || format[0] == '=') {
+        format++;
+#if PY_LITTLE_ENDIAN
+    } else if(format[0] == '<') {
+#else
+    } else if(format[0] == '>' || format[0] == '!') {
+#endif
+        format++;
+    }
+    if(format[0] == '\0' || format[1] != '\0' || strchr("bBhHiIlLqQnN", format[0]) == NULL ||
+       (view->itemsize != 1 && view->itemsize != 2 &&
+        view->itemsize != 4 && view->itemsize != 8)) {
+        PyErr_Format(PyExc_ValueError, "%s needs to contain native integers (got format '%s')",
+                     name, view->format);
+        PyBuffer_Release(view);
+        return -1;
+    }
+    *is_signed = strchr("bhilqn", format[0]) != NULL;
+    return 0;
+}
+
+inline static long long __int_buffer_get(Py_buffer *view, int is_signed, Py_ssize_t i)
+{
+    const char *item = (const char*)view->buf + i*view->strides[0];
+    switch(view->itemsize) {
+        case 1:
+            return is_signed ? (long long)*(const signed char*)item :
+                               (long long)*(const unsigned char*)item;
+        case 2:
+            return is_signed ? (long long)*(const short*)item :
+                               (long long)*(const unsigned short*)item;
+        case 4:
+            return is_signed ? (long long)*(const int*)item :
+                               (long long)*(const unsigned int*)item;
+        default:
+            return *(const long long*)item;
+    }
+}
+
+static PyObject* Cache__arrayaccess(Cache* self, PyObject *args, PyObject *kwds, int store)
+{
+    // Shared implementation of arrayload and arraystore: all elements of the addrs buffer (and
+    // optional lengths buffer) are handed to Cache__load/Cache__store without creating any
+    // intermediate Python objects.
+    PyObject *addrs, *lengths = Py_None;
+    Py_buffer addrs_view, lengths_view;
+    int addrs_signed, lengths_signed = 0;
+    int non_temporal = 0;
+    addr_range range;
+    range.length = 1; // default to 1
+
+    static char *load_kwlist[] = {"addrs", "lengths", "length", NULL};
+    static char *store_kwlist[] = {"addrs", "lengths", "length", "non_temporal", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, store ? "O|OLp" : "O|OL",
+                                    store ? store_kwlist : load_kwlist,
+                                    &addrs, &lengths, &range.length, &non_temporal)) {
+        return NULL;
+    }
+
+    if(__get_int_buffer(addrs, &addrs_view, &addrs_signed, "addrs") != 0) {
+        return NULL;
+    }
+    if(lengths != Py_None) {
+        if(__get_int_buffer(lengths, &lengths_view, &lengths_signed, "lengths") != 0) {
+            PyBuffer_Release(&addrs_view);
+            return NULL;
+        }
+        if(lengths_view.shape[0] != addrs_view.shape[0]) {
+            PyErr_SetString(PyExc_ValueError, "lengths needs to have as many elements as addrs");
+            PyBuffer_Release(&lengths_view);
+            PyBuffer_Release(&addrs_view);
+            return NULL;
+        }
+    }
+
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    int hierarchy_size, nogil = Cache__lock_hierarchy(self, hierarchy, &hierarchy_size);
+    if(nogil >= 0) {
+        // Buffers stay valid while we hold the views, so the GIL is not needed from here on
+        PyThreadState *thread_state = nogil ? PyEval_SaveThread() : NULL;
+        int with_lengths = lengths != Py_None;
+        Py_ssize_t n = addrs_view.shape[0];
+        for(Py_ssize_t i=0; i<n; i++) {
+            range.addr = __int_buffer_get(&addrs_view, addrs_signed, i);
+            if(with_lengths) {
+                range.length = __int_buffer_get(&lengths_view, lengths_signed, i);
+            }
+            if(store) {
+                Cache__store(self, range, non_temporal);
+            } else {
+                Cache__load(self, range);
+            }
+        }
+        if(thread_state != NULL) {
+            PyEval_RestoreThread(thread_state);
+        }
+        Cache__unlock_hierarchy(hierarchy, hierarchy_size);
+    }
+
+    if(lengths != Py_None) {
+        PyBuffer_Release(&lengths_view);
+    }
+    PyBuffer_Release(&addrs_view);
+    if(nogil < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* Cache_arrayload(Cache* self, PyObject *args, PyObject *kwds)
+{
+    return Cache__arrayaccess(self, args, kwds, 0);
+}
+
+static PyObject* Cache_arraystore(Cache* self, PyObject *args, PyObject *kwds)
+{
+    return Cache__arrayaccess(self, args, kwds, 1);
+}
+
+static int Cache__iteraccess(Cache* self, PyObject *addrs, addr_range range, int store,
+                             const char *name)
+{
+    // Loads or stores all addresses found in the addrs sequence. Returns -1 with exception set
+    // on error, 0 otherwise.
+    if(!PySequence_Check(addrs)) {
+        PyErr_Format(PyExc_ValueError, "%s element does not provide a sequence protocol", name);
+        return -1;
+    }
+
+    // Iterate of elements in addrs
+    PyObject *iter = PyObject_GetIter(addrs);
+    if(iter == NULL) {
+        PyErr_Format(PyExc_ValueError, "%s address is not iteratable", name);
+        return -1;
+    }
+    PyObject *addr;
+    while((addr = PyIter_Next(iter))) {
+        // For each address, build range:
+#if PY_MAJOR_VERSION >= 3
+        range.addr = PyLong_AsLong(addr);
+#else
+        range.addr = PyInt_AsLong(addr);
+#endif
+        Py_DECREF(addr);
+        if(range.addr == -1 && PyErr_Occurred()) {
+            Py_DECREF(iter);
+            return -1;
+        }
+        if(store) {
+            Cache__store(self, range, 0);
+        } else {
+            Cache__load(self, range);
+            // Swap cl_id is irrelevant here, since this is only called on first level cache
+        }
+    }
+    Py_DECREF(iter);
+    return PyErr_Occurred() ? -1 : 0;
+}
+
+static PyObject* Cache_loadstore(Cache* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *addrs;
+    addr_range range;
+    range.length = 1; // default to 1
+
+    static char *kwlist[] = {"addrs", "length", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|L", kwlist, &addrs, &range.length) ||
+       Cache__check_idle(self) != 0) {
+        return NULL;
+    }
+
+    // Get and check iterator
+    PyObject *addrs_iter = PyObject_GetIter(addrs);
+    if(addrs_iter == NULL) {
+        PyErr_SetString(PyExc_ValueError, "addrs is not iteratable");
+        return NULL;
+    }
+
+    // Iterate of elements in addrs
+    PyObject *loadstore_item, *load_addrs, *store_addrs;
+    while((loadstore_item = PyIter_Next(addrs_iter))) {
+        if(!PySequence_Check(loadstore_item)) {
+            PyErr_SetString(PyExc_ValueError, "addrs element does not provide a sequence protocol");
+            Py_DECREF(loadstore_item);
+            Py_DECREF(addrs_iter);
+            return NULL;
+        }
+        // PySys_WriteStdout("LENGTH=%i\n", PySequence_Length(loadstore_item));
+        if(PySequence_Length(loadstore_item) != 2){
+            PyErr_SetString(PyExc_ValueError, "each addrs element needs exactly two elements");
+            Py_DECREF(loadstore_item);
+            Py_DECREF(addrs_iter);
+            return NULL;
+        }
+        load_addrs = PySequence_GetItem(loadstore_item, 0);
+        store_addrs = PySequence_GetItem(loadstore_item, 1);
+        Py_DECREF(loadstore_item);
+        if(load_addrs == NULL || store_addrs == NULL) {
+            Py_XDECREF(load_addrs);
+            Py_XDECREF(store_addrs);
+            Py_DECREF(addrs_iter);
+            return NULL;
+        }
+
+        // Unless None (otherwise ignore loads and stores respectively)
+        if((load_addrs != Py_None &&
+            Cache__iteraccess(self, load_addrs, range, 0, "load") != 0) ||
+           (store_addrs != Py_None &&
+            Cache__iteraccess(self, store_addrs, range, 1, "store") != 0)) {
+            Py_DECREF(load_addrs);
+            Py_DECREF(store_addrs);
+            Py_DECREF(addrs_iter);
+            return NULL;
+        }
+
+        Py_DECREF(load_addrs);
+        Py_DECREF(store_addrs);
+    }
+    Py_DECREF(addrs_iter);
+    if(PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static int __get_record_buffer(PyObject *obj, Py_buffer *view, const char *name)
+{
+    // Acquires a buffer of packed access records (see access_record) and checks all ops. On
+    // error, an exception is set and -1 is returned.
+    if(PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS) != 0) {
+        PyErr_Format(PyExc_ValueError,
+                     "%s needs to be a contiguous buffer of access records", name);
+        return -1;
+    }
+    if(view->len % sizeof(access_record) != 0 ||
+       (size_t)view->buf % sizeof(long long) != 0) {
+        PyErr_Format(PyExc_ValueError,
+                     "%s needs to be an aligned buffer of %zu byte access records",
+                     name, sizeof(access_record));
+        PyBuffer_Release(view);
+        return -1;
+    }
+
+    const access_record *record = (const access_record*)view->buf;
+    long long n = view->len / sizeof(access_record);
+    for(long long i=0; i<n; i++) {
+        if(record[i].op != ACCESS_LOAD && record[i].op != ACCESS_STORE) {
+            PyErr_Format(PyExc_ValueError, "invalid op %u in record %lli", record[i].op, i);
+            PyBuffer_Release(view);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static PyObject* Cache_replay(Cache* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *records;
+    Py_buffer view;
+    int threads = 1;
+
+    static char *kwlist[] = {"records", "threads", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist, &records, &threads)) {
+        return NULL;
+    }
+    if(threads < 1) {
+        PyErr_SetString(PyExc_ValueError, "threads needs to be positive.");
+        return NULL;
+    }
+    if(__get_record_buffer(records, &view, "records") != 0) {
+        return NULL;
+    }
+
+    const access_record *record = (const access_record*)view.buf;
+    long long n = view.len / sizeof(access_record);
+
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    int partitions = 1;
+    int hierarchy_size, nogil = Cache__lock_hierarchy(self, hierarchy, &hierarchy_size);
+    if(nogil > 0) {
+        PyThreadState *thread_state = PyEval_SaveThread();
+        partitions = Cache__replay_parallel(self, record, n, threads);
+        PyEval_RestoreThread(thread_state);
+        Cache__unlock_hierarchy(hierarchy, hierarchy_size);
+    } else if(nogil == 0) {
+        Cache__replay(self, record, n);
+        Cache__unlock_hierarchy(hierarchy, hierarchy_size);
+    }
+
+    PyBuffer_Release(&view);
+    if(nogil < 0) {
+        return NULL;
+    }
+    return PyLong_FromLong(partitions);
+}
+
+static void __set_trace_error(long long error, int saved_errno, const char *path)
+{
+    // Sets the exception for TRACE_ERROR_IO (with saved_errno) or TRACE_ERROR_FORMAT
+    if(error == TRACE_ERROR_IO) {
+        errno = saved_errno;
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    } else {
+        PyErr_Format(PyExc_ValueError, "%s is not a valid trace file", path);
+    }
+}
+
+static PyObject* Cache_replay_file(Cache* self, PyObject *args, PyObject *kwds)
+{
+    const char *path;
+    int decode_threads = 0;
+
+    static char *kwlist[] = {"path", "decode_threads", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|i", kwlist, &path, &decode_threads)) {
+        return NULL;
+    }
+
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    int hierarchy_size, nogil = Cache__lock_hierarchy(self, hierarchy, &hierarchy_size);
+    if(nogil < 0) {
+        return NULL;
+    }
+    PyThreadState *thread_state = nogil ? PyEval_SaveThread() : NULL;
+    long long replayed = Cache__replay_file(self, path, decode_threads);
+    int saved_errno = errno;
+    if(thread_state != NULL) {
+        PyEval_RestoreThread(thread_state);
+    }
+    Cache__unlock_hierarchy(hierarchy, hierarchy_size);
+
+    if(replayed < 0) {
+        __set_trace_error(replayed, saved_errno, path);
+        return NULL;
+    }
+    return PyLong_FromLongLong(replayed);
+}
+
+static int __check_time_sampling(long long period, long long detailed, long long warming)
+{
+    // Checks the arguments of time_sampling__init. On error, an exception is set and -1 is
+    // returned.
+    if(period < 1) {
+        PyErr_SetString(PyExc_ValueError, "period needs to be positive");
+        return -1;
+    }
+    if(detailed < 1 || detailed > period) {
+        PyErr_SetString(PyExc_ValueError, "detailed needs to be between 1 and period");
+        return -1;
+    }
+    if(warming < -1) {
+        PyErr_SetString(PyExc_ValueError,
+                        "warming needs to be a number of records or -1 (warm all)");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject* __time_sampling_estimates(const time_sampling* sampling)
+{
+    // Returns a dict of the extrapolated counts of every cache of the sampled hierarchy, by name
+    PyObject *estimates = PyDict_New();
+    if(estimates == NULL) {
+        return NULL;
+    }
+    long long windows = sampling->windows + (sampling->window_records > 0);
+    long long detailed = (long long)sampling->window_sum + sampling->window_records;
+    for(int i=0; i<sampling->caches; i++) {
+        time_sampling_estimate estimate;
+        time_sampling__estimate(sampling, sampling->hierarchy[i], &estimate);
+        PyObject *level = Py_BuildValue(
+            "{sdsdsdsdsdsdsLsLsL}",
+            "HIT_count", estimate.counts[0], "HIT_count_error", estimate.errors[0],
+            "MISS_count", estimate.counts[1], "MISS_count_error", estimate.errors[1],
+            "EVICT_count", estimate.counts[2], "EVICT_count_error", estimate.errors[2],
+            "windows", windows, "detailed", detailed, "records", sampling->records);
+        if(level == NULL ||
+           PyDict_SetItemString(estimates, sampling->hierarchy[i]->name, level) != 0) {
+            Py_XDECREF(level);
+            Py_DECREF(estimates);
+            return NULL;
+        }
+        Py_DECREF(level);
+    }
+    return estimates;
+}
+
+static PyObject* Cache_warm(Cache* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *records;
+    Py_buffer view;
+
+    static char *kwlist[] = {"records", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &records) ||
+       __get_record_buffer(records, &view, "records") != 0) {
+        return NULL;
+    }
+
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    int hierarchy_size, nogil = Cache__lock_hierarchy(self, hierarchy, &hierarchy_size);
+    if(nogil >= 0) {
+        PyThreadState *thread_state = nogil ? PyEval_SaveThread() : NULL;
+        Cache__warm(self, (const access_record*)view.buf, view.len / sizeof(access_record));
+        if(thread_state != NULL) {
+            PyEval_RestoreThread(thread_state);
+        }
+        Cache__unlock_hierarchy(hierarchy, hierarchy_size);
+    }
+
+    PyBuffer_Release(&view);
+    if(nogil < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* Cache_replay_sampled(Cache* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *records;
+    Py_buffer view;
+    long long period, detailed, warming = -1;
+
+    static char *kwlist[] = {"records", "period", "detailed", "warming", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "OLL|L", kwlist,
+                                    &records, &period, &detailed, &warming) ||
+       __check_time_sampling(period, detailed, warming) != 0 ||
+       __get_record_buffer(records, &view, "records") != 0) {
+        return NULL;
+    }
+    time_sampling *sampling = PyMem_Malloc(sizeof(time_sampling));
+    if(sampling == NULL) {
+        PyBuffer_Release(&view);
+        return PyErr_NoMemory();
+    }
+
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    int hierarchy_size, nogil = Cache__lock_hierarchy(self, hierarchy, &hierarchy_size);
+    if(nogil >= 0) {
+        time_sampling__init(sampling, self, period, detailed, warming);
+        PyThreadState *thread_state = nogil ? PyEval_SaveThread() : NULL;
+        time_sampling__replay(sampling, (const access_record*)view.buf,
+                              view.len / sizeof(access_record));
+        if(thread_state != NULL) {
+            PyEval_RestoreThread(thread_state);
+        }
+        Cache__unlock_hierarchy(hierarchy, hierarchy_size);
+    }
+
+    PyBuffer_Release(&view);
+    PyObject *estimates = nogil >= 0 ? __time_sampling_estimates(sampling) : NULL;
+    PyMem_Free(sampling);
+    return estimates;
+}
+
+static PyObject* Cache_replay_file_sampled(Cache* self, PyObject *args, PyObject *kwds)
+{
+    const char *path;
+    long long period, detailed, warming = -1;
+
+    static char *kwlist[] = {"path", "period", "detailed", "warming", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "sLL|L", kwlist,
+                                    &path, &period, &detailed, &warming) ||
+       __check_time_sampling(period, detailed, warming) != 0) {
+        return NULL;
+    }
+    time_sampling *sampling = PyMem_Malloc(sizeof(time_sampling));
+    if(sampling == NULL) {
+        return PyErr_NoMemory();
+    }
+
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    int hierarchy_size, nogil = Cache__lock_hierarchy(self, hierarchy, &hierarchy_size);
+    if(nogil < 0) {
+        PyMem_Free(sampling);
+        return NULL;
+    }
+    time_sampling__init(sampling, self, period, detailed, warming);
+    PyThreadState *thread_state = nogil ? PyEval_SaveThread() : NULL;
+    long long replayed = time_sampling__replay_file(sampling, path);
+    int saved_errno = errno;
+    if(thread_state != NULL) {
+        PyEval_RestoreThread(thread_state);
+    }
+    Cache__unlock_hierarchy(hierarchy, hierarchy_size);
+
+    PyObject *estimates = NULL;
+    if(replayed < 0) {
+        __set_trace_error(replayed, saved_errno, path);
+    } else {
+        estimates = __time_sampling_estimates(sampling);
+    }
+    PyMem_Free(sampling);
+    return estimates;
+}
+
+static void __set_state_error(int error, int saved_errno, const char *path)
+{
+    // Sets the exception for STATE_ERROR_IO (with saved_errno), STATE_ERROR_FORMAT or
+    // STATE_ERROR_MISMATCH, path is NULL for states not read from a file
+    if(error == STATE_ERROR_IO) {
+        errno = saved_errno;
+        if(path != NULL) {
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        } else {
+            PyErr_SetFromErrno(PyExc_IOError);
+        }
+    } else if(error == STATE_ERROR_MISMATCH) {
+        PyErr_Format(PyExc_ValueError, "%s was saved from a different cache configuration",
+                     path != NULL ? path : "state");
+    } else {
+        PyErr_Format(PyExc_ValueError, "%s is not a valid cache state",
+                     path != NULL ? path : "state");
+    }
+}
+
+static PyObject* Cache_save_state(Cache* self, PyObject *args, PyObject *kwds)
+{
+    const char *path;
+
+    static char *kwlist[] = {"path", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &path)) {
+        return NULL;
+    }
+
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    int hierarchy_size, nogil = Cache__lock_hierarchy(self, hierarchy, &hierarchy_size);
+    if(nogil < 0) {
+        return NULL;
+    }
+    PyThreadState *thread_state = nogil ? PyEval_SaveThread() : NULL;
+    int error = Cache__save_state(self, path);
+    int saved_errno = errno;
+    if(thread_state != NULL) {
+        PyEval_RestoreThread(thread_state);
+    }
+    Cache__unlock_hierarchy(hierarchy, hierarchy_size);
+
+    if(error != 0) {
+        __set_state_error(error, saved_errno, path);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* Cache_restore_state(Cache* self, PyObject *args, PyObject *kwds)
+{
+    const char *path;
+
+    static char *kwlist[] = {"path", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &path)) {
+        return NULL;
+    }
+
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    int hierarchy_size, nogil = Cache__lock_hierarchy(self, hierarchy, &hierarchy_size);
+    if(nogil < 0) {
+        return NULL;
+    }
+    PyThreadState *thread_state = nogil ? PyEval_SaveThread() : NULL;
+    int error = Cache__restore_state(self, path);
+    int saved_errno = errno;
+    if(thread_state != NULL) {
+        PyEval_RestoreThread(thread_state);
+    }
+    Cache__unlock_hierarchy(hierarchy, hierarchy_size);
+
+    if(error != 0) {
+        __set_state_error(error, saved_errno, path);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* Cache_reduce(Cache* self)
+{
+    // Pickles self as its constructor arguments (linked caches are pickled along) and its state
+    if(Cache__check_idle(self) != 0) {
+        return NULL;
+    }
+    PyObject *state = PyBytes_FromStringAndSize(NULL, Cache__state_size(self));
+    if(state == NULL) {
+        return NULL;
+    }
+    Cache__get_state(self, PyBytes_AS_STRING(state));
+    PyObject *links[4] = {self->load_from, self->store_to, self->victims_to, self->tlb};
+    for(int i=0; i<4; i++) {
+        links[i] = links[i] != NULL ? links[i] : Py_None;
+    }
+    return Py_BuildValue(
+        "(O(sllliiiilOOOiiiiiiiiiLiiiiiLli)(ON))", Py_TYPE(self),
+        self->name, self->sets, self->ways, self->cl_size, self->replacement_policy_id,
+        self->write_back, self->write_allocate, self->write_combining, self->subblock_size,
+        links[0], links[1], links[2], self->swap_on_load,
+        self->verbosity, self->tag_index_threshold, self->rrip_bits, self->rrip_insert,
+        self->rrip_hit_promotion, self->dueling.leader_sets, self->dueling.psel_bits,
+        self->dueling.follower, self->dueling.sample_interval, self->set_index_function,
+        self->slices, self->prefetcher, self->prefetch_distance, self->prefetch_degree,
+        self->prefetch_latency, self->sampling, self->sampling_function, links[3], state);
+}
+
+static PyObject* Cache_fork(Cache* self, PyObject *args)
+{
+    // Forks the hierarchy of self (see Cache__fork_hierarchy), returns a dict mapping every
+    // cache of the hierarchy to its fork
+    if(Cache__check_idle(self) != 0) {
+        return NULL;
+    }
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    Cache* forks[HIERARCHY_MAX_CACHES];
+    int n = Cache__get_hierarchy(self, hierarchy, HIERARCHY_MAX_CACHES);
+    int allocated = 0;
+    PyObject *result = PyDict_New();
+    while(result != NULL && allocated < n) {
+        PyTypeObject *type = Py_TYPE(hierarchy[allocated]);
+        forks[allocated] = (Cache*)type->tp_alloc(type, 0);
+        if(forks[allocated] == NULL) {
+            break;
+        }
+        allocated++;
+    }
+    int error = allocated < n ? STATE_ERROR_IO : Cache__fork_hierarchy(self, forks);
+    int saved_errno = errno;
+    if(error == 0) {
+        // Forks got the links and the name of their originals, they need their own references
+        // and copies
+        for(int i=0; i<n; i++) {
+            Py_XINCREF(forks[i]->load_from);
+            Py_XINCREF(forks[i]->store_to);
+            Py_XINCREF(forks[i]->victims_to);
+            Py_XINCREF(forks[i]->tlb);
+            char *name = PyMem_Malloc(strlen(hierarchy[i]->name)+1);
+            if(name != NULL) {
+                strcpy(name, hierarchy[i]->name);
+            }
+            forks[i]->name = name;
+            if(name == NULL && error == 0) {
+                PyErr_NoMemory();
+                error = STATE_ERROR_IO;
+            }
+        }
+    }
+    for(int i=0; i<n && error == 0; i++) {
+        if(PyDict_SetItem(result, (PyObject*)hierarchy[i], (PyObject*)forks[i]) != 0) {
+            error = 1;
+        }
+    }
+    for(int i=0; i<allocated; i++) {
+        Py_DECREF(forks[i]);
+    }
+    if(error != 0) {
+        Py_XDECREF(result);
+        if(PyErr_Occurred()) {
+            return NULL;
+        } else if(error == STATE_ERROR_MISMATCH) {
+            PyErr_SetString(PyExc_ValueError, "caches of a CoherenceDomain cannot be forked");
+        } else {
+            __set_state_error(error, saved_errno, NULL);
+        }
+        return NULL;
+    }
+    return result;
+}
+
+static PyObject* Cache_setstate(Cache* self, PyObject *args)
+{
+    PyObject *tlb, *tmp;
+    Py_buffer state;
+
+    if(!PyArg_ParseTuple(args, "(Os*)", &tlb, &state)) {
+        return NULL;
+    }
+    if(tlb != Py_None && !PyObject_IsInstance(tlb, (PyObject*)Py_TYPE(self))) {
+        PyErr_SetString(PyExc_TypeError, "tlb needs to be backend.Cache or None");
+        PyBuffer_Release(&state);
+        return NULL;
+    }
+    if(Cache__check_idle(self) != 0) {
+        PyBuffer_Release(&state);
+        return NULL;
+    }
+    tmp = self->tlb;
+    Py_XINCREF(tlb != Py_None ? tlb : NULL);
+    self->tlb = tlb != Py_None ? tlb : NULL;
+    Py_XDECREF(tmp);
+    int error = Cache__set_state(self, state.buf, (size_t)state.len);
+    int saved_errno = errno;
+    PyBuffer_Release(&state);
+    if(error != 0) {
+        __set_state_error(error, saved_errno, NULL);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* Cache_contains(Cache* self, PyObject *args, PyObject *kwds) {
+    long long addr;
+
+    static char *kwlist[] = {"addr", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "L", kwlist, &addr)) {
+        return NULL;
+    }
+    if(Cache__check_idle(self) != 0) {
+        return NULL;
+    }
+
+    long cl_id = Cache__get_cacheline_id(self, addr);
+    long set_id = Cache__get_set_id(self, cl_id);
+
+    if(Cache__get_location(self, cl_id, set_id) != -1) {
+        Py_RETURN_TRUE;
+    }
+    Py_RETURN_FALSE;
+}
+
+static PyObject* Cache_force_write_back(Cache* self) {
+    // PySys_WriteStdout("%s force_write_back\n", self->name);
+    Cache* hierarchy[HIERARCHY_MAX_CACHES];
+    int n, nogil = Cache__lock_hierarchy(self, hierarchy, &n);
+    if(nogil < 0) {
+        return NULL;
+    }
+    PyThreadState *thread_state = nogil ? PyEval_SaveThread() : NULL;
+    Cache__force_write_back(self);
+    if(thread_state != NULL) {
+        PyEval_RestoreThread(thread_state);
+    }
+    Cache__unlock_hierarchy(hierarchy, n);
+    Py_RETURN_NONE;
+}
+
+static PyObject* Cache_reset_stats(Cache* self) {
+    if(Cache__check_idle(self) != 0) {
+        return NULL;
+    }
+    Cache__reset_stats(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject* Cache_sampling_estimate(Cache* self) {
+    sampling_estimate estimate;
+    Cache__estimate(self, &estimate);
+    return Py_BuildValue("{sdsdsdsdsd}", "scale", estimate.scale,
+                         "misses", estimate.misses, "misses_error", estimate.misses_error,
+                         "miss_ratio", estimate.miss_ratio,
+                         "miss_ratio_error", estimate.miss_ratio_error);
+}
+
+static PyObject* Cache_count_invalid_entries(Cache* self) {
+    if(Cache__check_idle(self) != 0) {
+        return NULL;
+    }
+    int count = 0;
+    for(long i=0; i<self->ways*self->sampled_sets; i++) {
+        if(self->tags[i] == CACHE_TAG_INVALID) {
+            count++;
+        }
+    }
+    return Py_BuildValue("i", count);
+}
+
+static PyObject* Cache_mark_all_invalid(Cache* self) {
+    if(Cache__check_idle(self) != 0) {
+        return NULL;
+    }
+    Cache__clear_entries(self);
+    if(self->coherence != NULL) {
+        // Forget that the core held these lines
+        CoherenceDomain__collect(self->coherence);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef Cache_methods[] = {
+    {"load", (PyCFunction)Cache_load, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"iterload", (PyCFunction)Cache_iterload, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"store", (PyCFunction)Cache_store, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"iterstore", (PyCFunction)Cache_iterstore, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"arrayload", (PyCFunction)Cache_arrayload, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"arraystore", (PyCFunction)Cache_arraystore, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"loadstore", (PyCFunction)Cache_loadstore, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"replay", (PyCFunction)Cache_replay, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"replay_file", (PyCFunction)Cache_replay_file, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"warm", (PyCFunction)Cache_warm, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"replay_sampled", (PyCFunction)Cache_replay_sampled, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"replay_file_sampled", (PyCFunction)Cache_replay_file_sampled,
+     METH_VARARGS|METH_KEYWORDS, NULL},
+    {"save_state", (PyCFunction)Cache_save_state, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"restore_state", (PyCFunction)Cache_restore_state, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"__reduce__", (PyCFunction)Cache_reduce, METH_VARARGS, NULL},
+    {"__setstate__", (PyCFunction)Cache_setstate, METH_VARARGS, NULL},
+    {"fork", (PyCFunction)Cache_fork, METH_VARARGS, NULL},
+    {"contains", (PyCFunction)Cache_contains, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"force_write_back", (PyCFunction)Cache_force_write_back, METH_VARARGS, NULL},
+    {"reset_stats", (PyCFunction)Cache_reset_stats, METH_VARARGS, NULL},
+    {"sampling_estimate", (PyCFunction)Cache_sampling_estimate, METH_VARARGS, NULL},
+    {"count_invalid_entries", (PyCFunction)Cache_count_invalid_entries, METH_VARARGS, NULL},
+    {"mark_all_invalid", (PyCFunction)Cache_mark_all_invalid, METH_VARARGS, NULL},
+
+    /* Sentinel */
+    {NULL, NULL}
+};
+
+static PyObject* Cache_cached_get(Cache* self) {
+    if(Cache__check_idle(self) != 0) {
+        return NULL;
+    }
+    PyObject* cached_set = PySet_New(NULL);
+    for(long i=0; i<self->sampled_sets*self->ways; i++) {
+        // Skip invalidated entries
+        if(self->tags[i] == CACHE_TAG_INVALID) {
+            continue;
+        }
+
+        // For each cached cacheline expand to all cached addresses:
+        for(long j=0; j<self->cl_size; j++) {
+            PyObject* addr = PyLong_FromLong(
+                Cache__get_addr_from_cl_id(self, self->tags[i])+j);
+            PySet_Add(cached_set, addr);
+            Py_DECREF(addr);
+        }
+    }
+    return cached_set;
+}
+
+static PyObject* Cache_psel_samples_get(Cache* self) {
+    if(Cache__check_idle(self) != 0) {
+        return NULL;
+    }
+    PyObject* samples = PyList_New(self->dueling.samples_length);
+    if(samples == NULL) {
+        return NULL;
+    }
+    for(long long i=0; i<self->dueling.samples_length; i++) {
+        PyList_SET_ITEM(samples, i, PyLong_FromLong(self->dueling.samples[i]));
+    }
+    return samples;
+}
+
+static PyObject* Cache_verbosity_get(Cache* self) {
+    return PyLong_FromLong(self->verbosity);
+}
+
+static int Cache_verbosity_set(Cache* self, PyObject* value) {
+    if(value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "cannot delete verbosity");
+        return -1;
+    }
+    long verbosity = PyLong_AsLong(value);
+    if(verbosity == -1 && PyErr_Occurred()) {
+        return -1;
+    }
+    if(Cache__check_idle(self) != 0) {
+        return -1;
+    }
+    self->verbosity = (int)verbosity;
+    // Specialized kernels do not generate any output
+    Cache__bind_kernel(self);
+    return 0;
+}
+
+static PyObject* Cache__link_get(PyObject* link) {
+    if(link == NULL) {
+        Py_RETURN_NONE;
+    }
+    Py_INCREF(link);
+    return link;
+}
+
+static int Cache__link_set(Cache* self, PyObject** link, PyObject* value, const char* name) {
+    // Deleting a link is the same as setting it to None
+    if(value != NULL && value != Py_None && !PyObject_IsInstance(value, (PyObject*)Py_TYPE(self))) {
+        PyErr_Format(PyExc_TypeError, "%s needs to be backend.Cache or None", name);
+        return -1;
+    }
+    // Relinking would free or add levels while they are simulated with the GIL released
+    if(Cache__check_idle(self) != 0) {
+        return -1;
+    }
+    PyObject* tmp = *link;
+    if(value == Py_None) {
+        value = NULL;
+    }
+    Py_XINCREF(value);
+    *link = value;
+    Py_XDECREF(tmp);
+    return 0;
+}
+
+static PyObject* Cache_load_from_get(Cache* self) {
+    return Cache__link_get(self->load_from);
+}
+
+static int Cache_load_from_set(Cache* self, PyObject* value) {
+    return Cache__link_set(self, &self->load_from, value, "load_from");
+}
+
+static PyObject* Cache_store_to_get(Cache* self) {
+    return Cache__link_get(self->store_to);
+}
+
+static int Cache_store_to_set(Cache* self, PyObject* value) {
+    return Cache__link_set(self, &self->store_to, value, "store_to");
+}
+
+static PyObject* Cache_victims_to_get(Cache* self) {
+    return Cache__link_get(self->victims_to);
+}
+
+static int Cache_victims_to_set(Cache* self, PyObject* value) {
+    return Cache__link_set(self, &self->victims_to, value, "victims_to");
+}
+
+static PyObject* Cache_tlb_get(Cache* self) {
+    return Cache__link_get(self->tlb);
+}
+
+static int Cache_tlb_set(Cache* self, PyObject* value) {
+    // The kernels translate through the tlb without checking its type
+    return Cache__link_set(self, &self->tlb, value, "tlb");
+}
+
+static PyGetSetDef Cache_getset[] = {
+    {"cached", (getter)Cache_cached_get, NULL, "cache", NULL},
+    {"load_from", (getter)Cache_load_from_get, (setter)Cache_load_from_set,
+     "load parent Cache object (cache level which is closer to main memory)", NULL},
+    {"store_to", (getter)Cache_store_to_get, (setter)Cache_store_to_set,
+     "store parent Cache object (cache level which is closer to main memory)", NULL},
+    {"victims_to", (getter)Cache_victims_to_get, (setter)Cache_victims_to_set,
+     "Cache object where victims will be send to (closer to main memory, None if victims vanish)",
+     NULL},
+    {"tlb", (getter)Cache_tlb_get, (setter)Cache_tlb_set,
+     "Cache object translating the pages of all loads and stores to this level (None if none)",
+     NULL},
+    {"verbosity", (getter)Cache_verbosity_get, (setter)Cache_verbosity_set,
+     "verbosity level of output", NULL},
+    {"drrip_psel_samples", (getter)Cache_psel_samples_get, NULL,
+     "PSEL values recorded every drrip_sample_interval policy updates (since reset_stats)", NULL},
+
+    /* Sentinel */
+    {NULL},
+};
+
+static int Cache_init(Cache *self, PyObject *args, PyObject *kwds);
+
+static PyTypeObject CacheType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cachesim.backend.Cache",  /* tp_name */
+    sizeof(Cache),             /* tp_basicsize */
+    0,                         /* tp_itemsize */
+    (destructor)Cache_dealloc, /* tp_dealloc */
+    0,                         /* tp_print */
+    0,                         /* tp_getattr */
+    0,                         /* tp_setattr */
+    0,                         /* tp_reserved */
+    0,                         /* tp_repr */
+    0,                         /* tp_as_number */
+    0,                         /* tp_as_sequence */
+    0,                         /* tp_as_mapping */
+    0,                         /* tp_hash  */
+    0,                         /* tp_call */
+    0,                         /* tp_str */
+    0,                         /* tp_getattro */
+    0,                         /* tp_setattro */
+    0,                         /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,        /* tp_flags */
+    "Cache objects",           /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    Cache_methods,             /* tp_methods */
+    Cache_members,             /* tp_members */
+    Cache_getset,              /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)Cache_init,      /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+};
+
+static int Cache_init(Cache *self, PyObject *args, PyObject *kwds) {
+    PyObject *store_to, *load_from, *victims_to, *tmp;
+    const char *name;
+    self->verbosity = 0;
+    static char *kwlist[] = {"name", "sets", "ways", "cl_size",
+                             "replacement_policy_id", "write_back", "write_allocate",
+                             "write_combining", "subblock_size",
+                             "load_from", "store_to", "victims_to",
+                             "swap_on_load", "verbosity", "tag_index_threshold",
+                             "rrip_bits", "rrip_insert", "rrip_hit_promotion",
+                             "drrip_leader_sets", "drrip_psel_bits", "drrip_follower",
+                             "drrip_sample_interval", "set_index_function", "slices",
+                             "prefetcher", "prefetch_distance", "prefetch_degree",
+                             "prefetch_latency", "sampling", "sampling_function", NULL};
+    self->tag_index_threshold = TAG_INDEX_DEFAULT_THRESHOLD;
+    self->rrip_bits = RRIP_DEFAULT_BITS;
+    self->rrip_insert = -1;
+    self->rrip_hit_promotion = 0;
+    self->dueling.leader_sets = DRRIP_DEFAULT_LEADER_SETS;
+    self->dueling.psel_bits = DRRIP_DEFAULT_PSEL_BITS;
+    self->dueling.follower = 0;
+    self->dueling.sample_interval = 0;
+    self->set_index_function = SET_INDEX_MODULO;
+    self->slices = 1;
+    self->prefetcher = PREFETCH_NONE;
+    self->prefetch_distance = 1;
+    self->prefetch_degree = 1;
+    self->prefetch_latency = 0;
+    self->sampling = 1;
+    self->sampling_function = SAMPLE_INTERVAL;
+    self->coherence = NULL;
+    self->core = -1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "sIIIiiiiiOOOi|iiiiiiiiLiiiiiLli", kwlist,
+                                     &name, &self->sets, &self->ways, &self->cl_size,
+                                     &self->replacement_policy_id,
+                                     &self->write_back, &self->write_allocate,
+                                     &self->write_combining, &self->subblock_size,
+                                     &load_from, &store_to, &victims_to,
+                                     &self->swap_on_load, &self->verbosity,
+                                     &self->tag_index_threshold, &self->rrip_bits,
+                                     &self->rrip_insert, &self->rrip_hit_promotion,
+                                     &self->dueling.leader_sets, &self->dueling.psel_bits,
+                                     &self->dueling.follower, &self->dueling.sample_interval,
+                                     &self->set_index_function, &self->slices,
+                                     &self->prefetcher, &self->prefetch_distance,
+                                     &self->prefetch_degree, &self->prefetch_latency,
+                                     &self->sampling, &self->sampling_function)) {
+        return -1;
+    }
+
+    // Keep a copy of name, the argument might not outlive self (e.g., when unpickled)
+    char *name_copy = PyMem_Malloc(strlen(name)+1);
+    if(name_copy == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    strcpy(name_copy, name);
+    PyMem_Free((char*)self->name);
+    self->name = name_copy;
+
+    // Handle load_from parent (if given)
+    if(load_from != Py_None) {
+        if(!PyObject_IsInstance(load_from, (PyObject*)&CacheType)) {
+            PyErr_SetString(PyExc_TypeError, "load_from needs to be backend.Cache or None");
+            return -1;
+        }
+        tmp = self->load_from;
+        Py_INCREF(load_from);
+        self->load_from = load_from;
+        Py_XDECREF(tmp);
+    } else {
+        self->load_from = NULL;
+    }
+
+    // Handle store_to parent (if given)
+    if(store_to != Py_None) {
+        if(!PyObject_IsInstance(store_to, (PyObject*)&CacheType)) {
+            PyErr_SetString(PyExc_TypeError, "store_to needs to be backend.Cache or None");
+            return -1;
+        }
+        tmp = self->store_to;
+        Py_INCREF(store_to);
+        self->store_to = store_to;
+        Py_XDECREF(tmp);
+    } else {
+        self->store_to = NULL;
+    }
+
+    // Handle victims_to parent (if given)
+    if(victims_to != Py_None) {
+        if(!PyObject_IsInstance(victims_to, (PyObject*)&CacheType)) {
+            PyErr_SetString(
+                PyExc_TypeError, "victims_to needs to be of type backend.Cache or None");
+            return -1;
+        }
+        tmp = self->victims_to;
+        Py_INCREF(victims_to);
+        self->victims_to = victims_to;
+        Py_XDECREF(tmp);
+    } else {
+        self->victims_to = NULL;
+    }
+
+    // TODO validate store, load and victim paths so no null objects will be used until LLC/mem? is hit
+    // should we introduce a memory object in c?
+
+    // Check replacement policy and its parameters
+    if(self->replacement_policy_id < 0 || self->replacement_policy_id >= REPLACEMENT_POLICY_COUNT) {
+        PyErr_SetString(PyExc_ValueError, "replacement_policy_id needs to be between 0 and 7.");
+        return -1;
+    }
+    if(self->replacement_policy_id == 4 && !isPowerOfTwo(self->ways)) {
+        PyErr_SetString(PyExc_ValueError, "PLRU requires ways to be a power of two.");
+        return -1;
+    }
+    if(self->rrip_bits < 1 || self->rrip_bits > 8) {
+        PyErr_SetString(PyExc_ValueError, "rrip_bits needs to be between 1 and 8.");
+        return -1;
+    }
+    if(self->rrip_insert == -1) {
+        self->rrip_insert = (1 << self->rrip_bits) - 2;
+    }
+    if(self->rrip_insert < 0 || self->rrip_insert >= 1 << self->rrip_bits) {
+        PyErr_SetString(PyExc_ValueError, "rrip_insert needs to be between 0 and 2**rrip_bits-1.");
+        return -1;
+    }
+    if(self->rrip_hit_promotion != 0 && self->rrip_hit_promotion != 1) {
+        PyErr_SetString(PyExc_ValueError, "rrip_hit_promotion needs to be 0 (HP) or 1 (FP).");
+        return -1;
+    }
+    if(self->dueling.leader_sets < 1) {
+        PyErr_SetString(PyExc_ValueError, "drrip_leader_sets needs to be positive.");
+        return -1;
+    }
+    if(self->dueling.psel_bits < 1 || self->dueling.psel_bits > 30) {
+        PyErr_SetString(PyExc_ValueError, "drrip_psel_bits needs to be between 1 and 30.");
+        return -1;
+    }
+    if(self->dueling.follower < 0 || self->dueling.follower > 2) {
+        PyErr_SetString(PyExc_ValueError, "drrip_follower needs to be between 0 and 2.");
+        return -1;
+    }
+    if(self->dueling.sample_interval < 0) {
+        PyErr_SetString(PyExc_ValueError, "drrip_sample_interval must not be negative.");
+        return -1;
+    }
+
+    // Check set index function
+    if(self->set_index_function < SET_INDEX_MODULO ||
+       self->set_index_function > SET_INDEX_INTEL_SLICE) {
+        PyErr_SetString(PyExc_ValueError, "set_index_function needs to be between 0 and 2.");
+        return -1;
+    }
+    if(self->slices < 1 || self->slices > INTEL_SLICE_MAX_SLICES || !isPowerOfTwo(self->slices) ||
+       self->sets % self->slices != 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "slices needs to be 1, 2, 4 or 8 and a divisor of sets.");
+        return -1;
+    }
+
+    // Check prefetcher
+    if(self->prefetcher < PREFETCH_NONE || self->prefetcher > PREFETCH_STREAMER) {
+        PyErr_SetString(PyExc_ValueError, "prefetcher needs to be between 0 and 4.");
+        return -1;
+    }
+    if(self->prefetch_distance < 1 || self->prefetch_degree < 1 || self->prefetch_latency < 0) {
+        PyErr_SetString(PyExc_ValueError, "prefetch_distance and prefetch_degree need to be "
+                                          "positive, prefetch_latency must not be negative.");
+        return -1;
+    }
+
+    // Check set sampling
+    if(self->sampling < 1) {
+        PyErr_SetString(PyExc_ValueError, "sampling needs to be positive.");
+        return -1;
+    }
+    if(self->sampling_function != SAMPLE_INTERVAL && self->sampling_function != SAMPLE_HASH) {
+        PyErr_SetString(PyExc_ValueError, "sampling_function needs to be 0 or 1.");
+        return -1;
+    }
+    if(self->sampling > 1 && self->swap_on_load) {
+        PyErr_SetString(PyExc_ValueError, "sampling is not supported with swap_on_load.");
+        return -1;
+    }
+
+    // Free previous state, in case __init__ is called again
+    Cache__free_state(self);
+    if(Cache__alloc_state(self) != 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    // Check if cl_size is of power^2
+    if(!isPowerOfTwo(self->cl_size)) {
+        // throw exception
+        PyErr_SetString(PyExc_ValueError, "cl_size needs to be a power of two.");
+        return -1;
+    }
+
+    // Get number of bits in cacheline adressing
+    self->cl_bits = log2_uint((unsigned long)self->cl_size);
+
+    // Check if subblock_size is a divisor of cl_size
+    if(self->cl_size % self->subblock_size != 0) {
+        // throw exception
+        PyErr_SetString(PyExc_ValueError, "subblock_size needs to be a devisor of cl_size.");
+        return -1;
+    }
+    self->subblock_bits = self->cl_size/self->subblock_size;
+
+    // Allocate subblock_bitfield
+    if(self->write_combining && self->subblock_size != self->cl_size) {
+        // Subblocking will be used:
+        // since char is used as type, we need upper(subblock_bits/8) chars per placement
+        self->subblock_bitfield = PyMem_New(
+            char, BITNSLOTS(self->sets*self->ways*self->subblock_bits));
+        // Clear all bits
+        memset(self->subblock_bitfield, 0, BITNSLOTS(self->sets*self->ways*self->subblock_bits));
+    } else {
+        // Subblocking won't be used:
+        self->subblock_bitfield = NULL;
+    }
+
+    Cache_reset_stats(self);
+
+    if(self->verbosity >= 1) {
+        PySys_WriteStdout("CACHE sets=%li ways=%li cl_size=%li cl_bits=%li\n",
+                          self->sets, self->ways, self->cl_size, self->cl_bits);
+    }
+
+    return 0;
+}
+
+static Cache** CoherenceDomain__lock(CoherenceDomain* self, int *n, int *nogil) {
+    // Marks all caches reachable from any core as busy (see Cache__lock_hierarchy). Returns
+    // them (to be passed to CoherenceDomain__unlock) or NULL with an exception set.
+    if(self->private_caches == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "coherence domain is not initialized");
+        return NULL;
+    }
+    Cache** caches = PyMem_New(Cache*, self->cores*HIERARCHY_MAX_CACHES);
+    if(caches == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    *n = 0;
+    for(int core=0; core<self->cores; core++) {
+        Cache* hierarchy[HIERARCHY_MAX_CACHES];
+        int hierarchy_size = Cache__get_hierarchy(
+            CoherenceDomain__first_level(self, core), hierarchy, HIERARCHY_MAX_CACHES);
+        for(int i=0; i<hierarchy_size; i++) {
+            int known = 0;
+            for(int j=0; j<*n; j++) {
+                known |= caches[j] == hierarchy[i];
+            }
+            if(!known) {
+                caches[(*n)++] = hierarchy[i];
+            }
+        }
+    }
+    *nogil = 1;
+    for(int i=0; i<*n; i++) {
+        if(caches[i]->busy) {
+            PyErr_Format(PyExc_RuntimeError,
+                         "cache %s is already being simulated by another thread",
+                         caches[i]->name);
+            PyMem_Del(caches);
+            return NULL;
+        }
+        if(caches[i]->verbosity > 0) {
+            *nogil = 0;
+        }
+    }
+    for(int i=0; i<*n; i++) {
+        caches[i]->busy = 1;
+    }
+    return caches;
+}
 
-        Py_DECREF(addr);
+static void CoherenceDomain__unlock(Cache** caches, int n) {
+    Cache__unlock_hierarchy(caches, n);
+    PyMem_Del(caches);
+}
+
+static void CoherenceDomain_dealloc(CoherenceDomain* self) {
+    CoherenceDomain__free(self);
+    Py_XDECREF(self->first_levels);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static int CoherenceDomain__check_core(CoherenceDomain* self, int core) {
+    if(core < 0 || core >= self->cores) {
+        PyErr_Format(PyExc_ValueError, "core needs to be between 0 and %i", self->cores-1);
+        return -1;
     }
-    Py_DECREF(addrs_iter);
-    Py_RETURN_NONE;
+    return 0;
 }
 
-static PyObject* Cache_store(Cache* self, PyObject *args, PyObject *kwds)
+static PyObject* CoherenceDomain_load(CoherenceDomain* self, PyObject *args, PyObject *kwds)
 {
+    int core, n, nogil;
     addr_range range;
     range.length = 1; // default to 1
 
-    static char *kwlist[] = {"addr", "length", NULL};
-    PyArg_ParseTupleAndKeywords(args, kwds, "L|L", kwlist, &range.addr, &range.length);
-
-    // Handling ranges in c tremendously increases the speed for multiple elements
-    Cache__store(self, range, 0);
-
+    static char *kwlist[] = {"core", "addr", "length", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "iL|L", kwlist,
+                                    &core, &range.addr, &range.length) ||
+       CoherenceDomain__check_core(self, core) != 0) {
+        return NULL;
+    }
+    Cache** caches = CoherenceDomain__lock(self, &n, &nogil);
+    if(caches == NULL) {
+        return NULL;
+    }
+    CoherenceDomain__load(self, core, range);
+    CoherenceDomain__unlock(caches, n);
     Py_RETURN_NONE;
 }
 
-static PyObject* Cache_iterstore(Cache* self, PyObject *args, PyObject *kwds)
+static PyObject* CoherenceDomain_store(CoherenceDomain* self, PyObject *args, PyObject *kwds)
 {
-    PyObject *addrs;
+    int core, n, nogil;
     addr_range range;
     range.length = 1; // default to 1
+    int non_temporal = 0;
 
-    static char *kwlist[] = {"addrs", "length", NULL};
-    PyArg_ParseTupleAndKeywords(args, kwds, "O|L", kwlist, &addrs, &range.length);
-    Py_INCREF(addrs);
-
-    // Get and check iterator
-    PyObject *addrs_iter = PyObject_GetIter(addrs);
-    Py_DECREF(addrs);
-    if(addrs_iter == NULL) {
-        PyErr_SetString(PyExc_ValueError, "addrs is not iteratable");
+    static char *kwlist[] = {"core", "addr", "length", "non_temporal", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "iL|Lp", kwlist,
+                                    &core, &range.addr, &range.length, &non_temporal) ||
+       CoherenceDomain__check_core(self, core) != 0) {
         return NULL;
     }
-
-    // Iterate of elements in addrs
-    PyObject *addr;
-    while((addr = PyIter_Next(addrs_iter))) {
-        // For each address, build range:
-#if PY_MAJOR_VERSION >= 3
-        range.addr = PyLong_AsLong(addr);
-#else
-        range.addr = PyInt_AsLong(addr);
-#endif
-        Cache__store(self, range, 0);
-
-        Py_DECREF(addr);
+    Cache** caches = CoherenceDomain__lock(self, &n, &nogil);
+    if(caches == NULL) {
+        return NULL;
     }
-    Py_DECREF(addrs_iter);
+    CoherenceDomain__store(self, core, range, non_temporal);
+    CoherenceDomain__unlock(caches, n);
     Py_RETURN_NONE;
 }
 
-static PyObject* Cache_loadstore(Cache* self, PyObject *args, PyObject *kwds)
+static PyObject* CoherenceDomain_replay(CoherenceDomain* self, PyObject *args, PyObject *kwds)
 {
-    PyObject *addrs;
-    addr_range range;
-    range.length = 1; // default to 1
-
-    static char *kwlist[] = {"addrs", "length", NULL};
-    PyArg_ParseTupleAndKeywords(args, kwds, "O|L", kwlist, &addrs, &range.length);
-    Py_INCREF(addrs);
+    PyObject *traces, *timestamps = Py_None;
+    long long quantum = 1;
 
-    // Get and check iterator
-    PyObject *addrs_iter = PyObject_GetIter(addrs);
-    Py_DECREF(addrs);
-    if(addrs_iter == NULL) {
-        PyErr_SetString(PyExc_ValueError, "addrs is not iteratable");
+    static char *kwlist[] = {"traces", "timestamps", "quantum", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|OL", kwlist,
+                                    &traces, &timestamps, &quantum)) {
+        return NULL;
+    }
+    if(!PySequence_Check(traces) || PySequence_Size(traces) != self->cores) {
+        PyErr_Format(PyExc_ValueError, "traces needs to be a sequence of %i record buffers",
+                     self->cores);
+        return NULL;
+    }
+    if(timestamps != Py_None &&
+       (!PySequence_Check(timestamps) || PySequence_Size(timestamps) != self->cores)) {
+        PyErr_Format(PyExc_ValueError,
+                     "timestamps needs to be None or a sequence of %i integer buffers",
+                     self->cores);
         return NULL;
     }
 
-    // Iterate of elements in addrs
-    PyObject *loadstore_item, *load_addrs, *store_addrs, *addr, *load_iter, *store_iter;
-    while((loadstore_item = PyIter_Next(addrs_iter))) {
-        if(!PySequence_Check(loadstore_item)) {
-            PyErr_SetString(PyExc_ValueError, "addrs element does not provide a sequence protocol");
-            return NULL;
+    Py_buffer views[COHERENCE_MAX_CORES];
+    const access_record* records[COHERENCE_MAX_CORES];
+    long long lengths[COHERENCE_MAX_CORES];
+    long long* stamps[COHERENCE_MAX_CORES] = {NULL};
+    int acquired = 0, error = 0;
+    for(; acquired<self->cores && !error; acquired++) {
+        PyObject* trace = PySequence_GetItem(traces, acquired);
+        error = trace == NULL || __get_record_buffer(trace, &views[acquired], "trace") != 0;
+        Py_XDECREF(trace);
+        if(error) {
+            break;
         }
-        // PySys_WriteStdout("LENGTH=%i\n", PySequence_Length(loadstore_item));
-        if(PySequence_Length(loadstore_item) != 2){
-            PyErr_SetString(PyExc_ValueError, "each addrs element needs exactly two elements");
-            return NULL;
+        records[acquired] = (const access_record*)views[acquired].buf;
+        lengths[acquired] = views[acquired].len / sizeof(access_record);
+    }
+    for(int core=0; core<self->cores && !error && timestamps != Py_None; core++) {
+        // Copied to plain long long arrays, so any integer buffer can be used
+        Py_buffer view;
+        int is_signed;
+        PyObject* stamp = PySequence_GetItem(timestamps, core);
+        error = stamp == NULL || __get_int_buffer(stamp, &view, &is_signed, "timestamps") != 0;
+        Py_XDECREF(stamp);
+        if(error) {
+            break;
         }
-        load_addrs = PySequence_GetItem(loadstore_item, 0);
-        store_addrs = PySequence_GetItem(loadstore_item, 1);
-
-        // Unless None (otherwise ignore loads)
-        if(load_addrs != Py_None) {
-            if(!PySequence_Check(load_addrs)) {
-                PyErr_SetString(
-                    PyExc_ValueError, "load element does not provide a sequence protocol");
-                return NULL;
-            }
-
-            // FIXME maybe this is better: Pass along to iterstore
-            //Cache_iterstore(self, store_addrs, length)
-
-            // Iterate of elements in load_addrs
-            load_iter = PyObject_GetIter(load_addrs);
-            if(load_iter == NULL) {
-                PyErr_SetString(PyExc_ValueError, "load address is not iteratable");
-                return NULL;
-            }
-            while((addr = PyIter_Next(load_iter))) {
-                // For each address, build range:
-#if PY_MAJOR_VERSION >= 3
-                range.addr = PyLong_AsLong(addr);
-#else
-                range.addr = PyInt_AsLong(addr);
-#endif
-                Cache__load(self, range); // TODO , 0);
-                // Swap cl_id is irrelevant here, since this is only called on first level cache
-                Py_DECREF(addr);
-            }
-            Py_DECREF(load_iter);
+        if(view.shape[0] != lengths[core]) {
+            PyErr_SetString(PyExc_ValueError,
+                            "timestamps needs to have as many elements as the trace of its core");
+            error = 1;
+        } else if((stamps[core] = PyMem_New(long long, lengths[core]+1)) == NULL) {
+            PyErr_NoMemory();
+            error = 1;
         }
+        for(Py_ssize_t i=0; !error && i<view.shape[0]; i++) {
+            stamps[core][i] = __int_buffer_get(&view, is_signed, i);
+        }
+        PyBuffer_Release(&view);
+    }
 
-        // If store addresses are given
-        if(store_addrs != Py_None) {
-            if(!PySequence_Check(store_addrs)) {
-                PyErr_SetString(
-                    PyExc_ValueError, "store element does not provide a sequence protocol");
-                return NULL;
-            }
-
-            // FIXME maybe this is better: Pass along to iterstore
-            //Cache_iterload(self, load_addrs, length)
-
-            // Iterate of elements in store_addrs
-            store_iter = PyObject_GetIter(store_addrs);
-            if(store_iter == NULL) {
-                PyErr_SetString(PyExc_ValueError, "store address is not iteratable");
-                return NULL;
-            }
-            while((addr = PyIter_Next(store_iter))) {
-                // For each address, build range:
-#if PY_MAJOR_VERSION >= 3
-                range.addr = PyLong_AsLong(addr);
-#else
-                range.addr = PyInt_AsLong(addr);
-#endif
-                Cache__store(self, range, 0);
-                Py_DECREF(addr);
-            }
-            Py_DECREF(store_iter);
+    int n, nogil;
+    Cache** caches = error ? NULL : CoherenceDomain__lock(self, &n, &nogil);
+    if(caches != NULL) {
+        PyThreadState *thread_state = nogil ? PyEval_SaveThread() : NULL;
+        CoherenceDomain__replay(self, records, lengths,
+                                timestamps != Py_None ? (const long long**)stamps : NULL,
+                                quantum);
+        if(thread_state != NULL) {
+            PyEval_RestoreThread(thread_state);
         }
+        CoherenceDomain__unlock(caches, n);
+    }
 
-        Py_DECREF(load_addrs);
-        Py_DECREF(store_addrs);
-        Py_DECREF(loadstore_item);
+    for(int core=0; core<self->cores; core++) {
+        PyMem_Del(stamps[core]);
+    }
+    for(int i=0; i<acquired; i++) {
+        PyBuffer_Release(&views[i]);
+    }
+    if(caches == NULL) {
+        return NULL;
     }
-    Py_DECREF(addrs_iter);
     Py_RETURN_NONE;
 }
 
-static PyObject* Cache_contains(Cache* self, PyObject *args, PyObject *kwds) {
-    long long addr;
+static PyObject* CoherenceDomain_reset_stats(CoherenceDomain* self) {
+    self->lookups = 0;
+    self->misses = 0;
+    self->evictions = 0;
+    Py_RETURN_NONE;
+}
 
-    static char *kwlist[] = {"addr", NULL};
-    PyArg_ParseTupleAndKeywords(args, kwds, "L", kwlist, &addr);
+static PyMethodDef CoherenceDomain_methods[] = {
+    {"load", (PyCFunction)CoherenceDomain_load, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"store", (PyCFunction)CoherenceDomain_store, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"replay", (PyCFunction)CoherenceDomain_replay, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"reset_stats", (PyCFunction)CoherenceDomain_reset_stats, METH_VARARGS, NULL},
 
-    long cl_id = Cache__get_cacheline_id(self, addr);
-    long set_id = Cache__get_set_id(self, cl_id);
+    /* Sentinel */
+    {NULL, NULL}
+};
 
-    for(long i=0; i<self->ways; i++) {
-        if(self->placement[set_id*self->ways+i].invalid == 0 &&
-           self->placement[set_id*self->ways+i].cl_id == cl_id) {
-            Py_RETURN_TRUE;
-        }
-    }
-    Py_RETURN_FALSE;
-}
+static PyMemberDef CoherenceDomain_members[] = {
+    {"first_levels", T_OBJECT, offsetof(CoherenceDomain, first_levels), READONLY,
+     "tuple of first level Cache objects, one per core"},
+    {"protocol", T_INT, offsetof(CoherenceDomain, protocol), READONLY,
+     "coherence protocol (0 = MESI, 1 = MOESI)"},
+    {"cores", T_INT, offsetof(CoherenceDomain, cores), READONLY,
+     "number of cores"},
+    {"directory_sets", T_LONG, offsetof(CoherenceDomain, directory_sets), READONLY,
+     "sets of the directory (0 = unbounded)"},
+    {"directory_ways", T_LONG, offsetof(CoherenceDomain, directory_ways), READONLY,
+     "ways of the directory (0 = unbounded)"},
+    {"directory_lookups", T_LONGLONG, offsetof(CoherenceDomain, lookups), 0,
+     "number of directory accesses (by private misses and upgrades)"},
+    {"directory_misses", T_LONGLONG, offsetof(CoherenceDomain, misses), 0,
+     "number of directory accesses to lines not held by any core"},
+    {"directory_evictions", T_LONGLONG, offsetof(CoherenceDomain, evictions), 0,
+     "number of entries replaced in a bounded directory (copies are back-invalidated)"},
+    {NULL}  /* Sentinel */
+};
 
-static PyObject* Cache_force_write_back(Cache* self) {
-    // PySys_WriteStdout("%s force_write_back\n", self->name);
-    for(long i=0; i<self->ways*self->sets; i++) {
-        // PySys_WriteStdout("%i inv=%i dirty=%i\n", i, self->placement[i].invalid, self->placement[i].dirty);
-        // TODO merge with Cache__inject (last section)?
-        if(self->placement[i].invalid == 0 && self->placement[i].dirty == 1) {
-            self->EVICT.count++;
-            self->EVICT.byte += self->cl_size;
-            if(self->verbosity >= 3) {
-                PySys_WriteStdout(
-                    "%s EVICT cl_id=%li invalid=%u dirty=%u\n",
-                    self->name, self->placement[i].cl_id,
-                    self->placement[i].invalid, self->placement[i].dirty);
-            }
-            if(self->store_to != NULL) {
-                // Found dirty line, initiate write-back:
-                // PySys_WriteStdout("%s dirty_line cl_id=%i write_combining=%i\n", self->name, self->placement[i].cl_id, self->write_combining);
+static int CoherenceDomain_init(CoherenceDomain *self, PyObject *args, PyObject *kwds);
 
-                int non_temporal = 0; // default for non write-combining caches
+static PyTypeObject CoherenceDomainType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cachesim.backend.CoherenceDomain", /* tp_name */
+    sizeof(CoherenceDomain),   /* tp_basicsize */
+    0,                         /* tp_itemsize */
+    (destructor)CoherenceDomain_dealloc, /* tp_dealloc */
+    0,                         /* tp_print */
+    0,                         /* tp_getattr */
+    0,                         /* tp_setattr */
+    0,                         /* tp_reserved */
+    0,                         /* tp_repr */
+    0,                         /* tp_as_number */
+    0,                         /* tp_as_sequence */
+    0,                         /* tp_as_mapping */
+    0,                         /* tp_hash  */
+    0,                         /* tp_call */
+    0,                         /* tp_str */
+    0,                         /* tp_getattro */
+    0,                         /* tp_setattro */
+    0,                         /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,        /* tp_flags */
+    "Coherence domain of cores with private caches", /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    CoherenceDomain_methods,   /* tp_methods */
+    CoherenceDomain_members,   /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)CoherenceDomain_init, /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+};
 
-                if(self->write_combining == 1) {
-                    // Check if non-temporal store may be used or write-allocate is necessary
-                    non_temporal = 1;
-                    for(long j=0; j<self->subblock_bits; j++) {
-                        if(!BITTEST(self->subblock_bitfield, i*self->subblock_bits + j)) {
-                            // incomplete cacheline, thus write-allocate is necessary
-                            non_temporal = 0;
-                        }
-                        // Clear bits for future use
-                        BITCLEAR(self->subblock_bitfield, i*self->subblock_bits + j);
-                    }
-                }
+// Messages for the reasons returned by CoherenceDomain__check
+static const char* coherence_errors[] = {
+    NULL,
+    "number of cores needs to be between 1 and 64",
+    "first level %s is shared by all cores, each core needs a private level",
+    "cache %s is shared by some, but not all cores",
+    "cache %s already belongs to a coherence domain",
+    "cl_size of %s differs from the other levels of the domain",
+    "private level %s has a prefetcher, which is only supported in shared levels",
+    "private level %s samples sets, which is only supported in shared levels",
+};
 
-                Py_INCREF(self->store_to);
-                Cache__store(
-                    (Cache*)self->store_to,
-                    Cache__get_range_from_cl_id(self, self->placement[i].cl_id),
-                    non_temporal);
-                Py_DECREF(self->store_to);
-            }
-            self->placement[i].dirty = 0;
+static int CoherenceDomain_init(CoherenceDomain *self, PyObject *args, PyObject *kwds) {
+    PyObject *first_levels;
+    int protocol = COHERENCE_MESI;
+    long directory_sets = 0;
+    long directory_ways = 0;
+
+    static char *kwlist[] = {"first_levels", "protocol", "directory_sets", "directory_ways",
+                             NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|ill", kwlist, &first_levels, &protocol,
+                                    &directory_sets, &directory_ways)) {
+        return -1;
+    }
+    if(protocol != COHERENCE_MESI && protocol != COHERENCE_MOESI) {
+        PyErr_SetString(PyExc_ValueError, "protocol needs to be 0 (MESI) or 1 (MOESI)");
+        return -1;
+    }
+    if(directory_sets < 0 || (directory_sets > 0 && directory_ways < 1)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "directory_sets needs to be 0 (unbounded) or positive with "
+                        "directory_ways >= 1");
+        return -1;
+    }
+    PyObject *tuple = PySequence_Tuple(first_levels);
+    if(tuple == NULL) {
+        return -1;
+    }
+    int cores = (int)PyTuple_GET_SIZE(tuple);
+    Cache* caches[COHERENCE_MAX_CORES];
+    for(int core=0; core<cores && core<COHERENCE_MAX_CORES; core++) {
+        PyObject* item = PyTuple_GET_ITEM(tuple, core);
+        if(!PyObject_TypeCheck(item, &CacheType)) {
+            PyErr_SetString(PyExc_TypeError, "first_levels needs to contain Cache objects");
+            Py_DECREF(tuple);
+            return -1;
+        }
+        caches[core] = (Cache*)item;
+        if(Cache__check_idle(caches[core]) != 0) {
+            Py_DECREF(tuple);
+            return -1;
         }
     }
-    Py_RETURN_NONE;
-}
 
-static PyObject* Cache_reset_stats(Cache* self) {
-    self->LOAD.count = 0;
-    self->STORE.count = 0;
-    self->HIT.count = 0;
-    self->MISS.count = 0;
-    self->EVICT.count = 0;
+    // The caches of a previous initialization may still be simulated by another thread
+    for(int core=0; self->private_caches != NULL && core<self->cores; core++) {
+        if(Cache__check_idle(CoherenceDomain__first_level(self, core)) != 0) {
+            Py_DECREF(tuple);
+            return -1;
+        }
+    }
 
-    self->LOAD.byte = 0;
-    self->STORE.byte = 0;
-    self->HIT.byte = 0;
-    self->MISS.byte = 0;
-    self->EVICT.byte = 0;
+    // Forget previous initialization
+    CoherenceDomain__free(self);
+    Py_CLEAR(self->first_levels);
 
-    // self->LOAD.cl = 0;
-    // self->STORE.cl = 0;
-    // self->HIT.cl = 0;
-    // self->MISS.cl = 0;
+    Cache* culprit;
+    int error = CoherenceDomain__check(caches, cores, &culprit);
+    if(error == 0) {
+        error = CoherenceDomain__init(self, caches, cores, protocol, directory_sets,
+                                       directory_ways);
+    }
+    if(error != 0) {
+        if(error == -1) {
+            PyErr_NoMemory();
+        } else {
+            PyErr_Format(PyExc_ValueError, coherence_errors[error],
+                         culprit != NULL ? culprit->name : "");
+        }
+        Py_DECREF(tuple);
+        return -1;
+    }
+    self->first_levels = tuple;
+    return 0;
+}
 
-    Py_RETURN_NONE;
+static void StackDistance_dealloc(StackDistance* self) {
+    StackDistance__free(self);
+    Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
-static PyObject* Cache_count_invalid_entries(Cache* self) {
-    int count = 0;
-    for(long i=0; i<self->ways*self->sets; i++) {
-        if(self->placement[i].invalid == 1) {
-            count++;
-        }
+static int StackDistance__lock(StackDistance* self) {
+    // Like Cache__lock_hierarchy, the GIL is released while replaying
+    if(self->histograms == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "stack distance simulator is not initialized");
+        return -1;
     }
-    return Py_BuildValue("i", count);
+    if(self->busy) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "stack distance simulator is already replaying in another thread");
+        return -1;
+    }
+    self->busy = 1;
+    return 0;
 }
 
-static PyObject* Cache_mark_all_invalid(Cache* self) {
-    for(long i=0; i<self->ways*self->sets; i++) {
-        self->placement[i].invalid = 1;
+static PyObject* StackDistance_replay(StackDistance* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *records;
+    Py_buffer view;
+
+    static char *kwlist[] = {"records", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &records) ||
+       __get_record_buffer(records, &view, "records") != 0) {
+        return NULL;
+    }
+    if(StackDistance__lock(self) != 0) {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+
+    PyThreadState *thread_state = PyEval_SaveThread();
+    int error = StackDistance__replay(self, (const access_record*)view.buf,
+                                      view.len / sizeof(access_record));
+    PyEval_RestoreThread(thread_state);
+    self->busy = 0;
+    PyBuffer_Release(&view);
+
+    if(error != 0) {
+        return PyErr_NoMemory();
     }
     Py_RETURN_NONE;
 }
 
-static PyMethodDef Cache_methods[] = {
-    {"load", (PyCFunction)Cache_load, METH_VARARGS|METH_KEYWORDS, NULL},
-    {"iterload", (PyCFunction)Cache_iterload, METH_VARARGS|METH_KEYWORDS, NULL},
-    {"store", (PyCFunction)Cache_store, METH_VARARGS|METH_KEYWORDS, NULL},
-    {"iterstore", (PyCFunction)Cache_iterstore, METH_VARARGS|METH_KEYWORDS, NULL},
-    {"loadstore", (PyCFunction)Cache_loadstore, METH_VARARGS|METH_KEYWORDS, NULL},
-    {"contains", (PyCFunction)Cache_contains, METH_VARARGS, NULL},
-    {"force_write_back", (PyCFunction)Cache_force_write_back, METH_VARARGS, NULL},
-    {"reset_stats", (PyCFunction)Cache_reset_stats, METH_VARARGS, NULL},
-    {"count_invalid_entries", (PyCFunction)Cache_count_invalid_entries, METH_VARARGS, NULL},
-    {"mark_all_invalid", (PyCFunction)Cache_mark_all_invalid, METH_VARARGS, NULL},
+static PyObject* StackDistance_replay_file(StackDistance* self, PyObject *args, PyObject *kwds)
+{
+    const char *path;
 
-    /* Sentinel */
-    {NULL, NULL}
-};
+    static char *kwlist[] = {"path", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &path) ||
+       StackDistance__lock(self) != 0) {
+        return NULL;
+    }
+
+    PyThreadState *thread_state = PyEval_SaveThread();
+    long long replayed = StackDistance__replay_file(self, path);
+    int saved_errno = errno;
+    PyEval_RestoreThread(thread_state);
+    self->busy = 0;
 
-static PyObject* Cache_cached_get(Cache* self) {
-    PyObject* cached_set = PySet_New(NULL);
-    for(long i=0; i<self->sets*self->ways; i++) {
-        //PySys_WriteStdout("i=%li cl_id=%li invalid=%u addr=%li\n", i, self->placement[i].cl_id, self->placement[i].invalid, Cache__get_addr_from_cl_id(self, self->placement[i].cl_id));
-        // Skip invalidated entries
-        if(self->placement[i].invalid) {
-            continue;
-        }
+    if(replayed < 0) {
+        __set_trace_error(replayed, saved_errno, path);
+        return NULL;
+    }
+    return PyLong_FromLongLong(replayed);
+}
 
-        // For each cached cacheline expand to all cached addresses:
-        for(long j=0; j<self->cl_size; j++) {
-            // PySys_WriteStdout("%li %li %li %li\n", self->sets, self->ways, i, self->placement[i].cl_id);
-            PyObject* addr = PyLong_FromLong(
-                Cache__get_addr_from_cl_id(self, self->placement[i].cl_id)+j);
-            PySet_Add(cached_set, addr);
-            Py_DECREF(addr);
-        }
+static PyObject* StackDistance_histogram(StackDistance* self, PyObject *args, PyObject *kwds)
+{
+    // Returns the accesses by stack distance (0 to max_ways, the last entry counts all deeper
+    // and first accesses) for a number of sets as a tuple
+    long sets = 1;
+
+    static char *kwlist[] = {"sets", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|l", kwlist, &sets)) {
+        return NULL;
     }
-    return cached_set;
+    if(self->histograms == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "stack distance simulator is not initialized");
+        return NULL;
+    }
+    if(sets < 1 || (sets & (sets-1)) != 0 || sets > (1L << (self->levels-1))) {
+        PyErr_Format(PyExc_ValueError, "sets needs to be a power of two <= %li",
+                     1L << (self->levels-1));
+        return NULL;
+    }
+    int level = (int)log2_uint((unsigned long)sets);
+    PyObject *histogram = PyTuple_New(self->max_ways+1);
+    for(long distance=0; histogram != NULL && distance<=self->max_ways; distance++) {
+        PyTuple_SET_ITEM(histogram, distance, PyLong_FromLongLong(
+            self->histograms[level*(self->max_ways+1)+distance]));
+    }
+    return histogram;
 }
 
-static PyGetSetDef Cache_getset[] = {
-    {"cached", (getter)Cache_cached_get, NULL, "cache", NULL},
+static PyMethodDef StackDistance_methods[] = {
+    {"replay", (PyCFunction)StackDistance_replay, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"replay_file", (PyCFunction)StackDistance_replay_file, METH_VARARGS|METH_KEYWORDS, NULL},
+    {"histogram", (PyCFunction)StackDistance_histogram, METH_VARARGS|METH_KEYWORDS, NULL},
 
     /* Sentinel */
-    {NULL},
+    {NULL, NULL}
 };
 
-static int Cache_init(Cache *self, PyObject *args, PyObject *kwds);
+static PyMemberDef StackDistance_members[] = {
+    {"cl_size", T_UINT, offsetof(StackDistance, cl_size), READONLY,
+     "cacheline size in bytes"},
+    {"levels", T_INT, offsetof(StackDistance, levels), READONLY,
+     "number of set counts (1, 2, 4, ... max_sets)"},
+    {"max_ways", T_LONG, offsetof(StackDistance, max_ways), READONLY,
+     "largest associativity distances are counted for"},
+    {"accesses", T_LONGLONG, offsetof(StackDistance, accesses), READONLY,
+     "number of cacheline accesses"},
+    {NULL}  /* Sentinel */
+};
 
-static PyTypeObject CacheType = {
+static int StackDistance_init(StackDistance *self, PyObject *args, PyObject *kwds);
+
+static PyTypeObject StackDistanceType = {
     PyVarObject_HEAD_INIT(NULL, 0)
-    "cachesim.backend.Cache",  /* tp_name */
-    sizeof(Cache),             /* tp_basicsize */
+    "cachesim.backend.StackDistance", /* tp_name */
+    sizeof(StackDistance),     /* tp_basicsize */
     0,                         /* tp_itemsize */
-    (destructor)Cache_dealloc, /* tp_dealloc */
+    (destructor)StackDistance_dealloc, /* tp_dealloc */
     0,                         /* tp_print */
     0,                         /* tp_getattr */
     0,                         /* tp_setattr */
@@ -931,139 +6391,171 @@ static PyTypeObject CacheType = {
     0,                         /* tp_setattro */
     0,                         /* tp_as_buffer */
     Py_TPFLAGS_DEFAULT,        /* tp_flags */
-    "Cache objects",           /* tp_doc */
+    "LRU stack distances for many set counts and associativities", /* tp_doc */
     0,                         /* tp_traverse */
     0,                         /* tp_clear */
     0,                         /* tp_richcompare */
     0,                         /* tp_weaklistoffset */
     0,                         /* tp_iter */
     0,                         /* tp_iternext */
-    Cache_methods,             /* tp_methods */
-    Cache_members,             /* tp_members */
-    Cache_getset,              /* tp_getset */
+    StackDistance_methods,     /* tp_methods */
+    StackDistance_members,     /* tp_members */
+    0,                         /* tp_getset */
     0,                         /* tp_base */
     0,                         /* tp_dict */
     0,                         /* tp_descr_get */
     0,                         /* tp_descr_set */
     0,                         /* tp_dictoffset */
-    (initproc)Cache_init,      /* tp_init */
+    (initproc)StackDistance_init, /* tp_init */
     0,                         /* tp_alloc */
     0,                         /* tp_new */
 };
 
-static int Cache_init(Cache *self, PyObject *args, PyObject *kwds) {
-    PyObject *store_to, *load_from, *victims_to, *tmp;
-    self->verbosity = 0;
-    static char *kwlist[] = {"name", "sets", "ways", "cl_size",
-                             "replacement_policy_id", "write_back", "write_allocate",
-                             "write_combining", "subblock_size",
-                             "load_from", "store_to", "victims_to",
-                             "swap_on_load", "verbosity", NULL};
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "sIIIiiiiiOOOi|i", kwlist,
-                                     &self->name, &self->sets, &self->ways, &self->cl_size,
-                                     &self->replacement_policy_id,
-                                     &self->write_back, &self->write_allocate,
-                                     &self->write_combining, &self->subblock_size,
-                                     &load_from, &store_to, &victims_to,
-                                     &self->swap_on_load, &self->verbosity)) {
+static int StackDistance_init(StackDistance *self, PyObject *args, PyObject *kwds) {
+    unsigned int cl_size = 64;
+    long max_sets = 1;
+    long max_ways = 16;
+
+    static char *kwlist[] = {"cl_size", "max_sets", "max_ways", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|Ill", kwlist, &cl_size, &max_sets,
+                                    &max_ways)) {
         return -1;
     }
-
-    // Handle load_from parent (if given)
-    if(load_from != Py_None) {
-        if(!PyObject_IsInstance(load_from, (PyObject*)&CacheType)) {
-            PyErr_SetString(PyExc_TypeError, "load_from needs to be backend.Cache or None");
-            return -1;
-        }
-        tmp = self->load_from;
-        Py_INCREF(load_from);
-        self->load_from = load_from;
-        Py_XDECREF(tmp);
-    } else {
-        self->load_from = NULL;
+    if(cl_size < 1 || (cl_size & (cl_size-1)) != 0) {
+        PyErr_SetString(PyExc_ValueError, "cl_size needs to be a power of two");
+        return -1;
     }
-
-    // Handle store_to parent (if given)
-    if(store_to != Py_None) {
-        if(!PyObject_IsInstance(store_to, (PyObject*)&CacheType)) {
-            PyErr_SetString(PyExc_TypeError, "store_to needs to be backend.Cache or None");
-            return -1;
-        }
-        tmp = self->store_to;
-        Py_INCREF(store_to);
-        self->store_to = store_to;
-        Py_XDECREF(tmp);
-    } else {
-        self->store_to = NULL;
+    if(max_sets < 1 || (max_sets & (max_sets-1)) != 0 || max_sets > (1L << 24)) {
+        PyErr_SetString(PyExc_ValueError, "max_sets needs to be a power of two <= 2^24");
+        return -1;
+    }
+    if(max_ways < 1 || max_ways > (1L << 20)) {
+        PyErr_SetString(PyExc_ValueError, "max_ways needs to be between 1 and 2^20");
+        return -1;
+    }
+    if(self->busy) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "stack distance simulator is already replaying in another thread");
+        return -1;
     }
 
-    // Handle victims_to parent (if given)
-    if(victims_to != Py_None) {
-        if(!PyObject_IsInstance(victims_to, (PyObject*)&CacheType)) {
-            PyErr_SetString(
-                PyExc_TypeError, "victims_to needs to be of type backend.Cache or None");
-            return -1;
-        }
-        tmp = self->victims_to;
-        Py_INCREF(victims_to);
-        self->victims_to = victims_to;
-        Py_XDECREF(tmp);
-    } else {
-        self->victims_to = NULL;
+    // Forget previous initialization
+    StackDistance__free(self);
+    if(StackDistance__init(self, cl_size, max_sets, max_ways) != 0) {
+        PyErr_NoMemory();
+        return -1;
     }
+    return 0;
+}
 
-    // TODO validate store, load and victim paths so no null objects will be used until LLC/mem? is hit
-    // should we introduce a memory object in c?
+static PyObject* cachesim_write_trace(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    const char *path;
+    PyObject *records;
+    Py_buffer view;
+    int version = TRACE_VERSION_RLE;
 
-    self->placement = PyMem_New(struct cache_entry, self->sets*self->ways);
-    for(long i=0; i<self->sets*self->ways; i++) {
-        self->placement[i].invalid = 1;
-        self->placement[i].dirty = 0;
+    static char *kwlist[] = {"path", "records", "version", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "sO|i", kwlist, &path, &records, &version)) {
+        return NULL;
+    }
+    if(version != TRACE_VERSION_DELTA && version != TRACE_VERSION_RLE) {
+        PyErr_Format(PyExc_ValueError, "version needs to be %d or %d (got %d)",
+                     TRACE_VERSION_DELTA, TRACE_VERSION_RLE, version);
+        return NULL;
+    }
+    if(__get_record_buffer(records, &view, "records") != 0) {
+        return NULL;
     }
 
-    // Check if cl_size is of power^2
-    if(!isPowerOfTwo(self->cl_size)) {
-        // throw exception
-        PyErr_SetString(PyExc_ValueError, "cl_size needs to be a power of two.");
-        return -1;
+    const access_record *record = (const access_record*)view.buf;
+    long long n = view.len / sizeof(access_record);
+    trace_writer writer;
+    PyThreadState *thread_state = PyEval_SaveThread();
+    int error = trace_writer__open(&writer, path, version);
+    for(long long i=0; error == 0 && i<n; i++) {
+        error = trace_writer__write(&writer, &record[i]);
+    }
+    if(writer.file != NULL) {
+        int close_error = trace_writer__close(&writer);
+        error = error != 0 ? error : close_error;
     }
+    int saved_errno = errno;
+    PyEval_RestoreThread(thread_state);
+    PyBuffer_Release(&view);
 
-    // Get number of bits in cacheline adressing
-    self->cl_bits = log2_uint((unsigned long)self->cl_size);
+    if(error != 0) {
+        __set_trace_error(error, saved_errno, path);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
 
-    // Check if subblock_size is a divisor of cl_size
-    if(self->cl_size % self->subblock_size != 0) {
-        // throw exception
-        PyErr_SetString(PyExc_ValueError, "subblock_size needs to be a devisor of cl_size.");
-        return -1;
+static PyObject* cachesim_read_trace(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    const char *path;
+
+    static char *kwlist[] = {"path", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &path)) {
+        return NULL;
     }
-    self->subblock_bits = self->cl_size/self->subblock_size;
 
-    // Allocate subblock_bitfield
-    if(self->write_combining && self->subblock_size != self->cl_size) {
-        // Subblocking will be used:
-        // since char is used as type, we need upper(subblock_bits/8) chars per placement
-        self->subblock_bitfield = PyMem_New(
-            char, BITNSLOTS(self->sets*self->ways*self->subblock_bits));
-        // Clear all bits
-        for(long i=0; i<BITNSLOTS(self->sets*self->ways*self->subblock_bits); i++) {
-            BITCLEAR(self->subblock_bitfield, i);
+    trace_reader reader;
+    int n = trace_reader__open(&reader, path);
+    if(n != 0) {
+        __set_trace_error(n, errno, path);
+        return NULL;
+    }
+    // The header tells how many records to expect (no more are read). It has been checked
+    // against the file size, unless the file is not seekable, so then the buffer grows.
+    long long length = 0, capacity = reader.records;
+    if(reader.size == (size_t)-1 && capacity > TRACE_BLOCK_RECORDS) {
+        capacity = TRACE_BLOCK_RECORDS;
+    }
+    access_record *records = PyMem_New(access_record, capacity > 0 ? capacity : 1);
+    while(records != NULL) {
+        long long room = reader.records - length < TRACE_BLOCK_RECORDS ?
+            reader.records - length : TRACE_BLOCK_RECORDS;
+        if(capacity - length < room) {
+            capacity = capacity*2 < reader.records ? capacity*2 : reader.records;
+            access_record *grown = PyMem_Resize(records, access_record, capacity);
+            if(grown == NULL) {
+                PyMem_Del(records);
+                records = NULL;
+                break;
+            }
+            records = grown;
         }
-    } else {
-        // Subblocking won't be used:
-        self->subblock_bitfield = NULL;
+        n = trace_reader__next(&reader, &records[length]);
+        if(n <= 0) {
+            break;
+        }
+        length += n;
     }
+    int saved_errno = errno;
+    trace_reader__close(&reader);
 
-    Cache_reset_stats(self);
-
-    if(self->verbosity >= 1) {
-        PySys_WriteStdout("CACHE sets=%li ways=%li cl_size=%li cl_bits=%li\n",
-                          self->sets, self->ways, self->cl_size, self->cl_bits);
+    if(records == NULL) {
+        return PyErr_NoMemory();
     }
-
-    return 0;
+    PyObject *result = NULL;
+    if(n < 0) {
+        __set_trace_error(n, saved_errno, path);
+    } else {
+        result = PyByteArray_FromStringAndSize(
+            (const char*)records, (Py_ssize_t)(length*sizeof(access_record)));
+    }
+    PyMem_Del(records);
+    return result;
 }
 
+static PyMethodDef cachesim_methods[] = {
+    {"write_trace", (PyCFunction)cachesim_write_trace, METH_VARARGS|METH_KEYWORDS,
+     "write a buffer of access records to a trace file"},
+    {"read_trace", (PyCFunction)cachesim_read_trace, METH_VARARGS|METH_KEYWORDS,
+     "read all access records of a trace file into a bytearray"},
+    {NULL, NULL}
+};
 
 #if PY_MAJOR_VERSION >= 3
 static struct PyModuleDef moduledef = {
@@ -1071,7 +6563,7 @@ static struct PyModuleDef moduledef = {
         "cachesim.backend",
         "Backend of cachesim",
         -1,
-        NULL, NULL, NULL, NULL, NULL
+        cachesim_methods, NULL, NULL, NULL, NULL
 };
 
 #define INITERROR return NULL
@@ -1101,6 +6593,20 @@ initbackend(void)
     Py_INCREF(&CacheType);
     PyModule_AddObject(module, "Cache", (PyObject *)&CacheType);
 
+    CoherenceDomainType.tp_new = PyType_GenericNew;
+    if (PyType_Ready(&CoherenceDomainType) < 0)
+        INITERROR;
+
+    Py_INCREF(&CoherenceDomainType);
+    PyModule_AddObject(module, "CoherenceDomain", (PyObject *)&CoherenceDomainType);
+
+    StackDistanceType.tp_new = PyType_GenericNew;
+    if (PyType_Ready(&StackDistanceType) < 0)
+        INITERROR;
+
+    Py_INCREF(&StackDistanceType);
+    PyModule_AddObject(module, "StackDistance", (PyObject *)&StackDistanceType);
+
 #if PY_MAJOR_VERSION >= 3
     return module;
 #endif
@@ -1120,13 +6626,15 @@ void dealloc_cacheSim(Cache* cache)
     //TODO prevent double free in case of circular cache references. deallocation not needed?
     if (cache->load_from != NULL)
         dealloc_cacheSim((Cache*)cache->load_from);
-    free(cache->placement);
+    Cache__free_state(cache);
     free(cache);
     // fclose(file);
 }
 
-Cache* get_cacheSim_from_file(const char* cache_file)
+int get_cacheSims_from_file(const char* cache_file, Cache** first_levels, int max_first_levels)
 {
+    // Returns all first levels (levels nothing loads from, stores to or evicts to), e.g. one per
+    // core in front of shared levels. Exits if there are more than max_first_levels.
     //file for log output and errors/warnings (needed because stdout and stderr for some reason cannot be linked when using pin)
     file  = fopen ("log_cachesim","w");
     fprintf(file, "Cache* get_cacheSim_from_file(\"%s\"):\n\n", cache_file);
@@ -1162,6 +6670,8 @@ Cache* get_cacheSim_from_file(const char* cache_file)
     memset(store_to_buff, 0, size*sizeof(char*));
     char* victims_to_buff[size];
     memset(victims_to_buff, 0, size*sizeof(char*));
+    char* tlb_buff[size];
+    memset(tlb_buff, 0, size*sizeof(char*));
     int linkcounter[size];
     memset(linkcounter, 0, size*sizeof(int));
     int counter = 0;
@@ -1185,6 +6695,16 @@ Cache* get_cacheSim_from_file(const char* cache_file)
                 fflush(file);
                 exit(EXIT_FAILURE);
             }
+            cacheSim[counter]->tag_index_threshold = TAG_INDEX_DEFAULT_THRESHOLD;
+            cacheSim[counter]->rrip_bits = RRIP_DEFAULT_BITS;
+            cacheSim[counter]->rrip_insert = -1;
+            cacheSim[counter]->dueling.leader_sets = DRRIP_DEFAULT_LEADER_SETS;
+            cacheSim[counter]->dueling.psel_bits = DRRIP_DEFAULT_PSEL_BITS;
+            cacheSim[counter]->slices = 1;
+            cacheSim[counter]->prefetch_distance = 1;
+            cacheSim[counter]->prefetch_degree = 1;
+            cacheSim[counter]->sampling = 1;
+            cacheSim[counter]->core = -1;
 
             //key value pairs seperated by ','
             token = strtok_r(&line[0], ",\n\r", &saveptr1);
@@ -1262,10 +6782,78 @@ Cache* get_cacheSim_from_file(const char* cache_file)
                 {
                     victims_to_buff[counter] = strdup(value);
                 }
+                else if (strcmp(key, "tlb") == 0)
+                {
+                    tlb_buff[counter] = strdup(value);
+                }
                 else if (strcmp(key, "swap_on_load") == 0)
                 {
                     cacheSim[counter]->swap_on_load = atoi(value);
                 }
+                else if (strcmp(key, "tag_index_threshold") == 0)
+                {
+                    cacheSim[counter]->tag_index_threshold = atoi(value);
+                }
+                else if (strcmp(key, "rrip_bits") == 0)
+                {
+                    cacheSim[counter]->rrip_bits = atoi(value);
+                }
+                else if (strcmp(key, "rrip_insert") == 0)
+                {
+                    cacheSim[counter]->rrip_insert = atoi(value);
+                }
+                else if (strcmp(key, "rrip_hit_promotion") == 0)
+                {
+                    cacheSim[counter]->rrip_hit_promotion = atoi(value);
+                }
+                else if (strcmp(key, "drrip_leader_sets") == 0)
+                {
+                    cacheSim[counter]->dueling.leader_sets = atoi(value);
+                }
+                else if (strcmp(key, "drrip_psel_bits") == 0)
+                {
+                    cacheSim[counter]->dueling.psel_bits = atoi(value);
+                }
+                else if (strcmp(key, "drrip_follower") == 0)
+                {
+                    cacheSim[counter]->dueling.follower = atoi(value);
+                }
+                else if (strcmp(key, "drrip_sample_interval") == 0)
+                {
+                    cacheSim[counter]->dueling.sample_interval = atoll(value);
+                }
+                else if (strcmp(key, "set_index_function") == 0)
+                {
+                    cacheSim[counter]->set_index_function = atoi(value);
+                }
+                else if (strcmp(key, "slices") == 0)
+                {
+                    cacheSim[counter]->slices = atoi(value);
+                }
+                else if (strcmp(key, "prefetcher") == 0)
+                {
+                    cacheSim[counter]->prefetcher = atoi(value);
+                }
+                else if (strcmp(key, "prefetch_distance") == 0)
+                {
+                    cacheSim[counter]->prefetch_distance = atoi(value);
+                }
+                else if (strcmp(key, "prefetch_degree") == 0)
+                {
+                    cacheSim[counter]->prefetch_degree = atoi(value);
+                }
+                else if (strcmp(key, "prefetch_latency") == 0)
+                {
+                    cacheSim[counter]->prefetch_latency = atoll(value);
+                }
+                else if (strcmp(key, "sampling") == 0)
+                {
+                    cacheSim[counter]->sampling = atol(value);
+                }
+                else if (strcmp(key, "sampling_function") == 0)
+                {
+                    cacheSim[counter]->sampling_function = atoi(value);
+                }
                 else
                 {
                     fprintf(file, "unrecognized parameter:%s\n", key);
@@ -1331,27 +6919,110 @@ Cache* get_cacheSim_from_file(const char* cache_file)
                 // since char is used as type, we need upper(subblock_bits/8) chars per placement
                 cacheSim[counter]->subblock_bitfield = (char*) malloc(BITNSLOTS(cacheSim[counter]->sets*cacheSim[counter]->ways*cacheSim[counter]->subblock_bits) * sizeof(char));
                 // Clear all bits
-                for(int i=0; i<BITNSLOTS(cacheSim[counter]->sets*cacheSim[counter]->ways*cacheSim[counter]->subblock_bits); i++) {
-                    BITCLEAR(cacheSim[counter]->subblock_bitfield, i);
-                }
+                memset(cacheSim[counter]->subblock_bitfield, 0, BITNSLOTS(cacheSim[counter]->sets*cacheSim[counter]->ways*cacheSim[counter]->subblock_bits));
             } else {
                 // Subblocking won't be used:
                 cacheSim[counter]->subblock_bitfield = NULL;
             }
 
+            // Check replacement policy and its parameters
+            if(cacheSim[counter]->replacement_policy_id < 0 || cacheSim[counter]->replacement_policy_id >= REPLACEMENT_POLICY_COUNT) {
+                fprintf(file, "replacement_policy_id needs to be between 0 and 7!\n");
+                fflush(file);
+                exit(EXIT_FAILURE);
+            }
+            if(cacheSim[counter]->replacement_policy_id == 4 && !isPowerOfTwo(cacheSim[counter]->ways)) {
+                fprintf(file, "PLRU requires ways to be a power of two!\n");
+                fflush(file);
+                exit(EXIT_FAILURE);
+            }
+            if(cacheSim[counter]->rrip_bits < 1 || cacheSim[counter]->rrip_bits > 8) {
+                fprintf(file, "rrip_bits needs to be between 1 and 8!\n");
+                fflush(file);
+                exit(EXIT_FAILURE);
+            }
+            if(cacheSim[counter]->rrip_insert == -1) {
+                cacheSim[counter]->rrip_insert = (1 << cacheSim[counter]->rrip_bits) - 2;
+            }
+            if(cacheSim[counter]->rrip_insert < 0 || cacheSim[counter]->rrip_insert >= 1 << cacheSim[counter]->rrip_bits) {
+                fprintf(file, "rrip_insert needs to be between 0 and 2**rrip_bits-1!\n");
+                fflush(file);
+                exit(EXIT_FAILURE);
+            }
+            if(cacheSim[counter]->rrip_hit_promotion != 0 && cacheSim[counter]->rrip_hit_promotion != 1) {
+                fprintf(file, "rrip_hit_promotion needs to be 0 (HP) or 1 (FP)!\n");
+                fflush(file);
+                exit(EXIT_FAILURE);
+            }
+            if(cacheSim[counter]->dueling.leader_sets < 1) {
+                fprintf(file, "drrip_leader_sets needs to be positive!\n");
+                fflush(file);
+                exit(EXIT_FAILURE);
+            }
+            if(cacheSim[counter]->dueling.psel_bits < 1 || cacheSim[counter]->dueling.psel_bits > 30) {
+                fprintf(file, "drrip_psel_bits needs to be between 1 and 30!\n");
+                fflush(file);
+                exit(EXIT_FAILURE);
+            }
+            if(cacheSim[counter]->dueling.follower < 0 || cacheSim[counter]->dueling.follower > 2) {
+                fprintf(file, "drrip_follower needs to be between 0 and 2!\n");
+                fflush(file);
+                exit(EXIT_FAILURE);
+            }
+            if(cacheSim[counter]->dueling.sample_interval < 0) {
+                fprintf(file, "drrip_sample_interval must not be negative!\n");
+                fflush(file);
+                exit(EXIT_FAILURE);
+            }
+
+            // Check set index function
+            if(cacheSim[counter]->set_index_function < SET_INDEX_MODULO ||
+               cacheSim[counter]->set_index_function > SET_INDEX_INTEL_SLICE) {
+                fprintf(file, "set_index_function needs to be between 0 and 2!\n");
+                fflush(file);
+                exit(EXIT_FAILURE);
+            }
+            if(cacheSim[counter]->slices < 1 || cacheSim[counter]->slices > INTEL_SLICE_MAX_SLICES ||
+               !isPowerOfTwo(cacheSim[counter]->slices) ||
+               cacheSim[counter]->sets % cacheSim[counter]->slices != 0) {
+                fprintf(file, "slices needs to be 1, 2, 4 or 8 and a divisor of sets!\n");
+                fflush(file);
+                exit(EXIT_FAILURE);
+            }
+
+            // Check prefetcher
+            if(cacheSim[counter]->prefetcher < PREFETCH_NONE ||
+               cacheSim[counter]->prefetcher > PREFETCH_STREAMER) {
+                fprintf(file, "prefetcher needs to be between 0 and 4!\n");
+                fflush(file);
+                exit(EXIT_FAILURE);
+            }
+            if(cacheSim[counter]->prefetch_distance < 1 || cacheSim[counter]->prefetch_degree < 1 ||
+               cacheSim[counter]->prefetch_latency < 0) {
+                fprintf(file, "prefetch_distance and prefetch_degree need to be positive, "
+                              "prefetch_latency must not be negative!\n");
+                fflush(file);
+                exit(EXIT_FAILURE);
+            }
+
+            // Check set sampling
+            if(cacheSim[counter]->sampling < 1 ||
+               (cacheSim[counter]->sampling_function != SAMPLE_INTERVAL &&
+                cacheSim[counter]->sampling_function != SAMPLE_HASH) ||
+               (cacheSim[counter]->sampling > 1 && cacheSim[counter]->swap_on_load)) {
+                fprintf(file, "sampling needs to be positive (not supported with swap_on_load), "
+                              "sampling_function 0 or 1!\n");
+                fflush(file);
+                exit(EXIT_FAILURE);
+            }
+
             //init cache
-            cacheSim[counter]->placement = (cache_entry*) malloc(cacheSim[counter]->sets * cacheSim[counter]->ways * sizeof(cache_entry));
-            if (cacheSim[counter]->placement == NULL)
+            if (Cache__alloc_state(cacheSim[counter]) != 0)
             {
                 fprintf(file, "allocation of memory for cache object failed\n");
                 fflush(file);
                 exit(EXIT_FAILURE);
             }
-            for(unsigned int i=0; i<cacheSim[counter]->sets*cacheSim[counter]->ways; i++)
-            {
-                cacheSim[counter]->placement[i].invalid = 1;
-                cacheSim[counter]->placement[i].dirty = 0;
-            }
 
             ++counter;
         }
@@ -1370,17 +7041,22 @@ Cache* get_cacheSim_from_file(const char* cache_file)
             if(cacheSim[j]->name != NULL){
                 if (load_from_buff[i] != NULL && strcmp(load_from_buff[i], cacheSim[j]->name) == 0)
                 {
-                    cacheSim[i]->load_from = cacheSim[j];
+                    cacheSim[i]->load_from = (void*)cacheSim[j];
                     ++linkcounter[j];
                 }
                 if (store_to_buff[i] != NULL && strcmp(store_to_buff[i], cacheSim[j]->name) == 0)
                 {
-                    cacheSim[i]->store_to = cacheSim[j];
+                    cacheSim[i]->store_to = (void*)cacheSim[j];
                     ++linkcounter[j];
                 }
                 if (victims_to_buff[i] != NULL && strcmp(victims_to_buff[i], cacheSim[j]->name) == 0)
                 {
-                    cacheSim[i]->victims_to = cacheSim[j];
+                    cacheSim[i]->victims_to = (void*)cacheSim[j];
+                    ++linkcounter[j];
+                }
+                if (tlb_buff[i] != NULL && strcmp(tlb_buff[i], cacheSim[j]->name) == 0)
+                {
+                    cacheSim[i]->tlb = (void*)cacheSim[j];
                     ++linkcounter[j];
                 }
             }
@@ -1388,24 +7064,24 @@ Cache* get_cacheSim_from_file(const char* cache_file)
     }
 
 
-    //find first level cache as interface for the cacheSimulator
-    Cache* first_level = NULL;
+    //find first level caches (in the order of the file) as interface for the cacheSimulator
+    int first_level_count = 0;
     for (int i = 0; i < size; ++i)
     {
         // fprintf(file, "linkcounter %d: %d\n",i,linkcounter[i]);
         // fflush(file);
         if (linkcounter[i] == 0)
         {
-            if (first_level != NULL)
+            if (first_level_count == max_first_levels)
             {
                 fputs("cache that is not first level has no connection! exiting!\n\n",file);
                 fflush(file);
                 exit(EXIT_FAILURE);
             }
-            first_level = cacheSim[i];
+            first_levels[first_level_count++] = cacheSim[i];
         }
     }
-    if (first_level == NULL)
+    if (first_level_count == 0)
     {
         fputs("first level is null! exiting!\n\n",file);
         fflush(file);
@@ -1425,10 +7101,18 @@ Cache* get_cacheSim_from_file(const char* cache_file)
         free(load_from_buff[i]);
         free(store_to_buff[i]);
         free(victims_to_buff[i]);
+        free(tlb_buff[i]);
     }
 
     fputs("done\n\nreturning cache...\n",file);
     fclose(file);
+    return first_level_count;
+}
+
+Cache* get_cacheSim_from_file(const char* cache_file)
+{
+    Cache* first_level;
+    get_cacheSims_from_file(cache_file, &first_level, 1);
     return first_level;
 }
 
@@ -1442,12 +7126,24 @@ void printStats(Cache* cache)
     fprintf(stdout, "HIT: %llu   size: %lluB\n",cache->HIT.count, cache->HIT.byte);
     fprintf(stdout, "MISS: %llu   size: %lluB\n",cache->MISS.count, cache->MISS.byte);
     fprintf(stdout, "EVICT: %llu   size: %lluB\n",cache->EVICT.count, cache->EVICT.byte);
+    if (cache->sample_map != NULL)
+    {
+        // Counts above are those of the sampled sets
+        sampling_estimate estimate;
+        Cache__estimate(cache, &estimate);
+        fprintf(stdout, "SAMPLED: %li of %li sets   MISS estimate: %.0f +- %.0f   "
+                "miss ratio: %.4f +- %.4f\n", cache->sampled_sets, cache->sets,
+                estimate.misses, estimate.misses_error,
+                estimate.miss_ratio, estimate.miss_ratio_error);
+    }
 
     if (cache->load_from != NULL)
-        printStats(cache->load_from);
+        printStats((Cache*)cache->load_from);
     if (cache->store_to != NULL && cache->store_to != cache->load_from)
-        printStats(cache->store_to);
+        printStats((Cache*)cache->store_to);
     if (cache->victims_to != NULL && cache->store_to != cache->load_from && cache->store_to != cache->victims_to)
-        printStats(cache->victims_to);
+        printStats((Cache*)cache->victims_to);
+    if (cache->tlb != NULL)
+        printStats((Cache*)cache->tlb);
 }
 #endif
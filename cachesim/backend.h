@@ -1,4 +1,6 @@
 
+#include <stdio.h>
+
 // Array of bits as found in comp.lang.c FAQ Question 20.8: http://c-faq.com/misc/bitsets.html
 #define BITMASK(b) (1 << ((b) % CHAR_BIT))
 #define BITSLOT(b) ((b) / CHAR_BIT)
@@ -8,6 +10,8 @@
 #define BITNSLOTS(nb) ((nb + CHAR_BIT - 1) / CHAR_BIT)
 
 typedef struct cache_entry {
+    // Single entry as passed between caches (e.g., on injection). Inside a cache, entries are
+    // stored as separate arrays (see Cache.tags and Cache.dirty_mask).
     long cl_id;
 
     unsigned int dirty : 1; // if 0, content is in sync with main memory. if 1, it is not.
@@ -16,6 +20,89 @@ typedef struct cache_entry {
                               // it is empty.
 } cache_entry;
 
+// Tag of invalid (empty) entries in Cache.tags. Needs to be a cl_id no address maps to.
+#define CACHE_TAG_INVALID LONG_MIN
+
+typedef struct tag_index {
+    // Open addressing hash table (with linear probing) mapping cl_ids of valid entries to their
+    // index in tags. Only allocated if ways >= tag_index_threshold.
+    long *cl_ids;
+    long *locations; // index into tags, -1 marks an empty bucket
+    unsigned long long mask; // number of buckets - 1 (number of buckets is a power of two)
+    int shift; // 64 - log2(number of buckets), used for multiplicative hashing
+} tag_index;
+
+// Default associativity from which on a tag index is used for lookups
+#define TAG_INDEX_DEFAULT_THRESHOLD 64
+
+typedef struct state_snapshot {
+    // State of a cache (see Cache__get_state) in an anonymous file, which the cache and all
+    // its forks map copy-on-write (see Cache__fork)
+    int fd;
+    size_t size; // in bytes
+    long references; // caches mapping the snapshot
+} state_snapshot;
+
+typedef struct set_dueling {
+    // DRRIP state: leader sets always insert with SRRIP or BRRIP and their misses move PSEL,
+    // follower sets use the insertion policy PSEL currently favors
+    int leader_sets; // leader sets per insertion policy
+    int psel_bits; // width of the saturating policy selection counter
+    int follower; // 0 = follow PSEL, 1 = always SRRIP, 2 = always BRRIP
+    long leader_stride; // set % leader_stride is 0 for SRRIP and 1 for BRRIP leaders
+                        // (0 = no leaders)
+    int psel; // incremented on SRRIP leader misses, decremented on BRRIP leader misses,
+              // followers use BRRIP if the most significant bit is set
+    long long bimodal_count; // number of BRRIP insertions
+    long long leader_misses[2]; // misses in SRRIP and BRRIP leader sets
+    long long sample_interval; // record psel every sample_interval policy updates (0 = never)
+    long long events; // policy updates since the last reset
+    int *samples; // recorded psel values
+    long long samples_length;
+    long long samples_capacity;
+} set_dueling;
+
+// Defaults for DRRIP, every DRRIP_BIMODAL_INTERVAL-th BRRIP insertion uses rrip_insert instead
+// of the maximum age
+#define DRRIP_DEFAULT_LEADER_SETS 32
+#define DRRIP_DEFAULT_PSEL_BITS 10
+#define DRRIP_BIMODAL_INTERVAL 32
+
+// Set index functions (Cache.set_index_function)
+#define SET_INDEX_MODULO 0 // cl_id modulo sets
+#define SET_INDEX_XOR 1 // XOR of all log2(sets) bit wide chunks of cl_id, modulo sets
+#define SET_INDEX_INTEL_SLICE 2 // slice from the Intel LLC complex addressing hash (up to 8
+                                // slices), cl_id modulo sets per slice within the slice
+
+// Set sampling functions (Cache.sampling_function), select the sets simulated with sampling > 1
+#define SAMPLE_INTERVAL 0 // every sampling-th set, starting with set 0
+#define SAMPLE_HASH 1 // sets/sampling sets (rounded up), chosen pseudo-randomly with a fixed seed
+
+// Hardware prefetchers (Cache.prefetcher), trained by demand misses and by first demand hits
+// on prefetched lines
+#define PREFETCH_NONE 0
+#define PREFETCH_NEXT_LINE 1 // the degree lines starting distance lines after the access
+#define PREFETCH_ADJACENT 2 // other line of the aligned pair of lines (spatial prefetcher)
+#define PREFETCH_STRIDE 3 // constant strides between accesses within a page (IP-less)
+#define PREFETCH_STREAMER 4 // ascending or descending streams, never crosses a page boundary
+
+// Pages tracked by a prefetcher, and their size (stride and streamer detection)
+#define PREFETCH_STREAMS 16
+#define PREFETCH_PAGE_SIZE 4096
+
+typedef struct prefetch_stream {
+    // Accesses to one page as seen by a prefetcher
+    long long page; // CACHE_TAG_INVALID if unused
+    long last_cl_id;
+    long stride; // last stride seen (+1 or -1 with PREFETCH_STREAMER)
+    int confidence; // number of times stride was seen in a row
+    long long last_use; // Cache.prefetch_clock (streams are replaced in LRU order)
+} prefetch_stream;
+
+struct replacement_policy; // see backend.c
+struct cache_kernel; // see backend.c
+struct CoherenceDomain; // see below
+
 typedef struct addr_range {
     // Address range used to communicate consecutive accesses
     // last addr of range is addr+length-1
@@ -23,12 +110,95 @@ typedef struct addr_range {
     long long length;
 } addr_range;
 
+#define ACCESS_LOAD 0
+#define ACCESS_STORE 1
+
+typedef struct access_record {
+    // Packed access as used by Cache__replay (16 bytes, native byte order)
+    long long addr;
+    unsigned int length;
+    unsigned char op; // ACCESS_LOAD or ACCESS_STORE
+    unsigned char non_temporal; // 1 = store without write-allocate (ignored with loads)
+    unsigned char reserved[2];
+} access_record;
+
+// Binary trace files of access records (see trace_writer and Cache__replay_file)
+#define TRACE_MAGIC "CSTRACE" // followed by the version
+#define TRACE_VERSION_DELTA 1 // delta encoded addresses
+#define TRACE_VERSION_RLE 2 // delta encoded, run-length compressed records, with block index
+#define TRACE_HEADER_SIZE 16
+#define TRACE_FOOTER_SIZE 24 // offset of the index, number of blocks, TRACE_INDEX_MAGIC, version
+#define TRACE_INDEX_MAGIC "CSINDEX"
+#define TRACE_BLOCK_RECORDS 4096 // maximum number of records per block
+#define TRACE_BLOCK_HEADER_SIZE(version, records) \
+    ((version) == TRACE_VERSION_DELTA ? 8 + ((records)+1)/2 : 9)
+// Up to 1 byte flags, 10 bytes address and 5 bytes length per record
+#define TRACE_BLOCK_MAX_SIZE (9 + TRACE_BLOCK_RECORDS*16)
+#define TRACE_RLE_MAX_LAG 8 // records are predicted from up to 8 records before
+// Flags of a record (4 bits per record in the block header with TRACE_VERSION_DELTA)
+#define TRACE_FLAG_STORE 1
+#define TRACE_FLAG_NON_TEMPORAL 2
+#define TRACE_FLAG_LENGTH 4 // length differs from the previous (or predicting) record
+// Errors of trace functions
+#define TRACE_ERROR_IO -1 // see errno
+#define TRACE_ERROR_FORMAT -2 // not a trace file, or truncated or corrupt
+// Blocks decoded ahead of the simulation per decoder thread (see Cache__replay_file)
+#define TRACE_PIPELINE_SLOTS_PER_THREAD 4
+
+// State files (see Cache__save_state) hold the state of all caches of a hierarchy in native
+// byte order, every cache in its own section (see Cache__get_state)
+#define STATE_MAGIC "CSSTATE" // followed by the version
+#define STATE_VERSION 1
+#define STATE_HEADER_SIZE 32 // magic, byte order mark, number of caches, fixed size per cache
+#define STATE_BYTE_ORDER 0x0102030405060708LL
+#define STATE_ALIGNMENT 64 // of all sections and of all arrays within a section
+
+#define STATE_ERROR_IO -1 // see errno
+#define STATE_ERROR_FORMAT -2 // not a state file, or truncated or corrupt
+#define STATE_ERROR_MISMATCH -3 // saved from a different configuration or hierarchy
+
+typedef struct trace_writer {
+    FILE *file;
+    int version; // TRACE_VERSION_*
+    long long records; // records written so far
+    access_record *pending; // records of the current block
+    int pending_count;
+    unsigned char *block; // encoded block
+    long long offset; // file offset of the next block
+    long long *offsets; // file offsets of all blocks (only with TRACE_VERSION_RLE)
+    long long blocks;
+    long long blocks_capacity;
+} trace_writer;
+
+typedef struct trace_reader {
+    int version; // TRACE_VERSION_*
+    const unsigned char *data; // mapped file, NULL if it is read with stdio
+    size_t size;
+    size_t offset; // of the next block
+    size_t end; // of the last block (offset of the index)
+    const unsigned char *index; // file offsets of all blocks in data, NULL if not available
+    long long blocks; // number of blocks in index
+    FILE *file;
+    unsigned char *block; // current block if read with stdio
+    long long records; // number of records according to the file header
+    long long decoded; // number of records returned by trace_reader__next (or skipped) so far
+} trace_reader;
+
 struct stats {
     long long count;
     long long byte;
     //long cl; // might be used later
 };
 
+typedef struct sampling_estimate {
+    // Stats of a full cache level estimated from its sampled sets (see Cache__estimate)
+    double scale; // sets per sampled set, factor for all counters of the level
+    double misses; // MISS.count of all sets
+    double misses_error; // half-width of the 95% confidence interval of misses
+    double miss_ratio; // misses per cacheline load (HIT.count + MISS.count)
+    double miss_ratio_error; // half-width of the 95% confidence interval of miss_ratio
+} sampling_estimate;
+
 typedef struct Cache {
 #ifndef NO_PYTHON
     PyObject_HEAD
@@ -40,8 +210,26 @@ typedef struct Cache {
     long cl_bits;
     long subblock_size;
     long subblock_bits;
-    int replacement_policy_id; // 0 = FIFO, 1 = LRU, 2 = MRU, 3 = RR
-                               // (state is kept in the ordering)
+    int set_index_function; // see SET_INDEX_*
+    int slices; // number of slices with SET_INDEX_INTEL_SLICE (power of two), 1 otherwise
+    // Precomputed reduction of cl_ids to sets (per slice), see Cache__init_set_index
+    long set_modulus; // sets (per slice)
+    unsigned long long set_mask; // set_modulus-1 if set_modulus is a power of two, 0 otherwise
+    unsigned long long set_reciprocal[2]; // lower and upper half of ceil(2^128/set_modulus)
+    int set_fold_bits; // chunk width with SET_INDEX_XOR
+    // Set sampling: only sampled_sets of the sets are simulated (and have entries and
+    // replacement state), accesses to all other sets are ignored by this level. Their stats
+    // are estimated from the loads and misses of each sampled set (see Cache__estimate).
+    long sampling; // 1 = all sets, n = one in n sets
+    int sampling_function; // SAMPLE_INTERVAL or SAMPLE_HASH
+    long sampled_sets; // sets with state (sets if sampling is 1)
+    long *sample_map; // index among the sampled sets of each set, -1 if it is not simulated
+                      // (NULL if all sets are simulated)
+    long long *sample_loads; // cacheline loads (HIT and MISS) per sampled set
+    long long *sample_misses; // cacheline misses per sampled set
+    int replacement_policy_id; // 0 = FIFO, 1 = LRU, 2 = MRU, 3 = RR, 4 = PLRU (tree), 5 = NRU,
+                               // 6 = SRRIP, 7 = DRRIP
+                               // (state is kept in the recency lists or policy_state)
                                // for LFU an additional field would be required to capture state
     int write_back; // 1 = write-back
                     // 0 = write-through
@@ -53,33 +241,282 @@ typedef struct Cache {
     PyObject *load_from;
     PyObject *store_to;
     PyObject *victims_to;
+    PyObject *tlb;
 #else
     struct Cache *load_from;
     struct Cache *store_to;
     struct Cache *victims_to;
+    struct Cache *tlb;
 #endif
     int swap_on_load;
 
-    cache_entry *placement;
+    long *tags; // cl_id per entry (sets*ways, grouped by set), CACHE_TAG_INVALID if empty
+    unsigned long long *dirty_mask; // dirty bit per entry (used for write-back), each set starts
+                                    // a new word
+    long dirty_words; // 64 bit words in dirty_mask per set
+    // Queue order (FIFO, LRU and MRU) of each set as doubly linked list of ways, entries never
+    // move. The head is the most recently inserted (FIFO) or used (LRU, MRU) way.
+    int *recency_prev; // sets*ways, previous way in queue, -1 for the head
+    int *recency_next; // sets*ways, next way in queue, -1 for the tail
+    int *recency_head; // first way of each set
+    int *recency_tail; // last way of each set (replaced with FIFO and LRU)
+    // Compact state of PLRU (tree bits), NRU (one bit per way) and SRRIP/DRRIP (rrip_bits per
+    // way)
+    unsigned long long *policy_state;
+    long policy_state_words; // 64 bit words in policy_state per set
+    int rrip_bits; // bits per way for SRRIP ages
+    int rrip_insert; // age of inserted lines (0 is youngest, 2^rrip_bits-1 is replaced first)
+    int rrip_hit_promotion; // 0 = hit priority (age is reset to 0 on a hit),
+                            // 1 = frequency priority (age is decremented on a hit)
+    set_dueling dueling; // only used with DRRIP
+    const struct replacement_policy *policy; // implementation of replacement_policy_id
+    const struct cache_kernel *kernel; // load/store/inject implementation (see Cache__bind_kernel)
     char *subblock_bitfield;
 
+    int tag_index_threshold; // use tag index if ways >= tag_index_threshold (0 = never)
+    tag_index index;
+
+    // Snapshot all arrays of the state (but sample_map and the PSEL samples) point into, at
+    // state_mapping (NULL if they are allocated individually), see Cache__fork
+    state_snapshot *snapshot;
+    unsigned char *state_mapping;
+
+    int prefetcher; // see PREFETCH_*
+    int prefetch_distance; // lines between the access and the first prefetched line
+    int prefetch_degree; // lines prefetched per trigger
+    long long prefetch_latency; // demand accesses until a prefetched line arrives, earlier
+                                // hits are late
+    long long prefetch_clock; // demand accesses (cachelines) so far
+    long prefetch_trigger; // cl_id of the last demand access which triggers prefetches not
+                           // issued yet (CACHE_TAG_INVALID if none), see Cache__prefetch
+    long long *prefetched; // prefetch_clock at the fill of each prefetched entry not hit by a
+                           // demand access yet, -1 otherwise (only allocated with a prefetcher)
+    prefetch_stream prefetch_streams[PREFETCH_STREAMS];
+
+    // All struct stats members are kept contiguous, from LOAD to PREFETCH_LATE (CACHE_STATS)
     struct stats LOAD;
     struct stats STORE;
     struct stats HIT;
     struct stats MISS;
     struct stats EVICT;
+    // Coherence events (only counted in private caches of a CoherenceDomain)
+    struct stats INVALIDATE; // lines removed because another core wrote to them
+    struct stats INTERVENTION; // modified lines supplied to (or written back for) another core
+    struct stats UPGRADE; // stores to lines which were shared with other cores (first level)
+    struct stats BACK_INVALIDATE; // lines removed because the directory replaced their entry
+    // Prefetches (not included in LOAD, HIT and MISS)
+    struct stats PREFETCH_ISSUED; // lines filled by the prefetcher
+    struct stats PREFETCH_USEFUL; // prefetched lines hit by a demand access in time
+    struct stats PREFETCH_LATE; // prefetched lines hit before they could have arrived
+
+    struct CoherenceDomain *coherence; // domain this private cache belongs to (NULL if none)
+    int core; // core of this private cache within coherence (-1 if none)
 
     int verbosity;
+    int busy; // 1 while a thread simulates this cache without holding the GIL
 } Cache;
 
+// Number of struct stats members of Cache
+#define CACHE_STATS 12
+
+// Coherence protocols (CoherenceDomain.protocol)
+#define COHERENCE_MESI 0
+#define COHERENCE_MOESI 1 // modified lines are shared without write-back (OWNED)
+
+// Directory states of a cacheline (CoherenceDomain)
+#define COHERENCE_SHARED 0 // clean in all sharers
+#define COHERENCE_EXCLUSIVE 1 // held by owner only, not written
+#define COHERENCE_MODIFIED 2 // held by owner only, written
+#define COHERENCE_OWNED 3 // written by owner, which shares it with other cores (MOESI)
+
+// Maximum number of cores in a CoherenceDomain
+#define COHERENCE_MAX_CORES 64
+
+typedef struct coherence_entry {
+    // Directory entry of a cacheline held by at least one core
+    long cl_id;
+    unsigned long long sharers; // bit per core holding the line in any of its private levels
+    int owner; // core holding the line as EXCLUSIVE, MODIFIED or OWNED, -1 if SHARED
+    int state; // COHERENCE_SHARED, COHERENCE_EXCLUSIVE, COHERENCE_MODIFIED or COHERENCE_OWNED
+    long long last_use; // CoherenceDomain.clock at the last lookup (LRU in bounded directories)
+} coherence_entry;
+
+typedef struct CoherenceDomain {
+    // Cores with private cache levels in front of a shared level (or main memory). A directory
+    // tracks which cores hold a line, stores invalidate and loads downgrade copies of other
+    // cores. Accesses need to go through CoherenceDomain__load and CoherenceDomain__store.
+#ifndef NO_PYTHON
+    PyObject_HEAD
+    PyObject *first_levels; // tuple of Cache objects (one per core)
+#endif
+    int protocol; // COHERENCE_MESI or COHERENCE_MOESI
+    int cores;
+    Cache **private_caches; // private levels of all cores (each core's first level first)
+    int *private_start; // cores+1 offsets into private_caches
+    Cache *shared; // first level shared by all cores, NULL if only main memory is shared
+    // Directory (snoop filter): with directory_sets = 0, it has room for every line held by any
+    // core. Otherwise it is a set-associative cache of directory_sets*directory_ways entries
+    // (cl_id modulo directory_sets, LRU), a replaced entry back-invalidates all its copies.
+    long directory_sets;
+    long directory_ways;
+    coherence_entry *entries; // grouped by set if directory_sets > 0
+    long capacity;
+    long *free_entries; // unused indices into entries (only used if directory_sets = 0)
+    long free_count;
+    tag_index index; // cl_id to index into entries
+    long long clock; // number of lookups, orders entries by last use
+    long long lookups; // directory accesses (by private misses and upgrades)
+    long long misses; // lookups of lines not held by any core
+    long long evictions; // entries replaced in a bounded directory
+} CoherenceDomain;
+
+typedef struct StackDistance {
+    // LRU stack distances (Mattson) of all cacheline accesses, for 1, 2, 4, ... max_sets sets
+    // (modulo indexing) at once. The distance of an access is the number of distinct lines of
+    // its set used since the last access to the same line, it hits in every LRU cache with this
+    // number of sets and more ways than that. Distances are counted up to max_ways-1, larger
+    // ones and first accesses are counted as max_ways.
+#ifndef NO_PYTHON
+    PyObject_HEAD
+#endif
+    unsigned int cl_size;
+    unsigned int cl_bits;
+    int levels; // number of set counts (max_sets = 2^(levels-1))
+    long max_ways;
+    // Every set (of all levels, level k has 2^k sets, starting at set 2^k-1) numbers its accesses
+    // with a local time. A Fenwick tree over window = 2*max_ways times marks the last access of
+    // each line that is at most max_ways lines deep, the distance of an access is the number of
+    // marks after the line's previous mark. Marked lines own one of max_ways slots of their set,
+    // which holds the time of the mark, so the times of a set can be compacted when it runs out
+    // of window without touching the lines.
+    long window;
+    long window_step; // largest power of two <= window (Fenwick tree search)
+    // Per set (contiguous, STACK_DISTANCE_SET_SIZE ints): next local time, number of marks,
+    // Fenwick tree and slot at each local time (window entries each), time and line of each
+    // slot (max_ways entries each)
+    int *set_states;
+    tag_index index; // cl_id to line
+    long lines;
+    long lines_capacity;
+    int *last; // slot per line and level, only valid if the slot still belongs to the line
+    long long *histograms; // accesses per level (max_ways+1 each) by stack distance
+    long long accesses; // cacheline accesses
+    int busy; // 1 while a thread replays without holding the GIL
+} StackDistance;
+
+#define STACK_DISTANCE_SET_SIZE(window, max_ways) (2 + 2*(window) + 2*(max_ways))
+
+// Default bits per way for SRRIP ages
+#define RRIP_DEFAULT_BITS 2
+
+// Maximum number of caches that are considered part of one hierarchy
+#define HIERARCHY_MAX_CACHES 64
+
+// Counts extrapolated by time sampling: HIT, MISS and EVICT
+#define TIME_SAMPLING_STATS 3
+
+typedef struct time_sampling {
+    // Time sampling of a hierarchy (SMARTS, see time_sampling__replay): records are split into
+    // periods, the last detailed records of every period are simulated with stats (detailed
+    // window), the warming records before them are simulated without stats (functional
+    // warming, see Cache__warm) and all others are skipped (fast-forward).
+    long long period;
+    long long detailed;
+    long long warming; // -1 warms all records outside of detailed windows
+    long long records; // records seen so far, simulated or skipped
+    long long windows; // completed detailed windows
+    long long window_records; // records of the current detailed window (0 if none is open)
+    double window_sum; // records of completed windows
+    double window_squares; // sum of squared records per completed window
+    int caches;
+    Cache* hierarchy[HIERARCHY_MAX_CACHES]; // hierarchy[0] is the first level
+    // Per cache and extrapolated count: count when the current window was opened, sums of
+    // squared counts and of counts times records of completed windows
+    long long window_start[HIERARCHY_MAX_CACHES][TIME_SAMPLING_STATS];
+    double count_squares[HIERARCHY_MAX_CACHES][TIME_SAMPLING_STATS];
+    double count_records[HIERARCHY_MAX_CACHES][TIME_SAMPLING_STATS];
+} time_sampling;
+
+typedef struct time_sampling_estimate {
+    // Counts of a cache level over all records of a time sampled replay, extrapolated from the
+    // detailed windows (see time_sampling__estimate)
+    double counts[TIME_SAMPLING_STATS]; // HIT, MISS and EVICT counts
+    double errors[TIME_SAMPLING_STATS]; // half-widths of the 95% confidence intervals
+} time_sampling_estimate;
+
 int Cache__load(Cache* self, addr_range range);
 
 void Cache__store(Cache* self, addr_range range, int non_temporal);
 
+void Cache__replay(Cache* self, const access_record* records, long long n);
+
+int Cache__replay_parallel(Cache* self, const access_record* records, long long n, int threads);
+
+long long Cache__replay_file(Cache* self, const char* path, int decode_threads);
+
+int trace_writer__open(trace_writer* self, const char* path, int version);
+int trace_writer__write(trace_writer* self, const access_record* record);
+int trace_writer__close(trace_writer* self);
+
+int trace_reader__open(trace_reader* self, const char* path);
+int trace_reader__next(trace_reader* self, access_record* records);
+int trace_reader__decode(const trace_reader* self, long long block, access_record* records);
+void trace_reader__close(trace_reader* self);
+
+void Cache__force_write_back(Cache* self);
+
+void Cache__reset_stats(Cache* self);
+
+void Cache__estimate(const Cache* self, sampling_estimate* estimate);
+
+void Cache__warm(Cache* self, const access_record* records, long long n);
+
+size_t Cache__state_size(const Cache* self);
+void Cache__get_state(const Cache* self, void* state);
+int Cache__set_state(Cache* self, const void* state, size_t size);
+int Cache__save_state(Cache* self, const char* path);
+int Cache__restore_state(Cache* self, const char* path);
+int Cache__fork(Cache* self, Cache* fork);
+int Cache__fork_hierarchy(Cache* self, Cache** forks);
+
+int time_sampling__init(time_sampling* self, Cache* first_level, long long period,
+                        long long detailed, long long warming);
+void time_sampling__replay(time_sampling* self, const access_record* records, long long n);
+long long time_sampling__replay_file(time_sampling* self, const char* path);
+int time_sampling__estimate(const time_sampling* self, const Cache* cache,
+                            time_sampling_estimate* estimate);
+
+int Cache__alloc_state(Cache* self);
+void Cache__free_state(Cache* self);
+void Cache__bind_kernel(Cache* self);
+
+int CoherenceDomain__init(CoherenceDomain* self, Cache** first_levels, int cores, int protocol,
+                          long directory_sets, long directory_ways);
+void CoherenceDomain__free(CoherenceDomain* self);
+void CoherenceDomain__load(CoherenceDomain* self, int core, addr_range range);
+void CoherenceDomain__store(CoherenceDomain* self, int core, addr_range range, int non_temporal);
+void CoherenceDomain__replay(CoherenceDomain* self, const access_record** traces,
+                             const long long* lengths, const long long** timestamps,
+                             long long quantum);
+
+int StackDistance__init(StackDistance* self, unsigned int cl_size, long max_sets, long max_ways);
+void StackDistance__free(StackDistance* self);
+int StackDistance__access(StackDistance* self, long cl_id);
+int StackDistance__replay(StackDistance* self, const access_record* records, long long n);
+long long StackDistance__replay_file(StackDistance* self, const char* path);
+long long StackDistance__hits(const StackDistance* self, long sets, long ways);
+
+int tag_index__init(tag_index* index, long entries);
+void tag_index__clear(tag_index* index);
+void tag_index__free(tag_index* index);
+
+int Cache__get_hierarchy(Cache* self, Cache** caches, int max_caches);
+
 //!might break for complicated cache structures
 void dealloc_cacheSim(Cache*);
 
 Cache* get_cacheSim_from_file(const char* file);
+int get_cacheSims_from_file(const char* file, Cache** first_levels, int max_first_levels);
 // Cache* get_cacheSim_from_file(char** lines, int size);
 
 #ifndef USE_PIN
@@ -4,9 +4,12 @@ from __future__ import print_function
 from __future__ import division
 from __future__ import unicode_literals
 
+import copy
 import textwrap
 from functools import reduce
+import struct
 import sys
+from array import array
 from collections.abc import Iterable
 
 from cachesim import backend
@@ -20,6 +23,58 @@ def is_power2(num):
     return num > 0 and (num & (num - 1)) == 0
 
 
+# Layout of packed access records as consumed by CacheSimulator.replay() (see access_record in
+# backend.h). The equivalent numpy dtype is:
+#   numpy.dtype([('addr', 'i8'), ('length', 'u4'), ('op', 'u1'), ('non_temporal', 'u1'),
+#                ('reserved', 'V2')])
+ACCESS_RECORD_FORMAT = '=qIBB2x'
+ACCESS_LOAD = 0
+ACCESS_STORE = 1
+
+
+def pack_accesses(accesses):
+    """
+    Pack accesses into a buffer of access records, as used by CacheSimulator.replay().
+
+    :param accesses: iterable of (op, addr, length, non_temporal) tuples, with op being
+                     ACCESS_LOAD or ACCESS_STORE
+    """
+    record = struct.Struct(ACCESS_RECORD_FORMAT)
+    return bytearray(b''.join(record.pack(addr, length, op, non_temporal)
+                              for op, addr, length, non_temporal in accesses))
+
+
+def write_trace(path, accesses, compress=True):
+    """
+    Write accesses to a binary trace file, to be replayed with CacheSimulator.replay_file().
+
+    :param path: file to create (or overwrite)
+    :param accesses: buffer of packed access records or iterable of (op, addr, length,
+                     non_temporal) tuples, as accepted by CacheSimulator.replay()
+    :param compress: if True (default), runs of accesses continuing the strides of the
+                     previous accesses are compressed and an index of all blocks is written,
+                     which allows decoding them in parallel. Otherwise, only addresses are
+                     delta encoded.
+    """
+    if not is_buffer(accesses):
+        accesses = pack_accesses(accesses)
+    backend.write_trace(path, accesses, version=2 if compress else 1)
+
+
+def read_trace(path):
+    """Return all accesses of a binary trace file as bytearray of packed access records."""
+    return backend.read_trace(path)
+
+
+def is_buffer(obj):
+    """Return True if obj supports the buffer protocol (e.g., numpy arrays or array.array)."""
+    try:
+        memoryview(obj)
+    except TypeError:
+        return False
+    return True
+
+
 class CacheSimulator(object):
     """
     High-level interface to the Cache Simulator.
@@ -27,12 +82,14 @@ class CacheSimulator(object):
     This is the only class that needs to be directly interfaced to.
     """
 
-    def __init__(self, first_level, main_memory):
+    def __init__(self, first_level, main_memory, tlb=None):
         """
         Create interface to interact with cache simulator backend.
 
         :param first_level: first cache level object.
         :param main_memory: main memory object.
+        :param tlb: first TLB level object, translating all loads and stores to first_level
+                    (default: None, addresses are not translated)
         """
         assert isinstance(first_level, Cache), \
             "first_level needs to be a Cache object."
@@ -40,6 +97,8 @@ class CacheSimulator(object):
             "main_memory needs to be a MainMemory object"
 
         self.first_level = first_level
+        if tlb is not None:
+            first_level.set_tlb(tlb)
         for l in self.levels(with_mem=False):  # iterating to last level
             self.last_level = l
 
@@ -105,6 +164,8 @@ class CacheSimulator(object):
         """
         for c in self.levels(with_mem=False):
             c.reset_stats()
+        for t in self.tlb_levels():
+            t.reset_stats()
 
     def force_write_back(self):
         """Write all pending dirty lines back."""
@@ -117,12 +178,19 @@ class CacheSimulator(object):
         """
         Load one or more addresses.
 
-        :param addr: byte address of load location
+        :param addr: byte address of load location, an iterable of addresses or an integer
+                     array (anything supporting the buffer protocol, e.g. numpy.int64 arrays)
         :param length: All address from addr until addr+length (exclusive) are
-                       loaded (default: 1)
+                       loaded (default: 1). If addr is an array, length may also be an integer
+                       array with one length per address.
         """
         if addr is None:
             return
+        elif is_buffer(addr):
+            if is_buffer(length):
+                self.first_level.arrayload(addr, lengths=length)
+            else:
+                self.first_level.arrayload(addr, length=length)
         elif not isinstance(addr, Iterable):
             self.first_level.load(addr, length=length)
         else:
@@ -132,20 +200,24 @@ class CacheSimulator(object):
         """
         Store one or more adresses.
 
-        :param addr: byte address of store location
+        :param addr: byte address of store location, an iterable of addresses or an integer
+                     array (anything supporting the buffer protocol, e.g. numpy.int64 arrays)
         :param length: All address from addr until addr+length (exclusive) are
-                       stored (default: 1)
+                       stored (default: 1). If addr is an array, length may also be an integer
+                       array with one length per address.
         :param non_temporal: if True, no write-allocate will be issued, but cacheline will be zeroed
         """
-        if non_temporal:
-            raise ValueError("non_temporal stores are not yet supported")
-
         if addr is None:
             return
+        elif is_buffer(addr):
+            if is_buffer(length):
+                self.first_level.arraystore(addr, lengths=length, non_temporal=non_temporal)
+            else:
+                self.first_level.arraystore(addr, length=length, non_temporal=non_temporal)
         elif not isinstance(addr, Iterable):
-            self.first_level.store(addr, length=length)
+            self.first_level.store(addr, length=length, non_temporal=non_temporal)
         else:
-            self.first_level.iterstore(addr, length=length)
+            self.first_level.iterstore(addr, length=length, non_temporal=non_temporal)
 
     def loadstore(self, addrs, length=1):
         """
@@ -159,6 +231,128 @@ class CacheSimulator(object):
             raise ValueError("addr must be iteratable")
         self.first_level.loadstore(addrs, length=length)
 
+    def replay(self, accesses, threads=1):
+        """
+        Replay loads and stores in order given.
+
+        :param accesses: buffer of packed access records (see ACCESS_RECORD_FORMAT), e.g. as
+                         returned by pack_accesses() or a numpy structured array, or an iterable
+                         of (op, addr, length, non_temporal) tuples
+        :param threads: maximum number of threads. Cachelines are distributed over threads by
+                        their set, if this gives exactly the same results as a serial replay:
+                        all levels use modulo set indexing and the same cacheline size, no
+                        level uses RR or DRRIP replacement, a tag index, a prefetcher, set
+                        sampling, a TLB or verbose output, no level belongs to a coherence
+                        domain, the subblock bits of a set (ways*cl_size/subblock_size) of
+                        write-combining levels fill whole bytes, and no access spans more than
+                        one cacheline. The number of threads used divides the number of sets
+                        of every level.
+
+        Returns the number of threads used (1 if replayed serially).
+        """
+        if not is_buffer(accesses):
+            accesses = pack_accesses(accesses)
+        return self.first_level.replay(accesses, threads=threads)
+
+    def replay_file(self, path, decode_threads=1):
+        """
+        Replay a binary trace file (see write_trace()) in order given.
+
+        The file is decoded block by block while it is simulated, without loading it as a
+        whole. Returns the number of accesses replayed.
+
+        :param decode_threads: number of background threads decoding blocks of compressed
+                               traces ahead of the simulation (default 1). With 0, or for
+                               uncompressed traces, blocks are decoded by the simulating thread.
+        """
+        return self.first_level.replay_file(path, decode_threads=decode_threads)
+
+    def warm(self, accesses):
+        """
+        Replay loads and stores (see replay()) without counting any stats (functional warming).
+
+        Cache contents and replacement state are updated exactly like by replay(), stats and
+        verbose output are left alone. Useful to warm up the caches before a measurement,
+        instead of replay() followed by reset_stats().
+        """
+        if not is_buffer(accesses):
+            accesses = pack_accesses(accesses)
+        self.first_level.warm(accesses)
+
+    def replay_sampled(self, accesses, period, detailed, warming=None):
+        """
+        Replay loads and stores (see replay()) with time sampling and extrapolate the stats.
+
+        Accesses are split into periods of *period* accesses. The last *detailed* accesses of
+        every period are simulated in detail, with stats. The *warming* accesses before them
+        are simulated without stats (functional warming, see warm()), all others are skipped
+        (fast-forward). With warming=None, all accesses outside of detailed windows are warmed,
+        so cache contents are exact (SMARTS). Shorter warming is faster, but misses of lines
+        which would have been cached are counted as well (cold-start bias), most notably in
+        large levels.
+
+        All stats are reset first, afterwards they hold the sums of all detailed windows.
+        Returns a dict by level name with HIT_count, MISS_count and EVICT_count extrapolated
+        to all accesses, each with the half-width of its 95% confidence interval (e.g.
+        HIT_count_error), the number of detailed windows, of accesses simulated in detail
+        (detailed) and of all accesses (records). With set sampling, counts and errors are
+        scaled like in Cache.stats() (without the error of set sampling).
+        """
+        if not is_buffer(accesses):
+            accesses = pack_accesses(accesses)
+        return self._scale_sampled(self.first_level.replay_sampled(
+            accesses, period, detailed, -1 if warming is None else warming))
+
+    def replay_file_sampled(self, path, period, detailed, warming=None):
+        """
+        Replay a binary trace file (see write_trace()) with time sampling (see replay_sampled()).
+
+        Blocks of accesses which are skipped as a whole are not decoded.
+        """
+        return self._scale_sampled(self.first_level.replay_file_sampled(
+            path, period, detailed, -1 if warming is None else warming))
+
+    def _scale_sampled(self, estimates):
+        """Apply set sampling scale of every level to estimates of replay_sampled()."""
+        for c in list(self.levels(with_mem=False)) + list(self.tlb_levels()):
+            if c.name in estimates and c.backend.sampling > 1:
+                scale = c.backend.sampling_estimate()['scale']
+                for k in ['HIT_count', 'MISS_count', 'EVICT_count']:
+                    estimates[c.name][k] *= scale
+                    estimates[c.name][k + '_error'] *= scale
+        return estimates
+
+    def save_state(self, path):
+        """
+        Save contents, replacement state and stats of all cache levels to a checkpoint file.
+
+        A warmed up hierarchy can thus be restored by restore_state() instead of being warmed up
+        again. The file is in native byte order. The global state of the RR policy's random
+        number generator is not saved. CacheSimulator objects can also be pickled.
+        """
+        self.first_level.save_state(path)
+
+    def restore_state(self, path):
+        """
+        Restore all cache levels from a checkpoint file written by save_state().
+
+        The hierarchy needs to be configured identically, otherwise ValueError is raised and
+        no level is changed.
+        """
+        self.first_level.restore_state(path)
+
+    def fork(self):
+        """
+        Return an independent copy of this simulator, with the current contents, state and stats.
+
+        Levels of the fork share their state with the originals copy-on-write, in groups of
+        sets of one page each, so forks are cheap to create and only take memory for the sets
+        they (or the original) change afterwards. Useful to try several continuations of one
+        warmed up hierarchy.
+        """
+        forks = self.first_level.backend.fork()
+        return copy.deepcopy(self, {id(c): f for c, f in forks.items()})
+
     def stats(self):
         """Collect all stats from all cache levels."""
         for c in self.levels():
@@ -175,10 +369,30 @@ class CacheSimulator(object):
                   "({STORE_byte:>8}B) {EVICT_count:>6} ({EVICT_byte:>8}B)".format(
                     HIT_bytes=2342, **s),
                   file=file)
+        for t in self.tlb_levels():
+            s = t.stats()
+            print("{name:>5} {HIT_count:>6} ({HIT_byte:>8}B) {MISS_count:>6} ({MISS_byte:>8}B) "
+                  "{LOAD_count:>6} ({LOAD_byte:>8}B)".format(**s), file=file)
 
     def levels(self, with_mem=True):
         """Return cache levels, optionally including main memory."""
-        p = self.first_level
+        for l in self._levels_from(self.first_level):
+            yield l
+
+        if with_mem:
+            yield self.main_memory
+
+    def tlb_levels(self):
+        """Return TLB levels (and page-walk caches) translating accesses to first_level."""
+        t = self.first_level.tlb
+        while t is not None:
+            yield t
+            t = t.load_from
+
+    @staticmethod
+    def _levels_from(first_level):
+        """Return cache levels reachable from first_level."""
+        p = first_level
         while p is not None:
             yield p
             # FIXME bad hack to include victim caches, need a more general solution, probably
@@ -189,9 +403,6 @@ class CacheSimulator(object):
                 yield p.store_to
             p = p.load_from
 
-        if with_mem:
-            yield self.main_memory
-
     def count_invalid_entries(self):
         """Sum of all invalid entry counts from cache levels."""
         return sum([c.count_invalid_entries() for c in self.levels(with_mem=False)])
@@ -200,6 +411,8 @@ class CacheSimulator(object):
         """Mark all entries invalid and reset stats."""
         for c in self.levels(with_mem=False):
             c.mark_all_invalid()
+        for t in self.tlb_levels():
+            t.mark_all_invalid()
         self.reset_stats()
 
     # def draw_array(self, start, width, height, block=1):
@@ -230,9 +443,340 @@ class CacheSimulator(object):
         """Return string representation of object."""
         first_level_repr = self.first_level.__repr__(recursion=recursion)
         main_memory_repr = self.main_memory.__repr__(recursion=recursion)
+        if self.first_level.tlb is not None:
+            return 'CacheSimulator({}, {}, tlb={})'.format(
+                first_level_repr, main_memory_repr,
+                self.first_level.tlb.__repr__(recursion=recursion))
         return 'CacheSimulator({}, {})'.format(first_level_repr, main_memory_repr)
 
 
+class MultiCoreSimulator(CacheSimulator):
+    """
+    High-level interface to a multi-core cache hierarchy.
+
+    Each core has its own first level and private levels, which load from (and store to) a
+    level shared by all cores. Private copies are kept coherent by a MESI or MOESI protocol.
+    """
+
+    protocol_enum = {"MESI": 0, "MOESI": 1}
+
+    def __init__(self, first_levels, main_memory, protocol="MESI", directory=None):
+        """
+        Create interface to interact with a multi-core cache simulator backend.
+
+        :param first_levels: list of first cache level objects, one per core. All levels
+                             from a first level up to (excluding) the first level all cores
+                             load from are private to the core.
+        :param main_memory: main memory object.
+        :param protocol: MESI (default) or MOESI (modified lines are shared without
+                         write-back to the shared level)
+        :param directory: Directory object, bounding the number of lines tracked for the
+                          private levels (default: None, every line is tracked)
+        """
+        assert 1 <= len(first_levels) <= 64, "first_levels needs to contain 1 to 64 caches."
+        assert all(isinstance(l, Cache) for l in first_levels), \
+            "first_levels needs to contain Cache objects."
+        assert protocol in self.protocol_enum, \
+            "Unsupported coherence protocol, we only support: " + ', '.join(self.protocol_enum)
+        assert directory is None or isinstance(directory, Directory), \
+            "directory needs to be None or a Directory object."
+        self.first_levels = list(first_levels)
+        super(MultiCoreSimulator, self).__init__(first_levels[0], main_memory)
+        self.protocol = protocol
+        self.directory = directory
+        kwargs = {}
+        if directory is not None:
+            kwargs = {'directory_sets': directory.sets, 'directory_ways': directory.ways}
+        self.domain = backend.CoherenceDomain(
+            [l.backend for l in self.first_levels], protocol=self.protocol_enum[protocol],
+            **kwargs)
+        if directory is not None:
+            directory.domain = self.domain
+
+    @classmethod
+    def from_dict(cls, d, protocol="MESI"):
+        """
+        Create multi-core cache hierarchy from dictionary.
+
+        Cores are numbered by the order of their first levels (caches no other cache refers
+        to) in d. The level shared by all cores may hold a 'directory' dictionary with the
+        arguments of a Directory (e.g., {'sets': 1024, 'ways': 16}).
+        """
+        main_memory = MainMemory()
+        caches = {}
+        referred_caches = set()
+        directory = None
+        directory_level = None
+        for name, conf in d.items():
+            caches[name] = Cache(name=name,
+                                 **{k: v for k, v in conf.items()
+                                    if k not in ['store_to', 'load_from', 'victims_to',
+                                                 'directory']})
+            for link in ['store_to', 'load_from', 'victims_to']:
+                if conf.get(link) is not None:
+                    referred_caches.add(conf[link])
+            if conf.get('directory') is not None:
+                assert directory is None, "Only one level may have a directory."
+                directory = Directory(**dict({'name': name + '_DIR'}, **conf['directory']))
+                directory_level = caches[name]
+        for name, conf in d.items():
+            if conf.get('store_to') is not None:
+                caches[name].set_store_to(caches[conf['store_to']])
+            if conf.get('load_from') is not None:
+                caches[name].set_load_from(caches[conf['load_from']])
+            if conf.get('victims_to') is not None:
+                caches[name].set_victims_to(caches[conf['victims_to']])
+
+        first_levels = [caches[name] for name in d if name not in referred_caches]
+        assert first_levels, "Unable to find first cache levels."
+        last_level_load = c = first_levels[0]
+        while c is not None:
+            last_level_load = c
+            c = c.load_from
+        last_level_store = c = first_levels[0]
+        while c is not None:
+            last_level_store = c
+            c = c.store_to
+        main_memory.load_to(last_level_load)
+        main_memory.store_from(last_level_store)
+
+        if directory is not None:
+            shared = [l for l in cls._levels_from(first_levels[0])
+                      if all(any(l is s for s in cls._levels_from(f)) for f in first_levels)]
+            assert shared and shared[0] is directory_level, \
+                "directory needs to be attached to the first level shared by all cores."
+
+        return (cls(first_levels, main_memory, protocol=protocol, directory=directory),
+                caches, main_memory)
+
+    def reset_stats(self):
+        """Reset statistics in all cache levels and the directory."""
+        super(MultiCoreSimulator, self).reset_stats()
+        self.domain.reset_stats()
+
+    def load(self, addr, length=1, core=0):
+        """
+        Load one or more addresses on a core.
+
+        :param addr: byte address of load location or an iterable of addresses
+        :param length: All address from addr until addr+length (exclusive) are
+                       loaded (default: 1)
+        :param core: index of the core in first_levels
+        """
+        if addr is None:
+            return
+        elif not isinstance(addr, Iterable):
+            self.domain.load(core, addr, length=length)
+        else:
+            for a in addr:
+                self.domain.load(core, a, length=length)
+
+    def store(self, addr, length=1, non_temporal=False, core=0):
+        """
+        Store one or more adresses on a core.
+
+        :param addr: byte address of store location or an iterable of addresses
+        :param length: All address from addr until addr+length (exclusive) are
+                       stored (default: 1)
+        :param non_temporal: if True, no write-allocate will be issued, but cacheline will be zeroed
+        :param core: index of the core in first_levels
+        """
+        if addr is None:
+            return
+        elif not isinstance(addr, Iterable):
+            self.domain.store(core, addr, length=length, non_temporal=non_temporal)
+        else:
+            for a in addr:
+                self.domain.store(core, a, length=length, non_temporal=non_temporal)
+
+    def loadstore(self, addrs, length=1, core=0):
+        """
+        Load and store address in order given on a core.
+
+        :param addrs: iteratable of address tuples: [(loads, stores), ...]
+        :param length: will load and store all bytes between addr and
+                       addr+length (for each address)
+        :param core: index of the core in first_levels
+        """
+        if not isinstance(addrs, Iterable):
+            raise ValueError("addr must be iteratable")
+        for loads, stores in addrs:
+            self.load(loads, length=length, core=core)
+            self.store(stores, length=length, core=core)
+
+    def replay(self, traces, timestamps=None, quantum=1):
+        """
+        Replay one trace of loads and stores per core.
+
+        :param traces: list with one trace per core, each a buffer of packed access records
+                       (see CacheSimulator.replay) or an iterable of (op, addr, length,
+                       non_temporal) tuples
+        :param timestamps: None or list with one integer array per core, with a non-decreasing
+                           timestamp per access. Accesses of all cores are replayed in
+                           timestamp order, accesses with equal timestamps in core order.
+        :param quantum: without timestamps, cores take turns (round-robin), each replaying
+                        its next quantum accesses (default 1)
+
+        Both interleavings are deterministic, so results are reproducible.
+        """
+        traces = [t if is_buffer(t) else pack_accesses(t) for t in traces]
+        if timestamps is not None:
+            timestamps = [t if is_buffer(t) else array('q', t) for t in timestamps]
+        self.domain.replay(traces, timestamps=timestamps, quantum=quantum)
+
+    def replay_file(self, paths, timestamps=None, quantum=1):
+        """
+        Replay one binary trace file (see write_trace()) per core.
+
+        All traces are read into memory first, see replay() for the other arguments.
+        """
+        self.replay([read_trace(p) for p in paths], timestamps=timestamps, quantum=quantum)
+
+    def warm(self, accesses):
+        """Not supported, warming would bypass the coherence directory."""
+        raise NotImplementedError("warm() is not supported with multiple cores")
+
+    def replay_sampled(self, accesses, period, detailed, warming=None):
+        """Not supported, see warm()."""
+        raise NotImplementedError("replay_sampled() is not supported with multiple cores")
+
+    def replay_file_sampled(self, path, period, detailed, warming=None):
+        """Not supported, see warm()."""
+        raise NotImplementedError("replay_file_sampled() is not supported with multiple cores")
+
+    def save_state(self, path):
+        """Not supported, the coherence directory is not part of the checkpoint."""
+        raise NotImplementedError("save_state() is not supported with multiple cores")
+
+    def restore_state(self, path):
+        """Not supported, see save_state()."""
+        raise NotImplementedError("restore_state() is not supported with multiple cores")
+
+    def fork(self):
+        """Not supported, see save_state()."""
+        raise NotImplementedError("fork() is not supported with multiple cores")
+
+    def print_stats(self, header=True, file=sys.stdout):
+        """Pretty print stats table, including coherence events of private levels."""
+        if header:
+            print("CACHE {:*^18} {:*^18} {:*^18} {:*^18} {:*^18} {:*^18} {:*^18} {:*^18}".format(
+                "HIT", "MISS", "LOAD", "STORE", "EVICT", "INVALIDATE", "INTERVENTION",
+                "UPGRADE"), file=file)
+        for s in self.stats():
+            print("{name:>5} {HIT_count:>6} ({HIT_byte:>8}B) {MISS_count:>6} ({MISS_byte:>8}B) "
+                  "{LOAD_count:>6} ({LOAD_byte:>8}B) {STORE_count:>6} "
+                  "({STORE_byte:>8}B) {EVICT_count:>6} ({EVICT_byte:>8}B) "
+                  "{INVALIDATE_count:>6} ({INVALIDATE_byte:>8}B) "
+                  "{INTERVENTION_count:>6} ({INTERVENTION_byte:>8}B) "
+                  "{UPGRADE_count:>6} ({UPGRADE_byte:>8}B)".format(**s),
+                  file=file)
+        if self.directory is not None:
+            if header:
+                print("  DIR {:*^18} {:*^18} {:*^18} {:*^18}".format(
+                    "LOOKUP", "MISS", "EVICT", "BACK_INVALIDATE"), file=file)
+            s = self.directory.stats()
+            print("{name:>5} {LOOKUP_count:>6} {0:>11} {MISS_count:>6} {0:>11} "
+                  "{EVICT_count:>6} {0:>11} {BACK_INVALIDATE_count:>6} "
+                  "({BACK_INVALIDATE_byte:>8}B)".format('', **s), file=file)
+
+    def levels(self, with_mem=True):
+        """Return cache levels of all cores (each only once), optionally including main memory."""
+        seen = []
+        for first_level in self.first_levels:
+            for l in self._levels_from(first_level):
+                if not any(l is s for s in seen):
+                    seen.append(l)
+                    yield l
+        if with_mem:
+            yield self.main_memory
+
+    def __repr__(self, recursion=True):
+        """Return string representation of object."""
+        first_levels_repr = ', '.join(l.__repr__(recursion=recursion) for l in self.first_levels)
+        main_memory_repr = self.main_memory.__repr__(recursion=recursion)
+        return 'MultiCoreSimulator([{}], {}, protocol={!r}, directory={!r})'.format(
+            first_levels_repr, main_memory_repr, self.protocol, self.directory)
+
+
+class StackDistanceSimulator(object):
+    """
+    Single-pass simulation of many LRU cache configurations at once.
+
+    One replay counts the LRU stack distance of every cacheline access for 1, 2, 4, ...
+    *max_sets* sets (cacheline index modulo sets). This gives the hits of LRU caches with any of
+    these set counts and 1 to *max_ways* ways, e.g. to draw miss ratio curves, without
+    replaying the trace once per configuration. Loads and stores are counted alike (as loads of
+    a single level), no hierarchy is simulated. Misses equal those of an LRU Cache only for
+    loads, a Cache neither promotes nor counts lines on store hits.
+    """
+
+    def __init__(self, max_sets=1, max_ways=16, cl_size=64):
+        """Create simulator for LRU caches of up to *max_sets* (power of two) and *max_ways*."""
+        assert is_power2(max_sets), "max_sets needs to be a power of two."
+        assert is_power2(cl_size), "cl_size needs to be a power of two."
+        assert max_ways >= 1, "max_ways needs to be positive."
+        self.max_sets = max_sets
+        self.max_ways = max_ways
+        self.cl_size = cl_size
+        self.backend = backend.StackDistance(cl_size=cl_size, max_sets=max_sets,
+                                             max_ways=max_ways)
+
+    def replay(self, accesses):
+        """
+        Count accesses (see CacheSimulator.replay()) in order given.
+
+        Every cacheline touched by an access is counted once.
+        """
+        if not is_buffer(accesses):
+            accesses = pack_accesses(accesses)
+        self.backend.replay(accesses)
+
+    def replay_file(self, path):
+        """Count all accesses of a binary trace file (see write_trace()), return their number."""
+        return self.backend.replay_file(path)
+
+    @property
+    def accesses(self):
+        """Return number of cacheline accesses counted."""
+        return self.backend.accesses
+
+    def histogram(self, sets=1):
+        """
+        Return number of accesses by stack distance for *sets* sets.
+
+        Entry d counts accesses to lines used d other lines of the same set ago, the last
+        entry (d = max_ways) counts first accesses and all accesses with larger distances.
+        """
+        return self.backend.histogram(sets)
+
+    def hits(self, sets, ways):
+        """Return number of cacheline hits in an LRU cache with *sets* sets and *ways* ways."""
+        assert 1 <= ways <= self.max_ways, "ways needs to be between 1 and max_ways."
+        return sum(self.histogram(sets)[:ways])
+
+    def misses(self, sets, ways):
+        """Return number of cacheline misses in an LRU cache with *sets* sets and *ways* ways."""
+        return self.accesses - self.hits(sets, ways)
+
+    def miss_ratio_curve(self, sets=1):
+        """Return miss ratios for *sets* sets and 1 to max_ways ways as array('d')."""
+        curve = array('d')
+        misses = self.accesses
+        for count in self.histogram(sets)[:-1]:
+            misses -= count
+            curve.append(misses / self.accesses if self.accesses else 0.0)
+        return curve
+
+    def miss_ratio_curves(self):
+        """Return dictionary of miss ratio curves (see miss_ratio_curve()) for all set counts."""
+        return {1 << l: self.miss_ratio_curve(1 << l) for l in range(self.backend.levels)}
+
+    def __repr__(self):
+        """Return string representation of object."""
+        return 'StackDistanceSimulator(max_sets={!r}, max_ways={!r}, cl_size={!r})'.format(
+            self.max_sets, self.max_ways, self.cl_size)
+
+
 def get_backend(cache):
     """Return backend of *cache* unless *cache* is None, then None is returned."""
     if cache is not None:
@@ -243,7 +787,13 @@ def get_backend(cache):
 class Cache(object):
     """Cache level object."""
 
-    replacement_policy_enum = {"FIFO": 0, "LRU": 1, "MRU": 2, "RR": 3}
+    replacement_policy_enum = {"FIFO": 0, "LRU": 1, "MRU": 2, "RR": 3, "PLRU": 4, "NRU": 5,
+                               "SRRIP": 6, "QLRU": 6, "DRRIP": 7}
+    rrip_hit_promotion_enum = {"HP": 0, "FP": 1}
+    drrip_follower_enum = {"PSEL": 0, "SRRIP": 1, "BRRIP": 2}
+    set_index_enum = {"MODULO": 0, "XOR": 1, "INTEL_SLICE": 2}
+    prefetcher_enum = {None: 0, "NEXT_LINE": 1, "ADJACENT": 2, "STRIDE": 3, "STREAMER": 4}
+    sampling_function_enum = {"INTERVAL": 0, "HASH": 1}
 
     def __init__(self, name, sets, ways, cl_size,
                  replacement_policy="LRU",
@@ -252,13 +802,24 @@ class Cache(object):
                  write_combining=False,
                  subblock_size=None,
                  load_from=None, store_to=None, victims_to=None,
-                 swap_on_load=False):
+                 swap_on_load=False,
+                 tag_index_threshold=None,
+                 rrip_bits=2, rrip_insert=None, rrip_hit_promotion="HP",
+                 drrip_leader_sets=32, drrip_psel_bits=10, drrip_follower="PSEL",
+                 drrip_sample_interval=0,
+                 set_index="MODULO", slices=1,
+                 prefetcher=None, prefetch_distance=1, prefetch_degree=1, prefetch_latency=0,
+                 sampling=1, sampling_function="INTERVAL"):
         """Create one cache level out of given configuration.
 
         :param sets: total number of sets, if 1 cache will be full-associative
         :param ways: total number of ways, if 1 cache will be direct mapped
         :param cl_size: number of bytes that can be addressed individually
-        :param replacement_policy: FIFO, LRU (default), MRU or RR
+        :param replacement_policy: FIFO, LRU (default), MRU, RR, PLRU (tree pseudo-LRU, ways
+                                   need to be a power of two), NRU (bit pseudo-LRU), SRRIP
+                                   (static re-reference interval prediction), QLRU (SRRIP
+                                   with insertion age 1, as in quad-age LRU) or DRRIP (set
+                                   dueling between SRRIP and bimodal RRIP insertion)
         :param write_back: if true (default), write back will be done on evict.
                            Otherwise write-through is used
         :param write_allocate: if true (default), a load will be issued on a
@@ -275,9 +836,55 @@ class Cache(object):
                          memory
         :param victims_to: the cache level to forward any evicted lines to
                            (dirty or not)
-        :param swap_on_load: if true, lines will be swaped between this and the
-                             higher cache level (default is false).
-                             Currently not supported.
+        :param swap_on_load: if true, this level is exclusive of the levels loading from
+                             it (or using it as victims_to): a hit moves the line up and
+                             removes it here, a miss is forwarded without allocating the
+                             line, and lines replaced above move down into this level, dirty
+                             or not (default is false).
+        :param tag_index_threshold: minimum number of ways from which on a hashed tag index is
+                                    used for lookups instead of scanning the set. 0 disables
+                                    the index, None uses the backend default (64).
+        :param rrip_bits: bits per way used for SRRIP/QLRU/DRRIP ages (default 2)
+        :param rrip_insert: age of inserted lines with SRRIP/QLRU/DRRIP, from 0 (kept longest)
+                            to 2**rrip_bits-1 (replaced next). None uses 2**rrip_bits-2 for
+                            SRRIP and DRRIP and 1 for QLRU. BRRIP insertion uses this age only
+                            for every 32nd line and 2**rrip_bits-1 otherwise.
+        :param rrip_hit_promotion: age update on hits with SRRIP/QLRU/DRRIP, HP (default, hit
+                                   priority: age is reset to 0) or FP (frequency priority: age
+                                   is decremented)
+        :param drrip_leader_sets: number of leader sets per insertion policy with DRRIP
+                                  (default 32, spread evenly over all sets)
+        :param drrip_psel_bits: width of the saturating counter selecting the insertion of
+                                follower sets with DRRIP (default 10)
+        :param drrip_follower: insertion of DRRIP follower sets, PSEL (default, whichever
+                               leaders miss less), SRRIP or BRRIP
+        :param drrip_sample_interval: record the policy selection counter every
+                                      drrip_sample_interval insertions and hits (0 = never,
+                                      default). See backend.drrip_psel_samples.
+        :param set_index: mapping of cachelines to sets, MODULO (default, cacheline index modulo
+                          sets), XOR (XOR of all log2(sets) bit wide chunks of the cacheline
+                          index, modulo sets) or INTEL_SLICE (slice by the Intel LLC complex
+                          addressing hash of the address, set within the slice by modulo)
+        :param slices: number of slices with INTEL_SLICE (1, 2, 4 or 8), sets are split evenly
+                       between slices
+        :param prefetcher: None (default), NEXT_LINE (lines following the access), ADJACENT
+                           (other line of the aligned 2-line pair), STRIDE (constant strides
+                           within a page) or STREAMER (ascending or descending streams, stops
+                           at page boundaries). Prefetchers are trained by demand misses and
+                           by the first demand hit on a prefetched line.
+        :param prefetch_distance: lines (strides with STRIDE) between the access and the first
+                                  prefetched line (default 1)
+        :param prefetch_degree: lines prefetched per trigger (default 1)
+        :param prefetch_latency: demand accesses (cachelines) to this level until a prefetched
+                                 line arrives, earlier hits count as PREFETCH_LATE instead of
+                                 PREFETCH_USEFUL (default 0)
+        :param sampling: simulate only one in sampling sets (default 1, all sets). Accesses to
+                         other sets are ignored by this level and not passed on to the levels
+                         below. stats() scales all counters by sets/sampled_sets and reports
+                         confidence intervals of the estimated misses and miss ratio.
+        :param sampling_function: sets simulated with sampling, INTERVAL (default, every
+                                  sampling-th set) or HASH (pseudo-random sets, always the
+                                  same for a configuration)
 
         The total cache size is the product of sets*ways*cl_size.
         Internally all addresses are converted to cacheline indices.
@@ -301,6 +908,30 @@ class Cache(object):
         assert replacement_policy in self.replacement_policy_enum, \
             "Unsupported replacement strategy, we only support: " + \
             ', '.join(self.replacement_policy_enum)
+        assert replacement_policy != "PLRU" or is_power2(ways), \
+            "PLRU requires ways to be a power of two."
+        assert rrip_hit_promotion in self.rrip_hit_promotion_enum, \
+            "Unsupported hit promotion, we only support: " + \
+            ', '.join(self.rrip_hit_promotion_enum)
+        assert set_index in self.set_index_enum, \
+            "Unsupported set index function, we only support: " + \
+            ', '.join(self.set_index_enum)
+        assert slices in [1, 2, 4, 8] and sets % slices == 0, \
+            "slices needs to be 1, 2, 4 or 8 and a divisor of sets."
+        assert prefetcher in self.prefetcher_enum, \
+            "Unsupported prefetcher, we only support: " + \
+            ', '.join(str(p) for p in self.prefetcher_enum)
+        assert prefetch_distance >= 1 and prefetch_degree >= 1 and prefetch_latency >= 0, \
+            "prefetch_distance and prefetch_degree need to be positive, prefetch_latency must " \
+            "not be negative."
+        assert sampling >= 1 and (sampling == 1 or not swap_on_load), \
+            "sampling needs to be positive and is not supported with swap_on_load."
+        assert sampling_function in self.sampling_function_enum, \
+            "Unsupported sampling function, we only support: " + \
+            ', '.join(self.sampling_function_enum)
+        assert drrip_follower in self.drrip_follower_enum, \
+            "Unsupported DRRIP follower policy, we only support: " + \
+            ', '.join(self.drrip_follower_enum)
         assert (write_back, write_allocate) in [(False, False), (True, True), (True, False)], \
             "Unsupported write policy, we only support write-through and non-write-allocate, " \
             "write-back and write-allocate, and write-back and non-write-allocate."
@@ -319,10 +950,19 @@ class Cache(object):
         self.store_to = store_to
         self.victims_to = victims_to
         self.swap_on_load = swap_on_load
+        self.prefetcher = prefetcher
+        self.tlb = None
 
         if subblock_size is None:
             subblock_size = cl_size
 
+        if rrip_insert is None:
+            rrip_insert = 1 if replacement_policy == "QLRU" else 2**rrip_bits - 2
+
+        backend_kwargs = {}
+        if tag_index_threshold is not None:
+            backend_kwargs['tag_index_threshold'] = tag_index_threshold
+
         self.backend = backend.Cache(
             name=name, sets=sets, ways=ways, cl_size=cl_size,
             replacement_policy_id=self.replacement_policy_id,
@@ -330,7 +970,16 @@ class Cache(object):
             write_combining=write_combining, subblock_size=subblock_size,
             load_from=get_backend(load_from), store_to=get_backend(store_to),
             victims_to=get_backend(victims_to),
-            swap_on_load=swap_on_load)
+            swap_on_load=swap_on_load, rrip_bits=rrip_bits, rrip_insert=rrip_insert,
+            rrip_hit_promotion=self.rrip_hit_promotion_enum[rrip_hit_promotion],
+            drrip_leader_sets=drrip_leader_sets, drrip_psel_bits=drrip_psel_bits,
+            drrip_follower=self.drrip_follower_enum[drrip_follower],
+            drrip_sample_interval=drrip_sample_interval,
+            set_index_function=self.set_index_enum[set_index], slices=slices,
+            prefetcher=self.prefetcher_enum[prefetcher], prefetch_distance=prefetch_distance,
+            prefetch_degree=prefetch_degree, prefetch_latency=prefetch_latency,
+            sampling=sampling, sampling_function=self.sampling_function_enum[sampling_function],
+            **backend_kwargs)
 
     def get_cl_start(self, addr):
         """Return first address belonging to the same cacheline as *addr*."""
@@ -367,6 +1016,16 @@ class Cache(object):
         self.victims_to = victims_to
         self.backend.victims_to = victims_to.backend
 
+    def set_tlb(self, tlb):
+        """Update tlb (first TLB level translating all loads and stores) in Cache and backend."""
+        assert tlb is None or isinstance(tlb, TLB), \
+            "tlb needs to be None or a TLB object."
+        self.tlb = tlb
+        if tlb is None:
+            del self.backend.tlb
+        else:
+            self.backend.tlb = tlb.backend
+
     def __getattr__(self, key):
         """Return cache attribute, preferably to backend."""
         if "backend" in self.__dict__:
@@ -375,7 +1034,14 @@ class Cache(object):
             raise AttributeError("'{}' object has no attribute '{}'".format(self.__class__, key))
 
     def stats(self):
-        """Return dictionay with all stats at this level."""
+        """
+        Return dictionay with all stats at this level.
+
+        With set sampling, all counts and bytes are estimates for the whole level (the sampled
+        counts scaled by sets/sampled_sets). MISS_count_error is the half-width of the 95%
+        confidence interval of MISS_count, MISS_ratio (misses per cacheline accessed) comes
+        with MISS_ratio_error.
+        """
         assert self.backend.LOAD_count >= 0, "LOAD_count < 0"
         assert self.backend.LOAD_byte >= 0, "LOAD_byte < 0"
         assert self.backend.STORE_count >= 0, "STORE_count < 0"
@@ -386,17 +1052,40 @@ class Cache(object):
         assert self.backend.MISS_byte >= 0, "MISS_byte < 0"
         assert self.backend.EVICT_count >= 0, "EVICT_count < 0"
         assert self.backend.EVICT_byte >= 0, "EVICT_byte < 0"
-        return {'name': self.name,
-                'LOAD_count': self.backend.LOAD_count,
-                'LOAD_byte': self.backend.LOAD_byte,
-                'STORE_count': self.backend.STORE_count,
-                'STORE_byte': self.backend.STORE_byte,
-                'HIT_count': self.backend.HIT_count,
-                'HIT_byte': self.backend.HIT_byte,
-                'MISS_count': self.backend.MISS_count,
-                'MISS_byte': self.backend.MISS_byte,
-                'EVICT_count': self.backend.EVICT_count,
-                'EVICT_byte': self.backend.EVICT_byte}
+        s = {'name': self.name,
+             'LOAD_count': self.backend.LOAD_count,
+             'LOAD_byte': self.backend.LOAD_byte,
+             'STORE_count': self.backend.STORE_count,
+             'STORE_byte': self.backend.STORE_byte,
+             'HIT_count': self.backend.HIT_count,
+             'HIT_byte': self.backend.HIT_byte,
+             'MISS_count': self.backend.MISS_count,
+             'MISS_byte': self.backend.MISS_byte,
+             'EVICT_count': self.backend.EVICT_count,
+             'EVICT_byte': self.backend.EVICT_byte,
+             'INVALIDATE_count': self.backend.INVALIDATE_count,
+             'INVALIDATE_byte': self.backend.INVALIDATE_byte,
+             'INTERVENTION_count': self.backend.INTERVENTION_count,
+             'INTERVENTION_byte': self.backend.INTERVENTION_byte,
+             'UPGRADE_count': self.backend.UPGRADE_count,
+             'UPGRADE_byte': self.backend.UPGRADE_byte,
+             'BACK_INVALIDATE_count': self.backend.BACK_INVALIDATE_count,
+             'BACK_INVALIDATE_byte': self.backend.BACK_INVALIDATE_byte,
+             'PREFETCH_ISSUED_count': self.backend.PREFETCH_ISSUED_count,
+             'PREFETCH_ISSUED_byte': self.backend.PREFETCH_ISSUED_byte,
+             'PREFETCH_USEFUL_count': self.backend.PREFETCH_USEFUL_count,
+             'PREFETCH_USEFUL_byte': self.backend.PREFETCH_USEFUL_byte,
+             'PREFETCH_LATE_count': self.backend.PREFETCH_LATE_count,
+             'PREFETCH_LATE_byte': self.backend.PREFETCH_LATE_byte}
+        if self.backend.sampling > 1:
+            estimate = self.backend.sampling_estimate()
+            for k in s:
+                if k.endswith('_count') or k.endswith('_byte'):
+                    s[k] = int(round(s[k] * estimate['scale']))
+            s['MISS_count_error'] = estimate['misses_error']
+            s['MISS_ratio'] = estimate['miss_ratio']
+            s['MISS_ratio_error'] = estimate['miss_ratio_error']
+        return s
 
     def size(self):
         """Return total cache size."""
@@ -420,6 +1109,57 @@ class Cache(object):
             store_to_repr, victims_to_repr, self.swap_on_load)
 
 
+class TLB(Cache):
+    """
+    TLB level object, caching the translations of pages (one entry per page).
+
+    A TLB is a cache level with cl_size = page_size, which only sees loads. It is attached to
+    the first cache level (see CacheSimulator or Cache.set_tlb) and looked up for every load
+    and store to it, before the access is simulated in the data caches. Misses are loaded from
+    the next TLB level (e.g., from the STLB in an L1 DTLB). Page-walk caches can be modelled as
+    further levels with the page_size of the page table entries they cache (e.g., 2 MiB for
+    PDE and 1 GiB for PDPTE caches), misses of the last level are full page walks.
+    """
+
+    def __init__(self, name, sets, ways, page_size=4096, replacement_policy="LRU",
+                 load_from=None, **kwargs):
+        """Create one TLB level out of given configuration.
+
+        :param sets: total number of sets, if 1 the TLB will be full-associative
+        :param ways: total number of ways (entries per set)
+        :param page_size: size of the translated pages in bytes, e.g. 4096 (default), 2**21 or
+                          2**30
+        :param replacement_policy: any replacement policy supported by Cache (default LRU)
+        :param load_from: the TLB level to look up misses in, if None, misses are page walks
+
+        Further keyword arguments (e.g., set_index or rrip_bits) are passed on to Cache.
+        """
+        assert is_power2(page_size), "page_size needs to be a power of two."
+        assert load_from is None or isinstance(load_from, TLB), \
+            "load_from needs to be None or a TLB object."
+        super(TLB, self).__init__(name, sets, ways, page_size,
+                                  replacement_policy=replacement_policy,
+                                  write_back=False, write_allocate=False,
+                                  load_from=load_from, **kwargs)
+        self.page_size = page_size
+
+    def stats(self):
+        """Return dictionay with all stats at this level (only loads, hits and misses count)."""
+        s = super(TLB, self).stats()
+        return {k: s[k] for k in ['name', 'LOAD_count', 'LOAD_byte', 'HIT_count', 'HIT_byte',
+                                  'MISS_count', 'MISS_byte']}
+
+    def __repr__(self, recursion=False):
+        """Return string representation of object."""
+        if recursion and self.load_from is not None:
+            load_from_repr = self.load_from.__repr__(recursion=True)
+        else:
+            load_from_repr = self.load_from.name if self.load_from is not None else 'None'
+        return ('TLB(name={!r}, sets={!r}, ways={!r}, page_size={!r}, replacement_policy={!r}, '
+                'load_from={})').format(self.name, self.sets, self.ways, self.page_size,
+                                        self.replacement_policy, load_from_repr)
+
+
 class MainMemory(object):
     """Main memory object. Last level of cache hierarchy, able to hit on all requests."""
 
@@ -461,6 +1201,9 @@ class MainMemory(object):
 
     def __getattr__(self, key):
         """Return cache attribute, preferably to backend."""
+        if key.startswith('__'):
+            # Never a stat, and stats() would recurse while unpickling (no last levels yet)
+            raise AttributeError(key)
         try:
             return self.stats()[key]
         except KeyError:
@@ -468,25 +1211,43 @@ class MainMemory(object):
 
     def stats(self):
         """Return dictionay with all stats at this level."""
-        load_count = self.last_level_load.MISS_count
-        load_byte = self.last_level_load.MISS_byte
+        # From the stats of the last levels, which are scaled if they sample sets
+        last_level_load = self.last_level_load.stats()
+        last_level_store = self.last_level_store.stats()
+        load_count = last_level_load['MISS_count']
+        load_byte = last_level_load['MISS_byte']
 
         if self.last_level_load.victims_to is not None:
             # If there is a victim cache between last_level and memory, subtract all victim hits
-            load_count -= self.last_level_load.victims_to.HIT_count
-            load_byte -= self.last_level_load.victims_to.HIT_byte
+            victims = self.last_level_load.victims_to.stats()
+            load_count -= victims['HIT_count']
+            load_byte -= victims['HIT_byte']
 
         return {'name': self.name,
                 'LOAD_count': load_count,
                 'LOAD_byte': load_byte,
                 'HIT_count': load_count,
                 'HIT_byte': load_byte,
-                'STORE_count': self.last_level_store.EVICT_count,
-                'STORE_byte': self.last_level_store.EVICT_byte,
+                'STORE_count': last_level_store['EVICT_count'],
+                'STORE_byte': last_level_store['EVICT_byte'],
                 'EVICT_count': 0,
                 'EVICT_byte': 0,
                 'MISS_count': 0,
-                'MISS_byte': 0}
+                'MISS_byte': 0,
+                'INVALIDATE_count': 0,
+                'INVALIDATE_byte': 0,
+                'INTERVENTION_count': 0,
+                'INTERVENTION_byte': 0,
+                'UPGRADE_count': 0,
+                'UPGRADE_byte': 0,
+                'BACK_INVALIDATE_count': 0,
+                'BACK_INVALIDATE_byte': 0,
+                'PREFETCH_ISSUED_count': 0,
+                'PREFETCH_ISSUED_byte': 0,
+                'PREFETCH_USEFUL_count': 0,
+                'PREFETCH_USEFUL_byte': 0,
+                'PREFETCH_LATE_count': 0,
+                'PREFETCH_LATE_byte': 0}
 
     def __repr__(self, recursion=False):
         """Return string representation of object."""
@@ -503,6 +1264,45 @@ class MainMemory(object):
             last_level_load_repr, last_level_store_repr)
 
 
+class Directory(object):
+    """
+    Directory (snoop filter) of a multi-core hierarchy, attached to the level shared by all cores.
+
+    It tracks which cores hold a line in their private levels in sets*ways entries. If an
+    entry has to be replaced, all private copies of its line are back-invalidated.
+    """
+
+    def __init__(self, sets, ways, name="DIR"):
+        """Create directory with *sets* (cacheline index modulo sets) and *ways* (LRU)."""
+        assert sets >= 1 and ways >= 1, "sets and ways need to be positive."
+        self.name = name
+        self.sets = sets
+        self.ways = ways
+        self.domain = None  # set by MultiCoreSimulator
+
+    def stats(self):
+        """Return dictionary with lookups, misses, evictions and back-invalidated lines."""
+        assert self.domain is not None, "Directory needs to be used by a MultiCoreSimulator."
+        back_invalidate = [0, 0]
+        for first_level in self.domain.first_levels:
+            c = first_level
+            while c is not None and c.core != -1:
+                back_invalidate[0] += c.BACK_INVALIDATE_count
+                back_invalidate[1] += c.BACK_INVALIDATE_byte
+                c = c.load_from
+        return {'name': self.name,
+                'LOOKUP_count': self.domain.directory_lookups,
+                'MISS_count': self.domain.directory_misses,
+                'EVICT_count': self.domain.directory_evictions,
+                'BACK_INVALIDATE_count': back_invalidate[0],
+                'BACK_INVALIDATE_byte': back_invalidate[1]}
+
+    def __repr__(self):
+        """Return string representation of object."""
+        return 'Directory(sets={!r}, ways={!r}, name={!r})'.format(
+            self.sets, self.ways, self.name)
+
+
 class CacheVisualizer(object):
     """Visualize cache state by generation of VTK files."""
 
@@ -49,7 +49,7 @@ l3 = Cache(name="L3",
            replacement_policy="LRU",
            write_back=True, write_allocate=True,
            store_to=None, load_from=None, victims_to=None,
-           swap_on_load=False)  # This is a victim cache, so exclusiveness should be obvious
+           swap_on_load=True)  # Victim cache, lines move up into L2 on a hit
 mem.store_from(l3)
 l2 = Cache(name="L2",
            sets=2048, ways=16, cl_size=cacheline_size,  # 2048kB
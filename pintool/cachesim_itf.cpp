@@ -1,7 +1,9 @@
 #include "pin.H"
-#include "pinMarker.h"
 #include <iostream>
 #include <fstream>
+#include <deque>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -10,14 +12,85 @@ extern "C"
 #include "backend.h"
 }
 
-//cache object for the load and store calls of the instrumentation functions
-Cache* firstLevel;
+//cache objects for the accesses of the application threads, one per core (thread i simulates on core i modulo cores)
+Cache* firstLevels[COHERENCE_MAX_CORES];
+int cores = 1;
+
+//keeps the private levels coherent, if the cache definition has several first levels
+CoherenceDomain domain;
+
+//writer for the trace file, if accesses are recorded instead of simulated
+trace_writer traceWriter;
+
+//memory access as written into the per-thread trace buffers by the instrumented instructions
+struct MemRef
+{
+    ADDRINT addr;
+    UINT32 size;
+    UINT32 op; // ACCESS_LOAD or ACCESS_STORE
+    UINT64 time; // time stamp counter, only filled with -thread_order time
+};
+
+//per-thread trace buffer, filled without calling into the tool
+BUFFER_ID bufId = BUFFER_ID_INVALID;
+
+//converted buffer contents, simulated or written to the trace file
+struct AccessBatch
+{
+    UINT64 count;
+    access_record* records;
+    UINT64* times;
+};
+
+//full batches of an application thread. The application thread (single producer) and the
+//simulation thread (single consumer) only synchronize through head and tail, without locks
+#define QUEUE_MAX_SLOTS 64
+struct ThreadQueue
+{
+    AccessBatch slots[QUEUE_MAX_SLOTS]; // batch i is kept in slot i modulo queueSlots
+    UINT64 head; // batches simulated, written by the simulation thread
+    UINT64 tail; // batches queued, written by the application thread
+    UINT64 pos; // next record of the batch at head (only with -thread_order time)
+    std::deque<AccessBatch> overflow; // batches queued after the simulation thread has finished
+    int core;
+    bool active; // control flow is inside the marked region (only needed for following calls)
+    bool exited;
+};
+
+//queues of the application threads by THREADID
+#define MAX_THREADS 1024
+ThreadQueue* queues[MAX_THREADS];
+UINT32 threadCount = 0; // highest THREADID with a queue + 1
+UINT32 queueSlots = 1;
+UINT32 batchRecords = 0;
+
+//serializes the simulation, if full buffers are simulated by the application threads
+//(-sim_thread 0), which therefore wait for each other
+PIN_LOCK simLock;
+
+//state of the simulation thread, if full buffers are simulated asynchronously
+bool simThread = false;
+bool ordered = false; // records of all threads are merged by time stamp
+PIN_THREAD_UID simThreadUid;
+bool simThreadDone = false;
+ThreadQueue* ready[MAX_THREADS]; // scratch space of SimulateOrdered
 
 //pin way of adding commandline parameters
 //bool, if function calls are in the instrumented region or not
 KNOB<bool> KnobFollowCalls(KNOB_MODE_WRITEONCE, "pintool", "follow_calls", "0", "specify if the instrumentation has to follow function calls between the markers. Default: false");
 //path to the cache definition file
 KNOB<std::string> KnobCacheFile(KNOB_MODE_WRITEONCE, "pintool", "cache_file", "cachedef", "specify if the file, where the cache object is defined. Default: \"cachedef\"");
+//path to the trace file
+KNOB<std::string> KnobTraceFile(KNOB_MODE_WRITEONCE, "pintool", "trace_file", "", "specify a file to write the accesses to (binary trace format), instead of simulating them. Default: \"\" (simulate)");
+
+//size of the per-thread buffers
+KNOB<UINT32> KnobBufferPages(KNOB_MODE_WRITEONCE, "pintool", "buffer_pages", "64", "specify the size of the per-thread access buffers in pages. Default: 64");
+//bool, if full buffers are simulated by a separate thread (handed over without locks)
+KNOB<bool> KnobSimThread(KNOB_MODE_WRITEONCE, "pintool", "sim_thread", "1", "specify if full access buffers are handed to a separate simulation thread without locks, while the application continues. Otherwise each application thread simulates its buffers itself, serialized by a lock. Default: true");
+//number of buffers per application thread queued for the simulation thread
+KNOB<UINT32> KnobQueuedBuffers(KNOB_MODE_WRITEONCE, "pintool", "queued_buffers", "8", "specify how many full access buffers of an application thread may wait for the simulation thread before the thread is stalled (at most 64). Default: 8");
+//interleaving of the accesses of several application threads
+KNOB<std::string> KnobThreadOrder(KNOB_MODE_WRITEONCE, "pintool", "thread_order", "batch", "specify how the accesses of several application threads are interleaved: batch (whole buffers, in the order they are filled) or time (by time stamp counter, implies -sim_thread). Default: batch");
 
 //instruction and function addresses as markers for the instrumentation
 ADDRINT startCall = 0;
@@ -27,15 +100,15 @@ ADDRINT stopIns = 0;
 
 
 //callback functions to activate and deactivate calls to the cache simulator on memory instructions. only needed when following function calls
-LOCALFUN VOID activate()
+LOCALFUN VOID activate(THREADID tid)
 {
     std::cerr << "activate" << std::endl;
-    _pinMarker_active = true;
+    queues[tid]->active = true;
 }
-LOCALFUN VOID deactivate()
+LOCALFUN VOID deactivate(THREADID tid)
 {
     std::cerr << "deactivate" << std::endl;
-    _pinMarker_active = false;
+    queues[tid]->active = false;
 }
 
 //executed once. finds the magic pin marker functions and calls to them
@@ -83,7 +156,7 @@ VOID ImageLoad(IMG img, VOID *v)
                                 {
                                     // needed. activation and deactivation of the magic start and stop functions does not work
                                     const AFUNPTR Activate = (AFUNPTR) activate;
-                                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, Activate, IARG_END);
+                                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, Activate, IARG_THREAD_ID, IARG_END);
                                 }
                                 else
                                 {
@@ -97,7 +170,7 @@ VOID ImageLoad(IMG img, VOID *v)
                                 {
                                     // needed. activation and deactivation of the magic start and stop functions does not work
                                     const AFUNPTR Deactivate = (AFUNPTR) deactivate;
-                                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, Deactivate, IARG_END);
+                                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, Deactivate, IARG_THREAD_ID, IARG_END);
                                 }
                                 else
                                 {
@@ -123,102 +196,380 @@ VOID ImageLoad(IMG img, VOID *v)
     }
 }
 
-//callbacks for loads and stores, containing check if current control flow is inside instrumented region (needed for following calls)
-LOCALFUN VOID MemRead_check(UINT64 addr, UINT32 size)
+//predicate for the buffer fill, if current control flow of the thread is inside instrumented region (needed for following calls)
+LOCALFUN ADDRINT IsActive(THREADID tid)
 {
-    if (_pinMarker_active)
-      Cache__load(firstLevel, {static_cast<long int>(addr), size});
+    return queues[tid]->active;
 }
-LOCALFUN VOID MemWrite_check(UINT64 addr, UINT32 size)
+
+LOCALFUN AccessBatch AllocateBatch()
 {
-    if (_pinMarker_active)
-      Cache__store(firstLevel, {static_cast<long int>(addr), size},0);
+    AccessBatch batch;
+    batch.count = 0;
+    batch.records = static_cast<access_record*>(malloc(batchRecords * sizeof(access_record)));
+    batch.times = ordered ? static_cast<UINT64*>(malloc(batchRecords * sizeof(UINT64))) : NULL;
+    return batch;
 }
 
-//callbacks for loads and stores, without checks
-LOCALFUN VOID MemRead(UINT64 addr, UINT32 size)
+//converts the contents of a trace buffer into access records
+LOCALFUN VOID FillBatch(AccessBatch* batch, const MemRef* refs, UINT64 numElements)
 {
-  Cache__load(firstLevel, {static_cast<long int>(addr), size});
+    for (UINT64 i = 0; i < numElements; i++)
+    {
+        access_record record = {static_cast<long long>(refs[i].addr), refs[i].size,
+                                static_cast<unsigned char>(refs[i].op), 0};
+        batch->records[i] = record;
+    }
+    if (ordered)
+    {
+        for (UINT64 i = 0; i < numElements; i++)
+        {
+            batch->times[i] = refs[i].time;
+        }
+    }
+    batch->count = numElements;
 }
-LOCALFUN VOID MemWrite(UINT64 addr, UINT32 size)
+
+//simulates or writes a single access of a core
+LOCALFUN VOID SimulateRecord(int core, const access_record* record)
 {
-  Cache__store(firstLevel, {static_cast<long int>(addr), size},0);
+    if (!KnobTraceFile.Value().empty())
+    {
+        trace_writer__write(&traceWriter, record);
+        return;
+    }
+    addr_range range = {static_cast<long int>(record->addr), record->length};
+    if (cores > 1)
+    {
+        if (record->op == ACCESS_STORE)
+            CoherenceDomain__store(&domain, core, range, record->non_temporal);
+        else
+            CoherenceDomain__load(&domain, core, range);
+    }
+    else if (record->op == ACCESS_STORE)
+        Cache__store(firstLevels[0], range, record->non_temporal);
+    else
+        Cache__load(firstLevels[0], range);
 }
 
-// instrumentation routine inserting the callbacks to memory instructions
-VOID Instruction(INS ins, VOID *v)
+//simulates or writes the accesses of a batch in order
+LOCALFUN VOID SimulateBatch(int core, const AccessBatch* batch)
 {
-    // when following calls, each instruction has to be instrumented, containing a check if control flow is inside marked region
-    // the magic start and stop functions set this flag
-    if (KnobFollowCalls)
+    if (cores == 1 && KnobTraceFile.Value().empty())
     {
-        const AFUNPTR readFun = (AFUNPTR) MemRead_check;
-        const AFUNPTR writeFun = (AFUNPTR) MemWrite_check;
-        
-        if (INS_IsMemoryRead(ins) && INS_IsStandardMemop(ins))
+        Cache__replay(firstLevels[0], batch->records, batch->count);
+        return;
+    }
+    for (UINT64 i = 0; i < batch->count; i++)
+    {
+        SimulateRecord(core, &batch->records[i]);
+    }
+}
+
+//called by pin in the application thread when its buffer is full or the thread exits
+LOCALFUN VOID* BufferFull(BUFFER_ID id, THREADID tid, const CONTEXT* ctxt, VOID* buf, UINT64 numElements, VOID* v)
+{
+    ThreadQueue* q = queues[tid];
+    const MemRef* refs = static_cast<const MemRef*>(buf);
+    if (numElements == 0)
+        return buf;
+
+    if (!simThread)
+    {
+        FillBatch(&q->slots[0], refs, numElements);
+        PIN_GetLock(&simLock, tid + 1);
+        SimulateBatch(q->core, &q->slots[0]);
+        PIN_ReleaseLock(&simLock);
+        return buf;
+    }
+
+    // wait for a free slot, the simulation thread frees them in order
+    while (q->tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) >= queueSlots)
+    {
+        if (__atomic_load_n(&simThreadDone, __ATOMIC_ACQUIRE))
         {
-            INS_InsertPredicatedCall(
-                ins, IPOINT_BEFORE, readFun,
-                IARG_MEMORYREAD_EA,
-                IARG_MEMORYREAD_SIZE,
-                IARG_END);
+            // simulated in Fini
+            AccessBatch batch = AllocateBatch();
+            FillBatch(&batch, refs, numElements);
+            q->overflow.push_back(batch);
+            return buf;
         }
+        PIN_Yield();
+    }
+    FillBatch(&q->slots[q->tail % queueSlots], refs, numElements);
+    __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+    return buf;
+}
 
-        if(INS_IsMemoryWrite(ins))
+//simulates whole batches, one of each thread per turn. Returns false if no batch was queued
+LOCALFUN bool SimulateBatches()
+{
+    bool progress = false;
+    UINT32 n = __atomic_load_n(&threadCount, __ATOMIC_ACQUIRE);
+    for (UINT32 t = 0; t < n; t++)
+    {
+        ThreadQueue* q = __atomic_load_n(&queues[t], __ATOMIC_ACQUIRE);
+        if (q != NULL && q->head < __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
         {
-            INS_InsertPredicatedCall(
-                ins, IPOINT_BEFORE, writeFun,
-                IARG_MEMORYWRITE_EA,
-                IARG_MEMORYWRITE_SIZE,
-                IARG_END);
+            SimulateBatch(q->core, &q->slots[q->head % queueSlots]);
+            __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+            progress = true;
+        }
+    }
+    return progress;
+}
+
+//simulates the accesses of all threads in time stamp order, as long as every running thread has
+//queued accesses or a thread is stalled on a full queue. Accesses of a thread that are buffered
+//longer than the accesses of the stalled threads are simulated late. Returns false if no access
+//was simulated
+LOCALFUN bool SimulateOrdered(bool final)
+{
+    bool progress = false;
+    while (true)
+    {
+        int readyCount = 0;
+        bool waiting = false, stalled = false;
+        UINT32 n = __atomic_load_n(&threadCount, __ATOMIC_ACQUIRE);
+        for (UINT32 t = 0; t < n; t++)
+        {
+            ThreadQueue* q = __atomic_load_n(&queues[t], __ATOMIC_ACQUIRE);
+            if (q == NULL)
+                continue;
+            UINT64 tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+            if (q->head < tail)
+            {
+                ready[readyCount++] = q;
+                stalled |= tail - q->head == queueSlots;
+            }
+            else if (!final && !__atomic_load_n(&q->exited, __ATOMIC_ACQUIRE))
+            {
+                waiting = true;
+            }
+        }
+        if (readyCount == 0 || (waiting && !stalled))
+            return progress;
+
+        // merge until the batch of one of the threads is used up
+        while (true)
+        {
+            ThreadQueue* next = NULL;
+            UINT64 time = 0;
+            for (int i = 0; i < readyCount; i++)
+            {
+                const AccessBatch* batch = &ready[i]->slots[ready[i]->head % queueSlots];
+                if (next == NULL || batch->times[ready[i]->pos] < time)
+                {
+                    next = ready[i];
+                    time = batch->times[next->pos];
+                }
+            }
+            const AccessBatch* batch = &next->slots[next->head % queueSlots];
+            SimulateRecord(next->core, &batch->records[next->pos]);
+            progress = true;
+            if (++next->pos == batch->count)
+            {
+                next->pos = 0;
+                __atomic_store_n(&next->head, next->head + 1, __ATOMIC_RELEASE);
+                break;
+            }
         }
     }
+}
+
+//simulation thread, simulates full batches until the application exits
+LOCALFUN VOID SimThread(VOID* arg)
+{
+    while (true)
+    {
+        bool progress = ordered ? SimulateOrdered(false) : SimulateBatches();
+        if (!progress)
+        {
+            if (PIN_IsProcessExiting())
+                break;
+            PIN_Sleep(1);
+        }
+    }
+}
+
+//creates the queue of a new application thread
+VOID ThreadStart(THREADID tid, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    if (tid >= MAX_THREADS)
+    {
+        std::cerr << "Too many threads! At most " << MAX_THREADS << " are supported." << std::endl;
+        PIN_ExitProcess(1);
+    }
+    ThreadQueue* q = queues[tid];
+    if (q != NULL)
+    {
+        //pin reuses the THREADID of an exited thread. The new thread continues its queue, so
+        //batches still queued for the exited thread are simulated first
+        q->active = false;
+        __atomic_store_n(&q->exited, false, __ATOMIC_RELEASE);
+        return;
+    }
+    q = new ThreadQueue();
+    q->head = q->tail = q->pos = 0;
+    q->core = tid % cores;
+    q->active = false;
+    q->exited = false;
+    for (UINT32 i = 0; i < queueSlots; i++)
+    {
+        q->slots[i] = AllocateBatch();
+    }
+    __atomic_store_n(&queues[tid], q, __ATOMIC_RELEASE);
+    UINT32 n = __atomic_load_n(&threadCount, __ATOMIC_RELAXED);
+    while (n < tid + 1 &&
+           !__atomic_compare_exchange_n(&threadCount, &n, tid + 1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+    }
+}
 
+//threads that exited do not hold back the merge by time stamp
+VOID ThreadFini(THREADID tid, const CONTEXT* ctxt, INT32 code, VOID* v)
+{
+    __atomic_store_n(&queues[tid]->exited, true, __ATOMIC_RELEASE);
+}
+
+//inserts the buffer fill for a memory operand, predicated on the marker flag when following calls
+LOCALFUN VOID InsertFill(INS ins, bool checkActive, int ea, int size, UINT32 op)
+{
+    if (checkActive)
+    {
+        INS_InsertIfPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) IsActive, IARG_THREAD_ID, IARG_END);
+        if (ordered)
+            INS_InsertFillBufferThen(ins, IPOINT_BEFORE, bufId,
+                ea, offsetof(MemRef, addr), size, offsetof(MemRef, size),
+                IARG_UINT32, op, offsetof(MemRef, op), IARG_TSC, offsetof(MemRef, time),
+                IARG_END);
+        else
+            INS_InsertFillBufferThen(ins, IPOINT_BEFORE, bufId,
+                ea, offsetof(MemRef, addr), size, offsetof(MemRef, size),
+                IARG_UINT32, op, offsetof(MemRef, op),
+                IARG_END);
+    }
+    else
+    {
+        if (ordered)
+            INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, bufId,
+                ea, offsetof(MemRef, addr), size, offsetof(MemRef, size),
+                IARG_UINT32, op, offsetof(MemRef, op), IARG_TSC, offsetof(MemRef, time),
+                IARG_END);
+        else
+            INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, bufId,
+                ea, offsetof(MemRef, addr), size, offsetof(MemRef, size),
+                IARG_UINT32, op, offsetof(MemRef, op),
+                IARG_END);
+    }
+}
+
+// instrumentation routine inserting the buffer fills for memory instructions
+// accesses are only written to the per-thread buffer, they are simulated in batches when it is full
+VOID Instruction(INS ins, VOID *v)
+{
+    // when following calls, each instruction has to be instrumented, containing a check if control flow is inside marked region
+    // the magic start and stop functions set this flag
     // in case function calls do not need to be followed, only instructions inside the marked region need to be instrumented
-    // this slightly decreases the overhead introduces by the pin callback
-    else if(INS_Address(ins) > startIns && INS_Address(ins) < stopIns)
+    // this slightly decreases the overhead introduces by the instrumentation
+    if (KnobFollowCalls || (INS_Address(ins) > startIns && INS_Address(ins) < stopIns))
     {
-        const AFUNPTR readFun = (AFUNPTR) MemRead;
-        const AFUNPTR writeFun = (AFUNPTR) MemWrite;
-        
         if (INS_IsMemoryRead(ins) && INS_IsStandardMemop(ins))
         {
-            INS_InsertPredicatedCall(
-                ins, IPOINT_BEFORE, readFun,
-                IARG_MEMORYREAD_EA,
-                IARG_MEMORYREAD_SIZE,
-                IARG_END);
+            InsertFill(ins, KnobFollowCalls, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, ACCESS_LOAD);
         }
 
         if(INS_IsMemoryWrite(ins))
         {
-            INS_InsertPredicatedCall(
-                ins, IPOINT_BEFORE, writeFun,
-                IARG_MEMORYWRITE_EA,
-                IARG_MEMORYWRITE_SIZE,
-                IARG_END);
+            InsertFill(ins, KnobFollowCalls, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, ACCESS_STORE);
         }
     }
 }
 
 // function to print the cache stats (needed, as the one from the cachesimulator does not work with pin)
-VOID printStats(Cache* cache)
+// levels from stop on are not printed
+VOID printStats(Cache* cache, Cache* stop)
 {
+    if (cache == stop)
+        return;
     std::cout << std::string(cache->name) << "\n";
     std::cout << "LOAD: " << cache->LOAD.count << " size: " << cache->LOAD.byte << " B\n";
     std::cout << "STORE: " << cache->STORE.count << " size: " << cache->STORE.byte << " B\n";
     std::cout << "HIT: " << cache->HIT.count << " size: " << cache->HIT.byte << " B\n";
     std::cout << "MISS: " << cache->MISS.count << " size: " << cache->MISS.byte << " B\n";
     std::cout << "EVICT: " << cache->EVICT.count << " size: " << cache->EVICT.byte << " B\n";
+    if (cache->sample_map != NULL)
+    {
+        // counts above are those of the sampled sets
+        sampling_estimate estimate;
+        Cache__estimate(cache, &estimate);
+        std::cout << "SAMPLED: " << cache->sampled_sets << " of " << cache->sets
+                  << " sets MISS estimate: " << estimate.misses << " +- " << estimate.misses_error
+                  << " miss ratio: " << estimate.miss_ratio << " +- "
+                  << estimate.miss_ratio_error << "\n";
+    }
     std::cout << "\n";
     if (cache->load_from != NULL)
-        printStats(cache->load_from);
+        printStats(cache->load_from, stop);
+}
+
+// stop the simulation thread, before the application threads are terminated
+VOID PrepareForFini(VOID * v)
+{
+    PIN_WaitForThreadTermination(simThreadUid, PIN_INFINITE_TIMEOUT, NULL);
+    __atomic_store_n(&simThreadDone, true, __ATOMIC_RELEASE);
 }
 
 // print stats, when instrumented program exits
 VOID Fini(int code, VOID * v)
 {
-    printStats(firstLevel);
+    // batches queued after the simulation thread has finished, all application threads have exited
+    bool queued = simThread;
+    while (queued)
+    {
+        while (ordered ? SimulateOrdered(true) : SimulateBatches())
+        {
+        }
+        queued = false;
+        for (UINT32 t = 0; t < threadCount; t++)
+        {
+            ThreadQueue* q = queues[t];
+            for (UINT32 i = 0; q != NULL && i < queueSlots && !q->overflow.empty(); i++)
+            {
+                AccessBatch* slot = &q->slots[q->tail % queueSlots];
+                free(slot->records);
+                free(slot->times);
+                *slot = q->overflow.front();
+                q->overflow.pop_front();
+                q->tail++;
+                queued = true;
+            }
+        }
+    }
+
+    if (!KnobTraceFile.Value().empty())
+    {
+        long long records = traceWriter.records;
+        if (trace_writer__close(&traceWriter) != 0)
+        {
+            std::cerr << "Writing the trace file failed!" << std::endl;
+        }
+        std::cout << records << " accesses written to " << KnobTraceFile.Value() << std::endl;
+        return;
+    }
+    if (cores == 1)
+    {
+        printStats(firstLevels[0], NULL);
+        return;
+    }
+    // private levels of each core, then the shared levels
+    for (int core = 0; core < cores; core++)
+    {
+        std::cout << "core " << core << ":\n";
+        printStats(firstLevels[core], domain.shared);
+    }
+    if (domain.shared != NULL)
+        printStats(domain.shared, NULL);
     // not needed? and could break for more complicated cache configurations
     // dealloc_cacheSim(firstLevel);
 }
@@ -234,8 +585,27 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    //get cachesim exits with failure on errors. in that case, the log file has to be checked
-    firstLevel = get_cacheSim_from_file(KnobCacheFile.Value().c_str());
+    if (!KnobTraceFile.Value().empty())
+    {
+        //accesses are only recorded, they can be replayed against any cache definition later
+        if (trace_writer__open(&traceWriter, KnobTraceFile.Value().c_str(), TRACE_VERSION_RLE) != 0)
+        {
+            std::cerr << "Cannot create trace file " << KnobTraceFile.Value() << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        //get cachesim exits with failure on errors. in that case, the log file has to be checked
+        //with several first levels, each one is the private first level of a core
+        cores = get_cacheSims_from_file(KnobCacheFile.Value().c_str(), firstLevels, COHERENCE_MAX_CORES);
+        if (cores > 1 && CoherenceDomain__init(&domain, firstLevels, cores, COHERENCE_MESI, 0, 0) != 0)
+        {
+            std::cerr << "The first levels do not form a multi-core hierarchy (each core needs private levels in front of levels shared by all cores)!" << std::endl;
+            return 1;
+        }
+        std::cerr << cores << " core(s), application thread i runs on core i modulo " << cores << "\n" << std::endl;
+    }
 
     if (KnobFollowCalls.Value())
     {
@@ -246,6 +616,40 @@ int main(int argc, char *argv[])
         std::cerr << "following of function calls disabled\n" << std::endl;
     }
 
+    if (KnobThreadOrder.Value() != "batch" && KnobThreadOrder.Value() != "time")
+    {
+        std::cerr << "Unknown thread order " << KnobThreadOrder.Value() << "!" << std::endl;
+        return 1;
+    }
+    ordered = KnobThreadOrder.Value() == "time";
+    simThread = KnobSimThread.Value() || ordered;
+    if (simThread)
+    {
+        queueSlots = KnobQueuedBuffers.Value() < 1 ? 1 :
+                     KnobQueuedBuffers.Value() > QUEUE_MAX_SLOTS ? QUEUE_MAX_SLOTS : KnobQueuedBuffers.Value();
+    }
+    batchRecords = KnobBufferPages.Value() * 4096 / sizeof(MemRef);
+
+    bufId = PIN_DefineTraceBuffer(sizeof(MemRef), KnobBufferPages.Value(), BufferFull, 0);
+    if (bufId == BUFFER_ID_INVALID)
+    {
+        std::cerr << "Cannot allocate the access buffers!" << std::endl;
+        return 1;
+    }
+    PIN_InitLock(&simLock);
+
+    if (simThread)
+    {
+        if (PIN_SpawnInternalThread(SimThread, NULL, 0, &simThreadUid) == INVALID_THREADID)
+        {
+            std::cerr << "Cannot start the simulation thread!" << std::endl;
+            return 1;
+        }
+        PIN_AddPrepareForFiniFunction(PrepareForFini, 0);
+    }
+
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+    PIN_AddThreadFiniFunction(ThreadFini, 0);
     IMG_AddInstrumentFunction(ImageLoad, 0);
     INS_AddInstrumentFunction(Instruction, 0);
     PIN_AddFiniFunction(Fini, 0);
@@ -17,6 +17,16 @@ with open(os.path.join(here, 'README.rst'), encoding='utf-8') as f:
     long_description = f.read()
 
 
+# Build one load/store kernel per cache configuration (larger binary, no per-access checks of
+# policy and write mode), enabled by setting CACHESIM_SPECIALIZED_KERNELS=1
+define_macros = []
+if os.environ.get('CACHESIM_SPECIALIZED_KERNELS', '0') not in ('', '0'):
+    define_macros.append(('CACHESIM_SPECIALIZED_KERNELS', None))
+
+# Parallel replay uses POSIX threads
+extra_link_args = ['-pthread'] if os.name == 'posix' else []
+
+
 # Stolen from pip
 def read(*names, **kwargs):
     with io.open(
@@ -98,7 +108,9 @@ setup(
         Extension(
             'cachesim.backend',
             sources=['cachesim/backend.c'],
-            extra_compile_args=['-std=c99'],  
+            extra_compile_args=['-std=c99'],
+            define_macros=define_macros,
+            extra_link_args=extra_link_args,
             #include_dirs=[numpy.get_include()]
         )
     ],
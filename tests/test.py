@@ -3,11 +3,22 @@ Unit tests for cachesim module
 """
 from __future__ import print_function
 
+import io
+import os
+import pickle
+import shutil
+import struct
+import tempfile
 import unittest
+from array import array
+from concurrent.futures import ThreadPoolExecutor
+from contextlib import redirect_stdout
 from itertools import chain
 from pprint import pprint
 
-from cachesim import CacheSimulator, Cache, MainMemory
+from cachesim import backend
+from cachesim import CacheSimulator, MultiCoreSimulator, Cache, MainMemory, ACCESS_LOAD, \
+    ACCESS_STORE, TLB, StackDistanceSimulator, pack_accesses, read_trace, write_trace
 
 
 # TODO Required Testcases:
@@ -131,6 +142,474 @@ class TestHighlevel(unittest.TestCase):
         self.assertEqual(l2.EVICT_count, length // 64)
         self.assertEqual(l3.EVICT_count, length // 64)
 
+    def test_array_load_store(self):
+        mh, l1, l2, l3, mem, cacheline_size = self._get_SandyEP_caches()
+        mh_ref, l1_ref, l2_ref, l3_ref, mem_ref, _ = self._get_SandyEP_caches()
+
+        addrs = [(i * 4160) % (4 * 1024 * 1024) for i in range(20000)]
+        lengths = [8 if i % 3 else 72 for i in range(20000)]
+
+        mh.load(array('q', addrs), length=8)
+        mh.store(array('q', addrs), length=array('i', lengths))
+        mh.force_write_back()
+        mh_ref.load(addrs, length=8)
+        for a, l in zip(addrs, lengths):
+            mh_ref.store(a, length=l)
+        mh_ref.force_write_back()
+
+        for c, c_ref in zip(mh.levels(), mh_ref.levels()):
+            self.assertEqual(c.stats(), c_ref.stats())
+
+        with self.assertRaises(ValueError):
+            l1.backend.arrayload(array('d', [1.0]))
+        with self.assertRaises(ValueError):
+            l1.backend.arraystore(array('q', [1, 2]), lengths=array('q', [1]))
+
+    def test_replay(self):
+        mh, l1, l2, l3, mem, cacheline_size = self._get_SandyEP_caches()
+        mh_ref, l1_ref, l2_ref, l3_ref, mem_ref, _ = self._get_SandyEP_caches()
+
+        offsets = [self._build_2d5pt_offset(i, j, 2000, 100, 8)
+                   for j in range(1, 99) for i in range(1, 1999)]
+        accesses = []
+        for loads, stores in offsets:
+            accesses += [(ACCESS_LOAD, a, 8, False) for a in loads]
+            accesses += [(ACCESS_STORE, a, 8, False) for a in stores]
+
+        mh.replay(accesses)
+        mh.force_write_back()
+        mh_ref.loadstore(offsets, length=8)
+        mh_ref.force_write_back()
+
+        for c, c_ref in zip(mh.levels(), mh_ref.levels()):
+            self.assertEqual(c.stats(), c_ref.stats())
+
+        with self.assertRaises(ValueError):
+            mh.replay(bytearray(15))
+
+        # Non-integer addresses are rejected on all iterable paths, before anything is simulated
+        l1.backend.reset_stats()
+        for access in (lambda: l1.backend.loadstore([(["x"], None)]),
+                       lambda: l1.backend.iterload(["x"]),
+                       lambda: l1.backend.iterstore(iter(["x"]))):
+            with self.assertRaises(TypeError):
+                access()
+        self.assertEqual(l1.backend.LOAD_count + l1.backend.STORE_count, 0)
+
+    def test_parallel_replay(self):
+        mh, l1, l2, l3, mem, cacheline_size = self._get_SandyEP_caches()
+        mh_ref, l1_ref, l2_ref, l3_ref, mem_ref, _ = self._get_SandyEP_caches()
+
+        accesses = [(ACCESS_STORE if i % 3 == 0 else ACCESS_LOAD,
+                     (i * 4160 + (i // 7) * 72) % (24 * 1024 * 1024), 8, i % 50 == 0)
+                    for i in range(100000)]
+        # Sets of all levels are multiples of 64, thus four partitions are possible
+        self.assertEqual(mh.replay(accesses, threads=4), 4)
+        mh.force_write_back()
+        self.assertEqual(mh_ref.replay(accesses), 1)
+        mh_ref.force_write_back()
+
+        for c, c_ref in zip(mh.levels(), mh_ref.levels()):
+            self.assertEqual(c.stats(), c_ref.stats())
+
+        # Accesses spanning two cachelines and RR replacement require a serial replay
+        self.assertEqual(mh.replay([(ACCESS_LOAD, 60, 8, False)], threads=4), 1)
+        mh_rr, l1_rr = self._get_single_cache("RR")
+        self.assertEqual(mh_rr.replay(accesses[:100], threads=4), 1)
+
+        for threads in (0, -3):
+            with self.assertRaises(ValueError):
+                mh.replay(pack_accesses(accesses[:100]), threads=threads)
+
+    def _get_multicore_caches(self, protocol="MESI", cores=2):
+        # Private L1 and L2 per core, shared L3
+        mem = MainMemory()
+        l3 = Cache("L3", 64, 16, 64, "LRU")
+        mem.load_to(l3)
+        mem.store_from(l3)
+        l1s = []
+        for core in range(cores):
+            l2 = Cache("L2_{}".format(core), 16, 8, 64, "LRU", store_to=l3, load_from=l3)
+            l1s.append(Cache("L1_{}".format(core), 4, 4, 64, "LRU", store_to=l2, load_from=l2))
+        return MultiCoreSimulator(l1s, mem, protocol=protocol), l1s, l3
+
+    def test_multicore_coherence(self):
+        for protocol in ["MESI", "MOESI"]:
+            mc, (l1_0, l1_1), l3 = self._get_multicore_caches(protocol)
+            l2_0, l2_1 = l1_0.load_from, l1_1.load_from
+            mc.load(0, length=8, core=0)  # EXCLUSIVE in core 0
+            mc.store(0, length=8, core=0)  # MODIFIED without coherence traffic
+            mc.load(0, length=8, core=1)  # intervention of core 0
+            self.assertEqual(l1_0.INTERVENTION_count, 1)
+            # MESI writes the modified line back to L3, MOESI shares it as OWNED
+            self.assertEqual(l3.STORE_count, 1 if protocol == "MESI" else 0)
+            mc.store(0, length=8, core=1)  # upgrade miss, invalidates core 0
+            self.assertEqual(l1_1.UPGRADE_count, 1)
+            self.assertEqual(l1_0.INVALIDATE_count, 1)
+            self.assertEqual(l2_0.INVALIDATE_count, 1)
+            self.assertFalse(l1_0.contains(0))
+            mc.store(0, length=8, core=0)  # read for ownership, core 1 supplies its copy
+            self.assertEqual(l1_1.INTERVENTION_count, 1)
+            self.assertEqual(l1_1.INVALIDATE_count, 1)
+            self.assertEqual(l1_0.MISS_count, 2)
+            self.assertEqual(l3.LOAD_count, 3)
+            self.assertEqual(l3.MISS_count, 1)
+
+        # Round-robin and timestamped interleaving of per-core traces
+        traces = [[(ACCESS_STORE if i % 4 == core else ACCESS_LOAD, (i % 40) * 64, 8, False)
+                   for i in range(300)] for core in range(2)]
+        mc, l1s, l3 = self._get_multicore_caches()
+        mc_ref, l1s_ref, l3_ref = self._get_multicore_caches()
+        mc.replay(traces, quantum=3)
+        for i in range(0, 300, 3):
+            for core in range(2):
+                for op, addr, length, non_temporal in traces[core][i:i+3]:
+                    if op == ACCESS_STORE:
+                        mc_ref.store(addr, length=length, core=core)
+                    else:
+                        mc_ref.load(addr, length=length, core=core)
+        self.assertGreater(l1s[0].INVALIDATE_count, 0)
+        for c, c_ref in zip(mc.levels(), mc_ref.levels()):
+            self.assertEqual(c.stats(), c_ref.stats())
+
+        mc_ts, l1s_ts, l3_ts = self._get_multicore_caches()
+        # Core 1 runs ahead by a quarter step, equal timestamps go to core 0 first
+        mc_ts.replay(traces, timestamps=[range(0, 1200, 4), range(1, 1201, 4)])
+        mc.mark_all_invalid()
+        mc.replay(traces, quantum=1)
+        for c, c_ref in zip(mc_ts.levels(), mc.levels()):
+            self.assertEqual(c.stats(), c_ref.stats())
+
+        # Reinitializing the domain is rejected while another thread simulates its caches
+        long_traces = [pack_accesses([(ACCESS_LOAD, (i * 4160) % (1024 * 1024), 8, False)
+                                      for i in range(200000)])] * 2
+        _, other_l1s, _ = self._get_multicore_caches()
+        raised = False
+        with ThreadPoolExecutor(max_workers=1) as pool:
+            for i in range(20):
+                future = pool.submit(mc.replay, long_traces)
+                while not future.done() and not raised:
+                    try:
+                        mc.domain.__init__([l.backend for l in other_l1s])
+                    except RuntimeError:
+                        raised = True
+                future.result()
+                if raised:
+                    break
+        self.assertTrue(raised)
+
+    def test_multicore_directory(self):
+        d = {'L3': {'sets': 64, 'ways': 16, 'cl_size': 64, 'directory': {'sets': 4, 'ways': 2}}}
+        for core in range(2):
+            d['L2_{}'.format(core)] = {'sets': 16, 'ways': 8, 'cl_size': 64,
+                                       'load_from': 'L3', 'store_to': 'L3'}
+        for core in range(2):
+            d['L1_{}'.format(core)] = {'sets': 4, 'ways': 4, 'cl_size': 64,
+                                       'load_from': 'L2_{}'.format(core),
+                                       'store_to': 'L2_{}'.format(core)}
+        mc, caches, mem = MultiCoreSimulator.from_dict(d)
+        l1_0, l2_0, l3 = caches['L1_0'], caches['L2_0'], caches['L3']
+
+        # 16 lines fit into the private levels of core 0, but only 8 into the directory
+        mc.store(range(0, 16 * 64, 64), length=8, core=0)
+        dir_stats = mc.directory.stats()
+        self.assertEqual(dir_stats['LOOKUP_count'], 16)
+        self.assertEqual(dir_stats['MISS_count'], 16)
+        self.assertEqual(dir_stats['EVICT_count'], 8)
+        self.assertEqual(l1_0.BACK_INVALIDATE_count, 8)
+        self.assertEqual(l2_0.BACK_INVALIDATE_count, 8)
+        self.assertEqual(dir_stats['BACK_INVALIDATE_count'], 16)
+        self.assertEqual(l3.STORE_count, 8)  # modified lines are written back
+        self.assertFalse(l2_0.contains(0))
+        self.assertTrue(l2_0.contains(15 * 64))
+
+        # Back-invalidated lines miss in the private levels again
+        mc.reset_stats()
+        mc.load(range(0, 16 * 64, 64), length=8, core=0)
+        self.assertEqual(l2_0.MISS_count, 16)
+        self.assertEqual(l3.HIT_count, 16)
+        self.assertEqual(mc.directory.stats()['LOOKUP_count'], 16)
+
+        # Without the directory, all lines stay in the private levels
+        del d['L3']['directory']
+        mc, caches, mem = MultiCoreSimulator.from_dict(d)
+        mc.store(range(0, 16 * 64, 64), length=8, core=0)
+        mc.reset_stats()
+        mc.load(range(0, 16 * 64, 64), length=8, core=0)
+        self.assertEqual(caches['L2_0'].MISS_count, 0)
+        self.assertEqual(caches['L2_0'].BACK_INVALIDATE_count, 0)
+
+    def test_non_temporal_store(self):
+        mh, l1, l2, l3, mem, cacheline_size = self._get_SandyEP_caches()
+
+        mh.store(0, length=64 * cacheline_size, non_temporal=True)
+        mh.replay([(ACCESS_STORE, 64 * cacheline_size, cacheline_size, True)])
+        mh.force_write_back()
+
+        # No write-allocate in L1, but all lines are written back through the whole hierarchy
+        self.assertEqual(l1.LOAD_count, 0)
+        self.assertEqual(l1.MISS_count, 0)
+        self.assertEqual(l1.STORE_count, 2)
+        self.assertEqual(l1.EVICT_count, 65)
+        self.assertEqual(l2.STORE_count, 65)
+        self.assertEqual(mem.STORE_count, 65)
+
+    def test_concurrent_hierarchies(self):
+        addrs = array('q', [(i * 4160) % (4 * 1024 * 1024) for i in range(50000)])
+
+        def simulate(mh):
+            mh.load(addrs, length=8)
+            mh.store(addrs, length=8)
+            mh.force_write_back()
+            return list(mh.stats())
+
+        hierarchies = [self._get_SandyEP_caches()[0] for i in range(4)]
+        with ThreadPoolExecutor(max_workers=4) as pool:
+            results = list(pool.map(simulate, hierarchies))
+
+        reference = simulate(self._get_SandyEP_caches()[0])
+        for r in results:
+            self.assertEqual(r, reference)
+
+    def test_relink_while_simulating(self):
+        mh, l1, l2, l3, mem, cacheline_size = self._get_SandyEP_caches()
+        addrs = array('q', [(i * 4160) % (64 * 1024 * 1024) for i in range(2000000)])
+
+        # Relinking, resetting and reading the contents are rejected while another thread
+        # simulates the hierarchy
+        expected = {'load_from', 'victims_to', 'reset_stats', 'cached', 'contains',
+                    'count_invalid_entries', 'drrip_psel_samples'}
+        raised = set()
+        with ThreadPoolExecutor(max_workers=1) as pool:
+            for i in range(20):
+                future = pool.submit(mh.load, addrs, length=8)
+                while not future.done():
+                    for name, change in (
+                            ('load_from', lambda: setattr(l1.backend, 'load_from', l2.backend)),
+                            ('victims_to', lambda: setattr(l2.backend, 'victims_to', None)),
+                            ('reset_stats', l3.backend.reset_stats),
+                            ('cached', lambda: l3.backend.cached),
+                            ('contains', lambda: l3.backend.contains(0)),
+                            ('count_invalid_entries', l3.backend.count_invalid_entries),
+                            ('drrip_psel_samples', lambda: l3.backend.drrip_psel_samples)):
+                        try:
+                            change()
+                        except RuntimeError:
+                            raised.add(name)
+                future.result()
+                if raised == expected:
+                    break
+        self.assertEqual(raised, expected)
+        self.assertIs(l1.backend.load_from, l2.backend)
+
+        with self.assertRaises(TypeError):
+            l1.backend.store_to = 5
+        self.assertIs(l1.backend.store_to, l2.backend)
+        del l1.backend.store_to
+        self.assertIsNone(l1.backend.store_to)
+        l1.backend.store_to = l2.backend
+        self.assertIs(l1.backend.store_to, l2.backend)
+
+    def test_tag_index(self):
+        addrs = array('q', [(((i * 7919) % 97) + (i // 40) % 600) * 64 + (i % 3) * 8
+                             for i in range(20000)])
+
+        def simulate(policy, threshold):
+            mem = MainMemory()
+            l2 = Cache("L2", 4, 128, 64, policy, tag_index_threshold=threshold)
+            mem.load_to(l2)
+            mem.store_from(l2)
+            l1 = Cache("L1", 1, 64, 64, policy, store_to=l2, load_from=l2,
+                       tag_index_threshold=threshold)
+            mh = CacheSimulator(l1, mem)
+            mh.load(addrs, length=8)
+            mh.store(addrs[::3], length=8)
+            mh.force_write_back()
+            return list(mh.stats()), [l2.backend.contains(a) for a in addrs[-500:]]
+
+        for policy in ["FIFO", "LRU", "MRU"]:
+            self.assertEqual(simulate(policy, 1), simulate(policy, 0))
+
+    def test_wide_set_write_back(self):
+        # More than 64 ways: dirty bits span several words per set
+        mem = MainMemory()
+        l1 = Cache("L1", 1, 100, 64, "LRU")
+        mem.load_to(l1)
+        mem.store_from(l1)
+        mh = CacheSimulator(l1, mem)
+
+        mh.store(range(0, 100*64, 128), length=8)
+        mh.load(range(0, 100*64, 64), length=8)
+        self.assertEqual(l1.HIT_count, 50)
+        self.assertEqual(l1.EVICT_count, 0)
+        mh.load(range(100*64, 150*64, 64), length=8)
+        self.assertEqual(l1.EVICT_count, 25)
+        mh.force_write_back()
+        self.assertEqual(l1.EVICT_count, 50)
+        self.assertEqual(mem.STORE_count, 50)
+
+    def test_mru_replacement(self):
+        mem = MainMemory()
+        l1 = Cache("L1", 1, 4, 64, "MRU")
+        mem.load_to(l1)
+        mem.store_from(l1)
+        mh = CacheSimulator(l1, mem)
+
+        mh.store(range(0, 4*64, 64), length=8)
+        mh.load(64)  # line 1 becomes most recently used
+        mh.load(4*64)  # replaces line 1
+        self.assertEqual(l1.EVICT_count, 1)
+        self.assertEqual(mem.STORE_count, 1)
+        self.assertFalse(l1.backend.contains(64))
+        self.assertTrue(l1.backend.contains(0))
+        self.assertTrue(l1.backend.contains(4*64))
+        mh.load(5*64)  # replaces line 4, which is clean
+        self.assertEqual(l1.EVICT_count, 1)
+        self.assertFalse(l1.backend.contains(4*64))
+
+    def test_force_write_back_order(self):
+        mem = MainMemory()
+        l2 = Cache("L2", 1, 1, 64, "LRU")
+        mem.load_to(l2)
+        mem.store_from(l2)
+        l1 = Cache("L1", 1, 2, 64, "LRU", store_to=l2, load_from=l2)
+        mh = CacheSimulator(l1, mem)
+
+        # Dirty lines are written back in way order, regardless of the queue order
+        mh.store(0, length=8)  # placed in way 1
+        mh.store(64, length=8)  # placed in way 0
+        mh.load(0)  # line 0 becomes first of queue
+        mh.force_write_back()
+        self.assertEqual(l1.EVICT_count, 2)
+        self.assertEqual(l2.STORE_count, 2)
+        self.assertTrue(l2.backend.contains(0))
+        self.assertFalse(l2.backend.contains(64))
+
+    def _get_single_cache(self, policy, ways=4, **kwargs):
+        mem = MainMemory()
+        l1 = Cache("L1", 1, ways, 64, policy, **kwargs)
+        mem.load_to(l1)
+        mem.store_from(l1)
+        return CacheSimulator(l1, mem), l1
+
+    def test_plru_replacement(self):
+        mh, l1 = self._get_single_cache("PLRU")
+
+        mh.load(range(0, 4*64, 64))
+        mh.load([0, 64, 128])
+        # Tree bits point to line 0 (LRU would replace line 3)
+        mh.load(4*64)
+        self.assertFalse(l1.backend.contains(0))
+        self.assertTrue(l1.backend.contains(3*64))
+
+        # Without queue order (no recency lists), cached lines are printed in way order
+        l1.backend.verbosity = 2
+        output = io.StringIO()
+        with redirect_stdout(output):
+            mh.load(5*64)
+        self.assertIn("L1 CACHED [4, 1, 2, 3]", output.getvalue())
+
+    def test_nru_replacement(self):
+        mh, l1 = self._get_single_cache("NRU")
+
+        # Filling sets all used bits, thus only the last way remains marked
+        mh.load(range(0, 4*64, 64))
+        mh.load(0)
+        mh.load(4*64)
+        self.assertFalse(l1.backend.contains(64))
+        mh.load(5*64)
+        self.assertFalse(l1.backend.contains(128))
+        mh.load(6*64)
+        self.assertFalse(l1.backend.contains(0))
+        self.assertTrue(l1.backend.contains(3*64))
+        self.assertEqual(l1.MISS_count, 7)
+
+    def test_srrip_replacement(self):
+        mh, l1 = self._get_single_cache("SRRIP")
+        self.assertEqual(l1.backend.rrip_insert, 2)
+
+        mh.load(range(0, 4*64, 64))
+        mh.load(0)  # hit promotes line 0 to age 0
+        mh.load(range(4*64, 8*64, 64))  # scan does not displace line 0
+        self.assertTrue(l1.backend.contains(0))
+        self.assertEqual(l1.HIT_count, 1)
+        mh.load(0)
+        self.assertEqual(l1.HIT_count, 2)
+
+        # QLRU inserts with age 1, with frequency priority a hit decrements the age to 0
+        mh, l1 = self._get_single_cache("QLRU", rrip_hit_promotion="FP")
+        self.assertEqual(l1.backend.rrip_insert, 1)
+        mh.load(range(0, 4*64, 64))
+        mh.load(0)
+        mh.load(range(4*64, 7*64, 64))
+        self.assertTrue(l1.backend.contains(0))
+        mh.load(range(7*64, 9*64, 64))
+        self.assertFalse(l1.backend.contains(0))
+
+        with self.assertRaises(ValueError):
+            backend.Cache("L1", 1, 4, 64, 6, 1, 1, 0, 64, None, None, None, 0,
+                          rrip_hit_promotion=2)
+
+    def test_set_index_functions(self):
+        def conflicts(set_index, sets, addrs, **kwargs):
+            # Direct mapped cache, returns True if addrs[0] was evicted by the other addresses
+            mem = MainMemory()
+            l1 = Cache("L1", sets, 1, 64, "LRU", set_index=set_index, **kwargs)
+            mem.load_to(l1)
+            mem.store_from(l1)
+            mh = CacheSimulator(l1, mem)
+            mh.load(addrs)
+            return not l1.backend.contains(addrs[0])
+
+        # cl_ids 0 and 4 share a set with modulo, XOR-folding 4 (0b100) gives set 1
+        self.assertTrue(conflicts("MODULO", 4, [0, 4*64]))
+        self.assertFalse(conflicts("XOR", 4, [0, 4*64]))
+        # Address bit 10 is part of the slice hash, bit 7 is not
+        self.assertTrue(conflicts("MODULO", 2, [0, 1024]))
+        self.assertFalse(conflicts("INTEL_SLICE", 2, [0, 1024], slices=2))
+        self.assertTrue(conflicts("INTEL_SLICE", 2, [0, 128], slices=2))
+        # Non power of two sets
+        self.assertTrue(conflicts("MODULO", 9216, [0, 9216*64]))
+        self.assertFalse(conflicts("MODULO", 9216, [0, 9215*64]))
+
+    def test_drrip_set_dueling(self):
+        # Cyclic working set of 1.5 times the capacity: SRRIP leaders miss on every access,
+        # BRRIP leaders keep part of it, so PSEL saturates and followers switch to BRRIP
+        trace = list(range(0, 64*8*64*3//2, 64))*8
+        hits = {}
+        for follower in ["PSEL", "SRRIP", "BRRIP"]:
+            mem = MainMemory()
+            l1 = Cache("L1", 64, 8, 64, "DRRIP", drrip_leader_sets=8, drrip_follower=follower,
+                       drrip_sample_interval=64)
+            mem.load_to(l1)
+            mem.store_from(l1)
+            mh = CacheSimulator(l1, mem)
+            mh.load(trace)
+            hits[follower] = l1.HIT_count
+
+            self.assertGreater(l1.backend.drrip_psel, 2**9)
+            self.assertGreater(l1.backend.drrip_srrip_leader_misses,
+                               l1.backend.drrip_brrip_leader_misses)
+            samples = l1.backend.drrip_psel_samples
+            self.assertEqual(len(samples), len(trace)//64)
+            self.assertEqual(samples[-1], l1.backend.drrip_psel)
+            if follower == "PSEL":
+                psel_samples = samples
+            mh.reset_stats()
+            self.assertEqual(l1.backend.drrip_psel_samples, [])
+
+        self.assertEqual(hits["PSEL"], hits["BRRIP"])
+        self.assertGreater(hits["PSEL"], hits["SRRIP"])
+
+        # Samples grow the same while a buffer is replayed (without the GIL)
+        mem = MainMemory()
+        l1 = Cache("L1", 64, 8, 64, "DRRIP", drrip_leader_sets=8, drrip_sample_interval=64)
+        mem.load_to(l1)
+        mem.store_from(l1)
+        CacheSimulator(l1, mem).replay(
+            pack_accesses([(ACCESS_LOAD, addr, 1, False) for addr in trace]))
+        self.assertEqual(l1.backend.drrip_psel_samples, psel_samples)
+
     def test_large_fill_iter(self):
         mh, l1, l2, l3, mem, cacheline_size = self._get_SandyEP_caches()
 
@@ -585,6 +1064,490 @@ class TestHighlevel(unittest.TestCase):
 
         return cs, l1, wcc, l2, l3, mem, cacheline_size
 
+    def test_write_combining_subblocks(self):
+        mem = MainMemory()
+        l2 = Cache("L2", 64, 8, 64, "LRU")
+        mem.load_to(l2)
+        mem.store_from(l2)
+        l1 = Cache("L1", 8, 16, 64, "LRU", write_combining=True, write_allocate=False,
+                   subblock_size=8, store_to=l2)
+        cs = CacheSimulator(l1, mem)
+
+        # Lines 0-3 are written completely (in subblocks), lines 4 and 5 partially
+        for addr in range(0, 4 * 64, 8):
+            cs.store(addr, length=8)
+        cs.store(4 * 64 + 8, length=8)
+        cs.store(5 * 64 + 60, length=2)
+        cs.force_write_back()
+        # Only incomplete lines need to be loaded (write-allocate) before they are written
+        self.assertEqual(l2.STORE_count, 6)
+        self.assertEqual(l2.LOAD_count, 2)
+
+        # Stores to all ways of all sets, subblock bits stay within their entries
+        cs.reset_stats()
+        for i in range(20000):
+            cs.store((i * 7919) % 32768 * 8, length=8 if i % 3 else 16)
+        cs.force_write_back()
+        self.assertEqual(l1.STORE_count, 20000)
+        self.assertEqual(l2.STORE_count, l1.EVICT_count)
+
+    def test_exclusive_swap_on_load(self):
+        mem = MainMemory()
+        l3 = Cache("L3", 64, 16, 64, "LRU")
+        mem.load_to(l3)
+        mem.store_from(l3)
+        l2 = Cache("L2", 1, 2, 64, "LRU", store_to=l3, load_from=l3, swap_on_load=True)
+        l1 = Cache("L1", 1, 2, 64, "LRU", store_to=l2, load_from=l2)
+        cs = CacheSimulator(l1, mem)
+        a, b, c, d, e, f = [i * 64 for i in range(6)]
+
+        cs.load(a)
+        cs.load(b)
+        # Misses are forwarded without allocating in L2
+        self.assertEqual(l2.MISS_count, 2)
+        self.assertFalse(l2.contains(a) or l2.contains(b))
+        cs.load(c)  # a moves down
+        self.assertTrue(l2.contains(a))
+        cs.load(a)  # a moves up, b moves down
+        self.assertEqual(l2.HIT_count, 1)
+        self.assertEqual(l3.LOAD_count, 3)
+        self.assertTrue(l1.contains(a) and not l2.contains(a))
+        self.assertTrue(l2.contains(b) and not l1.contains(b))
+
+        cs.store(b)  # b moves up and is modified there, c moves down
+        cs.load(d)  # a moves down
+        cs.load(e)  # modified b moves down, c is dropped (clean)
+        self.assertEqual(l3.STORE_count, 0)
+        self.assertTrue(l2.contains(b) and not l2.contains(c))
+        cs.load(f)  # d moves down, a is dropped
+        cs.load(a)  # a misses in L2 (clean copy in L3), e moves down and b is written back
+        self.assertEqual(l3.STORE_count, 1)
+        self.assertEqual(l1.EVICT_count, l2.STORE_count)
+        for addr in [a, b, c, d, e, f]:
+            self.assertFalse(l1.contains(addr) and l2.contains(addr))
+
+    def _build_L1L2_caches(self, tlb=None, **l1_kwargs):
+        # Small inclusive hierarchy, l1_kwargs configure the first level (e.g., its prefetcher)
+        mem = MainMemory()
+        l2 = Cache("L2", 512, 8, 64, "LRU")  # 256kB 8-ways
+        mem.load_to(l2)
+        mem.store_from(l2)
+        l1 = Cache("L1", 64, 8, 64, "LRU", store_to=l2, load_from=l2, **l1_kwargs)  # 32kB 8-ways
+        return CacheSimulator(l1, mem, tlb=tlb), l1, l2
+
+    def test_prefetchers(self):
+        # Two pages, streamed line by line
+        cs, l1, l2 = self._build_L1L2_caches(prefetcher="NEXT_LINE")
+        cs.load(range(0, 128 * 64, 64), length=8)
+        self.assertEqual(l1.MISS_count, 1)
+        self.assertEqual(l1.HIT_count, 127)
+        self.assertEqual(l1.PREFETCH_ISSUED_count, 128)
+        self.assertEqual(l1.PREFETCH_USEFUL_count, 127)
+        self.assertEqual(l2.LOAD_count, 129)
+
+        # Each prefetched line is hit one access after it was issued
+        cs, l1, l2 = self._build_L1L2_caches(prefetcher="NEXT_LINE", prefetch_latency=2)
+        cs.load(range(0, 128 * 64, 64), length=8)
+        self.assertEqual(l1.PREFETCH_USEFUL_count, 0)
+        self.assertEqual(l1.PREFETCH_LATE_count, 127)
+
+        # Adjacent-line prefetcher fetches the other half of each 128 byte pair
+        cs, l1, l2 = self._build_L1L2_caches(prefetcher="ADJACENT")
+        cs.load(range(0, 128 * 64, 64), length=8)
+        self.assertEqual(l1.MISS_count, 64)
+        self.assertEqual(l1.PREFETCH_USEFUL_count, 64)
+
+        # Streamer needs three misses per page and does not cross page boundaries
+        cs, l1, l2 = self._build_L1L2_caches(prefetcher="STREAMER", prefetch_distance=2,
+                                             prefetch_degree=2)
+        cs.load(range(0, 128 * 64, 64), length=8)
+        self.assertEqual(l1.MISS_count, 8)
+        self.assertEqual(l1.PREFETCH_ISSUED_count, 120)
+        self.assertEqual(l1.PREFETCH_USEFUL_count, 120)
+
+        # Stride detector follows a stride of three lines, also into the next pages
+        cs, l1, l2 = self._build_L1L2_caches(prefetcher="STRIDE")
+        cs.load(range(0, 128 * 3 * 64, 3 * 64), length=8)
+        self.assertEqual(l1.MISS_count, 3)
+        self.assertEqual(l1.PREFETCH_USEFUL_count, 125)
+
+    def test_tlb(self):
+        # 128 pages, twice: too many for the 64 entry DTLB, but not for the STLB
+        stlb = TLB("STLB", 128, 4, replacement_policy="SRRIP")
+        dtlb = TLB("DTLB", 16, 4, load_from=stlb)
+        cs, l1, l2 = self._build_L1L2_caches(tlb=dtlb)
+        for i in range(2):
+            cs.load(range(0, 128 * 4096, 4096), length=8)
+        self.assertEqual(dtlb.LOAD_count, 256)
+        self.assertEqual(dtlb.MISS_count, 256)
+        self.assertEqual(stlb.LOAD_count, 256)
+        self.assertEqual(stlb.HIT_count, 128)
+        self.assertEqual(stlb.MISS_count, 128)
+        self.assertEqual(l1.MISS_count, 256)
+        self.assertEqual(list(cs.tlb_levels()), [dtlb, stlb])
+
+        # Stores are translated as well
+        cs.store(127 * 4096, length=8)
+        self.assertEqual(dtlb.LOAD_count, 257)
+        self.assertEqual(dtlb.HIT_count, 1)
+
+        cs.reset_stats()
+        self.assertEqual(dtlb.LOAD_count, 0)
+        self.assertEqual(stlb.MISS_count, 0)
+
+        # All accesses fall into a single 2 MiB page, also when replayed
+        dtlb = TLB("DTLB2M", 1, 32, page_size=2**21)
+        cs, l1, l2 = self._build_L1L2_caches(tlb=dtlb)
+        cs.replay([(ACCESS_LOAD, a, 8, 0) for a in range(0, 128 * 4096, 4096)] +
+                  [(ACCESS_STORE, 127 * 4096 + 8, 8, 0)], threads=4)
+        self.assertEqual(dtlb.LOAD_count, 129)
+        self.assertEqual(dtlb.HIT_count, 128)
+        self.assertEqual(dtlb.MISS_count, 1)
+        self.assertEqual(l1.MISS_count, 128)
+
+        # Only backend caches can translate pages
+        for tlb in (5, object()):
+            with self.assertRaises(TypeError):
+                l1.backend.tlb = tlb
+        self.assertIs(l1.backend.tlb, dtlb.backend)
+        l1.set_tlb(None)
+        self.assertIsNone(l1.backend.tlb)
+        cs.load(0, length=8)
+        self.assertEqual(dtlb.LOAD_count, 129)
+        l1.set_tlb(dtlb)
+        self.assertIs(l1.backend.tlb, dtlb.backend)
+
+    def test_trace_file(self):
+        # More than one block, with negative, large and repeated address differences
+        accesses = [(ACCESS_STORE if i % 3 == 0 else ACCESS_LOAD,
+                     (i * 4104) % 2**22 if i % 5 else 2**62 - i, 8 if i % 7 else 64, i % 6 == 0)
+                    for i in range(10000)]
+        tmpdir = tempfile.mkdtemp()
+        try:
+            cs = self._build_L1L2_caches()[0]
+            cs.replay(accesses)
+            for compress in (False, True):
+                path = os.path.join(tmpdir, 'accesses.trace')
+                write_trace(path, accesses, compress=compress)
+                self.assertEqual(read_trace(path), pack_accesses(accesses))
+                self.assertLess(os.path.getsize(path), len(pack_accesses(accesses)) // 2)
+
+                for decode_threads in (0, 2):
+                    cs_file = self._build_L1L2_caches()[0]
+                    self.assertEqual(cs_file.replay_file(path, decode_threads), len(accesses))
+                    self.assertEqual(list(cs_file.stats()), list(cs.stats()))
+
+                # Truncated file, also right after the first block or without the footer, and
+                # too many records in the header
+                with open(path, 'rb') as f:
+                    data = f.read()
+                records, payload = struct.unpack('<II', data[16:24])
+                first_block = 16 + (8 + (records + 1) // 2 if not compress else 9) + payload
+                header = data[:8] + struct.pack('<Q', 2**40)
+                for broken in (data[:len(data) // 2], data[:first_block], data[:-24],
+                               header + data[16:]):
+                    with open(path, 'wb') as f:
+                        f.write(broken)
+                    for decode_threads in (0, 2):
+                        with self.assertRaises(ValueError):
+                            self._build_L1L2_caches()[0].replay_file(path, decode_threads)
+                    with self.assertRaises(ValueError):
+                        read_trace(path)
+            with self.assertRaises(IOError):
+                cs_file = self._build_L1L2_caches()[0]
+                cs_file.replay_file(os.path.join(tmpdir, 'missing.trace'))
+            with self.assertRaises(ValueError):
+                backend.write_trace(path, pack_accesses(accesses), version=3)
+
+            # Interleaved streams are run-length encoded
+            streams = [(ACCESS_LOAD, s * 2**30 + i * 8, 8, False)
+                       for i in range(10000) for s in range(3)]
+            write_trace(path, streams)
+            self.assertLess(os.path.getsize(path), len(streams) // 10)
+            self.assertEqual(read_trace(path), pack_accesses(streams))
+        finally:
+            shutil.rmtree(tmpdir)
+
+    def _build_sampled_caches(self, **kwargs):
+        mem = MainMemory()
+        l2 = Cache("L2", 1024, 8, 64, "LRU", **kwargs)
+        mem.load_to(l2)
+        mem.store_from(l2)
+        l1 = Cache("L1", 16, 4, 64, "LRU", store_to=l2, load_from=l2)
+        return CacheSimulator(l1, mem), l2
+
+    def test_set_sampling(self):
+        # Only accesses to every 4th set: sampled level behaves like the full one
+        accesses = [(ACCESS_STORE if i % 5 == 0 else ACCESS_LOAD,
+                     ((i * 7919) % 6007) * 4 * 64, 8, False) for i in range(30000)]
+        cs, l2 = self._build_sampled_caches()
+        cs.replay(accesses)
+        cs_sampled, l2_sampled = self._build_sampled_caches(sampling=4)
+        cs_sampled.replay(accesses)
+        self.assertEqual(l2_sampled.backend.sampled_sets, 256)
+        for k in ['LOAD_count', 'HIT_count', 'MISS_count', 'EVICT_count']:
+            self.assertEqual(getattr(l2_sampled.backend, k), getattr(l2.backend, k))
+            self.assertEqual(l2_sampled.stats()[k], 4 * l2.stats()[k])
+        self.assertEqual(cs_sampled.main_memory.stats()['LOAD_count'], 4 * l2.MISS_count)
+
+        # Accesses to all sets: estimates agree with the full simulation within their errors
+        accesses = [(ACCESS_LOAD, ((i * 7919) % 24007 if i % 2 else i // 2 % 9000) * 64, 8, False)
+                    for i in range(100000)]
+        cs, l2 = self._build_sampled_caches()
+        cs.replay(accesses)
+        for sampling_function in ('INTERVAL', 'HASH'):
+            cs_sampled, l2_sampled = self._build_sampled_caches(
+                sampling=8, sampling_function=sampling_function)
+            cs_sampled.replay(accesses)
+            s = l2_sampled.stats()
+            self.assertEqual(l2_sampled.backend.sampled_sets, 128)
+            self.assertGreater(s['MISS_count_error'], 0)
+            self.assertLess(abs(s['MISS_count'] - l2.MISS_count), 3 * s['MISS_count_error'])
+            self.assertLess(abs(s['MISS_ratio'] - l2.MISS_count / (l2.HIT_count + l2.MISS_count)),
+                            3 * s['MISS_ratio_error'])
+
+    def _build_warming_caches(self):
+        mem = MainMemory()
+        l2 = Cache("L2", 256, 8, 64, "LRU")
+        mem.load_to(l2)
+        mem.store_from(l2)
+        l1 = Cache("L1", 16, 4, 64, "LRU", store_to=l2, load_from=l2)
+        return CacheSimulator(l1, mem)
+
+    def test_time_sampling(self):
+        # Reuse in L1 and L2 mixed with a stream
+        accesses = [(ACCESS_STORE if i % 4 == 0 else ACCESS_LOAD,
+                     ((i * 7919) % 53 if i % 3 == 0 else
+                      (i * 31) % 1601 if i % 3 == 1 else 4096 + i // 3 % 20011) * 64, 8, False)
+                    for i in range(100000)]
+        cs = self._build_warming_caches()
+        cs.replay(accesses)
+        full = {s['name']: s for s in cs.stats()}
+
+        # Warming updates the caches like replay, but counts nothing
+        cs_warm = self._build_warming_caches()
+        cs_warm.warm(accesses[:50000])
+        self.assertEqual([s['LOAD_count'] for s in cs_warm.stats()], [0, 0, 0])
+        cs_replay = self._build_warming_caches()
+        cs_replay.replay(accesses[:50000])
+        cs_replay.reset_stats()
+        cs_warm.replay(accesses[50000:])
+        cs_replay.replay(accesses[50000:])
+        self.assertEqual(list(cs_warm.stats()), list(cs_replay.stats()))
+
+        # Neither do prefetches, hits in an exclusive victim cache and DRRIP set dueling, and
+        # nothing is printed
+        def build_victim():
+            mem = MainMemory()
+            l3 = Cache("L3", 64, 8, 64, "LRU", swap_on_load=True)
+            mem.store_from(l3)
+            l2 = Cache("L2", 32, 4, 64, "DRRIP", store_to=l3, victims_to=l3,
+                       drrip_leader_sets=8, drrip_sample_interval=1, prefetcher="NEXT_LINE")
+            mem.load_to(l2)
+            l1 = Cache("L1", 16, 4, 64, "LRU", store_to=l2, load_from=l2)
+            return CacheSimulator(l1, mem), l2, l3
+
+        cs_warm, l2, l3 = build_victim()
+        cs_warm.replay(accesses[:10000])
+        self.assertGreater(l3.HIT_count, 0)
+        stats = list(cs_warm.stats())
+        dueling = (l2.backend.drrip_srrip_leader_misses, l2.backend.drrip_brrip_leader_misses,
+                   l2.backend.drrip_psel_samples)
+        for cache in (cs_warm.first_level, l2, l3):
+            cache.backend.verbosity = 4
+        output = io.StringIO()
+        with redirect_stdout(output):
+            cs_warm.warm(accesses[10000:50000])
+        self.assertEqual(output.getvalue(), '')
+        self.assertEqual(list(cs_warm.stats()), stats)
+        self.assertEqual((l2.backend.drrip_srrip_leader_misses,
+                          l2.backend.drrip_brrip_leader_misses,
+                          l2.backend.drrip_psel_samples), dueling)
+
+        # Every access in detail: exact counts
+        cs_sampled = self._build_warming_caches()
+        estimates = cs_sampled.replay_sampled(accesses, period=1000, detailed=1000)
+        for name in ('L1', 'L2'):
+            for k in ('HIT_count', 'MISS_count', 'EVICT_count'):
+                self.assertEqual(estimates[name][k], full[name][k])
+                self.assertEqual(estimates[name][k + '_error'], 0)
+
+        # Functional warming: estimates within their errors, stats hold the detailed windows
+        cs_sampled = self._build_warming_caches()
+        estimates = cs_sampled.replay_sampled(accesses, period=5000, detailed=500)
+        self.assertEqual(estimates['L1']['windows'], 20)
+        self.assertEqual(estimates['L1']['detailed'], 10000)
+        self.assertEqual(cs_sampled.first_level.STORE_count,
+                         sum(1 for i, a in enumerate(accesses)
+                             if i % 5000 >= 4500 and a[0] == ACCESS_STORE))
+        for name in ('L1', 'L2'):
+            for k in ('HIT_count', 'MISS_count', 'EVICT_count'):
+                self.assertGreater(estimates[name][k + '_error'], 0)
+                self.assertLess(abs(estimates[name][k] - full[name][k]),
+                                3 * estimates[name][k + '_error'])
+
+        # Trace files give the same estimates, also with fast-forwarded blocks
+        tmpdir = tempfile.mkdtemp()
+        try:
+            for compress in (False, True):
+                path = os.path.join(tmpdir, 'accesses.trace')
+                write_trace(path, accesses, compress=compress)
+                for warming in (None, 0, 2000):
+                    cs_file = self._build_warming_caches()
+                    cs_sampled = self._build_warming_caches()
+                    self.assertEqual(
+                        cs_file.replay_file_sampled(path, 20000, 2000, warming=warming),
+                        cs_sampled.replay_sampled(accesses, 20000, 2000, warming=warming))
+        finally:
+            shutil.rmtree(tmpdir)
+
+    def _build_checkpoint_caches(self, l3_policy="LRU", psel_bits=10):
+        mem = MainMemory()
+        l3 = Cache("L3", 64, 8, 64, l3_policy)
+        mem.load_to(l3)
+        mem.store_from(l3)
+        l2 = Cache("L2", 32, 4, 64, "DRRIP", store_to=l3, load_from=l3,
+                   prefetcher="STREAMER", drrip_sample_interval=1, drrip_psel_bits=psel_bits)
+        l1 = Cache("L1", 8, 16, 64, "LRU", store_to=l2, load_from=l2, tag_index_threshold=8)
+        return CacheSimulator(l1, mem)
+
+    def test_checkpoint(self):
+        accesses = [(ACCESS_STORE if i % 5 == 0 else ACCESS_LOAD,
+                     ((i * 7919) % 1499 if i % 2 else i % 3001) * 64, 8, False)
+                    for i in range(40000)]
+        cs = self._build_checkpoint_caches()
+        cs.replay(accesses[:20000])
+
+        tmpdir = tempfile.mkdtemp()
+        try:
+            path = os.path.join(tmpdir, 'state')
+            cs.save_state(path)
+
+            # Restored and unpickled hierarchies continue exactly like the original
+            cs_restored = self._build_checkpoint_caches()
+            cs_restored.restore_state(path)
+            cs_pickled = pickle.loads(pickle.dumps(cs))
+            self.assertEqual(list(cs_restored.stats()), list(cs.stats()))
+            self.assertEqual(cs_restored.first_level.load_from.backend.drrip_psel_samples,
+                             cs.first_level.load_from.backend.drrip_psel_samples)
+            for sim in (cs, cs_restored, cs_pickled):
+                sim.replay(accesses[20000:])
+            self.assertEqual(list(cs_restored.stats()), list(cs.stats()))
+            self.assertEqual(list(cs_pickled.stats()), list(cs.stats()))
+            self.assertEqual(cs_pickled.first_level.cached, cs.first_level.cached)
+
+            # A different configuration is rejected and left untouched
+            for cs_other in (self._build_checkpoint_caches("FIFO"),
+                             self._build_checkpoint_caches(psel_bits=6)):
+                with self.assertRaises(ValueError):
+                    cs_other.restore_state(path)
+                self.assertEqual(cs_other.first_level.cached, set())
+        finally:
+            shutil.rmtree(tmpdir)
+
+    def test_fork(self):
+        def build():
+            # L3 is a victim cache of L2
+            mem = MainMemory()
+            l3 = Cache("L3", 256, 8, 64, "LRU", sampling=2)
+            mem.store_from(l3)
+            l2 = Cache("L2", 32, 4, 64, "DRRIP", store_to=l3, victims_to=l3,
+                       prefetcher="STREAMER")
+            mem.load_to(l2)
+            l1 = Cache("L1", 8, 16, 64, "LRU", store_to=l2, load_from=l2, tag_index_threshold=8)
+            return CacheSimulator(l1, mem)
+
+        accesses = [(ACCESS_STORE if i % 5 == 0 else ACCESS_LOAD,
+                     ((i * 7919) % 2999 if i % 2 else i % 6007) * 64, 8, False)
+                    for i in range(30000)]
+        cs = build()
+        cs.replay(accesses[:10000])
+        fork = cs.fork()
+        fork_of_fork = fork.fork()
+        fork_of_fork.replay(accesses[20000:])
+        self.assertIsNot(fork.first_level.backend, cs.first_level.backend)
+        self.assertIs(fork.first_level.load_from.backend, fork.first_level.backend.load_from)
+        self.assertNotEqual(list(fork_of_fork.stats()), list(cs.stats()))
+
+        # Forks continue like the original, changes in one do not show in any other
+        reference = build()
+        reference.replay(accesses[:10000])
+        for sim in (cs, fork, reference):
+            sim.replay(accesses[10000:20000])
+        self.assertEqual(list(cs.stats()), list(reference.stats()))
+        self.assertEqual(list(fork.stats()), list(reference.stats()))
+
+        # Forking a changed original snapshots its current state
+        later_fork = cs.fork()
+        for sim in (later_fork, reference):
+            sim.replay(accesses[20000:])
+        self.assertEqual(list(later_fork.stats()), list(reference.stats()))
+
+        # Forks release their mappings and snapshots with their last reference
+        if os.path.isdir('/proc/self/fd'):
+            del fork, fork_of_fork, later_fork
+            open_files = len(os.listdir('/proc/self/fd'))
+            for i in range(50):
+                fork = cs.fork()
+                fork.replay(accesses[:100])
+                del fork
+                cs.replay(accesses[i * 400:(i + 1) * 400])
+            self.assertLessEqual(len(os.listdir('/proc/self/fd')), open_files)
+
+    def test_stack_distance(self):
+        # Mix of streams and random reuse over a few hundred cachelines
+        accesses = [(ACCESS_LOAD, ((i * 7919) % 397 if i % 3 else i % 1031) * 64 + i % 64, 1,
+                     False) for i in range(20000)]
+        sd = StackDistanceSimulator(max_sets=16, max_ways=12)
+        sd.replay(accesses)
+        self.assertEqual(sd.accesses, len(accesses))
+        for sets in (1, 2, 16):
+            self.assertEqual(sum(sd.histogram(sets)), len(accesses))
+            for ways in (1, 3, 12):
+                mem = MainMemory()
+                l1 = Cache("L1", sets, ways, 64, "LRU")
+                mem.load_to(l1)
+                mem.store_from(l1)
+                cs = CacheSimulator(l1, mem)
+                cs.replay(accesses)
+                self.assertEqual(sd.misses(sets, ways), l1.backend.MISS_count)
+                self.assertAlmostEqual(sd.miss_ratio_curve(sets)[ways-1],
+                                       l1.backend.MISS_count / len(accesses))
+        self.assertEqual(sorted(sd.miss_ratio_curves()), [1, 2, 4, 8, 16])
+
+        # Stores are counted like loads: same misses as an LRU level which loads all lines,
+        # but not as one which stores some of them (store hits neither promote nor count)
+        def replay_lru(accesses):
+            mem = MainMemory()
+            l1 = Cache("L1", 1, 2, 64, "LRU")
+            mem.load_to(l1)
+            mem.store_from(l1)
+            CacheSimulator(l1, mem).replay(accesses)
+            return l1.backend.MISS_count
+        a, b, c = 0, 64, 128
+        mix = [(ACCESS_LOAD, a, 8, False), (ACCESS_LOAD, b, 8, False),
+               (ACCESS_STORE, a, 8, False), (ACCESS_LOAD, c, 8, False),
+               (ACCESS_LOAD, a, 8, False)]
+        sd_mix = StackDistanceSimulator(max_sets=1, max_ways=2)
+        sd_mix.replay(mix)
+        self.assertEqual(sd_mix.accesses, 5)
+        self.assertEqual(sd_mix.misses(1, 2), 3)
+        self.assertEqual(replay_lru([(ACCESS_LOAD,) + m[1:] for m in mix]), 3)
+        self.assertEqual(replay_lru(mix), 4)
+
+        # Trace files give the same distances, accesses spanning two cachelines count both
+        tmpdir = tempfile.mkdtemp()
+        try:
+            path = os.path.join(tmpdir, 'accesses.trace')
+            write_trace(path, accesses)
+            sd_file = StackDistanceSimulator(max_sets=16, max_ways=12)
+            self.assertEqual(sd_file.replay_file(path), len(accesses))
+            self.assertEqual(sd_file.histogram(16), sd.histogram(16))
+            sd_file.replay([(ACCESS_STORE, 60, 8, False)])
+            self.assertEqual(sd_file.accesses, len(accesses) + 2)
+        finally:
+            shutil.rmtree(tmpdir)
+
     def test_victim_write_back_cache(self):
         cs, l1, wcc, l2, l3, mem, cacheline_size = self._build_Bulldozer_caches()
         # STREAM copy 10MB in cacheline chunks
@@ -675,6 +1638,28 @@ class TestHighlevel(unittest.TestCase):
         self.assertEqual(mem.STORE_count, 1)
         self.assertEqual(mem.EVICT_count, 0)
 
+    def test_write_combining_eviction(self):
+        mem = MainMemory()
+        l2 = Cache("L2", 64, 8, 64, "LRU")
+        mem.load_to(l2)
+        mem.store_from(l2)
+        l1 = Cache("L1", 1, 2, 64, "LRU", write_combining=True, write_allocate=False,
+                   subblock_size=1, store_to=l2)
+        mh = CacheSimulator(l1, mem)
+
+        # Lines are checked for completeness on their own, not the line used last
+        mh.store(0, length=64)
+        mh.store(64, length=8)
+        mh.store(128, length=8)  # replaces complete line 0
+        self.assertEqual(l2.STORE_count, 1)
+        self.assertEqual(l2.LOAD_count, 0)
+        mh.store(256, length=64)  # replaces incomplete line 1
+        self.assertEqual(l2.STORE_count, 2)
+        self.assertEqual(l2.LOAD_count, 1)
+        mh.store(192, length=8)  # replaces incomplete line 2, while line 4 is complete
+        self.assertEqual(l2.STORE_count, 3)
+        self.assertEqual(l2.LOAD_count, 2)
+
     def _build_Skylake_caches(self):
         cacheline_size = 64
 